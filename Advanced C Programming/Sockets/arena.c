@@ -0,0 +1,389 @@
+/*
+
+     arena.c
+
+     Functions for bump arenas: memory for one connection's buffers
+     and state that is all given back at once when the connection
+     closes, instead of a malloc(3) and a free(3) for every piece.
+
+     arena_alloc() hands out the next size bytes of the arena's
+     newest chunk, rounded up to ARENA_ALIGN, which costs a compare
+     and an add.  When the chunk is full the arena takes another one
+     from a free list shared by every arena in the process, and only
+     goes to malloc(3) when that list is empty.  A request too big to
+     fit in a chunk gets a block of its own from malloc(3).
+     Nothing is freed one piece at a time.  arena_realloc() grows the
+     last allocation in place when there is room, or a block of its
+     own with realloc(3), and otherwise copies the data to a new
+     allocation and leaves the old one until the reset.
+
+     arena_reset() puts every chunk the arena holds back on the free
+     list, frees its blocks, and leaves it empty and ready to use
+     again.  The free list keeps at most ARENA_FREE_MAX chunks and
+     frees the rest, so a burst of connections doesn't hold on to
+     its memory forever.  arena_release() frees every chunk on the
+     list.
+
+     arena_get_stats() reports how many bytes the arenas hold in
+     chunks and blocks, how many chunks are held and free, and the
+     most of each there have ever been.  Those are only counted when
+     an arena takes or gives back memory, under the lock it takes to
+     do that anyway, so arena_alloc() never has to touch anything
+     another thread is using.  How much of its memory an arena has
+     handed out is in its bytes member.  An arena may only be used by
+     one thread at a time, but different threads may use different
+     arenas.
+
+     Written by Matthew Campbell.
+
+*/
+
+#ifndef _ARENA_C
+#define _ARENA_C
+
+#include "sockets.h"
+
+struct arena_chunk
+{
+     struct arena_chunk *next;
+     size_t size;                /* Bytes in data.                     */
+     _Alignas( ARENA_ALIGN ) char data[];
+};
+
+/*
+
+     What a chunk takes from malloc(3).  The header goes on top of
+     ARENA_CHUNK_SIZE so that a whole power of 2, such as the 128 KB
+     step of nb_queue_send()'s queue, still fits in one chunk.
+
+*/
+
+#define ARENA_CHUNK_BYTES ( offsetof( struct arena_chunk, data ) + \
+                            ARENA_CHUNK_SIZE )
+
+static pthread_mutex_t arena_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct arena_chunk *arena_free = NULL;
+
+/* Guarded by arena_lock. */
+
+static uint64_t arena_chunks_in_use = 0;
+static uint64_t arena_chunks_high = 0;
+static uint64_t arena_chunks_free = 0;
+static uint64_t arena_chunks_allocated = 0;
+static uint64_t arena_chunks_reused = 0;
+static uint64_t arena_blocks = 0;
+static uint64_t arena_resets = 0;
+static uint64_t arena_bytes_in_use = 0;
+static uint64_t arena_bytes_high = 0;
+
+void arena_init( struct arena *arena )
+{
+     if ( arena == NULL )
+     {
+          return;
+     }
+     memset( arena, 0, sizeof( struct arena ) );
+     return;
+}
+
+/*
+
+     Counts bytes an arena has taken, and remembers the most there
+     have been.  The caller must hold arena_lock.
+
+*/
+
+static void arena_count( const uint64_t bytes )
+{
+     arena_bytes_in_use += bytes;
+     if ( arena_bytes_in_use > arena_bytes_high )
+     {
+          arena_bytes_high = arena_bytes_in_use;
+     }
+     return;
+}
+
+/* Gives the arena a new chunk to allocate from. */
+
+static int arena_take_chunk( struct arena *arena )
+{
+     struct arena_chunk *chunk;
+
+     pthread_mutex_lock( &arena_lock );
+     chunk = arena_free;
+     if ( chunk != NULL )
+     {
+          arena_free = chunk->next;
+          arena_chunks_free--;
+          arena_chunks_reused++;
+     }
+     else
+     {
+          pthread_mutex_unlock( &arena_lock );
+          chunk = malloc( ARENA_CHUNK_BYTES );
+          if ( chunk == NULL )
+          {
+               errno = ENOMEM;
+               return ( -1 );
+          }
+          chunk->size = ARENA_CHUNK_SIZE;
+          pthread_mutex_lock( &arena_lock );
+          arena_chunks_allocated++;
+     }
+     arena_chunks_in_use++;
+     if ( arena_chunks_in_use > arena_chunks_high )
+     {
+          arena_chunks_high = arena_chunks_in_use;
+     }
+     arena_count( ARENA_CHUNK_BYTES );
+     pthread_mutex_unlock( &arena_lock );
+
+     chunk->next = arena->chunks;
+     arena->chunks = chunk;
+     arena->next = chunk->data;
+     arena->end = chunk->data + chunk->size;
+     return 0;
+}
+
+/* Gives a request too big for a chunk a block of its own. */
+
+static void *arena_block( struct arena *arena, const size_t size )
+{
+     struct arena_chunk *block;
+
+     block = malloc( offsetof( struct arena_chunk, data ) + size );
+     if ( block == NULL )
+     {
+          errno = ENOMEM;
+          return NULL;
+     }
+     block->size = size;
+     block->next = arena->blocks;
+     arena->blocks = block;
+
+     pthread_mutex_lock( &arena_lock );
+     arena_blocks++;
+     arena_count( offsetof( struct arena_chunk, data ) + size );
+     pthread_mutex_unlock( &arena_lock );
+     return block->data;
+}
+
+void *arena_alloc( struct arena *arena, const size_t size )
+{
+     size_t rounded;
+     void *ptr;
+
+     if ( arena == NULL )
+     {
+          errno = EFAULT;
+          return NULL;
+     }
+     if ( size < 1 || size > ( SIZE_MAX - ARENA_ALIGN ) )
+     {
+          errno = EINVAL;
+          return NULL;
+     }
+
+     rounded = ( size + ARENA_ALIGN - 1 ) & ~( ( size_t )ARENA_ALIGN - 1 );
+     if ( rounded > ARENA_CHUNK_SIZE )
+     {
+          ptr = arena_block( arena, rounded );
+     }
+     else
+     {
+          if ( arena->next == NULL ||
+               ( size_t )( arena->end - arena->next ) < rounded )
+          {
+               if ( arena_take_chunk( arena ) != 0 )
+               {
+                    return NULL;
+               }
+          }
+          ptr = arena->next;
+          arena->next += rounded;
+     }
+     if ( ptr == NULL )
+     {
+          return NULL;
+     }
+
+     arena->last = ptr;
+     arena->bytes += rounded;
+     return ptr;
+}
+
+void *arena_realloc( struct arena *arena, void *ptr, const size_t old_size,
+                     const size_t new_size )
+{
+     size_t new_rounded, old_rounded;
+     struct arena_chunk *block, **link;
+     void *bigger;
+
+     if ( ptr == NULL )
+     {
+          return arena_alloc( arena, new_size );
+     }
+     if ( arena == NULL )
+     {
+          errno = EFAULT;
+          return NULL;
+     }
+     if ( new_size < 1 || new_size > ( SIZE_MAX - ARENA_ALIGN ) )
+     {
+          errno = EINVAL;
+          return NULL;
+     }
+
+     old_rounded = ( old_size + ARENA_ALIGN - 1 ) &
+                   ~( ( size_t )ARENA_ALIGN - 1 );
+     new_rounded = ( new_size + ARENA_ALIGN - 1 ) &
+                   ~( ( size_t )ARENA_ALIGN - 1 );
+     if ( new_rounded <= old_rounded )
+     {
+          return ptr;
+     }
+
+     /* The last allocation in a chunk can just take more of it. */
+
+     if ( ptr == arena->last && arena->next != NULL &&
+          ( char * )ptr + old_rounded == arena->next &&
+          ( size_t )( arena->end - ( char * )ptr ) >= new_rounded )
+     {
+          arena->next = ( char * )ptr + new_rounded;
+          arena->bytes += new_rounded - old_rounded;
+          return ptr;
+     }
+
+     /* A block of its own can be grown with realloc(3). */
+
+     for( link = &( arena->blocks ); *link != NULL;
+          link = &( ( *link )->next ) )
+     {
+          if ( ( *link )->data == ptr )
+          {
+               block = realloc( *link, offsetof( struct arena_chunk, data ) +
+                                       new_rounded );
+               if ( block == NULL )
+               {
+                    errno = ENOMEM;
+                    return NULL;
+               }
+               *link = block;
+               pthread_mutex_lock( &arena_lock );
+               arena_count( new_rounded - block->size );
+               pthread_mutex_unlock( &arena_lock );
+               arena->bytes += new_rounded - block->size;
+               block->size = new_rounded;
+               arena->last = block->data;
+               return block->data;
+          }
+     }
+
+     bigger = arena_alloc( arena, new_size );
+     if ( bigger == NULL )
+     {
+          return NULL;
+     }
+     memcpy( bigger, ptr, old_size );
+     return bigger;
+}
+
+void arena_reset( struct arena *arena )
+{
+     struct arena_chunk *block, *chunk, *next, *spill;
+     uint64_t block_bytes, held;
+
+     if ( arena == NULL )
+     {
+          return;
+     }
+
+     block_bytes = 0;
+     while( arena->blocks != NULL )
+     {
+          block = arena->blocks;
+          arena->blocks = block->next;
+          block_bytes += offsetof( struct arena_chunk, data ) + block->size;
+          free( block );
+     }
+
+     /* Keep what the free list has room for and free the rest. */
+
+     spill = NULL;
+     held = 0;
+     pthread_mutex_lock( &arena_lock );
+     for( chunk = arena->chunks; chunk != NULL; chunk = next )
+     {
+          next = chunk->next;
+          held++;
+          if ( arena_chunks_free < ARENA_FREE_MAX )
+          {
+               chunk->next = arena_free;
+               arena_free = chunk;
+               arena_chunks_free++;
+          }
+          else
+          {
+               chunk->next = spill;
+               spill = chunk;
+          }
+     }
+     arena_chunks_in_use -= held;
+     arena_resets++;
+     arena_bytes_in_use -= held * ARENA_CHUNK_BYTES + block_bytes;
+     pthread_mutex_unlock( &arena_lock );
+
+     while( spill != NULL )
+     {
+          chunk = spill;
+          spill = chunk->next;
+          free( chunk );
+     }
+
+     memset( arena, 0, sizeof( struct arena ) );
+     return;
+}
+
+void arena_release( void )
+{
+     struct arena_chunk *chunk, *list;
+
+     pthread_mutex_lock( &arena_lock );
+     list = arena_free;
+     arena_free = NULL;
+     arena_chunks_free = 0;
+     pthread_mutex_unlock( &arena_lock );
+
+     while( list != NULL )
+     {
+          chunk = list;
+          list = chunk->next;
+          free( chunk );
+     }
+     return;
+}
+
+void arena_get_stats( struct arena_stats *stats )
+{
+     if ( stats == NULL )
+     {
+          return;
+     }
+
+     pthread_mutex_lock( &arena_lock );
+     stats->chunks_in_use = arena_chunks_in_use;
+     stats->chunks_high = arena_chunks_high;
+     stats->chunks_free = arena_chunks_free;
+     stats->chunks_allocated = arena_chunks_allocated;
+     stats->chunks_reused = arena_chunks_reused;
+     stats->blocks = arena_blocks;
+     stats->resets = arena_resets;
+     stats->bytes_in_use = arena_bytes_in_use;
+     stats->bytes_high = arena_bytes_high;
+     pthread_mutex_unlock( &arena_lock );
+     return;
+}
+
+#endif  /* _ARENA_C */
+
+/* EOF arena.c */
@@ -0,0 +1,254 @@
+/*
+
+     bench_abstract.c
+
+     Measures how long it takes to set up and tear down an AF_UNIX
+     server bound to a socket file, the way setup_af_unix() and
+     shutdown_sockets() do it without USE_ABSTRACT_AF_UNIX, against
+     the same server bound to an abstract name.
+
+     A listener cycle opens a stream socket, binds it, listens and
+     closes it again.  With a socket file that also means a stat(2)
+     and an unlink(2) afterwards, and the bind(2) has to create the
+     file in the first place.  A pair cycle does the same and also
+     connects a client with connect_pair() before closing everything.
+
+     Afterwards each kind of name is bound, closed without being
+     cleaned up, and bound again, which is what a restart after a
+     crash does.  A socket file left behind makes that fail.
+
+     The socket file is made in the current directory.
+
+     Usage: bench_abstract [ cycles ]
+
+     cycles defaults to BENCH_ABSTRACT_CYCLES.
+
+     Written by Matthew Campbell.
+
+*/
+
+#include "sockets.h"
+
+#define BENCH_ABSTRACT_CYCLES 5000
+
+/* The name used for both kinds. */
+
+#define BENCH_SOCK_NAME "bench_abstract_socket"
+
+static const char *kind_names[ 2 ] = { "socket file", "abstract" };
+
+/*
+
+     Sets up and tears down one server, and a connected pair if pair
+     is 1.  Returns 0 or -1 on error.
+
+*/
+
+static int cycle( const struct sockaddr_un *addr, const socklen_t addr_len,
+                  const int abstract, const int pair )
+{
+     int csock_fd, lsock_fd, ret, save_errno, ssock_fd;
+     struct stat sock_file;
+
+     lsock_fd = socket( AF_UNIX, SOCK_STREAM, 0 );
+     if ( lsock_fd < 0 )
+     {
+          return ( -1 );
+     }
+     if ( bind( lsock_fd, ( const struct sockaddr * )addr, addr_len ) != 0 ||
+          listen( lsock_fd, LISTEN_BACKLOG ) != 0 )
+     {
+          save_errno = errno;
+          close( lsock_fd );
+          errno = save_errno;
+          return ( -1 );
+     }
+
+     ret = 0;
+     if ( pair == 1 )
+     {
+          csock_fd = socket( AF_UNIX, SOCK_STREAM, 0 );
+          ssock_fd = ( -1 );
+          if ( csock_fd >= 0 )
+          {
+               ssock_fd = connect_pair( csock_fd, lsock_fd,
+                                        ( const struct sockaddr * )addr,
+                                        addr_len, NULL, NULL );
+          }
+          if ( ssock_fd < 0 )
+          {
+               ret = ( -1 );
+          }
+          save_errno = errno;
+          if ( ssock_fd >= 0 )
+          {
+               close( ssock_fd );
+          }
+          if ( csock_fd >= 0 )
+          {
+               close( csock_fd );
+          }
+          errno = save_errno;
+     }
+     save_errno = errno;
+     close( lsock_fd );
+
+     /* This is what shutdown_sockets() does with the socket file. */
+
+     if ( abstract == 0 &&
+          ( stat( BENCH_SOCK_NAME, &sock_file ) != 0 ||
+            S_ISSOCK( sock_file.st_mode ) == 0 ||
+            unlink( BENCH_SOCK_NAME ) != 0 ) )
+     {
+          return ( -1 );
+     }
+
+     errno = save_errno;
+     return ret;
+}
+
+/* Times cycles cycles of one kind and prints a line.  Returns the mean. */
+
+static double time_cycles( const int abstract, const int pair,
+                           const int cycles )
+{
+     int count;
+     socklen_t addr_len;
+     struct sockaddr_un addr;
+     uint64_t start_ns, total_ns, *samples;
+
+     if ( unix_address( BENCH_SOCK_NAME, abstract, &addr,
+                        &addr_len ) != 0 )
+     {
+          return ( -1.0 );
+     }
+     samples = calloc( ( size_t )cycles, sizeof( uint64_t ) );
+     if ( samples == NULL )
+     {
+          errno = ENOMEM;
+          return ( -1.0 );
+     }
+     if ( abstract == 0 )
+     {
+          unlink( BENCH_SOCK_NAME );  /* Left over from an earlier run. */
+     }
+
+     total_ns = 0;
+     for( count = 0; count < cycles; count++ )
+     {
+          start_ns = get_time_ns();
+          if ( cycle( &addr, addr_len, abstract, pair ) != 0 )
+          {
+               free( samples );
+               return ( -1.0 );
+          }
+          samples[ count ] = get_time_ns() - start_ns;
+          total_ns += samples[ count ];
+     }
+
+     sort_samples( samples, ( uint64_t )cycles );
+     printf( "%-9s %-12s %7d %10.2f %10.2f %10.2f\n",
+             ( ( pair == 1 ) ? "pair" : "listener" ), kind_names[ abstract ],
+             cycles, ( double )total_ns / ( double )cycles / 1000.0,
+             ( double )percentile( samples, ( uint64_t )cycles, 50 ) /
+             1000.0,
+             ( double )percentile( samples, ( uint64_t )cycles, 99 ) /
+             1000.0 );
+     fflush( stdout );
+
+     free( samples );
+     return ( double )total_ns / ( double )cycles;
+}
+
+/* Binds, closes without cleaning up and binds again.  Returns errno. */
+
+static int restart( const int abstract )
+{
+     int pass, ret, sock_fd;
+     socklen_t addr_len;
+     struct sockaddr_un addr;
+
+     if ( unix_address( BENCH_SOCK_NAME, abstract, &addr,
+                        &addr_len ) != 0 )
+     {
+          return errno;
+     }
+     if ( abstract == 0 )
+     {
+          unlink( BENCH_SOCK_NAME );
+     }
+
+     ret = 0;
+     for( pass = 0; pass < 2 && ret == 0; pass++ )
+     {
+          sock_fd = socket( AF_UNIX, SOCK_STREAM, 0 );
+          if ( sock_fd < 0 )
+          {
+               return errno;
+          }
+          if ( bind( sock_fd, ( struct sockaddr * )( &addr ),
+                     addr_len ) != 0 )
+          {
+               ret = errno;
+          }
+          close( sock_fd );  /* A crash doesn't clean up either. */
+     }
+
+     if ( abstract == 0 )
+     {
+          unlink( BENCH_SOCK_NAME );
+     }
+     return ret;
+}
+
+int main( int argc, char **argv )
+{
+     double mean[ 2 ];
+     int abstract, pair, ret;
+     long long cycles;
+
+     cycles = BENCH_ABSTRACT_CYCLES;
+     if ( argc > 1 && ( sscanf( argv[ 1 ], "%lld", &cycles ) != 1 ||
+                        cycles < 1 || cycles > 10000000 ) )
+     {
+          printf( "\nUsage: %s [ cycles ]\n\n", argv[ 0 ] );
+          exit( EXIT_FAILURE );
+     }
+
+     printf( "\nAF_UNIX setup and teardown in microseconds:\n\n" );
+     printf( "%-9s %-12s %7s %10s %10s %10s\n", "Cycle", "Name",
+             "Cycles", "Mean", "p50", "p99" );
+
+     for( pair = 0; pair < 2; pair++ )
+     {
+          for( abstract = 0; abstract < 2; abstract++ )
+          {
+               mean[ abstract ] = time_cycles( abstract, pair,
+                                               ( int )cycles );
+               if ( mean[ abstract ] < 0.0 )
+               {
+                    printf( "%-9s %-12s failed (%s)\n",
+                            ( ( pair == 1 ) ? "pair" : "listener" ),
+                            kind_names[ abstract ], strerror( errno ) );
+               }
+          }
+          if ( mean[ 0 ] > 0.0 && mean[ 1 ] > 0.0 )
+          {
+               printf( "%-9s %-12s %7s %9.2fx\n", "", "speedup", "",
+                       mean[ 0 ] / mean[ 1 ] );
+          }
+     }
+
+     printf( "\nRestarting without cleaning up:\n\n" );
+     for( abstract = 0; abstract < 2; abstract++ )
+     {
+          ret = restart( abstract );
+          printf( "%-12s %s\n", kind_names[ abstract ],
+                  ( ( ret == 0 ) ? "binds again" : strerror( ret ) ) );
+     }
+
+     printf( "\n" );
+     exit( EXIT_SUCCESS );
+}
+
+/* EOF bench_abstract.c */
@@ -0,0 +1,387 @@
+/*
+
+     bench_arena.c
+
+     Measures what the bump arenas in arena.c save when connections
+     are short-lived.  A simulated connection allocates some parse
+     state, a read buffer, a few small pieces such as header fields,
+     and a write queue that grows from 16 KB to 64 KB with realloc(3)
+     the way nb_queue_send() grows it.  BENCH_ARENA_LIVE of them are
+     kept open at once, and each new one closes the oldest.  This is
+     timed once with malloc(3) and free(3) for every piece and once
+     with an arena that is reset when the connection closes.
+
+     Afterwards the same churn is done with real sockets.  Each
+     connection is a socketpair(2) with an nb_conn on one end, which
+     takes its parse state from the connection's arena and queues a
+     reply bigger than the socket's send buffer.  The other end reads
+     it all while nb_flush() sends the rest, and then nb_conn_free()
+     resets the arena and both ends are closed.
+
+     For each run this prints the nanoseconds per connection and how
+     much memory the arenas held at the most, and how many chunks had
+     to be allocated and how many came back off the free list.
+
+     Usage: bench_arena [ connections [ live ] ]
+
+     connections defaults to BENCH_ARENA_CONNS, and live to
+     BENCH_ARENA_LIVE.
+
+     Written by Matthew Campbell.
+
+*/
+
+#include "sockets.h"
+
+#define BENCH_ARENA_CONNS 200000
+#define BENCH_ARENA_LIVE 256
+
+/* What a simulated connection allocates. */
+
+#define BENCH_PARSE_SIZE 512
+#define BENCH_READ_SIZE 4096
+#define BENCH_PIECES 4
+#define BENCH_PIECE_SIZE 48
+#define BENCH_QUEUE_START ( 16 * 1024 )
+#define BENCH_QUEUE_END ( 64 * 1024 )
+
+/* The reply each socket connection queues, and the send buffer. */
+
+#define BENCH_REPLY_SIZE ( 96 * 1024 )
+#define BENCH_SNDBUF ( 16 * 1024 )
+
+struct sim_conn
+{
+     char *parse;
+     char *read_buf;
+     char *piece[ BENCH_PIECES ];
+     char *queue;
+};
+
+/* Allocates a simulated connection with malloc(3).  Returns 0 or -1. */
+
+static int malloc_open( struct sim_conn *conn )
+{
+     char *bigger;
+     int index;
+     size_t size;
+
+     conn->parse = malloc( BENCH_PARSE_SIZE );
+     conn->read_buf = malloc( BENCH_READ_SIZE );
+     for( index = 0; index < BENCH_PIECES; index++ )
+     {
+          conn->piece[ index ] = malloc( BENCH_PIECE_SIZE );
+          if ( conn->piece[ index ] == NULL )
+          {
+               return ( -1 );
+          }
+          conn->piece[ index ][ 0 ] = ( char )index;
+     }
+     conn->queue = malloc( BENCH_QUEUE_START );
+     if ( conn->parse == NULL || conn->read_buf == NULL ||
+          conn->queue == NULL )
+     {
+          return ( -1 );
+     }
+     conn->parse[ 0 ] = 1;
+     conn->read_buf[ 0 ] = 1;
+     conn->queue[ 0 ] = 1;
+
+     for( size = BENCH_QUEUE_START * 2; size <= BENCH_QUEUE_END; size *= 2 )
+     {
+          bigger = realloc( conn->queue, size );
+          if ( bigger == NULL )
+          {
+               return ( -1 );
+          }
+          conn->queue = bigger;
+          conn->queue[ size - 1 ] = 1;
+     }
+     return 0;
+}
+
+static void malloc_close( struct sim_conn *conn )
+{
+     int index;
+
+     free( conn->parse );
+     free( conn->read_buf );
+     for( index = 0; index < BENCH_PIECES; index++ )
+     {
+          free( conn->piece[ index ] );
+     }
+     free( conn->queue );
+     memset( conn, 0, sizeof( struct sim_conn ) );
+     return;
+}
+
+/* Allocates the same pieces from an arena.  Returns 0 or -1. */
+
+static int arena_open( struct arena *arena, struct sim_conn *conn )
+{
+     char *bigger;
+     int index;
+     size_t size;
+
+     conn->parse = arena_alloc( arena, BENCH_PARSE_SIZE );
+     conn->read_buf = arena_alloc( arena, BENCH_READ_SIZE );
+     for( index = 0; index < BENCH_PIECES; index++ )
+     {
+          conn->piece[ index ] = arena_alloc( arena, BENCH_PIECE_SIZE );
+          if ( conn->piece[ index ] == NULL )
+          {
+               return ( -1 );
+          }
+          conn->piece[ index ][ 0 ] = ( char )index;
+     }
+     conn->queue = arena_alloc( arena, BENCH_QUEUE_START );
+     if ( conn->parse == NULL || conn->read_buf == NULL ||
+          conn->queue == NULL )
+     {
+          return ( -1 );
+     }
+     conn->parse[ 0 ] = 1;
+     conn->read_buf[ 0 ] = 1;
+     conn->queue[ 0 ] = 1;
+
+     for( size = BENCH_QUEUE_START * 2; size <= BENCH_QUEUE_END; size *= 2 )
+     {
+          bigger = arena_realloc( arena, conn->queue, size / 2, size );
+          if ( bigger == NULL )
+          {
+               return ( -1 );
+          }
+          conn->queue = bigger;
+          conn->queue[ size - 1 ] = 1;
+     }
+     return 0;
+}
+
+/* Prints what the arenas have held so far. */
+
+static void print_stats( void )
+{
+     struct arena_stats stats;
+
+     arena_get_stats( &stats );
+     printf( "\
+     Bytes held:       %" PRIu64 " now, %" PRIu64 " KB at most\n\
+     Chunks:           %" PRIu64 " in use, %" PRIu64 " at most, \
+%" PRIu64 " free\n\
+     Chunks taken:     %" PRIu64 " allocated, %" PRIu64 " reused\n\
+     Blocks:           %" PRIu64 "\n\
+     Resets:           %" PRIu64 "\n",
+             stats.bytes_in_use, stats.bytes_high / 1024,
+             stats.chunks_in_use, stats.chunks_high, stats.chunks_free,
+             stats.chunks_allocated, stats.chunks_reused, stats.blocks,
+             stats.resets );
+     return;
+}
+
+/*
+
+     Churns through conns simulated connections with live open at a
+     time, using malloc(3) if use_arena is 0 and arenas otherwise.
+     Returns the nanoseconds per connection, or -1.0 on error.
+
+*/
+
+static double sim_churn( const int conns, const int live,
+                         const int use_arena )
+{
+     int count, slot;
+     struct arena *arenas;
+     struct sim_conn *sims;
+     uint64_t start_ns, total_ns;
+
+     sims = calloc( ( size_t )live, sizeof( struct sim_conn ) );
+     arenas = calloc( ( size_t )live, sizeof( struct arena ) );
+     if ( sims == NULL || arenas == NULL )
+     {
+          free( sims );
+          free( arenas );
+          errno = ENOMEM;
+          return ( -1.0 );
+     }
+     for( slot = 0; slot < live; slot++ )
+     {
+          arena_init( &( arenas[ slot ] ) );
+     }
+
+     start_ns = get_time_ns();
+     for( count = 0; count < conns + live; count++ )
+     {
+          slot = count % live;
+          if ( count >= live )  /* Close the oldest. */
+          {
+               if ( use_arena == 0 )
+               {
+                    malloc_close( &( sims[ slot ] ) );
+               }
+               else
+               {
+                    arena_reset( &( arenas[ slot ] ) );
+               }
+          }
+          if ( count >= conns )
+          {
+               continue;
+          }
+          if ( ( use_arena == 0 && malloc_open( &( sims[ slot ] ) ) != 0 ) ||
+               ( use_arena != 0 &&
+                 arena_open( &( arenas[ slot ] ), &( sims[ slot ] ) ) != 0 ) )
+          {
+               free( sims );
+               free( arenas );
+               errno = ENOMEM;
+               return ( -1.0 );
+          }
+     }
+     total_ns = get_time_ns() - start_ns;
+
+     free( sims );
+     free( arenas );
+     return ( double )total_ns / ( double )conns;
+}
+
+/*
+
+     Opens a socketpair, queues a reply on one end, reads it on the
+     other and closes both.  Returns 0 or -1 on error.
+
+*/
+
+static int socket_conn( const char *reply, char *buffer )
+{
+     char *parse;
+     int fds[ 2 ], ret, save_errno, sndbuf;
+     size_t received;
+     ssize_t num;
+     struct nb_conn conn;
+
+     if ( socketpair( AF_UNIX, SOCK_STREAM, 0, fds ) != 0 )
+     {
+          return ( -1 );
+     }
+     sndbuf = BENCH_SNDBUF;
+     setsockopt( fds[ 0 ], SOL_SOCKET, SO_SNDBUF, &sndbuf, sizeof( int ) );
+
+     ret = nb_conn_init( &conn, fds[ 0 ], NULL, NULL );
+     if ( ret == 0 )
+     {
+          parse = arena_alloc( &( conn.arena ), BENCH_PARSE_SIZE );
+          if ( parse == NULL )
+          {
+               ret = ( -1 );
+          }
+          else
+          {
+               memset( parse, 0, BENCH_PARSE_SIZE );
+               ret = nb_queue_send( &conn, reply, BENCH_REPLY_SIZE );
+          }
+     }
+
+     received = 0;
+     while( ret == 0 && received < BENCH_REPLY_SIZE )
+     {
+          num = recv_nb( fds[ 1 ], buffer, BENCH_REPLY_SIZE );
+          if ( num > 0 )
+          {
+               received += ( size_t )num;
+          }
+          else if ( num == 0 || errno != EAGAIN )
+          {
+               if ( num == 0 )
+               {
+                    errno = ECONNRESET;
+               }
+               ret = ( -1 );
+               break;
+          }
+          ret = nb_flush( &conn );
+     }
+
+     save_errno = errno;
+     nb_conn_free( &conn );
+     close( fds[ 0 ] );
+     close( fds[ 1 ] );
+     errno = save_errno;
+     return ret;
+}
+
+int main( int argc, char **argv )
+{
+     char *buffer, *reply;
+     double mean[ 2 ];
+     int use_arena;
+     long long conns, count, live;
+     uint64_t start_ns, total_ns;
+
+     conns = BENCH_ARENA_CONNS;
+     live = BENCH_ARENA_LIVE;
+     if ( ( argc > 1 && ( sscanf( argv[ 1 ], "%lld", &conns ) != 1 ||
+                          conns < 1 || conns > 100000000 ) ) ||
+          ( argc > 2 && ( sscanf( argv[ 2 ], "%lld", &live ) != 1 ||
+                          live < 1 || live > 100000 ) ) )
+     {
+          printf( "\nUsage: %s [ connections [ live ] ]\n\n", argv[ 0 ] );
+          exit( EXIT_FAILURE );
+     }
+
+     printf( "\n\
+Churning through %lld simulated connections, %lld open at a time.\n\n",
+             conns, live );
+     for( use_arena = 0; use_arena < 2; use_arena++ )
+     {
+          mean[ use_arena ] = sim_churn( ( int )conns, ( int )live,
+                                         use_arena );
+          if ( mean[ use_arena ] < 0.0 )
+          {
+               printf( "%-8s failed (%s)\n",
+                       ( ( use_arena == 0 ) ? "malloc" : "arena" ),
+                       strerror( errno ) );
+               exit( EXIT_FAILURE );
+          }
+          printf( "%-8s %10.1f ns per connection\n",
+                  ( ( use_arena == 0 ) ? "malloc" : "arena" ),
+                  mean[ use_arena ] );
+     }
+     printf( "%-8s %9.2fx\n\n", "speedup", mean[ 0 ] / mean[ 1 ] );
+     print_stats();
+
+     reply = malloc( BENCH_REPLY_SIZE );
+     buffer = malloc( BENCH_REPLY_SIZE );
+     if ( reply == NULL || buffer == NULL )
+     {
+          printf( "\nUnable to allocate memory.\n\n" );
+          exit( EXIT_FAILURE );
+     }
+     memset( reply, 'A', BENCH_REPLY_SIZE );
+
+     printf( "\n\
+Churning through %lld socketpair connections with a %d KB reply each.\n\n",
+             conns / 10 + 1, BENCH_REPLY_SIZE / 1024 );
+     start_ns = get_time_ns();
+     for( count = 0; count < conns / 10 + 1; count++ )
+     {
+          if ( socket_conn( reply, buffer ) != 0 )
+          {
+               printf( "Connection %lld failed (%s).\n\n", count,
+                       strerror( errno ) );
+               exit( EXIT_FAILURE );
+          }
+     }
+     total_ns = get_time_ns() - start_ns;
+     printf( "%-8s %10.1f ns per connection, %.0f per second\n\n", "arena",
+             ( double )total_ns / ( double )count,
+             ( double )count * 1e9 / ( double )total_ns );
+     print_stats();
+
+     arena_release();
+     free( reply );
+     free( buffer );
+     printf( "\n" );
+     exit( EXIT_SUCCESS );
+}
+
+/* EOF bench_arena.c */
@@ -0,0 +1,371 @@
+/*
+
+     bench_eyeballs.c
+
+     Measures how long a client takes to connect to a dual-stack
+     service when one of its families is slow or broken, comparing
+     he_race() with the plain one-address-at-a-time loop.
+
+     The service is a pair of stand-ins on the loopback addresses,
+     ::1 and 127.0.0.1, sharing one port, and the client tries them
+     in that order the way a resolver following RFC 6724 would hand
+     them out.  Each stand-in can be made to behave one of three ways:
+
+          ready     It accepts connections.
+          delayed   Its accept queue is full, so the kernel drops the
+                    SYN and the connect just waits, the way it would
+                    on a path that loses packets.
+          refused   Nothing listens on it, so the connect fails at
+                    once.
+
+     For each case this prints which family won and the median and
+     worst connect times.  The one-at-a-time loop gives up on an
+     address after CONNECT_TIMEOUT_MS.
+
+     Usage: bench_eyeballs [ trials [ delay_ms ] ]
+
+     trials defaults to BENCH_EYEBALL_TRIALS and delay_ms, the wait
+     before racing the next address, to HE_ATTEMPT_DELAY_MS.
+
+     Written by Matthew Campbell.
+
+*/
+
+#include "sockets.h"
+
+#define BENCH_EYEBALL_TRIALS 5
+
+/* How a stand-in behaves. */
+
+#define STANDIN_READY   0
+#define STANDIN_DELAYED 1
+#define STANDIN_REFUSED 2
+
+#define STANDIN_FILLERS 8
+
+static const char *standin_names[] = { "ready", "delayed", "refused" };
+
+struct standin
+{
+     int lsock_fd;
+     int fillers[ STANDIN_FILLERS ];
+     int num_fillers;
+};
+
+/* Fills the accept queue of the listener at addr so SYNs are dropped. */
+
+static int fill_queue( struct standin *standin,
+                       const struct sockaddr_storage *addr,
+                       const socklen_t addr_len )
+{
+     int fd, ret;
+     struct pollfd pfd;
+
+     while( standin->num_fillers < STANDIN_FILLERS )
+     {
+          fd = socket( addr->ss_family,
+                       ( SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC ), 0 );
+          if ( fd < 0 )
+          {
+               return ( -1 );
+          }
+          if ( connect( fd, ( const struct sockaddr * )addr,
+                        addr_len ) != 0 && errno != EINPROGRESS )
+          {
+               close( fd );
+               return ( -1 );
+          }
+          pfd.fd = fd;
+          pfd.events = POLLOUT;
+          pfd.revents = 0;
+          ret = poll( &pfd, 1, 50 );
+          if ( ret == 0 )
+          {
+               /* This one's SYN was dropped, so the queue is full. */
+
+               close( fd );
+               return 0;
+          }
+          standin->fillers[ standin->num_fillers++ ] = fd;
+     }
+     errno = ENOSPC;
+     return ( -1 );
+}
+
+/* Opens a stand-in on addr that behaves the way mode says. */
+
+static int open_standin( struct standin *standin, const int mode,
+                         const struct sockaddr_storage *addr,
+                         const socklen_t addr_len )
+{
+     int opt, save_errno;
+
+     memset( standin, 0, sizeof( struct standin ) );
+     standin->lsock_fd = ( -1 );
+     if ( mode == STANDIN_REFUSED )
+     {
+          return 0;
+     }
+
+     standin->lsock_fd = socket( addr->ss_family,
+                                 ( SOCK_STREAM | SOCK_CLOEXEC ), 0 );
+     if ( standin->lsock_fd < 0 )
+     {
+          return ( -1 );
+     }
+     opt = 1;
+     if ( setsockopt( standin->lsock_fd, SOL_SOCKET, SO_REUSEADDR, &opt,
+                      sizeof( opt ) ) != 0 ||
+          bind( standin->lsock_fd, ( const struct sockaddr * )addr,
+                addr_len ) != 0 ||
+          listen( standin->lsock_fd,
+                  ( ( mode == STANDIN_DELAYED ) ? 0 : LISTEN_BACKLOG ) ) != 0 ||
+          set_nonblocking( standin->lsock_fd ) != 0 ||
+          ( mode == STANDIN_DELAYED &&
+            fill_queue( standin, addr, addr_len ) != 0 ) )
+     {
+          save_errno = errno;
+          close( standin->lsock_fd );
+          standin->lsock_fd = ( -1 );
+          errno = save_errno;
+          return ( -1 );
+     }
+     return 0;
+}
+
+/* Accepts and closes whatever a ready stand-in has waiting. */
+
+static void drain_standin( struct standin *standin, const int mode )
+{
+     int fd;
+
+     if ( mode != STANDIN_READY || standin->lsock_fd < 0 )
+     {
+          return;
+     }
+     for( ; ; )
+     {
+          fd = accept( standin->lsock_fd, NULL, NULL );
+          if ( fd < 0 )
+          {
+               return;
+          }
+          close( fd );
+     }
+}
+
+static void close_standin( struct standin *standin )
+{
+     while( standin->num_fillers > 0 )
+     {
+          close( standin->fillers[ --standin->num_fillers ] );
+     }
+     if ( standin->lsock_fd >= 0 )
+     {
+          close( standin->lsock_fd );
+          standin->lsock_fd = ( -1 );
+     }
+     return;
+}
+
+/*
+
+     Finds a port that is free on both loopback addresses and fills
+     in addrs[ 0 ] with ::1 and addrs[ 1 ] with 127.0.0.1 on it.
+
+*/
+
+static int pick_port( struct sockaddr_storage *addrs )
+{
+     int fd, tries;
+     socklen_t size;
+     struct sockaddr_in *in4;
+     struct sockaddr_in6 *in6;
+
+     for( tries = 0; tries < 20; tries++ )
+     {
+          memset( addrs, 0, 2 * sizeof( struct sockaddr_storage ) );
+          in6 = ( struct sockaddr_in6 * )( &( addrs[ 0 ] ) );
+          in6->sin6_family = AF_INET6;
+          in6->sin6_addr = in6addr_loopback;
+          in4 = ( struct sockaddr_in * )( &( addrs[ 1 ] ) );
+          in4->sin_family = AF_INET;
+          in4->sin_addr.s_addr = htonl( INADDR_LOOPBACK );
+
+          /* Let the kernel pick a port on ::1, then check 127.0.0.1. */
+
+          fd = socket( AF_INET6, SOCK_STREAM, 0 );
+          if ( fd < 0 )
+          {
+               return ( -1 );
+          }
+          size = sizeof( struct sockaddr_in6 );
+          if ( bind( fd, ( struct sockaddr * )in6, size ) != 0 ||
+               getsockname( fd, ( struct sockaddr * )in6, &size ) != 0 )
+          {
+               close( fd );
+               return ( -1 );
+          }
+          close( fd );
+          in4->sin_port = in6->sin6_port;
+
+          fd = socket( AF_INET, SOCK_STREAM, 0 );
+          if ( fd < 0 )
+          {
+               return ( -1 );
+          }
+          if ( bind( fd, ( struct sockaddr * )in4, sizeof( *in4 ) ) == 0 )
+          {
+               close( fd );
+               return 0;
+          }
+          close( fd );
+     }
+     errno = EADDRINUSE;
+     return ( -1 );
+}
+
+/* Runs trials connects with delay_ms.  Returns 0 or -1 on error. */
+
+static int run_case( const int mode6, const int mode4, const int trials,
+                     const int delay_ms )
+{
+     const char *winner;
+     int attempts, fd, index, v4_wins, v6_wins;
+     struct he_result result;
+     struct sockaddr_storage addrs[ 2 ];
+     struct standin standin4, standin6;
+     uint64_t *samples;
+
+     if ( pick_port( addrs ) != 0 ||
+          open_standin( &standin6, mode6, &( addrs[ 0 ] ),
+                        sizeof( struct sockaddr_in6 ) ) != 0 )
+     {
+          return ( -1 );
+     }
+     if ( open_standin( &standin4, mode4, &( addrs[ 1 ] ),
+                        sizeof( struct sockaddr_in ) ) != 0 )
+     {
+          close_standin( &standin6 );
+          return ( -1 );
+     }
+
+     samples = calloc( ( size_t )trials, sizeof( uint64_t ) );
+     if ( samples == NULL )
+     {
+          close_standin( &standin4 );
+          close_standin( &standin6 );
+          errno = ENOMEM;
+          return ( -1 );
+     }
+
+     v4_wins = 0;
+     v6_wins = 0;
+     attempts = 0;
+     for( index = 0; index < trials; index++ )
+     {
+          fd = he_race( addrs, 2, delay_ms, &result );
+          if ( fd < 0 )
+          {
+               samples[ index ] = ( uint64_t )CONNECT_TIMEOUT_MS * 1000000ULL;
+               continue;
+          }
+          close( fd );
+          samples[ index ] = result.elapsed_ns;
+          attempts += result.attempts;
+          if ( result.family == AF_INET6 )
+          {
+               v6_wins++;
+          }
+          else
+          {
+               v4_wins++;
+          }
+          drain_standin( &standin6, mode6 );
+          drain_standin( &standin4, mode4 );
+     }
+
+     if ( v6_wins + v4_wins < trials )
+     {
+          winner = "failed";
+     }
+     else if ( v6_wins > 0 && v4_wins > 0 )
+     {
+          winner = "both";
+     }
+     else
+     {
+          winner = ( ( v6_wins > 0 ) ? "IPv6" : "IPv4" );
+     }
+
+     sort_samples( samples, ( uint64_t )trials );
+     printf( "%-8s %-8s %-10s %-7s %10.3f %10.3f %9.1f\n",
+             standin_names[ mode6 ], standin_names[ mode4 ],
+             ( ( delay_ms >= 0 ) ? "race" : "one-by-one" ), winner,
+             ( double )percentile( samples, ( uint64_t )trials, 50 ) /
+             1e6,
+             ( double )samples[ trials - 1 ] / 1e6,
+             ( double )attempts / ( double )trials );
+     fflush( stdout );
+
+     free( samples );
+     close_standin( &standin4 );
+     close_standin( &standin6 );
+     return 0;
+}
+
+int main( int argc, char **argv )
+{
+     int index;
+     long long delay_ms, trials;
+
+     /* IPv6 stand-in, IPv4 stand-in. */
+
+     const int cases[ 4 ][ 2 ] =
+     {
+          { STANDIN_READY,   STANDIN_READY   },
+          { STANDIN_DELAYED, STANDIN_READY   },
+          { STANDIN_REFUSED, STANDIN_READY   },
+          { STANDIN_READY,   STANDIN_DELAYED }
+     };
+
+     trials = BENCH_EYEBALL_TRIALS;
+     delay_ms = HE_ATTEMPT_DELAY_MS;
+     if ( ( argc > 1 && ( sscanf( argv[ 1 ], "%lld", &trials ) != 1 ||
+                          trials < 1 || trials > 100000 ) ) ||
+          ( argc > 2 && ( sscanf( argv[ 2 ], "%lld", &delay_ms ) != 1 ||
+                          delay_ms < 0 || delay_ms > 10000 ) ) )
+     {
+          printf( "\nUsage: %s [ trials [ delay_ms ] ]\n\n", argv[ 0 ] );
+          exit( EXIT_FAILURE );
+     }
+
+     printf( "\n\
+Connecting to ::1 and then 127.0.0.1, %lld times for each case.\n\
+Racing starts the next address after %lld milliseconds.\n\n",
+             trials, delay_ms );
+     printf( "%-8s %-8s %-10s %-7s %10s %10s %9s\n", "IPv6", "IPv4",
+             "Method", "Winner", "Median ms", "Worst ms", "Attempts" );
+
+     for( index = 0; index < 4; index++ )
+     {
+          if ( run_case( cases[ index ][ 0 ], cases[ index ][ 1 ],
+                         ( int )trials, ( int )delay_ms ) != 0 ||
+               run_case( cases[ index ][ 0 ], cases[ index ][ 1 ],
+                         ( int )trials, ( -1 ) ) != 0 )
+          {
+               printf( "\nCould not set up the stand-ins: %s.\n\n",
+                       strerror( errno ) );
+               exit( EXIT_FAILURE );
+          }
+     }
+
+     printf( "\n\
+Attempts is how many connects were started on average.  A delayed\n\
+family costs the race about delay_ms, and costs the one-by-one loop\n\
+its whole timeout of %d milliseconds.\n\n", CONNECT_TIMEOUT_MS );
+
+     exit( EXIT_SUCCESS );
+}
+
+/* EOF bench_eyeballs.c */
@@ -0,0 +1,122 @@
+/*
+
+     bench_latency.c
+
+     Measures round trip latency over a connected pair for every
+     domain and socket type this program can set up on one device,
+     using run_latency().  This is the comparison to look at when
+     choosing between AF_UNIX and loopback TCP for a sidecar, or
+     deciding whether a shared memory ring is worth it.
+
+     Usage: bench_latency [ round_trips [ message_size ] ]
+
+     round_trips defaults to BENCH_LATENCY_ROUND_TRIPS and
+     message_size defaults to BENCH_LATENCY_SIZE bytes.
+
+     Written by Matthew Campbell.
+
+*/
+
+#include "sockets.h"
+
+#define BENCH_LATENCY_ROUND_TRIPS 1000000
+#define BENCH_LATENCY_SIZE 64
+
+/* The AF_UNIX socket file used by this benchmark. */
+
+#define BENCH_SOCK_NAME "bench_latency_socket"
+
+/* Every combination to measure. */
+
+struct combination
+{
+     int domain;
+     int sock_type;
+     const char *domain_name;
+     const char *type_name;
+};
+
+static const struct combination combinations[] =
+{
+     { AF_UNIX,  SOCK_STREAM,    "AF_UNIX",  "stream"    },
+     { AF_UNIX,  SOCK_DGRAM,     "AF_UNIX",  "dgram"     },
+     { AF_UNIX,  SOCK_SEQPACKET, "AF_UNIX",  "seqpacket" },
+     { AF_UNIX,  SOCK_SHM_RING,  "memfd",    "shm ring"  },
+     { AF_INET,  SOCK_STREAM,    "AF_INET",  "stream"    },
+     { AF_INET,  SOCK_DGRAM,     "AF_INET",  "dgram"     },
+     { AF_INET6, SOCK_STREAM,    "AF_INET6", "stream"    },
+     { AF_INET6, SOCK_DGRAM,     "AF_INET6", "dgram"     }
+};
+
+#define NUM_COMBINATIONS \
+     ( sizeof( combinations ) / sizeof( combinations[ 0 ] ) )
+
+int main( int argc, char **argv )
+{
+     int count, csock_fd, ret, save_errno, ssock_fd;
+     long long round_trips, size;
+     struct latency_stats stats;
+
+     round_trips = BENCH_LATENCY_ROUND_TRIPS;
+     size = BENCH_LATENCY_SIZE;
+     if ( ( argc > 1 && ( sscanf( argv[ 1 ], "%lld", &round_trips ) != 1 ||
+                          round_trips < 1 ) ) ||
+          ( argc > 2 && ( sscanf( argv[ 2 ], "%lld", &size ) != 1 ||
+                          size < 1 || size > BENCH_MAX_DGRAM ) ) )
+     {
+          printf( "\nUsage: %s [ round_trips [ message_size ] ]\n\n",
+                  argv[ 0 ] );
+          exit( EXIT_FAILURE );
+     }
+
+     printf( "\n\
+Round trip latency in microseconds, %lld round trips of %lld bytes:\n\n",
+             round_trips, size );
+     printf( "%-9s %-10s %9s %9s %9s %9s %9s %9s\n", "Domain", "Type",
+             "Min", "Mean", "p50", "p99", "p99.9", "Max" );
+
+     for( count = 0; count < ( int )NUM_COMBINATIONS; count++ )
+     {
+          printf( "%-9s %-10s ", combinations[ count ].domain_name,
+                  combinations[ count ].type_name );
+          fflush( stdout );
+
+          if ( open_local_pair( combinations[ count ].domain,
+                                combinations[ count ].sock_type,
+                                BENCH_SOCK_NAME, &csock_fd,
+                                &ssock_fd ) != 0 )
+          {
+               printf( "skipped (%s)\n", strerror( errno ) );
+               continue;
+          }
+
+          ret = run_latency( csock_fd, ssock_fd,
+                             combinations[ count ].sock_type,
+                             ( size_t )size, ( uint64_t )round_trips,
+                             &stats );
+          save_errno = errno;
+          close( csock_fd );
+          close( ssock_fd );
+
+          if ( ret != 0 )
+          {
+               printf( "failed (%s)\n", strerror( save_errno ) );
+               continue;
+          }
+
+          printf( "%9.2f %9.2f %9.2f %9.2f %9.2f %9.2f\n",
+                  ( double )stats.min_ns / 1000.0,
+                  ( double )stats.mean_ns / 1000.0,
+                  ( double )stats.p50_ns / 1000.0,
+                  ( double )stats.p99_ns / 1000.0,
+                  ( double )stats.p999_ns / 1000.0,
+                  ( double )stats.max_ns / 1000.0 );
+          fflush( stdout );
+     }
+
+     printf( "\n\
+The clock overhead is measured and removed from every sample.\n\n" );
+     exit( EXIT_SUCCESS );
+}
+
+/* EOF bench_latency.c */
@@ -0,0 +1,163 @@
+/*
+
+     bench_mmsg.c
+
+     Compares sending and receiving datagrams one per system call with
+     batching them through sendmmsg(2) and recvmmsg(2), using
+     run_throughput(), for AF_UNIX, AF_INET and AF_INET6.  A batch of
+     1 is the single-datagram path.
+
+     For each run this prints the datagrams sent and received per
+     second, how many were lost, and how many each side handled per
+     second of its own CPU time, which is the rate one core could keep
+     up.
+
+     Usage: bench_mmsg [ datagrams [ size [ batch ... ] ] ]
+
+     datagrams is how many to send in each run and defaults to
+     BENCH_MMSG_DATAGRAMS, size defaults to BENCH_MMSG_SIZE bytes, and
+     any batch sizes given replace the default list.
+
+     Written by Matthew Campbell.
+
+*/
+
+#include "sockets.h"
+
+#define BENCH_MMSG_DATAGRAMS 1000000
+#define BENCH_MMSG_SIZE 256
+
+/* The AF_UNIX socket file used by this benchmark. */
+
+#define BENCH_SOCK_NAME "bench_mmsg_socket"
+
+static const int default_batches[] = { 1, 8, 32, 64 };
+
+#define NUM_DEFAULT_BATCHES \
+     ( sizeof( default_batches ) / sizeof( default_batches[ 0 ] ) )
+
+/* Runs one domain with one batch size and prints a line. */
+
+static void bench_one( const int domain, const char *domain_name,
+                       const int batch, const size_t size,
+                       const uint64_t datagrams )
+{
+     double loss, seconds;
+     int csock_fd, ret, save_errno, ssock_fd;
+     struct throughput_stats stats;
+
+     printf( "%-9s %5d ", domain_name, batch );
+     fflush( stdout );
+
+     if ( open_local_pair( domain, SOCK_DGRAM, BENCH_SOCK_NAME, &csock_fd,
+                           &ssock_fd ) != 0 )
+     {
+          printf( "skipped (%s)\n", strerror( errno ) );
+          return;
+     }
+
+     ret = run_throughput( csock_fd, ssock_fd, SOCK_DGRAM, size, batch,
+                           ( datagrams * size ), &stats );
+     save_errno = errno;
+     close( csock_fd );
+     close( ssock_fd );
+
+     if ( ret != 0 )
+     {
+          printf( "failed (%s)\n", strerror( save_errno ) );
+          return;
+     }
+
+     seconds = ( double )stats.elapsed_ns / 1e9;
+     loss = 0.0;
+     if ( stats.msgs_sent > stats.msgs_received )
+     {
+          loss = 100.0 * ( double )( stats.msgs_sent -
+                                     stats.msgs_received ) /
+                 ( double )stats.msgs_sent;
+     }
+
+     printf( "%11.0f %11.0f %6.2f %14.0f %14.0f\n",
+             ( double )stats.msgs_sent / seconds,
+             ( double )stats.msgs_received / seconds, loss,
+             ( double )stats.msgs_sent /
+             ( ( double )stats.send_cpu_ns / 1e9 ),
+             ( double )stats.msgs_received /
+             ( ( double )stats.recv_cpu_ns / 1e9 ) );
+     fflush( stdout );
+     return;
+}
+
+int main( int argc, char **argv )
+{
+     int count, index, num_batches, *batches;
+     long long datagrams, size, value;
+
+     const int domains[ 3 ] = { AF_UNIX, AF_INET, AF_INET6 };
+     const char *names[ 3 ] = { "AF_UNIX", "AF_INET", "AF_INET6" };
+
+     datagrams = BENCH_MMSG_DATAGRAMS;
+     size = BENCH_MMSG_SIZE;
+     if ( ( argc > 1 && ( sscanf( argv[ 1 ], "%lld", &datagrams ) != 1 ||
+                          datagrams < 1 ) ) ||
+          ( argc > 2 && ( sscanf( argv[ 2 ], "%lld", &size ) != 1 ||
+                          size < 1 || size > BENCH_MAX_DGRAM ) ) )
+     {
+          printf( "\nUsage: %s [ datagrams [ size [ batch ... ] ] ]\n\n",
+                  argv[ 0 ] );
+          exit( EXIT_FAILURE );
+     }
+
+     num_batches = ( ( argc > 3 ) ? ( argc - 3 ) :
+                                    ( int )NUM_DEFAULT_BATCHES );
+     batches = calloc( ( size_t )num_batches, sizeof( int ) );
+     if ( batches == NULL )
+     {
+          printf( "\nOut of memory.\n\n" );
+          exit( EXIT_FAILURE );
+     }
+     for( index = 0; index < num_batches; index++ )
+     {
+          if ( argc > 3 )
+          {
+               if ( sscanf( argv[ index + 3 ], "%lld", &value ) != 1 ||
+                    value < 1 || value > DGRAM_BATCH_MAX )
+               {
+                    printf( "\n\
+Batch sizes must be from 1 to %d datagrams.\n\n", DGRAM_BATCH_MAX );
+                    free( batches );
+                    exit( EXIT_FAILURE );
+               }
+               batches[ index ] = ( int )value;
+          }
+          else
+          {
+               batches[ index ] = default_batches[ index ];
+          }
+     }
+
+     printf( "\n%lld datagrams of %lld bytes per run:\n\n", datagrams,
+             size );
+     printf( "%-9s %5s %11s %11s %6s %14s %14s\n", "Domain", "Batch",
+             "Sent/sec", "Rcvd/sec", "Loss%", "Send/CPU sec",
+             "Recv/CPU sec" );
+
+     for( count = 0; count < 3; count++ )
+     {
+          for( index = 0; index < num_batches; index++ )
+          {
+               bench_one( domains[ count ], names[ count ],
+                          batches[ index ], ( size_t )size,
+                          ( uint64_t )datagrams );
+          }
+     }
+
+     printf( "\n\
+A batch of 1 uses send(2) and recv(2).  Larger batches use\n\
+sendmmsg(2) and recvmmsg(2).  The last two columns are datagrams\n\
+per second of each side's own CPU time.\n\n" );
+     free( batches );
+     exit( EXIT_SUCCESS );
+}
+
+/* EOF bench_mmsg.c */
@@ -0,0 +1,360 @@
+/*
+
+     bench_pool.c
+
+     Measures the I/O buffer pool in io_pool.c.
+
+     First several threads get and put back buffers in bursts of
+     BENCH_POOL_BURST, the way a server takes a buffer for each read
+     and gives it back once the data has been sent, once with
+     malloc(3) and free(3) and once with the pool.  Most of these come
+     out of each thread's own cache, and only every IO_POOL_BATCH or
+     so go to the free list the threads share.
+
+     Then one message at a time is sent to BENCH_POOL_FANOUT
+     connections, which are socketpairs drained after every message.
+     With copies every connection gets its own copy of the message in
+     a buffer of its own, the way a per-connection send queue works.
+     With sharing the message is written once into a pool buffer that
+     every connection holds a reference to, and the last one to send
+     it puts it back.
+
+     Afterwards it prints how the pool's region is backed and how
+     often the thread caches went to the shared free list.
+
+     Usage: bench_pool [ operations [ threads ] ]
+
+     operations defaults to BENCH_POOL_OPS, and threads to
+     BENCH_POOL_THREADS.
+
+     Written by Matthew Campbell.
+
+*/
+
+#include "sockets.h"
+
+#define BENCH_POOL_OPS 2000000
+#define BENCH_POOL_THREADS 4
+#define BENCH_POOL_BURST 16
+#define BENCH_POOL_FANOUT 32
+#define BENCH_POOL_MSG 1024
+
+static const char *backing_names[ 3 ] =
+{
+     "ordinary pages", "transparent huge pages", "reserved huge pages"
+};
+
+struct churn_arg
+{
+     int use_pool;
+     long long ops;
+     int failed;
+};
+
+/* Gets and puts back ops buffers, BENCH_POOL_BURST at a time. */
+
+static void *churn_thread( void *arg )
+{
+     char *mem[ BENCH_POOL_BURST ];
+     int index;
+     long long done;
+     struct churn_arg *churn;
+     struct io_buf *bufs[ BENCH_POOL_BURST ];
+
+     churn = ( struct churn_arg * )arg;
+     for( done = 0; done < churn->ops; done += BENCH_POOL_BURST )
+     {
+          for( index = 0; index < BENCH_POOL_BURST; index++ )
+          {
+               if ( churn->use_pool == 0 )
+               {
+                    mem[ index ] = malloc( IO_POOL_BUF_SIZE );
+                    if ( mem[ index ] == NULL )
+                    {
+                         churn->failed = 1;
+                         return NULL;
+                    }
+                    mem[ index ][ 0 ] = ( char )index;
+               }
+               else
+               {
+                    bufs[ index ] = io_buf_get();
+                    if ( bufs[ index ] == NULL )
+                    {
+                         churn->failed = 1;
+                         return NULL;
+                    }
+                    bufs[ index ]->data[ 0 ] = ( char )index;
+               }
+          }
+          for( index = 0; index < BENCH_POOL_BURST; index++ )
+          {
+               if ( churn->use_pool == 0 )
+               {
+                    free( mem[ index ] );
+               }
+               else
+               {
+                    io_buf_put( bufs[ index ] );
+               }
+          }
+     }
+     if ( churn->use_pool == 1 )
+     {
+          io_pool_flush();
+     }
+     return NULL;
+}
+
+/*
+
+     Runs the churn on threads threads.  Returns the nanoseconds per
+     get and put, or -1.0 on error.
+
+*/
+
+static double churn( const int use_pool, const long long ops,
+                     const int threads )
+{
+     int count, failed, ret;
+     pthread_t *tids;
+     struct churn_arg *args;
+     uint64_t start_ns, total_ns;
+
+     tids = calloc( ( size_t )threads, sizeof( pthread_t ) );
+     args = calloc( ( size_t )threads, sizeof( struct churn_arg ) );
+     if ( tids == NULL || args == NULL )
+     {
+          free( tids );
+          free( args );
+          errno = ENOMEM;
+          return ( -1.0 );
+     }
+
+     start_ns = get_time_ns();
+     for( count = 0; count < threads; count++ )
+     {
+          args[ count ].use_pool = use_pool;
+          args[ count ].ops = ops / threads;
+          ret = pthread_create( &( tids[ count ] ), NULL, churn_thread,
+                                &( args[ count ] ) );
+          if ( ret != 0 )
+          {
+               args[ count ].failed = 1;
+               break;
+          }
+     }
+     failed = 0;
+     for( ret = 0; ret < count; ret++ )
+     {
+          pthread_join( tids[ ret ], NULL );
+          failed |= args[ ret ].failed;
+     }
+     total_ns = get_time_ns() - start_ns;
+
+     free( tids );
+     free( args );
+     if ( failed != 0 || count < threads )
+     {
+          errno = ENOBUFS;
+          return ( -1.0 );
+     }
+     return ( double )total_ns / ( double )ops;
+}
+
+/* Reads whatever is waiting on each receiving end. */
+
+static int drain( const int *fds, const int fanout, char *buffer )
+{
+     int conn;
+     size_t received;
+     ssize_t num;
+
+     for( conn = 0; conn < fanout; conn++ )
+     {
+          received = 0;
+          while( received < BENCH_POOL_MSG )
+          {
+               num = recv( fds[ conn * 2 + 1 ], buffer, BENCH_POOL_MSG, 0 );
+               if ( num <= 0 )
+               {
+                    return ( -1 );
+               }
+               received += ( size_t )num;
+          }
+     }
+     return 0;
+}
+
+/*
+
+     Sends msgs messages to every connection, copying each one for
+     every connection if share is 0 or sharing one pool buffer.
+     Returns the nanoseconds per message, or -1.0 on error.
+
+*/
+
+static double fan_out( const int *fds, const int fanout, const int share,
+                       const long long msgs, const char *message )
+{
+     char buffer[ BENCH_POOL_MSG ], *copy;
+     int conn;
+     long long count;
+     struct io_buf *buf;
+     uint64_t start_ns, total_ns;
+
+     start_ns = get_time_ns();
+     for( count = 0; count < msgs; count++ )
+     {
+          buf = NULL;
+          if ( share == 1 )
+          {
+               buf = io_buf_get();
+               if ( buf == NULL )
+               {
+                    return ( -1.0 );
+               }
+               memcpy( buf->data, message, BENCH_POOL_MSG );
+               buf->len = BENCH_POOL_MSG;
+               for( conn = 1; conn < fanout; conn++ )
+               {
+                    io_buf_ref( buf );
+               }
+          }
+
+          for( conn = 0; conn < fanout; conn++ )
+          {
+               if ( share == 1 )
+               {
+                    if ( send( fds[ conn * 2 ], buf->data, buf->len,
+                               MSG_NOSIGNAL ) != BENCH_POOL_MSG )
+                    {
+                         return ( -1.0 );
+                    }
+                    io_buf_put( buf );
+               }
+               else
+               {
+                    copy = malloc( BENCH_POOL_MSG );
+                    if ( copy == NULL )
+                    {
+                         errno = ENOMEM;
+                         return ( -1.0 );
+                    }
+                    memcpy( copy, message, BENCH_POOL_MSG );
+                    if ( send( fds[ conn * 2 ], copy, BENCH_POOL_MSG,
+                               MSG_NOSIGNAL ) != BENCH_POOL_MSG )
+                    {
+                         free( copy );
+                         return ( -1.0 );
+                    }
+                    free( copy );
+               }
+          }
+
+          if ( drain( fds, fanout, buffer ) != 0 )
+          {
+               return ( -1.0 );
+          }
+     }
+     total_ns = get_time_ns() - start_ns;
+     return ( double )total_ns / ( double )msgs;
+}
+
+int main( int argc, char **argv )
+{
+     char message[ BENCH_POOL_MSG ];
+     double mean[ 2 ];
+     int conn, fds[ BENCH_POOL_FANOUT * 2 ], share, use_pool;
+     long long ops, threads;
+     struct io_pool_stats stats;
+
+     ops = BENCH_POOL_OPS;
+     threads = BENCH_POOL_THREADS;
+     if ( ( argc > 1 && ( sscanf( argv[ 1 ], "%lld", &ops ) != 1 ||
+                          ops < BENCH_POOL_BURST || ops > 1000000000 ) ) ||
+          ( argc > 2 && ( sscanf( argv[ 2 ], "%lld", &threads ) != 1 ||
+                          threads < 1 || threads > 256 ) ) )
+     {
+          printf( "\nUsage: %s [ operations [ threads ] ]\n\n", argv[ 0 ] );
+          exit( EXIT_FAILURE );
+     }
+
+     if ( io_pool_init( IO_POOL_BUFS, IO_POOL_BUF_SIZE ) != 0 )
+     {
+          printf( "\nio_pool_init() failed: %s\n\n", strerror( errno ) );
+          exit( EXIT_FAILURE );
+     }
+
+     printf( "\n\
+Getting and putting back %lld buffers of %d bytes on %lld threads:\n\n",
+             ops, IO_POOL_BUF_SIZE, threads );
+     for( use_pool = 0; use_pool < 2; use_pool++ )
+     {
+          mean[ use_pool ] = churn( use_pool, ops, ( int )threads );
+          if ( mean[ use_pool ] < 0.0 )
+          {
+               printf( "%-8s failed (%s)\n",
+                       ( ( use_pool == 0 ) ? "malloc" : "pool" ),
+                       strerror( errno ) );
+               exit( EXIT_FAILURE );
+          }
+          printf( "%-8s %8.1f ns per buffer\n",
+                  ( ( use_pool == 0 ) ? "malloc" : "pool" ),
+                  mean[ use_pool ] );
+     }
+     printf( "%-8s %7.2fx\n", "speedup", mean[ 0 ] / mean[ 1 ] );
+
+     for( conn = 0; conn < BENCH_POOL_FANOUT; conn++ )
+     {
+          if ( socketpair( AF_UNIX, SOCK_STREAM, 0,
+                           &( fds[ conn * 2 ] ) ) != 0 )
+          {
+               printf( "\nsocketpair() failed: %s\n\n", strerror( errno ) );
+               exit( EXIT_FAILURE );
+          }
+     }
+     memset( message, 'M', BENCH_POOL_MSG );
+
+     printf( "\n\
+Sending %lld messages of %d bytes to %d connections each:\n\n",
+             ops / 100, BENCH_POOL_MSG, BENCH_POOL_FANOUT );
+     for( share = 0; share < 2; share++ )
+     {
+          mean[ share ] = fan_out( fds, BENCH_POOL_FANOUT, share, ops / 100,
+                                   message );
+          if ( mean[ share ] < 0.0 )
+          {
+               printf( "%-8s failed (%s)\n",
+                       ( ( share == 0 ) ? "copies" : "shared" ),
+                       strerror( errno ) );
+               exit( EXIT_FAILURE );
+          }
+          printf( "%-8s %8.2f us per message, %d bytes of buffers\n",
+                  ( ( share == 0 ) ? "copies" : "shared" ),
+                  mean[ share ] / 1000.0,
+                  ( ( share == 0 ) ? ( BENCH_POOL_FANOUT * BENCH_POOL_MSG ) :
+                                     IO_POOL_BUF_SIZE ) );
+     }
+     printf( "%-8s %7.2fx\n", "speedup", mean[ 0 ] / mean[ 1 ] );
+
+     for( conn = 0; conn < BENCH_POOL_FANOUT * 2; conn++ )
+     {
+          close( fds[ conn ] );
+     }
+
+     io_pool_flush();
+     io_pool_get_stats( &stats );
+     printf( "\n\
+Pool:          %d buffers of %zu bytes in %zu MB of %s\n\
+Shared list:   %" PRIu64 " free, %" PRIu64 " refills, %" PRIu64 " spills\n\
+Exhausted:     %" PRIu64 "\n\n",
+             stats.count, stats.size, stats.bytes / ( 1024 * 1024 ),
+             backing_names[ stats.backing ], stats.shared_free,
+             stats.refills, stats.spills, stats.exhausted );
+
+     io_pool_free();
+     exit( EXIT_SUCCESS );
+}
+
+/* EOF bench_pool.c */
@@ -0,0 +1,456 @@
+/*
+
+     bench_prefork.c
+
+     Measures what it costs the multi-connection server to hand its
+     connections to prefork workers with SCM_RIGHTS instead of
+     serving them in the process that accepted them.
+
+     The first table times the hand-off on its own.  count
+     descriptors are passed with send_fd() and recv_fd() and then
+     closed, first within one process and then to a worker process
+     that keeps up as they arrive.  For comparison, the same number of
+     plain ints are written down a pipe to a worker, which is what
+     handing it some work costs without a descriptor attached.  An
+     in-process server pays none of this; it serves what it accepts.
+
+     The second table runs the whole server against a load generator
+     opening peers connections to the loopback address: once with
+     run_epoll_server() in one process, then with an acceptor and 1,
+     2 and 4 workers.  The last run kills one of 2 workers partway
+     through to show that only that worker's connections are lost and
+     that it is replaced.
+
+     Usage: bench_prefork [ count [ peers ] ]
+
+     count defaults to BENCH_HANDOFF_COUNT and peers to
+     BENCH_PREFORK_PEERS.
+
+     Written by Matthew Campbell.
+
+*/
+
+#include "sockets.h"
+
+#define BENCH_HANDOFF_COUNT 200000
+#define BENCH_PREFORK_PEERS 5000
+
+/* How long the kill run waits before killing a worker. */
+
+#define BENCH_KILL_DELAY_US 20000
+
+/* Hand-off methods for the first table. */
+
+#define HANDOFF_LOCAL 0
+#define HANDOFF_WORKER 1
+#define HANDOFF_PIPE 2
+
+static const char *handoff_names[] =
+{
+     "SCM_RIGHTS, same process",
+     "SCM_RIGHTS, to a worker",
+     "int over a pipe, to a worker"
+};
+
+/*
+
+     The worker side of a hand-off run: takes count items from in_fd
+     and writes one byte to done_fd when it has them all.  Runs in
+     the child process.
+
+*/
+
+static void handoff_worker( const int method, const int in_fd,
+                            const int done_fd, const int count )
+{
+     int fd, index, item;
+     ssize_t len;
+
+     for( index = 0; index < count; index++ )
+     {
+          if ( method == HANDOFF_PIPE )
+          {
+               do
+               {
+                    len = read( in_fd, &item, sizeof( item ) );
+               }    while( len < 0 && errno == EINTR );
+               if ( len != ( ssize_t )sizeof( item ) )
+               {
+                    _exit( EXIT_FAILURE );
+               }
+               continue;
+          }
+          fd = recv_fd( in_fd, 0 );
+          if ( fd < 0 )
+          {
+               _exit( EXIT_FAILURE );
+          }
+          close( fd );
+     }
+     len = write( done_fd, "", 1 );
+     _exit( ( len == 1 ) ? EXIT_SUCCESS : EXIT_FAILURE );
+}
+
+/* Times count hand-offs.  Returns nanoseconds each or -1 on error. */
+
+static double bench_handoff( const int method, const int count )
+{
+     char byte;
+     int chan_fd[ 2 ], done_fd[ 2 ], fd, index, ret, save_errno;
+     pid_t pid;
+     ssize_t len;
+     uint64_t elapsed_ns, start_ns;
+
+     /* One end of a pair stands in for an accepted connection. */
+
+     if ( method == HANDOFF_PIPE )
+     {
+          ret = pipe( chan_fd );
+     }
+     else
+     {
+          ret = socketpair( AF_UNIX, ( SOCK_SEQPACKET | SOCK_CLOEXEC ), 0,
+                            chan_fd );
+     }
+     if ( ret != 0 )
+     {
+          return ( -1.0 );
+     }
+     if ( pipe( done_fd ) != 0 )
+     {
+          save_errno = errno;
+          close( chan_fd[ 0 ] );
+          close( chan_fd[ 1 ] );
+          errno = save_errno;
+          return ( -1.0 );
+     }
+
+     pid = 0;
+     if ( method != HANDOFF_LOCAL )
+     {
+          fflush( stdout );
+          pid = fork();
+          if ( pid == ( -1 ) )
+          {
+               save_errno = errno;
+               close( chan_fd[ 0 ] );
+               close( chan_fd[ 1 ] );
+               close( done_fd[ 0 ] );
+               close( done_fd[ 1 ] );
+               errno = save_errno;
+               return ( -1.0 );
+          }
+          else if ( pid == 0 )  /* Child process */
+          {
+               close( ( method == HANDOFF_PIPE ) ?
+                      chan_fd[ 1 ] : chan_fd[ 0 ] );
+               close( done_fd[ 0 ] );
+               handoff_worker( method, ( ( method == HANDOFF_PIPE ) ?
+                                         chan_fd[ 0 ] : chan_fd[ 1 ] ),
+                               done_fd[ 1 ], count );
+          }
+          close( done_fd[ 1 ] );
+          done_fd[ 1 ] = ( -1 );
+     }
+
+     /* Parent process, or the only one for HANDOFF_LOCAL. */
+
+     ret = 0;
+     fd = done_fd[ 0 ];  /* Any open descriptor will do. */
+     start_ns = get_time_ns();
+     for( index = 0; index < count && ret == 0; index++ )
+     {
+          if ( method == HANDOFF_PIPE )
+          {
+               do
+               {
+                    len = write( chan_fd[ 1 ], &index, sizeof( index ) );
+               }    while( len < 0 && errno == EINTR );
+               ret = ( ( len == ( ssize_t )sizeof( index ) ) ? 0 : ( -1 ) );
+          }
+          else if ( method == HANDOFF_WORKER )
+          {
+               ret = send_fd( chan_fd[ 0 ], fd, 0 );
+          }
+          else if ( send_fd( chan_fd[ 0 ], fd, 0 ) != 0 )
+          {
+               ret = ( -1 );
+          }
+          else
+          {
+               ret = recv_fd( chan_fd[ 1 ], 0 );
+               if ( ret >= 0 )
+               {
+                    close( ret );
+                    ret = 0;
+               }
+          }
+     }
+     if ( ret == 0 && method != HANDOFF_LOCAL )
+     {
+          do
+          {
+               len = read( done_fd[ 0 ], &byte, 1 );
+          }    while( len < 0 && errno == EINTR );
+          ret = ( ( len == 1 ) ? 0 : ( -1 ) );
+     }
+     elapsed_ns = get_time_ns() - start_ns;
+     save_errno = errno;
+
+     close( chan_fd[ 0 ] );
+     close( chan_fd[ 1 ] );
+     close( done_fd[ 0 ] );
+     if ( done_fd[ 1 ] >= 0 )
+     {
+          close( done_fd[ 1 ] );
+     }
+     if ( pid > 0 )
+     {
+          waitpid( pid, NULL, 0 );
+     }
+
+     if ( ret != 0 )
+     {
+          errno = save_errno;
+          return ( -1.0 );
+     }
+     return ( double )elapsed_ns / ( double )count;
+}
+
+/*
+
+     Runs the server with workers prefork workers, or in one process
+     if workers is 0, killing a worker partway through if kill_one is
+     1.  Returns 0 or -1 on error.
+
+*/
+
+static int bench_server( const int workers, const int kill_one,
+                         const int peers, struct client_stats *client,
+                         uint64_t *respawned, double *rate )
+{
+     int index, lsock_fd, ret, save_errno, stop_fd[ 2 ];
+     pid_t killer, pid;
+     socklen_t addr_len;
+     ssize_t len;
+     struct prefork_pool pool;
+     struct server_stats acceptor, server;
+     struct sockaddr_in *in4;
+     struct sockaddr_storage addr;
+
+     memset( &addr, 0, sizeof( addr ) );
+     in4 = ( struct sockaddr_in * )( &addr );
+     in4->sin_family = AF_INET;
+     in4->sin_addr.s_addr = htonl( INADDR_LOOPBACK );
+     addr_len = sizeof( struct sockaddr_in );
+
+     lsock_fd = open_reuseport_listener( &addr, &addr_len, EPOLL_BACKLOG );
+     if ( lsock_fd < 0 )
+     {
+          return ( -1 );
+     }
+     if ( pipe( stop_fd ) != 0 )
+     {
+          save_errno = errno;
+          close( lsock_fd );
+          errno = save_errno;
+          return ( -1 );
+     }
+     if ( workers > 0 &&
+          prefork_start( &pool, lsock_fd, workers, stop_fd[ 0 ] ) != 0 )
+     {
+          save_errno = errno;
+          close( stop_fd[ 0 ] );
+          close( stop_fd[ 1 ] );
+          close( lsock_fd );
+          errno = save_errno;
+          return ( -1 );
+     }
+
+     fflush( stdout );
+     pid = fork();
+     if ( pid == ( -1 ) )
+     {
+          save_errno = errno;
+          if ( workers > 0 )
+          {
+               len = write( stop_fd[ 1 ], "", 1 );
+               prefork_finish( &pool, NULL, NULL );
+          }
+          close( stop_fd[ 0 ] );
+          close( stop_fd[ 1 ] );
+          close( lsock_fd );
+          errno = save_errno;
+          return ( -1 );
+     }
+     else if ( pid == 0 )  /* Child process */
+     {
+          close( stop_fd[ 0 ] );
+          close( lsock_fd );
+          for( index = 0; index < workers; index++ )
+          {
+               close( pool.chan_fds[ index ] );
+               close( pool.result_fds[ index ] );
+          }
+          if ( run_load_generator( AF_INET, &addr, addr_len, peers,
+                                   client ) != 0 )
+          {
+               memset( client, 0, sizeof( struct client_stats ) );
+               client->failed = ( uint64_t )peers;
+          }
+          len = write( stop_fd[ 1 ], client, sizeof( struct client_stats ) );
+          _exit( ( len == ( ssize_t )sizeof( struct client_stats ) ) ?
+                 EXIT_SUCCESS : EXIT_FAILURE );
+     }
+
+     /* Parent process, pid > 0 */
+
+     close( stop_fd[ 1 ] );
+
+     killer = 0;
+     if ( kill_one == 1 && workers > 0 )
+     {
+          killer = fork();
+          if ( killer == 0 )  /* Child process */
+          {
+               usleep( BENCH_KILL_DELAY_US );
+               kill( pool.pids[ 0 ], SIGKILL );
+               _exit( EXIT_SUCCESS );
+          }
+     }
+
+     if ( workers > 0 )
+     {
+          ret = run_prefork_server( lsock_fd, stop_fd[ 0 ], &pool,
+                                    &acceptor );
+          save_errno = errno;
+          *respawned = pool.respawned;
+
+          /* The worker that was killed has nothing to report. */
+
+          prefork_finish( &pool, &server, NULL );
+     }
+     else
+     {
+          ret = run_epoll_server( lsock_fd, stop_fd[ 0 ], &server );
+          save_errno = errno;
+          *respawned = 0;
+     }
+
+     memset( client, 0, sizeof( struct client_stats ) );
+     if ( ret == 0 )
+     {
+          len = read( stop_fd[ 0 ], client, sizeof( struct client_stats ) );
+          if ( len != ( ssize_t )sizeof( struct client_stats ) )
+          {
+               ret = ( -1 );
+               save_errno = EIO;
+          }
+     }
+     else
+     {
+          kill( pid, SIGTERM );
+     }
+
+     waitpid( pid, NULL, 0 );
+     if ( killer > 0 )
+     {
+          waitpid( killer, NULL, 0 );
+     }
+     close( stop_fd[ 0 ] );
+     close( lsock_fd );
+
+     if ( ret != 0 )
+     {
+          errno = save_errno;
+          return ( -1 );
+     }
+     *rate = ( ( client->elapsed_ns > 0 ) ?
+               ( double )client->completed /
+               ( ( double )client->elapsed_ns / 1e9 ) : 0.0 );
+     return 0;
+}
+
+int main( int argc, char **argv )
+{
+     char label[ 32 ];
+     double ns, rate;
+     int index, method;
+     long long count, peers;
+     struct client_stats client;
+     uint64_t respawned;
+
+     /* Workers for each server run, then whether to kill one. */
+
+     const int runs[ 5 ][ 2 ] =
+     {
+          { 0, 0 }, { 1, 0 }, { 2, 0 }, { 4, 0 }, { 2, 1 }
+     };
+
+     count = BENCH_HANDOFF_COUNT;
+     peers = BENCH_PREFORK_PEERS;
+     if ( ( argc > 1 && ( sscanf( argv[ 1 ], "%lld", &count ) != 1 ||
+                          count < 1 || count > 100000000 ) ) ||
+          ( argc > 2 && ( sscanf( argv[ 2 ], "%lld", &peers ) != 1 ||
+                          peers < 1 || peers > 1000000 ) ) )
+     {
+          printf( "\nUsage: %s [ count [ peers ] ]\n\n", argv[ 0 ] );
+          exit( EXIT_FAILURE );
+     }
+     raise_fd_limit();
+
+     printf( "\nHanding over %lld items:\n\n", count );
+     printf( "%-30s %12s %14s\n", "Method", "ns each", "Per second" );
+     for( method = HANDOFF_LOCAL; method <= HANDOFF_PIPE; method++ )
+     {
+          ns = bench_handoff( method, ( int )count );
+          if ( ns < 0.0 )
+          {
+               printf( "%-30s failed (%s)\n", handoff_names[ method ],
+                       strerror( errno ) );
+               continue;
+          }
+          printf( "%-30s %12.1f %14.0f\n", handoff_names[ method ], ns,
+                  1e9 / ns );
+          fflush( stdout );
+     }
+
+     printf( "\n%lld connections to 127.0.0.1 for each server:\n\n",
+             peers );
+     printf( "%-16s %10s %8s %11s %10s %10s %9s\n", "Server",
+             "Completed", "Failed", "Conns/sec", "p50 us", "p99 us",
+             "Replaced" );
+     for( index = 0; index < 5; index++ )
+     {
+          if ( runs[ index ][ 0 ] == 0 )
+          {
+               snprintf( label, sizeof( label ), "in-process" );
+          }
+          else
+          {
+               snprintf( label, sizeof( label ), "prefork %d%s",
+                         runs[ index ][ 0 ],
+                         ( ( runs[ index ][ 1 ] == 1 ) ? ", kill" : "" ) );
+          }
+          if ( bench_server( runs[ index ][ 0 ], runs[ index ][ 1 ],
+                             ( int )peers, &client, &respawned,
+                             &rate ) != 0 )
+          {
+               printf( "%-16s failed (%s)\n", label, strerror( errno ) );
+               continue;
+          }
+          printf( "%-16s %10" PRIu64 " %8" PRIu64 " %11.0f %10.1f %10.1f"
+                  " %9" PRIu64 "\n", label, client.completed, client.failed,
+                  rate, ( double )client.p50_ns / 1000.0,
+                  ( double )client.p99_ns / 1000.0, respawned );
+          fflush( stdout );
+     }
+
+     printf( "\n\
+The kill run loses only the connections the killed worker held,\n\
+and the acceptor starts a new worker in its place.\n\n" );
+
+     exit( EXIT_SUCCESS );
+}
+
+/* EOF bench_prefork.c */
@@ -0,0 +1,287 @@
+/*
+
+     bench_reuseport.c
+
+     Measures how the rate at which new connections are accepted
+     grows as the multi-connection server is split across more
+     SO_REUSEPORT listeners, each with its own pinned worker.  For
+     each number of listeners, from 1 up to the number of CPUs this
+     process may use, the same number of load generators each open
+     BENCH_SHARD_PEERS connections to the loopback address, send a
+     message and wait for the echo.
+
+     This prints the connections completed per second, the speedup
+     over a single listener, and the fewest and most connections any
+     one listener accepted, which shows how evenly the kernel spread
+     them.  With only one CPU the 2 listener run still shows that the
+     spreading works, but there is nothing for it to scale across.
+
+     Usage: bench_reuseport [ peers [ backlog ] ]
+
+     peers is how many connections each load generator opens and
+     defaults to BENCH_SHARD_PEERS.  backlog is each listener's accept
+     backlog and defaults to EPOLL_BACKLOG.
+
+     Written by Matthew Campbell.
+
+*/
+
+#include "sockets.h"
+
+#define BENCH_SHARD_PEERS 5000
+
+/* Runs one domain with count listeners.  Returns 0 or -1 on error. */
+
+static int bench_shards( const int domain, const int count,
+                         const int peers, const int backlog,
+                         double *rate, uint64_t *completed,
+                         uint64_t *failed, uint64_t *fewest,
+                         uint64_t *most )
+{
+     int index, lsock_fd, result_fd[ 2 ], save_errno, stop_fd[ 2 ];
+     int started;
+     pid_t pids[ SHARD_MAX ];
+     socklen_t addr_len;
+     ssize_t len;
+     struct client_stats client;
+     struct server_stats server;
+     struct shard_set set;
+     struct sockaddr_in *in4;
+     struct sockaddr_in6 *in6;
+     struct sockaddr_storage addr;
+     uint64_t accepted[ SHARD_MAX ], elapsed_ns, start_ns;
+
+     memset( &addr, 0, sizeof( addr ) );
+     if ( domain == AF_INET )
+     {
+          in4 = ( struct sockaddr_in * )( &addr );
+          in4->sin_family = AF_INET;
+          in4->sin_addr.s_addr = htonl( INADDR_LOOPBACK );
+          addr_len = sizeof( struct sockaddr_in );
+     }
+     else
+     {
+          in6 = ( struct sockaddr_in6 * )( &addr );
+          in6->sin6_family = AF_INET6;
+          in6->sin6_addr = in6addr_loopback;
+          addr_len = sizeof( struct sockaddr_in6 );
+     }
+
+     lsock_fd = open_reuseport_listener( &addr, &addr_len, backlog );
+     if ( lsock_fd < 0 )
+     {
+          return ( -1 );
+     }
+     if ( pipe( stop_fd ) != 0 )
+     {
+          save_errno = errno;
+          close( lsock_fd );
+          errno = save_errno;
+          return ( -1 );
+     }
+     if ( pipe( result_fd ) != 0 )
+     {
+          save_errno = errno;
+          close( stop_fd[ 0 ] );
+          close( stop_fd[ 1 ] );
+          close( lsock_fd );
+          errno = save_errno;
+          return ( -1 );
+     }
+
+     if ( shards_start( &set, lsock_fd, count, backlog, ENGINE_EPOLL,
+                        stop_fd[ 0 ] ) != 0 )
+     {
+          save_errno = errno;
+          close( result_fd[ 0 ] );
+          close( result_fd[ 1 ] );
+          close( stop_fd[ 0 ] );
+          close( stop_fd[ 1 ] );
+          close( lsock_fd );
+          errno = save_errno;
+          return ( -1 );
+     }
+
+     /* One load generator per listener. */
+
+     fflush( stdout );
+     start_ns = get_time_ns();
+     for( started = 0; started < count; started++ )
+     {
+          pids[ started ] = fork();
+          if ( pids[ started ] == ( -1 ) )
+          {
+               break;
+          }
+          else if ( pids[ started ] == 0 )  /* Child process */
+          {
+               close( result_fd[ 0 ] );
+               close( stop_fd[ 0 ] );
+               close( stop_fd[ 1 ] );
+               for( index = 0; index < count; index++ )
+               {
+                    close( set.lsock_fds[ index ] );
+               }
+               if ( run_load_generator( domain, &addr, addr_len, peers,
+                                        &client ) != 0 )
+               {
+                    memset( &client, 0, sizeof( client ) );
+                    client.failed = ( uint64_t )peers;
+               }
+               len = write( result_fd[ 1 ], &client, sizeof( client ) );
+               close( result_fd[ 1 ] );
+               _exit( ( len == ( ssize_t )sizeof( client ) ) ?
+                      EXIT_SUCCESS : EXIT_FAILURE );
+          }
+     }
+     close( result_fd[ 1 ] );
+
+     /* Parent process.  Collect every generator's results. */
+
+     *completed = 0;
+     *failed = 0;
+     for( index = 0; index < started; index++ )
+     {
+          do
+          {
+               len = read( result_fd[ 0 ], &client, sizeof( client ) );
+          }    while( len < 0 && errno == EINTR );
+          if ( len != ( ssize_t )sizeof( client ) )
+          {
+               break;
+          }
+          *completed += client.completed;
+          *failed += client.failed;
+     }
+     elapsed_ns = get_time_ns() - start_ns;
+     save_errno = ( ( started < count || index < started ) ? EIO : 0 );
+
+     /* The workers hold the write end too, so closing it isn't enough. */
+
+     len = write( stop_fd[ 1 ], "", 1 );  /* This stops the workers. */
+     shards_finish( &set, &server, accepted );
+     for( index = 0; index < started; index++ )
+     {
+          waitpid( pids[ index ], NULL, 0 );
+     }
+     close( result_fd[ 0 ] );
+     close( stop_fd[ 0 ] );
+     close( stop_fd[ 1 ] );
+     close( lsock_fd );
+
+     if ( save_errno != 0 )
+     {
+          errno = save_errno;
+          return ( -1 );
+     }
+
+     *rate = ( double )( *completed ) / ( ( double )elapsed_ns / 1e9 );
+     *fewest = accepted[ 0 ];
+     *most = accepted[ 0 ];
+     for( index = 1; index < count; index++ )
+     {
+          if ( accepted[ index ] < *fewest )
+          {
+               *fewest = accepted[ index ];
+          }
+          if ( accepted[ index ] > *most )
+          {
+               *most = accepted[ index ];
+          }
+     }
+     return 0;
+}
+
+int main( int argc, char **argv )
+{
+     cpu_set_t allowed;
+     double base, rate;
+     int count, counts[ 16 ], cpus, domain, index, num_counts;
+     long long backlog, peers;
+     uint64_t completed, failed, fewest, most;
+
+     const int domains[ 2 ] = { AF_INET, AF_INET6 };
+     const char *names[ 2 ] = { "AF_INET", "AF_INET6" };
+
+     peers = BENCH_SHARD_PEERS;
+     backlog = EPOLL_BACKLOG;
+     if ( ( argc > 1 && ( sscanf( argv[ 1 ], "%lld", &peers ) != 1 ||
+                          peers < 1 || peers > 1000000 ) ) ||
+          ( argc > 2 && ( sscanf( argv[ 2 ], "%lld", &backlog ) != 1 ||
+                          backlog < 1 || backlog > 65535 ) ) )
+     {
+          printf( "\nUsage: %s [ peers [ backlog ] ]\n\n", argv[ 0 ] );
+          exit( EXIT_FAILURE );
+     }
+
+     cpus = 1;
+     if ( sched_getaffinity( 0, sizeof( allowed ), &allowed ) == 0 )
+     {
+          cpus = CPU_COUNT( &allowed );
+     }
+     if ( cpus > SHARD_MAX )
+     {
+          cpus = SHARD_MAX;
+     }
+
+     /* 1, 2, 4 and so on, then the number of CPUs. */
+
+     num_counts = 0;
+     for( count = 1; count < cpus && num_counts < 15; count *= 2 )
+     {
+          counts[ num_counts++ ] = count;
+     }
+     counts[ num_counts++ ] = cpus;
+     if ( cpus == 1 )
+     {
+          counts[ num_counts++ ] = 2;
+     }
+
+     raise_fd_limit();
+     if ( backlog > get_somaxconn() )
+     {
+          printf( "\n\
+Warning: The kernel will cut the backlog down to %d.\n",
+                  get_somaxconn() );
+     }
+
+     printf( "\n\
+%d CPUs, %lld connections per load generator, backlog %lld:\n\n",
+             cpus, peers, backlog );
+     printf( "%-9s %9s %10s %8s %11s %8s %9s %9s\n", "Domain",
+             "Listeners", "Completed", "Failed", "Conns/sec", "Speedup",
+             "Fewest", "Most" );
+
+     for( domain = 0; domain < 2; domain++ )
+     {
+          base = 0.0;
+          for( index = 0; index < num_counts; index++ )
+          {
+               errno = 0;
+               if ( bench_shards( domains[ domain ], counts[ index ],
+                                  ( int )peers, ( int )backlog, &rate,
+                                  &completed, &failed, &fewest,
+                                  &most ) != 0 )
+               {
+                    printf( "%-9s %9d failed (%s)\n", names[ domain ],
+                            counts[ index ], strerror( errno ) );
+                    continue;
+               }
+               if ( index == 0 )
+               {
+                    base = rate;
+               }
+               printf( "%-9s %9d %10" PRIu64 " %8" PRIu64 " %11.0f %7.2fx"
+                       " %9" PRIu64 " %9" PRIu64 "\n", names[ domain ],
+                       counts[ index ], completed, failed, rate,
+                       ( ( base > 0.0 ) ? ( rate / base ) : 0.0 ),
+                       fewest, most );
+               fflush( stdout );
+          }
+     }
+
+     printf( "\n" );
+     exit( EXIT_SUCCESS );
+}
+
+/* EOF bench_reuseport.c */
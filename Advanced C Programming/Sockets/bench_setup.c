@@ -0,0 +1,270 @@
+/*
+
+     bench_setup.c
+
+     Measures how long it takes to get a client socket and a server
+     socket connected to each other on this device.  The old way,
+     where a child process created with fork(2) sleeps for a second
+     before calling connect(2), is compared with connect_pair() and
+     with swapping in a spare from a spare_pool for AF_INET, AF_INET6
+     and AF_UNIX stream sockets.
+
+     Every measured setup with the first two includes opening the
+     client socket, connecting it, and accepting the new connection.
+     A spare is connected ahead of time, so only spare_failover() is
+     measured and the pool is refilled between swaps.  The listening
+     socket is opened once per domain and reused, just like it is
+     when setup_sockets() reconnects a broken connection.
+
+     Written by Matthew Campbell.
+
+*/
+
+#include "sockets.h"
+
+/* The ways to get a pair connected. */
+
+#define METHOD_LEGACY 0
+#define METHOD_CONNECT_PAIR 1
+#define METHOD_SPARE 2
+
+static const char *method_names[ 3 ] =
+{
+     "fork+sleep", "connect_pair", "spare_pool"
+};
+
+/* How many pairs to set up with each method. */
+
+#define BENCH_SETUP_PAIRS 2000
+#define BENCH_SETUP_LEGACY_PAIRS 3
+
+/* The AF_UNIX socket file used by this benchmark. */
+
+#define BENCH_SOCK_NAME "bench_setup_socket"
+
+/*
+
+     This is how setup_af_inet(), setup_af_inet6() and
+     setup_af_unix() used to connect a pair on the same device.
+
+*/
+
+static int legacy_pair( const int csock_fd, const int lsock_fd,
+                        const struct sockaddr *addr,
+                        const socklen_t addr_len )
+{
+     int ssock_fd;
+     pid_t pid;
+
+     pid = fork();
+     if ( pid == ( -1 ) )
+     {
+          return ( -1 );
+     }
+     else if ( pid == 0 )  /* Child process */
+     {
+          sleep( 1 );
+          if ( connect( csock_fd, addr, addr_len ) != 0 )
+          {
+               kill( getppid(), SIGALRM );
+               _exit( EXIT_FAILURE );
+          }
+          _exit( EXIT_SUCCESS );
+     }
+
+     ssock_fd = accept( lsock_fd, NULL, NULL );
+     waitpid( pid, NULL, 0 );
+     return ssock_fd;
+}
+
+/* The legacy child process uses SIGALRM to wake us up. */
+
+static void wake_up( int sig_num )
+{
+     return;
+}
+
+/* Set up and tear down pairs, then print a line of results. */
+
+static int time_pairs( const int domain, const char *domain_name,
+                       const int method, const int pairs )
+{
+     int count, csock_fd, lsock_fd, save_errno, ssock_fd;
+     socklen_t addr_len;
+     struct sockaddr_storage addr;
+     struct spare_pool spares;
+     uint64_t start_ns, total_ns, *samples;
+
+     samples = calloc( ( size_t )pairs, sizeof( uint64_t ) );
+     if ( samples == NULL )
+     {
+          errno = ENOMEM;
+          return ( -1 );
+     }
+
+     lsock_fd = open_local_listener( domain, SOCK_STREAM, BENCH_SOCK_NAME,
+                                     &addr, &addr_len );
+     if ( lsock_fd < 0 )
+     {
+          free( samples );
+          return ( -1 );
+     }
+
+     /* The spares copy a working pair, so connect one first. */
+
+     memset( &spares, 0, sizeof( spares ) );
+     if ( method == METHOD_SPARE )
+     {
+          csock_fd = socket( domain, SOCK_STREAM, 0 );
+          ssock_fd = ( -1 );
+          if ( csock_fd >= 0 )
+          {
+               ssock_fd = connect_pair( csock_fd, lsock_fd,
+                                        ( struct sockaddr * )( &addr ),
+                                        addr_len, NULL, NULL );
+          }
+          if ( ssock_fd < 0 ||
+               spare_init( &spares, SPARE_COUNT, csock_fd, lsock_fd,
+                           ssock_fd ) != 0 )
+          {
+               save_errno = errno;
+               if ( ssock_fd >= 0 )
+               {
+                    close( ssock_fd );
+               }
+               if ( csock_fd >= 0 )
+               {
+                    close( csock_fd );
+               }
+               close( lsock_fd );
+               if ( domain == AF_UNIX )
+               {
+                    unlink( BENCH_SOCK_NAME );
+               }
+               free( samples );
+               errno = save_errno;
+               return ( -1 );
+          }
+          close( ssock_fd );
+          close( csock_fd );
+     }
+
+     total_ns = 0;
+     for( count = 0; count < pairs; count++ )
+     {
+          if ( method == METHOD_SPARE )
+          {
+               start_ns = get_time_ns();
+               if ( spare_failover( &spares, &csock_fd, &ssock_fd ) != 0 )
+               {
+                    break;
+               }
+               samples[ count ] = get_time_ns() - start_ns;
+               total_ns += samples[ count ];
+
+               close( ssock_fd );
+               close( csock_fd );
+               spare_refill( &spares );
+               continue;
+          }
+
+          start_ns = get_time_ns();
+
+          csock_fd = socket( domain, SOCK_STREAM, 0 );
+          if ( csock_fd < 0 )
+          {
+               break;
+          }
+          if ( method == METHOD_LEGACY )
+          {
+               ssock_fd = legacy_pair( csock_fd, lsock_fd,
+                                       ( struct sockaddr * )( &addr ),
+                                       addr_len );
+          }
+          else
+          {
+               ssock_fd = connect_pair( csock_fd, lsock_fd,
+                                        ( struct sockaddr * )( &addr ),
+                                        addr_len, NULL, NULL );
+          }
+          if ( ssock_fd < 0 )
+          {
+               close( csock_fd );
+               break;
+          }
+
+          samples[ count ] = get_time_ns() - start_ns;
+          total_ns += samples[ count ];
+
+          close( ssock_fd );
+          close( csock_fd );
+     }
+
+     save_errno = errno;
+     spare_free( &spares );
+     close( lsock_fd );
+     if ( domain == AF_UNIX )
+     {
+          unlink( BENCH_SOCK_NAME );
+     }
+
+     if ( count < pairs )
+     {
+          free( samples );
+          errno = save_errno;
+          return ( -1 );
+     }
+
+     sort_samples( samples, ( uint64_t )pairs );
+
+     printf( "%-9s %-13s %6d %12.1f %12.1f %12.1f\n", domain_name,
+             method_names[ method ], pairs,
+             ( double )total_ns / ( double )pairs / 1000.0,
+             ( double )percentile( samples, pairs, 50 ) / 1000.0,
+             ( double )percentile( samples, pairs, 99 ) / 1000.0 );
+     fflush( stdout );
+
+     free( samples );
+     return 0;
+}
+
+int main( void )
+{
+     int count, method, ret;
+     struct sigaction alrm_new;
+
+     const int domains[ 3 ] = { AF_INET, AF_INET6, AF_UNIX };
+     const char *names[ 3 ] = { "AF_INET", "AF_INET6", "AF_UNIX" };
+
+     /* The legacy child process may send SIGALRM. */
+
+     memset( &alrm_new, 0, sizeof( alrm_new ) );
+     alrm_new.sa_handler = wake_up;
+     sigaction( SIGALRM, &alrm_new, NULL );
+
+     printf( "\nPair setup latency in microseconds:\n\n" );
+     printf( "%-9s %-13s %6s %12s %12s %12s\n", "Domain", "Method",
+             "Pairs", "Mean", "p50", "p99" );
+
+     for( count = 0; count < 3; count++ )
+     {
+          for( method = METHOD_LEGACY; method <= METHOD_SPARE; method++ )
+          {
+               errno = 0;
+               ret = time_pairs( domains[ count ], names[ count ], method,
+                                 ( ( method == METHOD_LEGACY ) ?
+                                   BENCH_SETUP_LEGACY_PAIRS :
+                                   BENCH_SETUP_PAIRS ) );
+               if ( ret != 0 )
+               {
+                    printf( "%-9s %-13s skipped (%s)\n", names[ count ],
+                            method_names[ method ], strerror( errno ) );
+               }
+          }
+     }
+
+     printf( "\n" );
+     exit( EXIT_SUCCESS );
+}
+
+/* EOF bench_setup.c */
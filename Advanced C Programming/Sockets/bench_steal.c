@@ -0,0 +1,509 @@
+/*
+
+     bench_steal.c
+
+     Measures the work-stealing pool in work_pool.c under a skewed
+     load.  BENCH_STEAL_CONNS loopback TCP connections are accepted
+     with accept(2), and the accepting thread reads requests from all
+     of them with epoll(7) and hands each one to the worker that owns
+     its connection.  Each request costs BENCH_STEAL_WORK_US
+     microseconds of CPU time and is answered with a short reply.
+
+     A child process plays the clients.  It picks the connection for
+     each request from a Zipf distribution, so connection 0 gets
+     about a fifth of them and the last one hardly any, and the
+     workers that own the hot connections get far more than their
+     share.  It keeps BENCH_STEAL_WINDOW requests in flight.
+
+     The same run is done once with each worker only running its own
+     requests and once with stealing.  For each this prints the
+     requests per second and, for every worker, the requests it was
+     given, ran and stole, the most that were ever waiting in its
+     deque, and how much of the run it spent busy.  Stealing can only
+     help when there is more than one CPU for the workers to run on.
+
+     Usage: bench_steal [ requests [ workers ] ]
+
+     requests defaults to BENCH_STEAL_REQUESTS, and workers to the
+     number of CPUs this process may use, but at least 2.
+
+     Written by Matthew Campbell.
+
+*/
+
+#include "sockets.h"
+
+#define BENCH_STEAL_REQUESTS 200000
+#define BENCH_STEAL_CONNS 64
+#define BENCH_STEAL_WINDOW 256
+#define BENCH_STEAL_WORK_US 20
+#define BENCH_STEAL_MSG 16
+
+/* One accepted connection. */
+
+struct steal_conn
+{
+     int fd;
+     int index;
+     size_t partial;             /* Bytes of a request read so far. */
+     atomic_uint_fast64_t errors;
+};
+
+/* What the client hands back to the parent. */
+
+struct steal_result
+{
+     int ok;
+     uint64_t replies;
+};
+
+/* Burns BENCH_STEAL_WORK_US of CPU time, then answers. */
+
+static void handle_request( void *arg )
+{
+     char reply[ BENCH_STEAL_MSG ];
+     struct steal_conn *conn;
+     uint64_t end_ns;
+     volatile uint64_t sum;
+
+     conn = ( struct steal_conn * )arg;
+     sum = 0;
+     end_ns = get_time_ns() + ( BENCH_STEAL_WORK_US * 1000ULL );
+     while( get_time_ns() < end_ns )
+     {
+          sum += end_ns;
+     }
+
+     memset( reply, 'r', sizeof( reply ) );
+     if ( send( conn->fd, reply, sizeof( reply ), MSG_NOSIGNAL ) !=
+          ( ssize_t )sizeof( reply ) )
+     {
+          atomic_fetch_add( &( conn->errors ), 1 );
+     }
+     return;
+}
+
+/* Picks connections from a Zipf distribution with an exponent of 1. */
+
+static void build_cdf( double *cdf )
+{
+     double sum;
+     int index;
+
+     sum = 0.0;
+     for( index = 0; index < BENCH_STEAL_CONNS; index++ )
+     {
+          sum += 1.0 / ( double )( index + 1 );
+          cdf[ index ] = sum;
+     }
+     for( index = 0; index < BENCH_STEAL_CONNS; index++ )
+     {
+          cdf[ index ] /= sum;
+     }
+     return;
+}
+
+/* The client side.  This runs in the child process. */
+
+static void run_clients( const int *fds, const uint64_t requests,
+                         struct steal_result *result )
+{
+     char buffer[ 4096 ], request[ BENCH_STEAL_MSG ];
+     double cdf[ BENCH_STEAL_CONNS ], pick;
+     int index, ret;
+     ssize_t num;
+     struct pollfd pfds[ BENCH_STEAL_CONNS ];
+     uint64_t bytes, seed, sent;
+
+     memset( result, 0, sizeof( struct steal_result ) );
+     memset( request, 'q', sizeof( request ) );
+     build_cdf( cdf );
+     for( index = 0; index < BENCH_STEAL_CONNS; index++ )
+     {
+          pfds[ index ].fd = fds[ index ];
+          pfds[ index ].events = POLLIN;
+     }
+
+     seed = 0x2545F4914F6CDD1DULL;
+     sent = 0;
+     bytes = 0;
+     while( result->replies < requests )
+     {
+          while( sent < requests &&
+                 ( sent - result->replies ) < BENCH_STEAL_WINDOW )
+          {
+               seed ^= seed << 13;
+               seed ^= seed >> 7;
+               seed ^= seed << 17;
+               pick = ( double )( seed >> 11 ) / 9007199254740992.0;
+               for( index = 0; index < ( BENCH_STEAL_CONNS - 1 ) &&
+                    pick > cdf[ index ]; index++ )
+               {
+                    ;
+               }
+               if ( send( fds[ index ], request, sizeof( request ),
+                          MSG_NOSIGNAL ) != ( ssize_t )sizeof( request ) )
+               {
+                    return;
+               }
+               sent++;
+          }
+
+          ret = poll( pfds, BENCH_STEAL_CONNS, BENCH_STALL_MS );
+          if ( ret < 0 && errno == EINTR )
+          {
+               continue;
+          }
+          if ( ret <= 0 )
+          {
+               return;
+          }
+          for( index = 0; index < BENCH_STEAL_CONNS; index++ )
+          {
+               if ( pfds[ index ].revents == 0 )
+               {
+                    continue;
+               }
+               num = recv( fds[ index ], buffer, sizeof( buffer ),
+                           MSG_DONTWAIT );
+               if ( num == 0 ||
+                    ( num < 0 && errno != EAGAIN && errno != EINTR ) )
+               {
+                    return;
+               }
+               if ( num > 0 )
+               {
+                    bytes += ( uint64_t )num;
+                    result->replies = bytes / BENCH_STEAL_MSG;
+               }
+          }
+     }
+     result->ok = 1;
+     return;
+}
+
+/*
+
+     Runs one benchmark.  Returns 0 with the elapsed time in
+     *elapsed_ns and every worker's counters in stats, or -1 if an
+     error occurs.
+
+*/
+
+static int bench_pool( const int workers, const int steal,
+                       const uint64_t requests, uint64_t *elapsed_ns,
+                       struct wp_stats *stats )
+{
+     char buffer[ 4096 ];
+     int client_fds[ BENCH_STEAL_CONNS ], done_fd[ 2 ], epoll_fd, index;
+     int lsock_fd, num, ready, save_errno;
+     pid_t pid;
+     socklen_t addr_len;
+     ssize_t len;
+     struct epoll_event event, events[ EPOLL_MAX_EVENTS ];
+     struct sockaddr_storage addr;
+     struct steal_conn conns[ BENCH_STEAL_CONNS ], *conn;
+     struct steal_result result;
+     struct work_pool pool;
+     uint64_t start_ns, submitted;
+
+     lsock_fd = open_local_listener( AF_INET, SOCK_STREAM, NULL, &addr,
+                                     &addr_len );
+     if ( lsock_fd < 0 )
+     {
+          return ( -1 );
+     }
+
+     /* Connect every client, then accept them all. */
+
+     for( index = 0; index < BENCH_STEAL_CONNS; index++ )
+     {
+          client_fds[ index ] = socket( AF_INET, SOCK_STREAM, 0 );
+          if ( client_fds[ index ] < 0 ||
+               connect( client_fds[ index ], ( struct sockaddr * )( &addr ),
+                        addr_len ) != 0 )
+          {
+               break;
+          }
+     }
+     ready = index;
+     for( index = 0; index < ready; index++ )
+     {
+          conns[ index ].fd = accept4( lsock_fd, NULL, NULL, SOCK_NONBLOCK );
+          if ( conns[ index ].fd < 0 )
+          {
+               break;
+          }
+          conns[ index ].index = index;
+          conns[ index ].partial = 0;
+          atomic_init( &( conns[ index ].errors ), 0 );
+     }
+     save_errno = errno;
+     close( lsock_fd );
+     if ( ready < BENCH_STEAL_CONNS || index < ready )
+     {
+          while( index > 0 )
+          {
+               close( conns[ --index ].fd );
+          }
+          for( index = 0; index <= ready && index < BENCH_STEAL_CONNS;
+               index++ )
+          {
+               if ( client_fds[ index ] >= 0 )
+               {
+                    close( client_fds[ index ] );
+               }
+          }
+          errno = save_errno;
+          return ( -1 );
+     }
+
+     epoll_fd = epoll_create1( 0 );
+     if ( epoll_fd < 0 || pipe( done_fd ) != 0 )
+     {
+          save_errno = errno;
+          if ( epoll_fd >= 0 )
+          {
+               close( epoll_fd );
+          }
+          for( index = 0; index < BENCH_STEAL_CONNS; index++ )
+          {
+               close( conns[ index ].fd );
+               close( client_fds[ index ] );
+          }
+          errno = save_errno;
+          return ( -1 );
+     }
+     for( index = 0; index < BENCH_STEAL_CONNS; index++ )
+     {
+          event.events = EPOLLIN;
+          event.data.ptr = &( conns[ index ] );
+          epoll_ctl( epoll_fd, EPOLL_CTL_ADD, conns[ index ].fd, &event );
+     }
+
+     fflush( stdout );  /* Don't let the child repeat our output. */
+
+     pid = fork();
+     if ( pid == ( -1 ) )
+     {
+          save_errno = errno;
+          close( done_fd[ 0 ] );
+          close( done_fd[ 1 ] );
+          close( epoll_fd );
+          for( index = 0; index < BENCH_STEAL_CONNS; index++ )
+          {
+               close( conns[ index ].fd );
+               close( client_fds[ index ] );
+          }
+          errno = save_errno;
+          return ( -1 );
+     }
+     else if ( pid == 0 )  /* Child process */
+     {
+          close( done_fd[ 0 ] );
+          close( epoll_fd );
+          for( index = 0; index < BENCH_STEAL_CONNS; index++ )
+          {
+               close( conns[ index ].fd );
+          }
+          run_clients( client_fds, requests, &result );
+          len = write( done_fd[ 1 ], &result, sizeof( result ) );
+          close( done_fd[ 1 ] );
+          _exit( ( len == ( ssize_t )sizeof( result ) && result.ok ) ?
+                 EXIT_SUCCESS : EXIT_FAILURE );
+     }
+
+     /* Parent process, pid > 0 */
+
+     close( done_fd[ 1 ] );
+     for( index = 0; index < BENCH_STEAL_CONNS; index++ )
+     {
+          close( client_fds[ index ] );
+     }
+
+     save_errno = 0;
+     memset( &pool, 0, sizeof( pool ) );
+     if ( wp_start( &pool, workers, steal ) != 0 )
+     {
+          save_errno = errno;
+          kill( pid, SIGTERM );
+     }
+
+     /* The accepting thread reads requests and hands them out. */
+
+     start_ns = get_time_ns();
+     submitted = 0;
+     while( save_errno == 0 && submitted < requests )
+     {
+          ready = epoll_wait( epoll_fd, events, EPOLL_MAX_EVENTS,
+                              BENCH_STALL_MS );
+          if ( ready < 0 && errno == EINTR )
+          {
+               continue;
+          }
+          if ( ready <= 0 )
+          {
+               save_errno = ( ( ready == 0 ) ? ETIMEDOUT : errno );
+               break;
+          }
+          for( index = 0; index < ready; index++ )
+          {
+               conn = ( struct steal_conn * )events[ index ].data.ptr;
+               len = recv( conn->fd, buffer, sizeof( buffer ), 0 );
+               if ( len <= 0 )
+               {
+                    if ( len < 0 && ( errno == EAGAIN || errno == EINTR ) )
+                    {
+                         continue;
+                    }
+                    save_errno = ( ( len == 0 ) ? ECONNRESET : errno );
+                    break;
+               }
+               conn->partial += ( size_t )len;
+               for( num = ( int )( conn->partial / BENCH_STEAL_MSG );
+                    num > 0; num-- )
+               {
+                    while( wp_submit( &pool, conn->index, handle_request,
+                                      conn ) != 0 )
+                    {
+                         sched_yield();  /* Its deque is full. */
+                    }
+                    submitted++;
+               }
+               conn->partial %= BENCH_STEAL_MSG;
+          }
+     }
+
+     /* Wait for the client to get every reply. */
+
+     memset( &result, 0, sizeof( result ) );
+     if ( save_errno == 0 )
+     {
+          do
+          {
+               len = read( done_fd[ 0 ], &result, sizeof( result ) );
+          }    while( len < 0 && errno == EINTR );
+          *elapsed_ns = get_time_ns() - start_ns;
+          if ( len != ( ssize_t )sizeof( result ) || result.ok == 0 )
+          {
+               save_errno = EIO;
+          }
+     }
+     else
+     {
+          kill( pid, SIGTERM );
+     }
+
+     if ( pool.workers != NULL )
+     {
+          wp_wait( &pool );
+          for( index = 0; index < workers; index++ )
+          {
+               wp_get_stats( &pool, index, &( stats[ index ] ) );
+          }
+          wp_stop( &pool );
+     }
+     for( index = 0; index < BENCH_STEAL_CONNS; index++ )
+     {
+          if ( atomic_load( &( conns[ index ].errors ) ) > 0 &&
+               save_errno == 0 )
+          {
+               save_errno = EIO;
+          }
+          close( conns[ index ].fd );
+     }
+     close( done_fd[ 0 ] );
+     close( epoll_fd );
+     waitpid( pid, NULL, 0 );
+
+     if ( save_errno != 0 )
+     {
+          errno = save_errno;
+          return ( -1 );
+     }
+     return 0;
+}
+
+int main( int argc, char **argv )
+{
+     cpu_set_t allowed;
+     double busy, rate;
+     int index, mode;
+     long long requests, workers;
+     struct wp_stats stats[ WP_MAX_WORKERS ];
+     uint64_t elapsed_ns, stolen;
+
+     const char *modes[ 2 ] = { "Owner only", "Stealing" };
+
+     workers = 1;
+     if ( sched_getaffinity( 0, sizeof( allowed ), &allowed ) == 0 )
+     {
+          workers = CPU_COUNT( &allowed );
+     }
+     if ( workers < 2 )
+     {
+          workers = 2;
+     }
+     if ( workers > WP_MAX_WORKERS )
+     {
+          workers = WP_MAX_WORKERS;
+     }
+
+     requests = BENCH_STEAL_REQUESTS;
+     if ( ( argc > 1 && ( sscanf( argv[ 1 ], "%lld", &requests ) != 1 ||
+                          requests < 1 ) ) ||
+          ( argc > 2 && ( sscanf( argv[ 2 ], "%lld", &workers ) != 1 ||
+                          workers < 1 || workers > WP_MAX_WORKERS ) ) )
+     {
+          printf( "\nUsage: %s [ requests [ workers ] ]\n\n", argv[ 0 ] );
+          exit( EXIT_FAILURE );
+     }
+
+     printf( "\n\
+%lld requests of %d us each over %d connections, %lld workers:\n",
+             requests, BENCH_STEAL_WORK_US, BENCH_STEAL_CONNS, workers );
+
+     for( mode = 0; mode < 2; mode++ )
+     {
+          memset( stats, 0, sizeof( stats ) );
+          if ( bench_pool( ( int )workers, mode, ( uint64_t )requests,
+                           &elapsed_ns, stats ) != 0 )
+          {
+               printf( "\n%s: failed (%s)\n", modes[ mode ],
+                       strerror( errno ) );
+               continue;
+          }
+
+          rate = ( double )requests / ( ( double )elapsed_ns / 1e9 );
+          stolen = 0;
+          for( index = 0; index < workers; index++ )
+          {
+               stolen += stats[ index ].stolen;
+          }
+          printf( "\n%s: %.0f requests/sec, %.3f seconds, %" PRIu64
+                  " stolen\n\n", modes[ mode ], rate,
+                  ( double )elapsed_ns / 1e9, stolen );
+          printf( "%6s %10s %10s %10s %10s %9s %6s\n", "Worker", "Given",
+                  "Ran", "Stolen", "Misses", "Max depth", "Busy" );
+          for( index = 0; index < workers; index++ )
+          {
+               busy = 0.0;
+               if ( stats[ index ].elapsed_ns > 0 )
+               {
+                    busy = 100.0 * ( double )stats[ index ].busy_ns /
+                           ( double )stats[ index ].elapsed_ns;
+               }
+               printf( "%6d %10" PRIu64 " %10" PRIu64 " %10" PRIu64
+                       " %10" PRIu64 " %9" PRIu64 " %5.1f%%\n", index,
+                       stats[ index ].submitted, stats[ index ].executed,
+                       stats[ index ].stolen, stats[ index ].steal_misses,
+                       stats[ index ].max_depth, busy );
+          }
+          fflush( stdout );
+     }
+
+     printf( "\n" );
+     exit( EXIT_SUCCESS );
+}
+
+/* EOF bench_steal.c */
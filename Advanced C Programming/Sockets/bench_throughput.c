@@ -0,0 +1,181 @@
+/*
+
+     bench_throughput.c
+
+     Measures how fast bulk data moves over a connected pair for
+     every domain and socket type this program can set up on one
+     device: AF_UNIX stream, datagram and sequenced packet, the
+     shared memory ring, and AF_INET and AF_INET6 stream and
+     datagram.  Each combination is
+     run once for each message size with run_throughput().
+
+     Usage: bench_throughput [ megabytes [ message_size ... ] ]
+
+     megabytes is how much data to send in each run and defaults to
+     BENCH_THROUGHPUT_MB.  Any message sizes given replace the default
+     list.  Datagram sizes larger than a UDP datagram can carry are
+     skipped.
+
+     Written by Matthew Campbell.
+
+*/
+
+#include "sockets.h"
+
+#define BENCH_THROUGHPUT_MB 64
+
+/* The AF_UNIX socket file used by this benchmark. */
+
+#define BENCH_SOCK_NAME "bench_throughput_socket"
+
+/* Every combination to measure. */
+
+struct combination
+{
+     int domain;
+     int sock_type;
+     const char *domain_name;
+     const char *type_name;
+};
+
+static const struct combination combinations[] =
+{
+     { AF_UNIX,  SOCK_STREAM,    "AF_UNIX",  "stream"    },
+     { AF_UNIX,  SOCK_DGRAM,     "AF_UNIX",  "dgram"     },
+     { AF_UNIX,  SOCK_SEQPACKET, "AF_UNIX",  "seqpacket" },
+     { AF_UNIX,  SOCK_SHM_RING,  "memfd",    "shm ring"  },
+     { AF_INET,  SOCK_STREAM,    "AF_INET",  "stream"    },
+     { AF_INET,  SOCK_DGRAM,     "AF_INET",  "dgram"     },
+     { AF_INET6, SOCK_STREAM,    "AF_INET6", "stream"    },
+     { AF_INET6, SOCK_DGRAM,     "AF_INET6", "dgram"     }
+};
+
+#define NUM_COMBINATIONS \
+     ( sizeof( combinations ) / sizeof( combinations[ 0 ] ) )
+
+static const size_t default_sizes[] = { 64, 1024, 16384, 65536 };
+
+#define NUM_DEFAULT_SIZES \
+     ( sizeof( default_sizes ) / sizeof( default_sizes[ 0 ] ) )
+
+/* Runs one combination with one message size and prints a line. */
+
+static void bench_one( const struct combination *combo,
+                       const size_t msg_size, const uint64_t total_bytes )
+{
+     double loss, seconds;
+     int csock_fd, ret, save_errno, ssock_fd;
+     struct throughput_stats stats;
+
+     printf( "%-9s %-10s %7zu ", combo->domain_name, combo->type_name,
+             msg_size );
+
+     if ( combo->sock_type == SOCK_DGRAM && msg_size > BENCH_MAX_DGRAM )
+     {
+          printf( "skipped (larger than a datagram can be)\n" );
+          return;
+     }
+
+     if ( open_local_pair( combo->domain, combo->sock_type,
+                           BENCH_SOCK_NAME, &csock_fd, &ssock_fd ) != 0 )
+     {
+          printf( "skipped (%s)\n", strerror( errno ) );
+          return;
+     }
+
+     ret = run_throughput( csock_fd, ssock_fd, combo->sock_type, msg_size,
+                           1, total_bytes, &stats );
+     save_errno = errno;
+     close( csock_fd );
+     close( ssock_fd );
+
+     if ( ret != 0 )
+     {
+          printf( "failed (%s)\n", strerror( save_errno ) );
+          return;
+     }
+
+     seconds = ( double )stats.elapsed_ns / 1e9;
+     loss = 0.0;
+     if ( stats.bytes_sent > stats.bytes_received )
+     {
+          loss = 100.0 * ( double )( stats.bytes_sent -
+                                     stats.bytes_received ) /
+                 ( double )stats.bytes_sent;
+     }
+
+     printf( "%8.3f %11.0f %9.3f %9.3f %6.2f\n",
+             ( double )stats.bytes_received / seconds / 1e9,
+             ( double )stats.msgs_received / seconds,
+             ( double )stats.send_cpu_ns / 1e9,
+             ( double )stats.recv_cpu_ns / 1e9, loss );
+     fflush( stdout );
+     return;
+}
+
+int main( int argc, char **argv )
+{
+     int count, index, num_sizes;
+     long long value;
+     size_t *sizes;
+     uint64_t total_bytes;
+
+     total_bytes = ( uint64_t )BENCH_THROUGHPUT_MB * 1048576ULL;
+     if ( argc > 1 )
+     {
+          if ( sscanf( argv[ 1 ], "%lld", &value ) != 1 || value < 1 )
+          {
+               printf( "\nUsage: %s [ megabytes [ message_size ... ] ]\n\n",
+                       argv[ 0 ] );
+               exit( EXIT_FAILURE );
+          }
+          total_bytes = ( uint64_t )value * 1048576ULL;
+     }
+
+     num_sizes = ( ( argc > 2 ) ? ( argc - 2 ) : ( int )NUM_DEFAULT_SIZES );
+     sizes = calloc( ( size_t )num_sizes, sizeof( size_t ) );
+     if ( sizes == NULL )
+     {
+          printf( "\nOut of memory.\n\n" );
+          exit( EXIT_FAILURE );
+     }
+     for( index = 0; index < num_sizes; index++ )
+     {
+          if ( argc > 2 )
+          {
+               if ( sscanf( argv[ index + 2 ], "%lld", &value ) != 1 ||
+                    value < 1 || value > BENCH_MAX_MESSAGE )
+               {
+                    printf( "\n\
+Message sizes must be from 1 to %d bytes.\n\n", BENCH_MAX_MESSAGE );
+                    free( sizes );
+                    exit( EXIT_FAILURE );
+               }
+               sizes[ index ] = ( size_t )value;
+          }
+          else
+          {
+               sizes[ index ] = default_sizes[ index ];
+          }
+     }
+
+     printf( "\nThroughput with %" PRIu64 " megabytes per run:\n\n",
+             ( uint64_t )( total_bytes / 1048576ULL ) );
+     printf( "%-9s %-10s %7s %8s %11s %9s %9s %6s\n", "Domain", "Type",
+             "Size", "GB/s", "Msgs/sec", "Send CPU", "Recv CPU", "Loss%" );
+
+     for( count = 0; count < ( int )NUM_COMBINATIONS; count++ )
+     {
+          for( index = 0; index < num_sizes; index++ )
+          {
+               bench_one( &( combinations[ count ] ), sizes[ index ],
+                          total_bytes );
+          }
+     }
+
+     printf( "\nCPU times are in seconds.\n\n" );
+     free( sizes );
+     exit( EXIT_SUCCESS );
+}
+
+/* EOF bench_throughput.c */
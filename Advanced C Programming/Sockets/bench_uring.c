@@ -0,0 +1,352 @@
+/*
+
+     bench_uring.c
+
+     Compares the epoll and io_uring engines of the multi-connection
+     server.  For each of AF_INET, AF_INET6 and AF_UNIX a client
+     process opens BENCH_URING_CONNS stream connections to the server
+     and keeps BENCH_URING_WINDOW messages in flight on each one until
+     BENCH_URING_MESSAGES have been echoed back.  The client connects
+     with uring_connect_all() when the server is using io_uring and
+     with connect(2) otherwise.
+
+     For each run this prints the messages per second, the server's
+     CPU time per message, the combined CPU time of the server and the
+     client per message, and the number of system calls the server's
+     event loop made per message.
+
+     Written by Matthew Campbell.
+
+*/
+
+#include "sockets.h"
+
+#define BENCH_URING_CONNS 64
+#define BENCH_URING_MESSAGES 4000   /* Per connection. */
+#define BENCH_URING_WINDOW 8
+#define BENCH_URING_TIMEOUT 60000   /* In milliseconds. */
+
+/* The AF_UNIX socket file used by this benchmark. */
+
+#define BENCH_SOCK_NAME "bench_uring_socket"
+
+/* What the client hands back to the parent. */
+
+struct client_result
+{
+     int ok;
+     uint64_t messages;
+     uint64_t elapsed_ns;
+};
+
+/* The client's view of the whole run. */
+
+struct client_run
+{
+     int finished;
+     int failed;
+     volatile int done;
+};
+
+/* One client connection. */
+
+struct client_peer
+{
+     struct client_run *run;
+     uint64_t sent;
+     uint64_t received;  /* Bytes, not messages. */
+};
+
+static const char message[ EPOLL_MESSAGE_SIZE ] = "bench_uring";
+
+/* Counts echoed messages and keeps the window full. */
+
+static int peer_read( struct nb_conn *conn, const char *data,
+                      const size_t len )
+{
+     struct client_peer *peer;
+     uint64_t completed;
+
+     peer = ( struct client_peer * )conn->user;
+     if ( len == 0 )
+     {
+          peer->run->failed++;
+          peer->run->finished++;
+          if ( peer->run->finished == BENCH_URING_CONNS )
+          {
+               peer->run->done = 1;
+          }
+          return 1;
+     }
+
+     peer->received += len;
+     completed = peer->received / EPOLL_MESSAGE_SIZE;
+     while( peer->sent < BENCH_URING_MESSAGES &&
+            ( peer->sent - completed ) < BENCH_URING_WINDOW )
+     {
+          if ( nb_queue_send( conn, message, EPOLL_MESSAGE_SIZE ) != 0 )
+          {
+               return 1;
+          }
+          peer->sent++;
+     }
+
+     if ( completed == BENCH_URING_MESSAGES )
+     {
+          peer->run->finished++;
+          if ( peer->run->finished == BENCH_URING_CONNS )
+          {
+               peer->run->done = 1;
+          }
+     }
+     return 0;
+}
+
+/* The client side of a run.  This runs in the child process. */
+
+static void run_client( const int domain, const int engine,
+                        const struct sockaddr *target,
+                        const socklen_t target_len,
+                        struct client_result *result )
+{
+     int count, connected, fds[ BENCH_URING_CONNS ];
+     struct client_peer peers[ BENCH_URING_CONNS ];
+     struct client_run run;
+     struct nb_conn conns[ BENCH_URING_CONNS ];
+     struct nb_conn *list[ BENCH_URING_CONNS ];
+     uint64_t start_ns;
+
+     memset( result, 0, sizeof( struct client_result ) );
+     memset( &run, 0, sizeof( run ) );
+
+     for( count = 0; count < BENCH_URING_CONNS; count++ )
+     {
+          fds[ count ] = socket( domain, SOCK_STREAM, 0 );
+          if ( fds[ count ] < 0 )
+          {
+               break;
+          }
+     }
+     if ( count < BENCH_URING_CONNS )
+     {
+          while( count > 0 )
+          {
+               close( fds[ --count ] );
+          }
+          return;
+     }
+
+     start_ns = get_time_ns();
+
+     if ( engine == ENGINE_IO_URING )
+     {
+          connected = uring_connect_all( fds, BENCH_URING_CONNS, target,
+                                         target_len );
+     }
+     else
+     {
+          connected = 0;
+          for( count = 0; count < BENCH_URING_CONNS; count++ )
+          {
+               if ( connect( fds[ count ], target, target_len ) == 0 )
+               {
+                    connected++;
+               }
+          }
+     }
+
+     if ( connected == BENCH_URING_CONNS )
+     {
+          for( count = 0; count < BENCH_URING_CONNS; count++ )
+          {
+               peers[ count ].run = &run;
+               peers[ count ].sent = 0;
+               peers[ count ].received = 0;
+               nb_conn_init( &( conns[ count ] ), fds[ count ], peer_read,
+                             &( peers[ count ] ) );
+               list[ count ] = &( conns[ count ] );
+               while( peers[ count ].sent < BENCH_URING_WINDOW )
+               {
+                    nb_queue_send( &( conns[ count ] ), message,
+                                   EPOLL_MESSAGE_SIZE );
+                    peers[ count ].sent++;
+               }
+          }
+
+          if ( run_io_loop( list, BENCH_URING_CONNS, BENCH_URING_TIMEOUT,
+                            &( run.done ) ) == 0 &&
+               run.done == 1 && run.failed == 0 )
+          {
+               result->ok = 1;
+          }
+          result->elapsed_ns = get_time_ns() - start_ns;
+          for( count = 0; count < BENCH_URING_CONNS; count++ )
+          {
+               result->messages += peers[ count ].received /
+                                   EPOLL_MESSAGE_SIZE;
+               nb_conn_free( &( conns[ count ] ) );
+          }
+     }
+
+     for( count = 0; count < BENCH_URING_CONNS; count++ )
+     {
+          close( fds[ count ] );
+     }
+     return;
+}
+
+/* Runs one domain on one engine and prints a line of results. */
+
+static int bench_engine( const int domain, const char *domain_name,
+                         const int engine )
+{
+     double msgs;
+     int ctl_fd[ 2 ], lsock_fd, ret, save_errno;
+     pid_t pid;
+     socklen_t addr_len;
+     ssize_t len;
+     struct client_result result;
+     struct server_stats stats;
+     struct sockaddr_storage addr;
+     uint64_t child_before, self_before, server_cpu, total_cpu;
+
+     lsock_fd = open_local_listener( domain, SOCK_STREAM, BENCH_SOCK_NAME,
+                                     &addr, &addr_len );
+     if ( lsock_fd < 0 )
+     {
+          return ( -1 );
+     }
+     if ( pipe( ctl_fd ) != 0 )
+     {
+          save_errno = errno;
+          close( lsock_fd );
+          errno = save_errno;
+          return ( -1 );
+     }
+
+     self_before = get_cpu_ns( RUSAGE_SELF );
+     child_before = get_cpu_ns( RUSAGE_CHILDREN );
+
+     fflush( stdout );
+     pid = fork();
+     if ( pid == ( -1 ) )
+     {
+          save_errno = errno;
+          close( ctl_fd[ 0 ] );
+          close( ctl_fd[ 1 ] );
+          close( lsock_fd );
+          errno = save_errno;
+          return ( -1 );
+     }
+     else if ( pid == 0 )  /* Child process */
+     {
+          close( ctl_fd[ 0 ] );
+          close( lsock_fd );
+          run_client( domain, engine, ( struct sockaddr * )( &addr ),
+                      addr_len, &result );
+          len = write( ctl_fd[ 1 ], &result, sizeof( result ) );
+          close( ctl_fd[ 1 ] );
+          _exit( ( len == ( ssize_t )sizeof( result ) ) ?
+                 EXIT_SUCCESS : EXIT_FAILURE );
+     }
+
+     /* Parent process, pid > 0 */
+
+     close( ctl_fd[ 1 ] );
+
+     if ( engine == ENGINE_IO_URING )
+     {
+          ret = run_uring_server( lsock_fd, ctl_fd[ 0 ], &stats );
+     }
+     else
+     {
+          ret = run_epoll_server( lsock_fd, ctl_fd[ 0 ], &stats );
+     }
+     save_errno = errno;
+     server_cpu = get_cpu_ns( RUSAGE_SELF ) - self_before;
+
+     if ( ret != 0 )
+     {
+          kill( pid, SIGTERM );
+     }
+
+     memset( &result, 0, sizeof( result ) );
+     len = read( ctl_fd[ 0 ], &result, sizeof( result ) );
+     close( ctl_fd[ 0 ] );
+     close( lsock_fd );
+     waitpid( pid, NULL, 0 );
+     total_cpu = server_cpu + ( get_cpu_ns( RUSAGE_CHILDREN ) -
+                                child_before );
+     if ( domain == AF_UNIX )
+     {
+          unlink( BENCH_SOCK_NAME );
+     }
+
+     if ( ret != 0 )
+     {
+          errno = save_errno;
+          return ( -1 );
+     }
+     if ( len != ( ssize_t )sizeof( result ) || result.ok == 0 ||
+          result.messages == 0 )
+     {
+          errno = EIO;
+          return ( -1 );
+     }
+
+     msgs = ( double )result.messages;
+
+     printf( "%-9s %-9s %10.0f %12.2f %12.2f %10.3f\n", domain_name,
+             ( ( engine == ENGINE_IO_URING ) ? "io_uring" : "epoll" ),
+             msgs / ( ( double )result.elapsed_ns / 1e9 ),
+             ( double )server_cpu / msgs / 1000.0,
+             ( double )total_cpu / msgs / 1000.0,
+             ( double )stats.syscalls / msgs );
+     fflush( stdout );
+     return 0;
+}
+
+int main( void )
+{
+     int count, engine, have_uring, ret;
+
+     const int domains[ 3 ] = { AF_INET, AF_INET6, AF_UNIX };
+     const char *names[ 3 ] = { "AF_INET", "AF_INET6", "AF_UNIX" };
+
+     have_uring = uring_available();
+
+     printf( "\n\
+%d connections, %d messages of %d bytes each, %d in flight:\n\n",
+             BENCH_URING_CONNS, BENCH_URING_MESSAGES, EPOLL_MESSAGE_SIZE,
+             BENCH_URING_WINDOW );
+     printf( "%-9s %-9s %10s %12s %12s %10s\n", "Domain", "Engine",
+             "Msgs/sec", "Server us/m", "Total us/m", "Sys/msg" );
+
+     for( count = 0; count < 3; count++ )
+     {
+          for( engine = ENGINE_EPOLL; engine <= ENGINE_IO_URING; engine++ )
+          {
+               if ( engine == ENGINE_IO_URING && have_uring == 0 )
+               {
+                    printf( "%-9s %-9s not available on this system\n",
+                            names[ count ], "io_uring" );
+                    continue;
+               }
+               errno = 0;
+               ret = bench_engine( domains[ count ], names[ count ],
+                                   engine );
+               if ( ret != 0 )
+               {
+                    printf( "%-9s %-9s skipped (%s)\n", names[ count ],
+                            ( ( engine == ENGINE_IO_URING ) ? "io_uring" :
+                                                              "epoll" ),
+                            strerror( errno ) );
+               }
+          }
+     }
+
+     printf( "\n" );
+     exit( EXIT_SUCCESS );
+}
+
+/* EOF bench_uring.c */
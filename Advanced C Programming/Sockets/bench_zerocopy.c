@@ -0,0 +1,113 @@
+/*
+
+     bench_zerocopy.c
+
+     Compares the CPU time it takes to send bulk data over a stream
+     connection with write(2), with MSG_ZEROCOPY, with sendfile(2)
+     and with splice(2), using run_bulk_send(), for AF_UNIX, AF_INET
+     and AF_INET6.  AF_UNIX doesn't support MSG_ZEROCOPY.
+
+     On one device the kernel copies zero-copy data when it is
+     delivered to the receiving socket, which the Copied column shows,
+     so the numbers here are a lower bound on what MSG_ZEROCOPY saves
+     when the receiver is on the other end of a real network.
+
+     Usage: bench_zerocopy [ megabytes ]
+
+     megabytes is how much each method sends and defaults to
+     BENCH_BULK_MB.
+
+     Written by Matthew Campbell.
+
+*/
+
+#include "sockets.h"
+
+#define BENCH_BULK_MB 1024
+
+/* The AF_UNIX socket file used by this benchmark. */
+
+#define BENCH_SOCK_NAME "bench_zerocopy_socket"
+
+static const char *method_names[] =
+{
+     "", "write", "zerocopy", "sendfile", "splice"
+};
+
+int main( int argc, char **argv )
+{
+     double gigabytes, seconds;
+     int count, csock_fd, method, ret, save_errno, ssock_fd;
+     long long megabytes;
+     struct bulk_stats stats;
+
+     const int domains[ 3 ] = { AF_UNIX, AF_INET, AF_INET6 };
+     const char *names[ 3 ] = { "AF_UNIX", "AF_INET", "AF_INET6" };
+
+     megabytes = BENCH_BULK_MB;
+     if ( argc > 1 && ( sscanf( argv[ 1 ], "%lld", &megabytes ) != 1 ||
+                        megabytes < 1 ) )
+     {
+          printf( "\nUsage: %s [ megabytes ]\n\n", argv[ 0 ] );
+          exit( EXIT_FAILURE );
+     }
+
+     printf( "\nBulk stream sends of %lld megabytes:\n\n", megabytes );
+     printf( "%-9s %-9s %8s %12s %12s %10s %8s\n", "Domain", "Method",
+             "GB/s", "Send ms/GB", "Recv ms/GB", "Calls", "Copied" );
+
+     for( count = 0; count < 3; count++ )
+     {
+          for( method = BULK_WRITE; method <= BULK_SPLICE; method++ )
+          {
+               printf( "%-9s %-9s ", names[ count ],
+                       method_names[ method ] );
+               fflush( stdout );
+
+               if ( open_local_pair( domains[ count ], SOCK_STREAM,
+                                     BENCH_SOCK_NAME, &csock_fd,
+                                     &ssock_fd ) != 0 )
+               {
+                    printf( "skipped (%s)\n", strerror( errno ) );
+                    continue;
+               }
+
+               ret = run_bulk_send( csock_fd, ssock_fd, method,
+                                    ( uint64_t )megabytes * 1048576ULL,
+                                    &stats );
+               save_errno = errno;
+               close( csock_fd );
+               close( ssock_fd );
+
+               if ( ret != 0 )
+               {
+                    printf( "%s\n", ( ( save_errno == EOPNOTSUPP ) ?
+                                      "not supported" :
+                                      strerror( save_errno ) ) );
+                    continue;
+               }
+
+               gigabytes = ( double )stats.bytes_sent / 1e9;
+               seconds = ( double )stats.elapsed_ns / 1e9;
+               printf( "%8.3f %12.1f %12.1f %10" PRIu64,
+                       gigabytes / seconds,
+                       ( double )stats.send_cpu_ns / 1e6 / gigabytes,
+                       ( double )stats.recv_cpu_ns / 1e6 / gigabytes,
+                       stats.send_calls );
+               if ( stats.zc_completions > 0 )
+               {
+                    printf( " %7.1f%%", 100.0 * ( double )stats.zc_copied /
+                                        ( double )stats.zc_completions );
+               }
+               printf( "\n" );
+               fflush( stdout );
+          }
+     }
+
+     printf( "\n\
+CPU time is in milliseconds per gigabyte.  Copied is how many\n\
+zero-copy sends the kernel ended up copying anyway.\n\n" );
+     exit( EXIT_SUCCESS );
+}
+
+/* EOF bench_zerocopy.c */
@@ -0,0 +1,46 @@
+/*
+
+     calibrate_clock.c
+
+     This function measures how long it takes to read the clock with
+     get_time_ns().  Every timed interval includes the cost of one
+     clock read, so the latency benchmark subtracts this from each
+     sample.  The median of CLOCK_CALIBRATION_SAMPLES back to back
+     reads is used so a stray interruption doesn't throw it off.
+
+     Returns the overhead in nanoseconds.
+
+     Written by Matthew Campbell.
+
+*/
+
+#ifndef _CALIBRATE_CLOCK_C
+#define _CALIBRATE_CLOCK_C
+
+#include "sockets.h"
+
+uint64_t calibrate_clock( void )
+{
+     int count;
+     uint64_t first, samples[ CLOCK_CALIBRATION_SAMPLES ];
+
+     /* Warm up the clock and the cache first. */
+
+     for( count = 0; count < CLOCK_CALIBRATION_SAMPLES; count++ )
+     {
+          get_time_ns();
+     }
+
+     for( count = 0; count < CLOCK_CALIBRATION_SAMPLES; count++ )
+     {
+          first = get_time_ns();
+          samples[ count ] = get_time_ns() - first;
+     }
+
+     sort_samples( samples, CLOCK_CALIBRATION_SAMPLES );
+     return percentile( samples, CLOCK_CALIBRATION_SAMPLES, 50 );
+}
+
+#endif  /* _CALIBRATE_CLOCK_C */
+
+/* EOF calibrate_clock.c */
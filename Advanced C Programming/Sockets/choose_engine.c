@@ -0,0 +1,101 @@
+/*
+
+     choose_engine.c
+
+     This function asks which event engine the multi-connection
+     server should use: epoll(7) in one process, io_uring(7), a
+     prefork acceptor handing connections to worker processes that
+     each run epoll, or epoll handing each connection's requests to a
+     pool of threads that steal work from each other.  io_uring is
+     only accepted when the kernel supports everything the engine
+     needs.
+
+     Returns ENGINE_EPOLL, ENGINE_IO_URING, ENGINE_PREFORK or
+     ENGINE_THREADS, or -1 if an error occurs.
+
+     Written by Matthew Campbell.
+
+*/
+
+#ifndef _CHOOSE_ENGINE_C
+#define _CHOOSE_ENGINE_C
+
+#include "sockets.h"
+
+/* The names a configuration can use for each engine, in order. */
+
+static const char * const engine_names[] =
+{
+     "epoll", "io_uring", "prefork", "threads"
+};
+
+int choose_engine( void )
+{
+     char buffer[ 32 ];
+     int engine, num, ret, save_errno, uring;
+
+     uring = uring_available();
+     engine = 0;
+     do
+     {
+          printf( "\nWhich event engine should the server use?\n\n" );
+          printf( "1) epoll\n" );
+          printf( "2) io_uring%s\n", ( ( uring == 1 ) ? "" :
+                                       " (not available here)" ) );
+          printf( "3) prefork workers\n" );
+          printf( "4) epoll with work-stealing threads\n\n" );
+          errno = 0;
+          ret = read_answer( "engine", engine_names, 4, buffer, 32 );
+          if ( ret != 0 )
+          {
+               save_errno = errno;
+               printf( "\n\
+Something went wrong while reading your input.\n" );
+               if ( save_errno != 0 )
+               {
+                    printf( "Error: %s.\n", strerror( save_errno ) );
+               }
+               printf( "\n" );
+               errno = 0;  /* Don't show the same error twice. */
+               return ( -1 );
+          }
+          ret = sscanf( buffer, "%d", &num );
+          if ( ret != 1 )
+          {
+               printf( "\n\
+That is not a valid input.  Please try again.\n" );
+          }
+          else if ( num == 1 )
+          {
+               engine = ENGINE_EPOLL;
+          }
+          else if ( num == 2 && uring == 1 )
+          {
+               engine = ENGINE_IO_URING;
+          }
+          else if ( num == 2 )
+          {
+               printf( "\n\
+io_uring is not available on this system.  Please try again.\n" );
+          }
+          else if ( num == 3 )
+          {
+               engine = ENGINE_PREFORK;
+          }
+          else if ( num == 4 )
+          {
+               engine = ENGINE_THREADS;
+          }
+          else
+          {
+               printf( "\n\
+That is not a valid option.  Please try again.\n" );
+          }
+     }    while( engine == 0 );
+
+     return engine;
+}
+
+#endif  /* _CHOOSE_ENGINE_C */
+
+/* EOF choose_engine.c */
@@ -0,0 +1,320 @@
+/*
+
+     config.c
+
+     Functions for running the program without asking any questions.
+
+     Every question the program asks has a key.  When a configuration
+     has been loaded, read_answer() and read_number() take the answer
+     from it instead of reading stdin, so a whole run, from the
+     domain menu through the benchmark, happens with no prompts.
+
+     The configuration comes from the command line, from a file, or
+     both:
+
+          sockets [ -f file ] [ key=value ... ]
+
+     The file holds one key = value per line.  Blank lines and lines
+     starting with # are ignored.  Values on the command line replace
+     values from the file.  A key that isn't one of config_known[] is
+     an error, so a misspelled key can't be silently ignored.
+
+     Menus take the number of the option or its name, for example
+     domain=inet or domain=2.
+
+     Written by Matthew Campbell.
+
+*/
+
+#ifndef _CONFIG_C
+#define _CONFIG_C
+
+#include "sockets.h"
+
+/* Every key a question can ask for, and what it takes. */
+
+static const struct
+{
+     const char *key;
+     const char *help;
+} config_known[] =
+{
+     { "domain",      "bluetooth, inet, inet6, unix, shm or exit" },
+     { "mode",        "pair, client, server, multi or name" },
+     { "type",        "stream, dgram or seqpacket" },
+     { "address",     "Numeric IPv4 or IPv6 address" },
+     { "host",        "Host name for mode=name on inet6" },
+     { "port",        "1025 through 65535" },
+     { "profile",     "none, low-latency, bulk-throughput or many-idle" },
+     { "engine",      "epoll, io_uring, prefork or threads" },
+     { "backlog",     "Accept queue length for the multi server" },
+     { "shards",      "SO_REUSEPORT listeners for the multi server" },
+     { "workers",     "Workers for engine=prefork or threads" },
+     { "benchmark",   "none, throughput, latency, bulk or cancel" },
+     { "size",        "Bytes in each message" },
+     { "megabytes",   "How much to send" },
+     { "batch",       "Datagrams per system call" },
+     { "round_trips", "How many round trips to measure" },
+     { "cancels",     "How many cancels to send each way" }
+};
+
+#define CONFIG_KNOWN ( ( int )( sizeof( config_known ) / \
+                                sizeof( config_known[ 0 ] ) ) )
+
+static char config_keys[ CONFIG_MAX ][ CONFIG_KEY_SIZE ];
+static char config_values[ CONFIG_MAX ][ CONFIG_VALUE_SIZE ];
+static int config_count = 0;
+
+/* Removes white space from both ends of text, in place. */
+
+static char *trim( char *text )
+{
+     char *end;
+
+     while( *text == ' ' || *text == '\t' )
+     {
+          text++;
+     }
+     end = text + strlen( text );
+     while( end > text && ( end[ -1 ] == ' ' || end[ -1 ] == '\t' ||
+                            end[ -1 ] == '\n' || end[ -1 ] == '\r' ) )
+     {
+          end--;
+     }
+     *end = 0;
+     return text;
+}
+
+/* Returns 1 if a configuration has been loaded, otherwise 0. */
+
+int config_active( void )
+{
+     return ( ( config_count > 0 ) ? 1 : 0 );
+}
+
+/* Returns the value for key, or NULL if there isn't one. */
+
+const char *config_get( const char *key )
+{
+     int index;
+
+     if ( key == NULL )
+     {
+          return NULL;
+     }
+     for( index = 0; index < config_count; index++ )
+     {
+          if ( strcmp( config_keys[ index ], key ) == 0 )
+          {
+               return config_values[ index ];
+          }
+     }
+     return NULL;
+}
+
+/* Sets key to value, replacing any value it already had. */
+
+int config_set( const char *key, const char *value )
+{
+     int index, known;
+
+     if ( key == NULL || value == NULL )
+     {
+          errno = EFAULT;
+          return ( -1 );
+     }
+
+     known = 0;
+     for( index = 0; index < CONFIG_KNOWN; index++ )
+     {
+          if ( strcmp( config_known[ index ].key, key ) == 0 )
+          {
+               known = 1;
+               break;
+          }
+     }
+     if ( known == 0 || value[ 0 ] == 0 ||
+          strlen( value ) >= CONFIG_VALUE_SIZE )
+     {
+          errno = EINVAL;
+          return ( -1 );
+     }
+
+     for( index = 0; index < config_count; index++ )
+     {
+          if ( strcmp( config_keys[ index ], key ) == 0 )
+          {
+               break;
+          }
+     }
+     if ( index == config_count )
+     {
+          if ( config_count == CONFIG_MAX )
+          {
+               errno = ENOSPC;
+               return ( -1 );
+          }
+          config_count++;
+     }
+     snprintf( config_keys[ index ], CONFIG_KEY_SIZE, "%s", key );
+     snprintf( config_values[ index ], CONFIG_VALUE_SIZE, "%s", value );
+     return 0;
+}
+
+/* Reads key = value lines from the file at path. */
+
+int config_load_file( const char *path )
+{
+     char line[ CONFIG_VALUE_SIZE + CONFIG_KEY_SIZE + 8 ], *key, *value;
+     FILE *file;
+     int line_num, save_errno;
+
+     if ( path == NULL )
+     {
+          errno = EFAULT;
+          return ( -1 );
+     }
+
+     file = fopen( path, "r" );
+     if ( file == NULL )
+     {
+          return ( -1 );
+     }
+
+     line_num = 0;
+     while( fgets( line, sizeof( line ), file ) != NULL )
+     {
+          line_num++;
+          key = trim( line );
+          if ( key[ 0 ] == 0 || key[ 0 ] == '#' )
+          {
+               continue;
+          }
+          value = strchr( key, '=' );
+          if ( value == NULL )
+          {
+               printf( "%s line %d: Expected key = value.\n", path,
+                       line_num );
+               fclose( file );
+               errno = EINVAL;
+               return ( -1 );
+          }
+          *value = 0;
+          value = trim( value + 1 );
+          key = trim( key );
+          if ( config_set( key, value ) != 0 )
+          {
+               save_errno = errno;
+               printf( "%s line %d: \"%s\" is not a valid setting.\n",
+                       path, line_num, key );
+               fclose( file );
+               errno = save_errno;
+               return ( -1 );
+          }
+     }
+
+     save_errno = ( ferror( file ) ? EIO : 0 );
+     fclose( file );
+     if ( save_errno != 0 )
+     {
+          errno = save_errno;
+          return ( -1 );
+     }
+     return 0;
+}
+
+/*
+
+     Loads the configuration from the command line.  "-f file" reads
+     a file, and every other argument must be key=value.  Returns 0
+     on success or -1 after printing what was wrong.
+
+*/
+
+int config_load_args( const int argc, char **argv )
+{
+     char arg[ CONFIG_VALUE_SIZE + CONFIG_KEY_SIZE + 8 ], *value;
+     int index;
+
+     if ( argv == NULL )
+     {
+          errno = EFAULT;
+          return ( -1 );
+     }
+
+     /* Read the file first so the command line can override it. */
+
+     for( index = 1; index < argc; index++ )
+     {
+          if ( strcmp( argv[ index ], "-f" ) == 0 )
+          {
+               if ( ( index + 1 ) >= argc )
+               {
+                    printf( "-f needs the name of a file.\n" );
+                    errno = EINVAL;
+                    return ( -1 );
+               }
+               index++;
+               if ( config_load_file( argv[ index ] ) != 0 )
+               {
+                    if ( errno != EINVAL )
+                    {
+                         printf( "Could not read \"%s\": %s.\n",
+                                 argv[ index ], strerror( errno ) );
+                    }
+                    return ( -1 );
+               }
+          }
+     }
+
+     for( index = 1; index < argc; index++ )
+     {
+          if ( strcmp( argv[ index ], "-f" ) == 0 )
+          {
+               index++;
+               continue;
+          }
+          snprintf( arg, sizeof( arg ), "%s", argv[ index ] );
+          value = strchr( arg, '=' );
+          if ( value == NULL )
+          {
+               printf( "\"%s\" is not key=value.\n", argv[ index ] );
+               errno = EINVAL;
+               return ( -1 );
+          }
+          *value = 0;
+          if ( config_set( arg, value + 1 ) != 0 )
+          {
+               printf( "\"%s\" is not a valid setting.\n", argv[ index ] );
+               return ( -1 );
+          }
+     }
+
+     errno = 0;
+     return 0;
+}
+
+/* Prints how to use the command line and every key. */
+
+void config_usage( const char *name )
+{
+     int index;
+
+     printf( "\nUsage: %s [ -f file ] [ key=value ... ]\n\n\
+With no arguments every choice is asked for.  Otherwise the program\n\
+runs without asking anything, using these keys:\n\n",
+             ( ( name != NULL ) ? name : "sockets" ) );
+     for( index = 0; index < CONFIG_KNOWN; index++ )
+     {
+          printf( "     %-12s %s\n", config_known[ index ].key,
+                  config_known[ index ].help );
+     }
+     printf( "\n\
+Menus take the number of the option or its name, for example\n\
+domain=inet or domain=2.\n\n" );
+     return;
+}
+
+#endif  /* _CONFIG_C */
+
+/* EOF config.c */
@@ -0,0 +1,377 @@
+/*
+
+     conn_table.c
+
+     Functions for keeping track of open connections in a table of
+     fixed-size records, each on a cache line of its own.  The
+     records are allocated CONN_SLAB_RECORDS at a time as the table
+     fills, and a slab is never moved or freed until the table is, so
+     a pointer to a record stays good while it is in use.  A table of
+     capacity records never takes more than capacity records and a
+     slab pointer for every CONN_SLAB_RECORDS of them, whatever
+     happens to it.  The index by descriptor has an int for every
+     descriptor the process could ever have open, which is the hard
+     RLIMIT_NOFILE limit up to CONN_FD_MAX, so a descriptor is never
+     turned away just because its number is bigger than the table.
+
+     Free records are kept on a list, so conn_insert() and
+     conn_remove() take the same short time however full the table
+     is, apart from the conn_insert() that has to allocate a new slab.
+     A record can be found by its descriptor with conn_by_fd(), or by
+     the handle conn_insert() gave out with conn_get().  Each record
+     has a generation that changes when it is freed, and it is part
+     of the handle, so a handle to a connection that has gone away
+     finds nothing instead of whatever connection uses the record
+     now.  Inserting a descriptor that is already in the table
+     replaces its record, since the descriptor must have been closed
+     and reused without anyone telling us.
+
+     conn_next() walks the records in use, in the order of their
+     indexes.  conn_table_main() returns the table setup_sockets(),
+     shutdown_sockets() and list_sockets() keep the program's own
+     sockets in, along with the connections the multi-connection
+     servers accept, and creates it the first time it is called.  It
+     holds a record for every descriptor the process can open.  None
+     of these are safe to call from more than one thread at a time on
+     the same table, which is fine for the servers since each shard
+     and prefork worker is a process of its own.
+
+     The functions that return int return 0 on success or -1 if an
+     error occurs.  Those that return a pointer return NULL.
+
+     Written by Matthew Campbell.
+
+*/
+
+#ifndef _CONN_TABLE_C
+#define _CONN_TABLE_C
+
+#include "sockets.h"
+
+static struct conn_table conn_main;
+static int conn_main_ready = 0;
+
+/*
+
+     Returns the hard limit on open file descriptors, which no
+     descriptor can reach, up to CONN_FD_MAX.  Returns -1 if an error
+     occurs.
+
+*/
+
+static int conn_fd_limit( void )
+{
+     struct rlimit limit;
+
+     if ( getrlimit( RLIMIT_NOFILE, &limit ) != 0 )
+     {
+          return ( -1 );
+     }
+     if ( limit.rlim_max == RLIM_INFINITY || limit.rlim_max > CONN_FD_MAX )
+     {
+          return CONN_FD_MAX;
+     }
+     return ( int )limit.rlim_max;
+}
+
+int conn_table_init( struct conn_table *table, const int capacity )
+{
+     int fd_limit, slabs;
+
+     if ( table == NULL )
+     {
+          errno = EFAULT;
+          return ( -1 );
+     }
+     if ( capacity < 1 || capacity > CONN_TABLE_MAX )
+     {
+          errno = EINVAL;
+          return ( -1 );
+     }
+
+     fd_limit = conn_fd_limit();
+     if ( fd_limit < 0 )
+     {
+          return ( -1 );
+     }
+
+     memset( table, 0, sizeof( struct conn_table ) );
+     slabs = ( capacity + CONN_SLAB_RECORDS - 1 ) / CONN_SLAB_RECORDS;
+     table->capacity = slabs * CONN_SLAB_RECORDS;
+     table->fd_limit = fd_limit;
+     table->free_head = ( -1 );
+     table->slab = calloc( ( size_t )slabs, sizeof( struct conn_rec * ) );
+     table->by_fd = calloc( ( size_t )fd_limit, sizeof( int ) );
+     if ( table->slab == NULL || table->by_fd == NULL )
+     {
+          conn_table_free( table );
+          errno = ENOMEM;
+          return ( -1 );
+     }
+
+     errno = 0;
+     return 0;
+}
+
+void conn_table_free( struct conn_table *table )
+{
+     int index;
+
+     if ( table == NULL )
+     {
+          return;
+     }
+     if ( table->slab != NULL )
+     {
+          for( index = 0; index < table->slabs; index++ )
+          {
+               free( table->slab[ index ] );
+          }
+          free( table->slab );
+     }
+     free( table->by_fd );
+     memset( table, 0, sizeof( struct conn_table ) );
+     table->free_head = ( -1 );
+     return;
+}
+
+/* Finds the record at index, which must be in an allocated slab. */
+
+static struct conn_rec *conn_at( struct conn_table *table, const int index )
+{
+     return &( table->slab[ index / CONN_SLAB_RECORDS ]
+                          [ index % CONN_SLAB_RECORDS ] );
+}
+
+/*
+
+     Allocates another slab and puts its records on the free list,
+     lowest index first.  Returns 0 on success or -1 with errno set
+     to ENOSPC if the table is full.
+
+*/
+
+static int conn_grow( struct conn_table *table )
+{
+     int index;
+     struct conn_rec *slab;
+
+     if ( table->slabs * CONN_SLAB_RECORDS >= table->capacity )
+     {
+          errno = ENOSPC;
+          return ( -1 );
+     }
+     slab = aligned_alloc( 64, CONN_SLAB_RECORDS *
+                               sizeof( struct conn_rec ) );
+     if ( slab == NULL )
+     {
+          errno = ENOMEM;
+          return ( -1 );
+     }
+
+     for( index = CONN_SLAB_RECORDS - 1; index >= 0; index-- )
+     {
+          memset( &( slab[ index ] ), 0, sizeof( struct conn_rec ) );
+          slab[ index ].fd = ( -1 );
+          slab[ index ].gen = 1;
+          slab[ index ].next_free = table->free_head;
+          table->free_head = table->slabs * CONN_SLAB_RECORDS + index;
+     }
+     table->slab[ table->slabs ] = slab;
+     table->slabs++;
+     return 0;
+}
+
+int conn_insert( struct conn_table *table, const int fd, const int role,
+                 const int domain, const int sock_type, uint64_t *handle )
+{
+     int index;
+     struct conn_rec *rec;
+
+     if ( table == NULL )
+     {
+          errno = EFAULT;
+          return ( -1 );
+     }
+     if ( fd < 0 || role < CONN_ROLE_CLIENT || role > CONN_ROLE_PEER )
+     {
+          errno = EINVAL;
+          return ( -1 );
+     }
+     if ( fd >= table->fd_limit )
+     {
+          errno = EMFILE;
+          return ( -1 );
+     }
+
+     /* The descriptor was closed and reused behind our back. */
+
+     if ( table->by_fd[ fd ] != 0 )
+     {
+          conn_remove_fd( table, fd );
+     }
+
+     if ( table->free_head < 0 && conn_grow( table ) != 0 )
+     {
+          return ( -1 );
+     }
+     index = table->free_head;
+     rec = conn_at( table, index );
+     table->free_head = rec->next_free;
+
+     rec->fd = fd;
+     rec->role = role;
+     rec->domain = domain;
+     rec->sock_type = sock_type;
+     rec->next_free = ( -1 );
+     rec->handle = CONN_HANDLE( index, rec->gen );
+     rec->open_ns = get_time_ns();
+     rec->user = NULL;
+     table->by_fd[ fd ] = index + 1;
+     table->live++;
+     table->inserts++;
+     if ( handle != NULL )
+     {
+          *handle = rec->handle;
+     }
+
+     errno = 0;
+     return 0;
+}
+
+struct conn_rec *conn_get( struct conn_table *table, const uint64_t handle )
+{
+     int index;
+     struct conn_rec *rec;
+
+     if ( table == NULL )
+     {
+          errno = EFAULT;
+          return NULL;
+     }
+     index = CONN_HANDLE_INDEX( handle );
+     if ( index >= table->slabs * CONN_SLAB_RECORDS )
+     {
+          errno = EINVAL;
+          return NULL;
+     }
+     rec = conn_at( table, index );
+     if ( rec->fd < 0 || rec->gen != CONN_HANDLE_GEN( handle ) )
+     {
+          table->stale++;
+          errno = ESTALE;
+          return NULL;
+     }
+     return rec;
+}
+
+struct conn_rec *conn_by_fd( struct conn_table *table, const int fd )
+{
+     if ( table == NULL )
+     {
+          errno = EFAULT;
+          return NULL;
+     }
+     if ( fd < 0 || fd >= table->fd_limit || table->by_fd == NULL ||
+          table->by_fd[ fd ] == 0 )
+     {
+          errno = ENOENT;
+          return NULL;
+     }
+     return conn_at( table, table->by_fd[ fd ] - 1 );
+}
+
+int conn_remove( struct conn_table *table, const uint64_t handle )
+{
+     int index;
+     struct conn_rec *rec;
+
+     rec = conn_get( table, handle );
+     if ( rec == NULL )
+     {
+          return ( -1 );
+     }
+     index = CONN_HANDLE_INDEX( handle );
+
+     table->by_fd[ rec->fd ] = 0;
+     rec->fd = ( -1 );
+     rec->user = NULL;
+     rec->gen++;
+     if ( rec->gen == 0 )
+     {
+          rec->gen = 1;  /* Keep handles from ever being 0. */
+     }
+     rec->next_free = table->free_head;
+     table->free_head = index;
+     table->live--;
+     table->removes++;
+
+     errno = 0;
+     return 0;
+}
+
+int conn_remove_fd( struct conn_table *table, const int fd )
+{
+     struct conn_rec *rec;
+
+     rec = conn_by_fd( table, fd );
+     if ( rec == NULL )
+     {
+          return ( -1 );
+     }
+     return conn_remove( table, rec->handle );
+}
+
+/*
+
+     Returns the first record in use at or after *cursor and moves
+     *cursor past it, or NULL when there are no more.  Start with
+     *cursor set to 0.
+
+*/
+
+struct conn_rec *conn_next( struct conn_table *table, int *cursor )
+{
+     struct conn_rec *rec;
+
+     if ( table == NULL || cursor == NULL )
+     {
+          errno = EFAULT;
+          return NULL;
+     }
+     while( *cursor >= 0 && *cursor < table->slabs * CONN_SLAB_RECORDS )
+     {
+          rec = conn_at( table, *cursor );
+          ( *cursor )++;
+          if ( rec->fd >= 0 )
+          {
+               return rec;
+          }
+     }
+     errno = 0;
+     return NULL;
+}
+
+struct conn_table *conn_table_main( void )
+{
+     int fd_limit;
+
+     if ( conn_main_ready == 0 )
+     {
+          fd_limit = conn_fd_limit();
+          if ( fd_limit < 0 )
+          {
+               return NULL;
+          }
+          if ( conn_table_init( &conn_main, fd_limit ) != 0 )
+          {
+               return NULL;
+          }
+          conn_main_ready = 1;
+     }
+     return &conn_main;
+}
+
+#endif  /* _CONN_TABLE_C */
+
+/* EOF conn_table.c */
@@ -0,0 +1,183 @@
+/*
+
+     connect_by_name.c
+
+     This function asks for a host name and a port and connects a
+     client socket to it with happy_eyeballs(), so the client ends up
+     on whichever of IPv6 and IPv4 answered first.  setup_af_inet6()
+     calls it when the user chooses to connect by host name.
+
+     The name and port are kept so a reconnect, when initial is 0,
+     races both families again without asking.  The client socket
+     is left nonblocking with SO_KEEPALIVE set, the same as the one
+     setup_af_inet6() connects to a numeric address.
+
+     Returns 0 on success or -1 if an error occurs.
+
+     Written by Matthew Campbell.
+
+*/
+
+#ifndef _CONNECT_BY_NAME_C
+#define _CONNECT_BY_NAME_C
+
+#include "sockets.h"
+
+int connect_by_name( int *csock_fd, const int initial )
+{
+     static char host[ 256 ], service[ 16 ];
+     char addr_str[ ADDR_STR_SIZE ], buffer[ 256 ];
+     int count, num, opt, ret, save_errno;
+     struct he_result result;
+     struct sockaddr_storage addrs[ HE_MAX_ADDRS ];
+
+#ifdef DEBUG
+
+     int index;
+
+#endif
+
+     if ( csock_fd == NULL )
+     {
+          errno = EFAULT;
+          return ( -1 );
+     }
+     if ( ( initial != 0 && initial != 1 ) ||
+          ( initial == 0 && host[ 0 ] == 0 ) )
+     {
+          errno = EINVAL;
+          return ( -1 );
+     }
+
+     if ( initial == 1 )
+     {
+          printf( "\n\
+What host name would you like the client to connect to?\n\n" );
+          if ( read_answer( "host", NULL, 0, buffer, 256 ) != 0 )
+          {
+               return ( -1 );
+          }
+          snprintf( host, sizeof( host ), "%s", buffer );
+
+          for( ; ; )
+          {
+               printf( "\n\
+What numeric port number would you like the client to connect to?\n\
+Please specify a number that is greater than 1024 and less than 65536.\
+\n\n" );
+               if ( read_answer( "port", NULL, 0, buffer, 256 ) != 0 )
+               {
+                    return ( -1 );
+               }
+               if ( sscanf( buffer, "%d", &num ) == 1 && num > 1024 &&
+                    num < 65536 )
+               {
+                    break;
+               }
+               printf( "\nThat is not a valid port number.  \
+Please try again.\n" );
+          }
+          snprintf( service, sizeof( service ), "%d", num );
+     }
+
+     /* Look the name up in both families. */
+
+     count = he_resolve( host, service, addrs, HE_MAX_ADDRS );
+     if ( count < 1 )
+     {
+          save_errno = errno;
+          printf( "\nCould not find any addresses for \"%s\".\n", host );
+          errno = save_errno;
+          return ( -1 );
+     }
+
+#ifdef DEBUG
+
+     printf( "\n\"%s\" has %d addresses, to be tried in this order:\n",
+             host, count );
+     for( index = 0; index < count; index++ )
+     {
+          if ( format_address( ( struct sockaddr * )( &( addrs[ index ] ) ),
+                               addr_str, ADDR_STR_SIZE ) == 0 )
+          {
+               printf( "     %s\n", addr_str );
+          }
+     }
+     printf( "\n" );
+
+#endif
+
+     /* Race them. */
+
+     if ( initial == 1 )
+     {
+          printf( "Trying to connect to %s...\n", host );
+     }
+     else
+     {
+          printf( "Trying to reconnect to %s...\n", host );
+     }
+     *csock_fd = he_race( addrs, count, HE_ATTEMPT_DELAY_MS, &result );
+     if ( *csock_fd < 0 )
+     {
+          save_errno = errno;
+          *csock_fd = ( -1 );
+          printf( "\nSomething went wrong while connecting to %s.\n", host );
+          if ( save_errno != 0 )
+          {
+               printf( "Error: %s.\n", strerror( save_errno ) );
+          }
+          printf( "\n" );
+          errno = 0;  /* Don't show the same error twice. */
+          return ( -1 );
+     }
+
+     if ( format_address( ( struct sockaddr * )( &( result.addr ) ),
+                          addr_str, ADDR_STR_SIZE ) != 0 )
+     {
+          addr_str[ 0 ] = 0;
+     }
+     printf( "\
+Connected to %s over %s in %.3f milliseconds.\n\
+%d connects were started and %d of them failed.\n",
+             ( ( addr_str[ 0 ] != 0 ) ? addr_str : host ),
+             ( ( result.family == AF_INET6 ) ? "IPv6" : "IPv4" ),
+             ( double )result.elapsed_ns / 1e6, result.attempts,
+             result.failures );
+
+     /* Set the client socket option SO_KEEPALIVE. */
+
+     opt = 1;
+     ret = setsockopt( *csock_fd, SOL_SOCKET, SO_KEEPALIVE, &opt,
+                       sizeof( opt ) );
+     if ( ret != 0 )
+     {
+          save_errno = errno;
+          printf( "\n\
+Something went wrong when setting the SO_KEEPALIVE\n\
+option on the client socket.\n" );
+          if ( save_errno != 0 )
+          {
+               printf( "Error: %s.\n", strerror( save_errno ) );
+          }
+          printf( "\n" );
+          close( *csock_fd );
+          *csock_fd = ( -1 );
+          errno = 0;
+          return ( -1 );
+     }
+
+#ifdef DEBUG
+
+     printf( "\
+The SO_KEEPALIVE option has been set on the client socket.\n\n" );
+
+#endif
+
+     errno = 0;
+     return 0;
+}
+
+#endif  /* _CONNECT_BY_NAME_C */
+
+/* EOF connect_by_name.c */
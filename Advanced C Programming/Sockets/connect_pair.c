@@ -0,0 +1,187 @@
+/*
+
+     connect_pair.c
+
+     This function connects the client socket to the server's
+     listening socket and accepts the new connection, all in the
+     calling process.  The client socket is put into nonblocking
+     mode for the call to connect(2) so it can't hang waiting for
+     the server, and poll(2) is used to wait for both the accept
+     queue and the client's side of the connection to be ready.
+
+     This replaces the old approach of creating a child process with
+     fork(2) to call connect(2) after sleeping for a second, so
+     setting up or reconnecting a pair on the same device now takes
+     microseconds instead of over a second.
+
+     The address of the new connection's peer is stored in peer if
+     it isn't NULL.  peer may point to the same space as target since
+     target isn't needed any more by the time accept(2) is called.
+     The client socket's file status flags are restored before
+     returning.
+
+     Returns the server socket's file descriptor on success or -1
+     if an error occurs.
+
+     Written by Matthew Campbell.
+
+*/
+
+#ifndef _CONNECT_PAIR_C
+#define _CONNECT_PAIR_C
+
+#include "sockets.h"
+
+int connect_pair( const int csock_fd, const int lsock_fd,
+                  const struct sockaddr *target,
+                  const socklen_t target_len, struct sockaddr *peer,
+                  socklen_t *peer_len )
+{
+     int accepted, connected, error, flags, ret, save_errno, ssock_fd;
+     socklen_t size;
+     struct pollfd fds[ 2 ];
+     uint64_t deadline_ns, now_ns;
+
+     if ( csock_fd < 0 || lsock_fd < 0 || target_len < 1 )
+     {
+          errno = EINVAL;
+          return ( -1 );
+     }
+     if ( target == NULL )
+     {
+          errno = EFAULT;
+          return ( -1 );
+     }
+     if ( peer != NULL && peer_len == NULL )
+     {
+          errno = EFAULT;
+          return ( -1 );
+     }
+
+     /* Put the client socket into nonblocking mode. */
+
+     flags = fcntl( csock_fd, F_GETFL, 0 );
+     if ( flags == ( -1 ) )
+     {
+          return ( -1 );
+     }
+     if ( fcntl( csock_fd, F_SETFL, ( flags | O_NONBLOCK ) ) == ( -1 ) )
+     {
+          return ( -1 );
+     }
+
+     /*
+
+          On loopback and AF_UNIX this usually succeeds right away.
+          Otherwise the handshake finishes in the background.
+
+     */
+
+     connected = 0;
+     ret = connect( csock_fd, target, target_len );
+     if ( ret == 0 )
+     {
+          connected = 1;
+     }
+     else if ( errno != EINPROGRESS )
+     {
+          save_errno = errno;
+          fcntl( csock_fd, F_SETFL, flags );
+          errno = save_errno;
+          return ( -1 );
+     }
+
+     /* Wait for the connection to show up on both ends. */
+
+     accepted = 0;
+     save_errno = 0;
+     ssock_fd = ( -1 );
+     deadline_ns = get_time_ns() +
+                   ( ( uint64_t )CONNECT_TIMEOUT_MS * 1000000ULL );
+
+     while( accepted == 0 || connected == 0 )
+     {
+          fds[ 0 ].fd = ( ( accepted == 0 ) ? lsock_fd : ( -1 ) );
+          fds[ 0 ].events = POLLIN;
+          fds[ 0 ].revents = 0;
+          fds[ 1 ].fd = ( ( connected == 0 ) ? csock_fd : ( -1 ) );
+          fds[ 1 ].events = POLLOUT;
+          fds[ 1 ].revents = 0;
+
+          now_ns = get_time_ns();
+          if ( now_ns >= deadline_ns )
+          {
+               save_errno = ETIMEDOUT;
+               break;
+          }
+
+          ret = poll( fds, 2,
+                      ( int )( ( deadline_ns - now_ns ) / 1000000ULL ) + 1 );
+          if ( ret < 0 )
+          {
+               if ( errno == EINTR )
+               {
+                    continue;
+               }
+               save_errno = errno;
+               break;
+          }
+
+          /* Find out how the client's connect(2) turned out. */
+
+          if ( fds[ 1 ].revents != 0 )
+          {
+               error = 0;
+               size = sizeof( error );
+               if ( getsockopt( csock_fd, SOL_SOCKET, SO_ERROR, &error,
+                                &size ) != 0 )
+               {
+                    save_errno = errno;
+                    break;
+               }
+               if ( error != 0 )
+               {
+                    save_errno = error;
+                    break;
+               }
+               connected = 1;
+          }
+
+          /* Accept the new connection. */
+
+          if ( fds[ 0 ].revents != 0 )
+          {
+               ssock_fd = accept( lsock_fd, peer, peer_len );
+               if ( ssock_fd >= 0 )
+               {
+                    accepted = 1;
+               }
+               else if ( errno != EAGAIN && errno != EWOULDBLOCK &&
+                         errno != EINTR && errno != ECONNABORTED )
+               {
+                    save_errno = errno;
+                    break;
+               }
+          }
+
+     }    /* while( accepted == 0 || connected == 0 ) */
+
+     fcntl( csock_fd, F_SETFL, flags );
+
+     if ( accepted == 0 || connected == 0 )
+     {
+          if ( ssock_fd >= 0 )
+          {
+               close( ssock_fd );
+          }
+          errno = save_errno;
+          return ( -1 );
+     }
+
+     errno = 0;
+     return ssock_fd;
+}
+
+#endif  /* _CONNECT_PAIR_C */
+
+/* EOF connect_pair.c */
@@ -0,0 +1,200 @@
+/*
+
+     dgram_batch.c
+
+     Functions for sending and receiving many datagrams with one
+     system call.
+
+     A dgram_batch holds everything sendmmsg(2) and recvmmsg(2) need
+     for up to count datagrams of up to size bytes each: the mmsghdr
+     array, one iovec and one address per message, and the payload
+     buffers.  It is all allocated once by dgram_batch_init() and
+     pointed at itself, so sending and receiving never allocate.
+
+     To send, fill in the payloads and set each iov_len in iovs to
+     the length of that datagram, then call dgram_send_batch().
+     dgram_recv_batch() sets the lengths back to size before it
+     receives, and leaves the length of each datagram that arrived in
+     msgs[ i ].msg_len and who sent it in addrs[ i ].
+
+     Both work like send_nb() and recv_nb(): they never block, they
+     retry when a signal interrupts them, and a full or empty socket
+     isn't an error.
+
+     Written by Matthew Campbell.
+
+*/
+
+#ifndef _DGRAM_BATCH_C
+#define _DGRAM_BATCH_C
+
+#include "sockets.h"
+
+/*
+
+     Allocates a batch of count datagrams of up to size bytes each.
+     Returns 0 on success or -1 if an error occurs.
+
+*/
+
+int dgram_batch_init( struct dgram_batch *batch, const int count,
+                      const size_t size )
+{
+     int index;
+
+     if ( batch == NULL )
+     {
+          errno = EFAULT;
+          return ( -1 );
+     }
+     if ( count < 1 || count > DGRAM_BATCH_MAX || size < 1 )
+     {
+          errno = EINVAL;
+          return ( -1 );
+     }
+
+     memset( batch, 0, sizeof( struct dgram_batch ) );
+     batch->msgs = calloc( ( size_t )count, sizeof( struct mmsghdr ) );
+     batch->iovs = calloc( ( size_t )count, sizeof( struct iovec ) );
+     batch->addrs = calloc( ( size_t )count,
+                            sizeof( struct sockaddr_storage ) );
+     batch->data = calloc( ( size_t )count, size );
+     if ( batch->msgs == NULL || batch->iovs == NULL ||
+          batch->addrs == NULL || batch->data == NULL )
+     {
+          dgram_batch_free( batch );
+          errno = ENOMEM;
+          return ( -1 );
+     }
+
+     batch->count = count;
+     batch->size = size;
+     for( index = 0; index < count; index++ )
+     {
+          batch->iovs[ index ].iov_base = batch->data +
+                                          ( size * ( size_t )index );
+          batch->iovs[ index ].iov_len = size;
+          batch->msgs[ index ].msg_hdr.msg_iov = &( batch->iovs[ index ] );
+          batch->msgs[ index ].msg_hdr.msg_iovlen = 1;
+     }
+     return 0;
+}
+
+/* Releases everything dgram_batch_init() allocated. */
+
+void dgram_batch_free( struct dgram_batch *batch )
+{
+     if ( batch == NULL )
+     {
+          return;
+     }
+     free( batch->msgs );
+     free( batch->iovs );
+     free( batch->addrs );
+     free( batch->data );
+     memset( batch, 0, sizeof( struct dgram_batch ) );
+     return;
+}
+
+/*
+
+     Sends datagrams first through first + count - 1 of the batch
+     with sendmmsg(2).  If to isn't NULL every one of them goes to
+     that address, otherwise the socket must be connected.  Returns
+     how many were sent, which may be less than count or even 0 if
+     the socket's send buffer is full, or -1 if an error occurs.
+
+*/
+
+int dgram_send_batch( const int sock_fd, struct dgram_batch *batch,
+                      const int first, const int count,
+                      const struct sockaddr *to, const socklen_t to_len )
+{
+     int index, num;
+
+     if ( batch == NULL || batch->msgs == NULL )
+     {
+          errno = EFAULT;
+          return ( -1 );
+     }
+     if ( sock_fd < 0 || first < 0 || count < 0 ||
+          ( first + count ) > batch->count )
+     {
+          errno = EINVAL;
+          return ( -1 );
+     }
+     if ( count == 0 )
+     {
+          return 0;
+     }
+
+     for( index = first; index < ( first + count ); index++ )
+     {
+          batch->msgs[ index ].msg_hdr.msg_name = ( void * )to;
+          batch->msgs[ index ].msg_hdr.msg_namelen = ( ( to != NULL ) ?
+                                                       to_len : 0 );
+     }
+
+     do
+     {
+          num = sendmmsg( sock_fd, &( batch->msgs[ first ] ),
+                          ( unsigned int )count,
+                          ( MSG_NOSIGNAL | MSG_DONTWAIT ) );
+     }    while( num < 0 && errno == EINTR );
+
+     if ( num < 0 && ( errno == EAGAIN || errno == EWOULDBLOCK ) )
+     {
+          return 0;
+     }
+     return num;
+}
+
+/*
+
+     Receives as many datagrams as are waiting, up to count, with
+     recvmmsg(2).  Returns how many arrived, or -1 with errno set to
+     EAGAIN if none are waiting, or -1 if another error occurs.
+
+*/
+
+int dgram_recv_batch( const int sock_fd, struct dgram_batch *batch,
+                      const int count )
+{
+     int index, num;
+
+     if ( batch == NULL || batch->msgs == NULL )
+     {
+          errno = EFAULT;
+          return ( -1 );
+     }
+     if ( sock_fd < 0 || count < 1 || count > batch->count )
+     {
+          errno = EINVAL;
+          return ( -1 );
+     }
+
+     for( index = 0; index < count; index++ )
+     {
+          batch->iovs[ index ].iov_len = batch->size;
+          batch->msgs[ index ].msg_hdr.msg_name = &( batch->addrs[ index ] );
+          batch->msgs[ index ].msg_hdr.msg_namelen =
+               sizeof( struct sockaddr_storage );
+          batch->msgs[ index ].msg_len = 0;
+     }
+
+     do
+     {
+          num = recvmmsg( sock_fd, batch->msgs, ( unsigned int )count,
+                          MSG_DONTWAIT, NULL );
+     }    while( num < 0 && errno == EINTR );
+
+     if ( num < 0 && errno == EWOULDBLOCK )
+     {
+          errno = EAGAIN;
+     }
+     return num;
+}
+
+#endif  /* _DGRAM_BATCH_C */
+
+/* EOF dgram_batch.c */
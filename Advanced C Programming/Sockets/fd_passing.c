@@ -0,0 +1,133 @@
+/*
+
+     fd_passing.c
+
+     Functions for handing an open file descriptor to another process
+     over an AF_UNIX socket with an SCM_RIGHTS control message.  The
+     receiver gets a new descriptor for the same open file, so a
+     socket accepted in one process can be served in another.
+
+     Each descriptor travels with a single byte of ordinary data,
+     since a control message can't be sent on its own.  A sequenced
+     packet socket keeps one descriptor per message.
+
+     send_fd() returns 0 on success or -1 if an error occurs.
+     recv_fd() returns the new descriptor, or -1 if an error occurs,
+     with errno set to ECONNRESET if the sender has gone away.
+
+     Written by Matthew Campbell.
+
+*/
+
+#ifndef _FD_PASSING_C
+#define _FD_PASSING_C
+
+#include "sockets.h"
+
+/* Sends fd over sock_fd.  flags are passed on to sendmsg(2). */
+
+int send_fd( const int sock_fd, const int fd, const int flags )
+{
+     char byte;
+     ssize_t len;
+     struct cmsghdr *cmsg;
+     struct iovec iov;
+     struct msghdr msg;
+     union
+     {
+          char buf[ CMSG_SPACE( sizeof( int ) ) ];
+          struct cmsghdr align;
+     } control;
+
+     if ( sock_fd < 0 || fd < 0 )
+     {
+          errno = EINVAL;
+          return ( -1 );
+     }
+
+     byte = 'F';
+     iov.iov_base = &byte;
+     iov.iov_len = 1;
+     memset( &msg, 0, sizeof( msg ) );
+     memset( &control, 0, sizeof( control ) );
+     msg.msg_iov = &iov;
+     msg.msg_iovlen = 1;
+     msg.msg_control = control.buf;
+     msg.msg_controllen = sizeof( control.buf );
+
+     cmsg = CMSG_FIRSTHDR( &msg );
+     cmsg->cmsg_level = SOL_SOCKET;
+     cmsg->cmsg_type = SCM_RIGHTS;
+     cmsg->cmsg_len = CMSG_LEN( sizeof( int ) );
+     memcpy( CMSG_DATA( cmsg ), &fd, sizeof( int ) );
+
+     do
+     {
+          len = sendmsg( sock_fd, &msg, ( flags | MSG_NOSIGNAL ) );
+     }    while( len < 0 && errno == EINTR );
+     if ( len != 1 )
+     {
+          return ( -1 );
+     }
+     return 0;
+}
+
+/* Receives a descriptor from sock_fd.  flags go to recvmsg(2). */
+
+int recv_fd( const int sock_fd, const int flags )
+{
+     char byte;
+     int fd;
+     ssize_t len;
+     struct cmsghdr *cmsg;
+     struct iovec iov;
+     struct msghdr msg;
+     union
+     {
+          char buf[ CMSG_SPACE( sizeof( int ) ) ];
+          struct cmsghdr align;
+     } control;
+
+     if ( sock_fd < 0 )
+     {
+          errno = EINVAL;
+          return ( -1 );
+     }
+
+     iov.iov_base = &byte;
+     iov.iov_len = 1;
+     memset( &msg, 0, sizeof( msg ) );
+     msg.msg_iov = &iov;
+     msg.msg_iovlen = 1;
+     msg.msg_control = control.buf;
+     msg.msg_controllen = sizeof( control.buf );
+
+     do
+     {
+          len = recvmsg( sock_fd, &msg, ( flags | MSG_CMSG_CLOEXEC ) );
+     }    while( len < 0 && errno == EINTR );
+     if ( len < 0 )
+     {
+          return ( -1 );
+     }
+     if ( len == 0 )
+     {
+          errno = ECONNRESET;
+          return ( -1 );
+     }
+
+     cmsg = CMSG_FIRSTHDR( &msg );
+     if ( cmsg == NULL || cmsg->cmsg_level != SOL_SOCKET ||
+          cmsg->cmsg_type != SCM_RIGHTS ||
+          cmsg->cmsg_len != CMSG_LEN( sizeof( int ) ) )
+     {
+          errno = EBADMSG;
+          return ( -1 );
+     }
+     memcpy( &fd, CMSG_DATA( cmsg ), sizeof( int ) );
+     return fd;
+}
+
+#endif  /* _FD_PASSING_C */
+
+/* EOF fd_passing.c */
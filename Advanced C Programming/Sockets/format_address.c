@@ -0,0 +1,95 @@
+/*
+
+     format_address.c
+
+     This function turns an AF_INET or AF_INET6 socket address into
+     text with its port, as 192.0.2.1:5000 or [2001:db8::1]:5000.
+
+     A dual-stack AF_INET6 socket sees IPv4 peers as IPv4-mapped
+     addresses like ::ffff:192.0.2.1.  Those are shown the way an
+     AF_INET socket would show them, followed by "(IPv4-mapped)", so
+     the same peer looks the same whichever kind of listener accepted
+     it.
+
+     buffer should hold at least ADDR_STR_SIZE bytes.
+
+     Returns 0 on success or -1 if an error occurs.
+
+     Written by Matthew Campbell.
+
+*/
+
+#ifndef _FORMAT_ADDRESS_C
+#define _FORMAT_ADDRESS_C
+
+#include "sockets.h"
+
+int format_address( const struct sockaddr *addr, char *buffer,
+                    const size_t length )
+{
+     char ip_str[ INET6_ADDRSTRLEN ];
+     const struct sockaddr_in *addr4;
+     const struct sockaddr_in6 *addr6;
+     int ret;
+
+     if ( addr == NULL || buffer == NULL )
+     {
+          errno = EFAULT;
+          return ( -1 );
+     }
+
+     if ( addr->sa_family == AF_INET )
+     {
+          addr4 = ( const struct sockaddr_in * )addr;
+          if ( inet_ntop( AF_INET, &( addr4->sin_addr ), ip_str,
+                          sizeof( ip_str ) ) == NULL )
+          {
+               return ( -1 );
+          }
+          ret = snprintf( buffer, length, "%s:%u", ip_str,
+                          ( unsigned int )ntohs( addr4->sin_port ) );
+     }
+     else if ( addr->sa_family == AF_INET6 )
+     {
+          addr6 = ( const struct sockaddr_in6 * )addr;
+          if ( IN6_IS_ADDR_V4MAPPED( &( addr6->sin6_addr ) ) )
+          {
+               /* The last four bytes are the IPv4 address. */
+
+               if ( inet_ntop( AF_INET, &( addr6->sin6_addr.s6_addr[ 12 ] ),
+                               ip_str, sizeof( ip_str ) ) == NULL )
+               {
+                    return ( -1 );
+               }
+               ret = snprintf( buffer, length, "%s:%u (IPv4-mapped)",
+                               ip_str,
+                               ( unsigned int )ntohs( addr6->sin6_port ) );
+          }
+          else
+          {
+               if ( inet_ntop( AF_INET6, &( addr6->sin6_addr ), ip_str,
+                               sizeof( ip_str ) ) == NULL )
+               {
+                    return ( -1 );
+               }
+               ret = snprintf( buffer, length, "[%s]:%u", ip_str,
+                               ( unsigned int )ntohs( addr6->sin6_port ) );
+          }
+     }
+     else
+     {
+          errno = EAFNOSUPPORT;
+          return ( -1 );
+     }
+
+     if ( ret < 0 || ( size_t )ret >= length )
+     {
+          errno = ENOSPC;
+          return ( -1 );
+     }
+     return 0;
+}
+
+#endif  /* _FORMAT_ADDRESS_C */
+
+/* EOF format_address.c */
@@ -0,0 +1,35 @@
+/*
+
+     get_cpu_ns.c
+
+     This function returns the user plus system CPU time used so far,
+     in nanoseconds.  who is passed to getrusage(2), so RUSAGE_SELF
+     gives this process and RUSAGE_CHILDREN gives the children that
+     have been waited for.  Returns 0 if the usage can't be read.
+
+     Written by Matthew Campbell.
+
+*/
+
+#ifndef _GET_CPU_NS_C
+#define _GET_CPU_NS_C
+
+#include "sockets.h"
+
+uint64_t get_cpu_ns( const int who )
+{
+     struct rusage usage;
+
+     if ( getrusage( who, &usage ) != 0 )
+     {
+          return 0;
+     }
+     return ( ( uint64_t )usage.ru_utime.tv_sec * 1000000000ULL ) +
+            ( ( uint64_t )usage.ru_utime.tv_usec * 1000ULL ) +
+            ( ( uint64_t )usage.ru_stime.tv_sec * 1000000000ULL ) +
+            ( ( uint64_t )usage.ru_stime.tv_usec * 1000ULL );
+}
+
+#endif  /* _GET_CPU_NS_C */
+
+/* EOF get_cpu_ns.c */
@@ -0,0 +1,39 @@
+/*
+
+     get_somaxconn.c
+
+     This function returns the largest accept backlog the kernel will
+     give a listening socket, from /proc/sys/net/core/somaxconn.
+     listen(2) quietly cuts any larger backlog down to this.  Returns
+     SOMAXCONN if the file can't be read.
+
+     Written by Matthew Campbell.
+
+*/
+
+#ifndef _GET_SOMAXCONN_C
+#define _GET_SOMAXCONN_C
+
+#include "sockets.h"
+
+int get_somaxconn( void )
+{
+     FILE *fp;
+     int value;
+
+     fp = fopen( "/proc/sys/net/core/somaxconn", "r" );
+     if ( fp == NULL )
+     {
+          return SOMAXCONN;
+     }
+     if ( fscanf( fp, "%d", &value ) != 1 || value < 1 )
+     {
+          value = SOMAXCONN;
+     }
+     fclose( fp );
+     return value;
+}
+
+#endif  /* _GET_SOMAXCONN_C */
+
+/* EOF get_somaxconn.c */
@@ -0,0 +1,33 @@
+/*
+
+     get_time_ns.c
+
+     This function reads the monotonic clock and returns the time in
+     nanoseconds.  The starting point is arbitrary so the value is
+     only useful for measuring how long something took.  Returns 0
+     if the clock can't be read.
+
+     Written by Matthew Campbell.
+
+*/
+
+#ifndef _GET_TIME_NS_C
+#define _GET_TIME_NS_C
+
+#include "sockets.h"
+
+uint64_t get_time_ns( void )
+{
+     struct timespec now;
+
+     if ( clock_gettime( CLOCK_MONOTONIC, &now ) != 0 )
+     {
+          return 0;
+     }
+     return ( ( uint64_t )now.tv_sec * 1000000000ULL ) +
+            ( uint64_t )now.tv_nsec;
+}
+
+#endif  /* _GET_TIME_NS_C */
+
+/* EOF get_time_ns.c */
@@ -0,0 +1,347 @@
+/*
+
+     happy_eyeballs.c
+
+     Functions for connecting a client to a host name that has both
+     IPv4 and IPv6 addresses, the way RFC 8305 "Happy Eyeballs"
+     describes.
+
+     he_resolve() looks the name up in both families with
+     getaddrinfo(3) and reorders the answers so the families take
+     turns, keeping the first one the resolver preferred in front.
+     he_race() then starts a nonblocking connect(2) to the first
+     address, and if it hasn't finished after delay_ms milliseconds
+     starts the next one without giving up on the first, and so on.
+     An attempt that fails outright starts the next one at once.
+     Whichever connect finishes first wins and every other attempt is
+     closed, so a family whose path is slow or broken costs at most
+     delay_ms instead of a full connect timeout.
+
+     A delay_ms below zero turns the racing off, so each address is
+     only tried after the one before it has failed, which is what a
+     plain loop over getaddrinfo(3) does.  bench_eyeballs uses that
+     to show the difference.
+
+     he_race() and happy_eyeballs() return the connected socket, left
+     nonblocking, or -1 if an error occurs.  he_resolve() returns how
+     many addresses it found or -1 if an error occurs.
+
+     Written by Matthew Campbell.
+
+*/
+
+#ifndef _HAPPY_EYEBALLS_C
+#define _HAPPY_EYEBALLS_C
+
+#include "sockets.h"
+
+/* Returns the length of the socket address in addr. */
+
+static socklen_t he_addr_len( const struct sockaddr_storage *addr )
+{
+     return ( ( addr->ss_family == AF_INET6 ) ?
+              ( socklen_t )sizeof( struct sockaddr_in6 ) :
+              ( socklen_t )sizeof( struct sockaddr_in ) );
+}
+
+/*
+
+     Looks up host and service and stores up to max stream socket
+     addresses in addrs, taking turns between the families.
+
+*/
+
+int he_resolve( const char *host, const char *service,
+                struct sockaddr_storage *addrs, const int max )
+{
+     int count, first_family, index, other, ret, taken[ HE_MAX_ADDRS ];
+     int found;
+     struct addrinfo hints, *info, *list;
+     struct sockaddr_storage sorted[ HE_MAX_ADDRS ];
+
+     if ( host == NULL || service == NULL || addrs == NULL )
+     {
+          errno = EFAULT;
+          return ( -1 );
+     }
+     if ( max < 1 )
+     {
+          errno = EINVAL;
+          return ( -1 );
+     }
+
+     memset( &hints, 0, sizeof( hints ) );
+     hints.ai_family = AF_UNSPEC;
+     hints.ai_socktype = SOCK_STREAM;
+     ret = getaddrinfo( host, service, &hints, &list );
+     if ( ret != 0 )
+     {
+          errno = ( ( ret == EAI_SYSTEM ) ? errno : EHOSTUNREACH );
+          return ( -1 );
+     }
+
+     /* Keep the resolver's order within each family. */
+
+     found = 0;
+     for( info = list; info != NULL && found < HE_MAX_ADDRS;
+          info = info->ai_next )
+     {
+          if ( ( info->ai_family == AF_INET ||
+                 info->ai_family == AF_INET6 ) &&
+               info->ai_addrlen <= sizeof( struct sockaddr_storage ) )
+          {
+               memset( &( sorted[ found ] ), 0,
+                       sizeof( struct sockaddr_storage ) );
+               memcpy( &( sorted[ found ] ), info->ai_addr,
+                       info->ai_addrlen );
+               taken[ found ] = 0;
+               found++;
+          }
+     }
+     freeaddrinfo( list );
+     if ( found == 0 )
+     {
+          errno = EHOSTUNREACH;
+          return ( -1 );
+     }
+
+     /* Take turns, starting with the family the resolver put first. */
+
+     first_family = sorted[ 0 ].ss_family;
+     other = ( ( first_family == AF_INET6 ) ? AF_INET : AF_INET6 );
+     count = 0;
+     while( count < found && count < max )
+     {
+          for( index = 0; index < found; index++ )
+          {
+               if ( taken[ index ] == 0 &&
+                    sorted[ index ].ss_family ==
+                    ( ( ( count % 2 ) == 0 ) ? first_family : other ) )
+               {
+                    break;
+               }
+          }
+          if ( index == found )  /* One family ran out. */
+          {
+               for( index = 0; taken[ index ] != 0; index++ )
+               {
+                    ;
+               }
+          }
+          taken[ index ] = 1;
+          memcpy( &( addrs[ count ] ), &( sorted[ index ] ),
+                  sizeof( struct sockaddr_storage ) );
+          count++;
+     }
+
+     return count;
+}
+
+/*
+
+     Races connects to the count addresses in addrs, starting each
+     one delay_ms after the one before it.  The whole race gives up
+     after CONNECT_TIMEOUT_MS, or when racing is turned off, each
+     attempt does.  What happened is stored in result, which may be
+     NULL.
+
+*/
+
+int he_race( const struct sockaddr_storage *addrs, const int count,
+             const int delay_ms, struct he_result *result )
+{
+     int error, fd, index, last_error, live, next, ready, ret;
+     int slot[ HE_MAX_ADDRS ], timeout, winner;
+     socklen_t size;
+     struct he_result local;
+     struct pollfd pfds[ HE_MAX_ADDRS ];
+     uint64_t deadline_ns, next_ns, now_ns, start_ns;
+
+     if ( addrs == NULL )
+     {
+          errno = EFAULT;
+          return ( -1 );
+     }
+     if ( count < 1 || count > HE_MAX_ADDRS )
+     {
+          errno = EINVAL;
+          return ( -1 );
+     }
+     if ( result == NULL )
+     {
+          result = &local;
+     }
+     memset( result, 0, sizeof( struct he_result ) );
+
+     start_ns = get_time_ns();
+     deadline_ns = start_ns + ( uint64_t )CONNECT_TIMEOUT_MS * 1000000ULL;
+     next_ns = start_ns;
+     last_error = ETIMEDOUT;
+     live = 0;
+     next = 0;
+     winner = ( -1 );
+
+     while( winner < 0 )
+     {
+          now_ns = get_time_ns();
+
+          /*
+
+               A race that ran out of time is over.  Without racing,
+               only the attempt in flight is, and the next one goes.
+
+          */
+
+          if ( now_ns >= deadline_ns )
+          {
+               last_error = ETIMEDOUT;
+               if ( delay_ms >= 0 || next == count )
+               {
+                    break;
+               }
+               close( pfds[ 0 ].fd );
+               result->failures++;
+               live = 0;
+          }
+
+          /* Start the next attempt if its turn has come. */
+
+          while( next < count && ( live == 0 ||
+                                   ( delay_ms >= 0 && now_ns >= next_ns ) ) )
+          {
+               result->attempts++;
+               fd = socket( addrs[ next ].ss_family,
+                            ( SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC ),
+                            0 );
+               if ( fd < 0 ||
+                    ( connect( fd, ( const struct sockaddr * )
+                                   ( &( addrs[ next ] ) ),
+                               he_addr_len( &( addrs[ next ] ) ) ) != 0 &&
+                      errno != EINPROGRESS ) )
+               {
+                    /* It failed outright, so go on to the next one. */
+
+                    last_error = errno;
+                    if ( fd >= 0 )
+                    {
+                         close( fd );
+                    }
+                    result->failures++;
+                    next++;
+                    continue;
+               }
+               pfds[ live ].fd = fd;
+               pfds[ live ].events = POLLOUT;
+               pfds[ live ].revents = 0;
+               slot[ live ] = next;
+               live++;
+               next++;
+               if ( delay_ms >= 0 )
+               {
+                    next_ns = now_ns + ( uint64_t )delay_ms * 1000000ULL;
+               }
+               else
+               {
+                    deadline_ns = now_ns +
+                                  ( uint64_t )CONNECT_TIMEOUT_MS * 1000000ULL;
+               }
+          }
+
+          if ( live == 0 )  /* Every address has failed. */
+          {
+               errno = last_error;
+               return ( -1 );
+          }
+
+          /* Wait until something finishes or the next turn comes. */
+
+          if ( next < count && delay_ms >= 0 && next_ns < deadline_ns )
+          {
+               timeout = ( ( next_ns > now_ns ) ?
+                           ( int )( ( next_ns - now_ns ) / 1000000ULL ) + 1 :
+                           0 );
+          }
+          else
+          {
+               timeout = ( int )( ( deadline_ns - now_ns ) / 1000000ULL ) + 1;
+          }
+          ready = poll( pfds, ( nfds_t )live, timeout );
+          if ( ready < 0 && errno != EINTR )
+          {
+               last_error = errno;
+               break;
+          }
+
+          for( index = 0; ready > 0 && index < live; index++ )
+          {
+               if ( pfds[ index ].revents == 0 )
+               {
+                    continue;
+               }
+               error = 0;
+               size = sizeof( error );
+               ret = getsockopt( pfds[ index ].fd, SOL_SOCKET, SO_ERROR,
+                                 &error, &size );
+               if ( ret == 0 && error == 0 )
+               {
+                    winner = index;
+                    break;
+               }
+
+               /* This one failed.  Drop it and let the next one go. */
+
+               last_error = ( ( ret != 0 ) ? errno : error );
+               close( pfds[ index ].fd );
+               result->failures++;
+               live--;
+               pfds[ index ] = pfds[ live ];
+               slot[ index ] = slot[ live ];
+               next_ns = now_ns;
+               index--;
+          }
+     }
+
+     /* Close every attempt that didn't win. */
+
+     for( index = 0; index < live; index++ )
+     {
+          if ( index != winner )
+          {
+               close( pfds[ index ].fd );
+          }
+     }
+     if ( winner < 0 )
+     {
+          errno = last_error;
+          return ( -1 );
+     }
+
+     result->elapsed_ns = get_time_ns() - start_ns;
+     result->winner = slot[ winner ];
+     result->family = addrs[ slot[ winner ] ].ss_family;
+     result->addr_len = he_addr_len( &( addrs[ slot[ winner ] ] ) );
+     memcpy( &( result->addr ), &( addrs[ slot[ winner ] ] ),
+             sizeof( struct sockaddr_storage ) );
+     errno = 0;
+     return pfds[ winner ].fd;
+}
+
+/* Looks up host and service and connects to it with he_race(). */
+
+int happy_eyeballs( const char *host, const char *service,
+                    const int delay_ms, struct he_result *result )
+{
+     int count;
+     struct sockaddr_storage addrs[ HE_MAX_ADDRS ];
+
+     count = he_resolve( host, service, addrs, HE_MAX_ADDRS );
+     if ( count < 1 )
+     {
+          return ( -1 );
+     }
+     return he_race( addrs, count, delay_ms, result );
+}
+
+#endif  /* _HAPPY_EYEBALLS_C */
+
+/* EOF happy_eyeballs.c */
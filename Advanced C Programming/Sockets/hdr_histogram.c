@@ -0,0 +1,177 @@
+/*
+
+     hdr_histogram.c
+
+     A log-linear histogram in the style of HdrHistogram for recording
+     latency samples without keeping every one of them.  Values below
+     2^sub_bits each get their own bucket.  Above that, every power of
+     2 is split into 2^( sub_bits - 1 ) equal buckets, so a value is
+     always recorded to within 1 part in 2^( sub_bits - 1 ) of what it
+     really was.  Values of 2^max_bits or more are counted in the last
+     bucket, and the exact minimum and maximum are kept on the side.
+
+     hdr_init() sets a histogram up, hdr_record() adds a sample,
+     hdr_value_at() returns the value at a percentile, and hdr_free()
+     releases the buckets.
+
+     Written by Matthew Campbell.
+
+*/
+
+#ifndef _HDR_HISTOGRAM_C
+#define _HDR_HISTOGRAM_C
+
+#include "sockets.h"
+
+/* Which bucket a value belongs in. */
+
+static int hdr_index( const struct hdr_hist *hist, const uint64_t value )
+{
+     int msb, shift;
+
+     if ( value < ( uint64_t )hist->full )
+     {
+          return ( int )value;
+     }
+
+     msb = 63 - __builtin_clzll( ( unsigned long long )value );
+     if ( msb >= hist->max_bits )
+     {
+          return hist->buckets - 1;
+     }
+     shift = msb - hist->sub_bits + 1;
+     return hist->full + ( ( shift - 1 ) * hist->half ) +
+            ( int )( ( value >> shift ) - ( uint64_t )hist->half );
+}
+
+/* The largest value that would land in a bucket. */
+
+static uint64_t hdr_highest( const struct hdr_hist *hist, const int index )
+{
+     int shift, top;
+
+     if ( index < hist->full )
+     {
+          return ( uint64_t )index;
+     }
+     shift = ( ( index - hist->full ) / hist->half ) + 1;
+     top = hist->half + ( ( index - hist->full ) % hist->half );
+     return ( ( ( uint64_t )top + 1 ) << shift ) - 1;
+}
+
+/*
+
+     Sets up an empty histogram.  sub_bits must be from 2 to 16 and
+     max_bits must be larger than sub_bits and no more than 63.
+     Returns 0 on success or -1 if an error occurs.
+
+*/
+
+int hdr_init( struct hdr_hist *hist, const int sub_bits, const int max_bits )
+{
+     if ( hist == NULL )
+     {
+          errno = EFAULT;
+          return ( -1 );
+     }
+     if ( sub_bits < 2 || sub_bits > 16 || max_bits <= sub_bits ||
+          max_bits > 63 )
+     {
+          errno = EINVAL;
+          return ( -1 );
+     }
+
+     memset( hist, 0, sizeof( struct hdr_hist ) );
+     hist->sub_bits = sub_bits;
+     hist->max_bits = max_bits;
+     hist->full = 1 << sub_bits;
+     hist->half = 1 << ( sub_bits - 1 );
+     hist->buckets = hist->full + ( ( max_bits - sub_bits ) * hist->half );
+     hist->min = UINT64_MAX;
+
+     hist->counts = calloc( ( size_t )hist->buckets, sizeof( uint64_t ) );
+     if ( hist->counts == NULL )
+     {
+          errno = ENOMEM;
+          return ( -1 );
+     }
+     return 0;
+}
+
+/* Adds one sample. */
+
+void hdr_record( struct hdr_hist *hist, const uint64_t value )
+{
+     hist->counts[ hdr_index( hist, value ) ]++;
+     hist->total++;
+     hist->sum += value;
+     if ( value < hist->min )
+     {
+          hist->min = value;
+     }
+     if ( value > hist->max )
+     {
+          hist->max = value;
+     }
+     return;
+}
+
+/*
+
+     Returns the value that pct percent of the samples are at or
+     below, such as 99.9 for the 99.9th percentile.  Since every
+     value in a bucket is counted as the largest one it could be,
+     this never reports less than the real percentile.  Returns 0 if
+     nothing has been recorded.
+
+*/
+
+uint64_t hdr_value_at( const struct hdr_hist *hist, const double pct )
+{
+     int index;
+     uint64_t seen, target, value;
+
+     if ( hist == NULL || hist->total == 0 )
+     {
+          return 0;
+     }
+
+     target = ( uint64_t )( ( pct / 100.0 ) * ( double )hist->total );
+     if ( ( double )target < ( pct / 100.0 ) * ( double )hist->total )
+     {
+          target++;  /* Round up. */
+     }
+     if ( target < 1 )
+     {
+          target = 1;
+     }
+
+     seen = 0;
+     for( index = 0; index < hist->buckets; index++ )
+     {
+          seen += hist->counts[ index ];
+          if ( seen >= target )
+          {
+               value = hdr_highest( hist, index );
+               return ( ( value > hist->max ) ? hist->max : value );
+          }
+     }
+     return hist->max;
+}
+
+/* Releases the buckets. */
+
+void hdr_free( struct hdr_hist *hist )
+{
+     if ( hist == NULL )
+     {
+          return;
+     }
+     free( hist->counts );
+     memset( hist, 0, sizeof( struct hdr_hist ) );
+     return;
+}
+
+#endif  /* _HDR_HISTOGRAM_C */
+
+/* EOF hdr_histogram.c */
@@ -0,0 +1,461 @@
+/*
+
+     io_pool.c
+
+     Functions for a pool of fixed-size buffers for socket I/O, all
+     carved out of one region of memory.  Since the region is one
+     piece it can be registered with io_uring(7) as a single fixed
+     buffer, or have its pages pinned for MSG_ZEROCOPY, once for the
+     life of the program instead of for every operation.  The
+     io_uring server registers it through io_pool_iovec() for TCP
+     peers, and zc_init() makes its zero-copy buffers out of it.  The
+     region is mapped with MAP_HUGETLB when there are reserved huge
+     pages, and otherwise aligned to IO_POOL_HUGE_PAGE and marked with
+     MADV_HUGEPAGE so the kernel can back it with transparent huge
+     pages, which means far fewer TLB entries and far fewer pages for
+     the kernel to pin.  Every page is touched up front so none
+     of them fault in the middle of a transfer.
+
+     io_buf_get() takes a buffer from the calling thread's cache,
+     which doesn't need a lock or an atomic operation.  When the
+     cache is empty it takes IO_POOL_BATCH buffers from the free list
+     shared by every thread, which is a lock-free stack, and when
+     io_buf_put() fills the cache it gives IO_POOL_BATCH back.  A
+     buffer can be put back by a different thread than the one that
+     got it.  io_pool_flush() gives back everything in the calling
+     thread's cache, and a thread that is about to exit should call
+     it so its buffers aren't lost.
+
+     Each buffer has a reference count that starts at 1.  To queue
+     the same data to several connections, fill one buffer and call
+     io_buf_ref() once for every extra connection, and have each of
+     them call io_buf_put() when it is done sending.  The buffer goes
+     back to the pool with the last one, and the data is never
+     copied.
+
+     There is one pool per process.  io_pool_init() and
+     io_pool_free() must not be called while any thread is using it.
+
+     Written by Matthew Campbell.
+
+*/
+
+#ifndef _IO_POOL_C
+#define _IO_POOL_C
+
+#include "sockets.h"
+
+/* The shared free list's head: a tag in the top half, index + 1 below. */
+
+#define POOL_HEAD( tag, index ) \
+     ( ( ( uint64_t )( tag ) << 32 ) | ( uint32_t )( ( index ) + 1 ) )
+#define POOL_INDEX( head ) ( ( int )( ( head ) & 0xffffffff ) - 1 )
+#define POOL_TAG( head ) ( ( head ) >> 32 )
+
+static struct io_buf *io_pool_bufs = NULL;
+static char *io_pool_area = NULL;
+static size_t io_pool_bytes = 0;
+static size_t io_pool_size = 0;
+static int io_pool_count = 0;
+static int io_pool_backing = IO_POOL_PAGES;
+static uint64_t io_pool_gen = 0;
+
+static _Atomic uint64_t io_pool_head;
+static _Atomic uint64_t io_pool_shared_free;
+static _Atomic uint64_t io_pool_refills;
+static _Atomic uint64_t io_pool_spills;
+static _Atomic uint64_t io_pool_exhausted;
+
+/* Each thread's own free buffers, and the pool they came from. */
+
+static _Thread_local int io_cache[ IO_POOL_CACHE ];
+static _Thread_local int io_cache_count = 0;
+static _Thread_local uint64_t io_cache_gen = 0;
+
+/*
+
+     Maps bytes bytes for the region, with huge pages if we can get
+     them, and sets io_pool_backing.  Returns the region or NULL if
+     an error occurs.
+
+*/
+
+static char *pool_map( const size_t bytes )
+{
+     char *area, *aligned;
+     size_t offset, page;
+
+#ifdef MAP_HUGETLB
+
+     area = mmap( NULL, bytes, ( PROT_READ | PROT_WRITE ),
+                  ( MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB |
+                    MAP_POPULATE ), ( -1 ), 0 );
+     if ( area != MAP_FAILED )
+     {
+          io_pool_backing = IO_POOL_HUGETLB;
+          return area;
+     }
+
+#endif
+
+     /* Map extra so the region can start on a huge page boundary. */
+
+     area = mmap( NULL, bytes + IO_POOL_HUGE_PAGE,
+                  ( PROT_READ | PROT_WRITE ),
+                  ( MAP_PRIVATE | MAP_ANONYMOUS ), ( -1 ), 0 );
+     if ( area == MAP_FAILED )
+     {
+          return NULL;
+     }
+     aligned = ( char * )( ( ( uintptr_t )area + IO_POOL_HUGE_PAGE - 1 ) &
+                           ~( ( uintptr_t )IO_POOL_HUGE_PAGE - 1 ) );
+     offset = ( size_t )( aligned - area );
+     if ( offset > 0 )
+     {
+          munmap( area, offset );
+     }
+     munmap( aligned + bytes, IO_POOL_HUGE_PAGE - offset );
+
+     io_pool_backing = IO_POOL_PAGES;
+
+#ifdef MADV_HUGEPAGE
+
+     if ( madvise( aligned, bytes, MADV_HUGEPAGE ) == 0 )
+     {
+          io_pool_backing = IO_POOL_THP;
+     }
+
+#endif
+
+     page = ( size_t )sysconf( _SC_PAGESIZE );
+     for( offset = 0; offset < bytes; offset += page )
+     {
+          aligned[ offset ] = 0;
+     }
+     return aligned;
+}
+
+/*
+
+     Maps a region for count buffers of size bytes each and puts them
+     all on the shared free list.  Returns 0 on success, or -1 with
+     errno set to EALREADY if there already is a pool, or -1 if any
+     other error occurs.
+
+*/
+
+int io_pool_init( const int count, const size_t size )
+{
+     int index;
+     size_t bytes, stride;
+
+     if ( count < 1 || count > ( 1 << 24 ) || size < 1 ||
+          size > ( 1 << 30 ) )
+     {
+          errno = EINVAL;
+          return ( -1 );
+     }
+     if ( io_pool_bufs != NULL )
+     {
+          errno = EALREADY;
+          return ( -1 );
+     }
+
+     /* Start every buffer on its own cache line. */
+
+     stride = ( size + 63 ) & ~( ( size_t )63 );
+     bytes = stride * ( size_t )count;
+     bytes = ( bytes + IO_POOL_HUGE_PAGE - 1 ) &
+             ~( ( size_t )IO_POOL_HUGE_PAGE - 1 );
+
+     io_pool_bufs = aligned_alloc( 64, ( size_t )count *
+                                       sizeof( struct io_buf ) );
+     if ( io_pool_bufs == NULL )
+     {
+          errno = ENOMEM;
+          return ( -1 );
+     }
+     io_pool_area = pool_map( bytes );
+     if ( io_pool_area == NULL )
+     {
+          free( io_pool_bufs );
+          io_pool_bufs = NULL;
+          errno = ENOMEM;
+          return ( -1 );
+     }
+
+     for( index = 0; index < count; index++ )
+     {
+          memset( &( io_pool_bufs[ index ] ), 0, sizeof( struct io_buf ) );
+          io_pool_bufs[ index ].index = index;
+          io_pool_bufs[ index ].data = io_pool_area +
+                                       ( size_t )index * stride;
+          atomic_init( &( io_pool_bufs[ index ].refs ), 0 );
+          atomic_init( &( io_pool_bufs[ index ].next ),
+                       ( ( index + 1 < count ) ? ( index + 1 ) : ( -1 ) ) );
+     }
+     io_pool_bytes = bytes;
+     io_pool_size = size;
+     io_pool_count = count;
+     io_pool_gen++;
+     atomic_store( &io_pool_head, POOL_HEAD( 0, 0 ) );
+     atomic_store( &io_pool_shared_free, ( uint64_t )count );
+     atomic_store( &io_pool_refills, 0 );
+     atomic_store( &io_pool_spills, 0 );
+     atomic_store( &io_pool_exhausted, 0 );
+
+     errno = 0;
+     return 0;
+}
+
+void io_pool_free( void )
+{
+     if ( io_pool_area != NULL )
+     {
+          munmap( io_pool_area, io_pool_bytes );
+     }
+     free( io_pool_bufs );
+     io_pool_bufs = NULL;
+     io_pool_area = NULL;
+     io_pool_bytes = 0;
+     io_pool_size = 0;
+     io_pool_count = 0;
+     io_cache_count = 0;
+     return;
+}
+
+/*
+
+     Describes the whole region, for io_uring_register(2) with
+     IORING_REGISTER_BUFFERS.  Returns 0 on success or -1 with errno
+     set to ENXIO if there is no pool.
+
+*/
+
+int io_pool_iovec( struct iovec *iov )
+{
+     if ( iov == NULL )
+     {
+          errno = EFAULT;
+          return ( -1 );
+     }
+     if ( io_pool_bufs == NULL )
+     {
+          errno = ENXIO;
+          return ( -1 );
+     }
+     iov->iov_base = io_pool_area;
+     iov->iov_len = io_pool_bytes;
+     return 0;
+}
+
+/*
+
+     Pushes a chain of count buffers, linked from first to last, onto
+     the shared free list.
+
+*/
+
+static void pool_push( const int first, const int last, const int count )
+{
+     uint64_t head, new_head;
+
+     head = atomic_load_explicit( &io_pool_head, memory_order_relaxed );
+     do
+     {
+          atomic_store_explicit( &( io_pool_bufs[ last ].next ),
+                                 POOL_INDEX( head ), memory_order_relaxed );
+          new_head = POOL_HEAD( POOL_TAG( head ) + 1, first );
+     }    while( atomic_compare_exchange_weak_explicit( &io_pool_head,
+                                                        &head, new_head,
+                                                        memory_order_release,
+                                                        memory_order_relaxed )
+                 == 0 );
+     atomic_fetch_add_explicit( &io_pool_shared_free, ( uint64_t )count,
+                                memory_order_relaxed );
+     return;
+}
+
+/*
+
+     Pops one buffer off the shared free list.  The tag changes with
+     every push and pop, so a head that was popped and pushed again
+     in between can't be mistaken for the one we read.  Returns its
+     index or -1 if the list is empty.
+
+*/
+
+static int pool_pop( void )
+{
+     int index, next;
+     uint64_t head, new_head;
+
+     head = atomic_load_explicit( &io_pool_head, memory_order_acquire );
+     do
+     {
+          index = POOL_INDEX( head );
+          if ( index < 0 )
+          {
+               return ( -1 );
+          }
+          next = atomic_load_explicit( &( io_pool_bufs[ index ].next ),
+                                       memory_order_relaxed );
+          new_head = POOL_HEAD( POOL_TAG( head ) + 1, next );
+     }    while( atomic_compare_exchange_weak_explicit( &io_pool_head,
+                                                        &head, new_head,
+                                                        memory_order_acquire,
+                                                        memory_order_acquire )
+                 == 0 );
+     return index;
+}
+
+/* Forgets a cache left over from a pool that has since been freed. */
+
+static void cache_check( void )
+{
+     if ( io_cache_gen != io_pool_gen )
+     {
+          io_cache_count = 0;
+          io_cache_gen = io_pool_gen;
+     }
+     return;
+}
+
+/* Gives back the newest count buffers in this thread's cache. */
+
+static void cache_spill( const int count )
+{
+     int first, index;
+
+     first = io_cache_count - count;
+     for( index = first; index < io_cache_count - 1; index++ )
+     {
+          atomic_store_explicit( &( io_pool_bufs[ io_cache[ index ] ].next ),
+                                 io_cache[ index + 1 ],
+                                 memory_order_relaxed );
+     }
+     pool_push( io_cache[ first ], io_cache[ io_cache_count - 1 ], count );
+     io_cache_count = first;
+     atomic_fetch_add_explicit( &io_pool_spills, 1, memory_order_relaxed );
+     return;
+}
+
+struct io_buf *io_buf_get( void )
+{
+     int index, taken;
+     struct io_buf *buf;
+
+     if ( io_pool_bufs == NULL )
+     {
+          errno = ENXIO;
+          return NULL;
+     }
+     cache_check();
+
+     if ( io_cache_count == 0 )
+     {
+          for( taken = 0; taken < IO_POOL_BATCH; taken++ )
+          {
+               index = pool_pop();
+               if ( index < 0 )
+               {
+                    break;
+               }
+               io_cache[ io_cache_count++ ] = index;
+          }
+          if ( taken == 0 )
+          {
+               atomic_fetch_add_explicit( &io_pool_exhausted, 1,
+                                          memory_order_relaxed );
+               errno = ENOBUFS;
+               return NULL;
+          }
+          atomic_fetch_sub_explicit( &io_pool_shared_free, ( uint64_t )taken,
+                                     memory_order_relaxed );
+          atomic_fetch_add_explicit( &io_pool_refills, 1,
+                                     memory_order_relaxed );
+     }
+
+     buf = &( io_pool_bufs[ io_cache[ --io_cache_count ] ] );
+     atomic_store_explicit( &( buf->refs ), 1, memory_order_relaxed );
+     buf->len = 0;
+     buf->user = NULL;
+     return buf;
+}
+
+void io_buf_ref( struct io_buf *buf )
+{
+     if ( buf == NULL )
+     {
+          return;
+     }
+     atomic_fetch_add_explicit( &( buf->refs ), 1, memory_order_relaxed );
+     return;
+}
+
+void io_buf_put( struct io_buf *buf )
+{
+     if ( buf == NULL || io_pool_bufs == NULL )
+     {
+          return;
+     }
+
+     /* Whoever lets go last has to see everyone else's writes. */
+
+     if ( atomic_fetch_sub_explicit( &( buf->refs ), 1,
+                                     memory_order_acq_rel ) != 1 )
+     {
+          return;
+     }
+
+     cache_check();
+     if ( io_cache_count == IO_POOL_CACHE )
+     {
+          cache_spill( IO_POOL_BATCH );
+     }
+     io_cache[ io_cache_count++ ] = buf->index;
+     return;
+}
+
+void io_pool_flush( void )
+{
+     if ( io_pool_bufs == NULL )
+     {
+          return;
+     }
+     cache_check();
+     if ( io_cache_count > 0 )
+     {
+          cache_spill( io_cache_count );
+     }
+     return;
+}
+
+void io_pool_get_stats( struct io_pool_stats *stats )
+{
+     if ( stats == NULL )
+     {
+          return;
+     }
+     memset( stats, 0, sizeof( struct io_pool_stats ) );
+     if ( io_pool_bufs == NULL )
+     {
+          return;
+     }
+     cache_check();
+
+     stats->count = io_pool_count;
+     stats->backing = io_pool_backing;
+     stats->size = io_pool_size;
+     stats->bytes = io_pool_bytes;
+     stats->shared_free = atomic_load( &io_pool_shared_free );
+     stats->cached = ( uint64_t )io_cache_count;
+     stats->refills = atomic_load( &io_pool_refills );
+     stats->spills = atomic_load( &io_pool_spills );
+     stats->exhausted = atomic_load( &io_pool_exhausted );
+     return;
+}
+
+#endif  /* _IO_POOL_C */
+
+/* EOF io_pool.c */
@@ -0,0 +1,1502 @@
+/*
+
+     io_uring_engine.c
+
+     An io_uring(7) version of the multi-connection server, plus a
+     helper that connects a batch of client sockets with one system
+     call.  The rings are set up with the raw io_uring_setup(2),
+     io_uring_enter(2) and io_uring_register(2) system calls so
+     liburing isn't needed.
+
+     run_uring_server() keeps one multishot accept and one multishot
+     recv per connection armed at all times.  The data lands in a
+     ring of buffers the kernel picks from on its own, and the echoes
+     are sent straight out of those same buffers.  The buffers come
+     from the pool in io_pool.c, so they sit on huge pages when the
+     system has them.  When more than one buffer is waiting to go out
+     on a connection the sends are linked so they are written in
+     order, and they are all submitted along with the wait for the
+     next completions in a single call to io_uring_enter(2).  A busy
+     server ends up making a handful of system calls per batch
+     instead of several per message.
+
+     For TCP the pool's whole region is also registered with the ring
+     as a fixed buffer, and the echoes to peers on other machines go
+     out with IORING_OP_SEND_ZC straight from it.  The kernel doesn't
+     have to pin their pages for each send or copy them.  A plain
+     IORING_OP_SEND can't use a fixed buffer.  A buffer sent this way
+     only goes back to the kernel's ring once the notification that
+     the kernel is done with it comes in.  Peers that came in over
+     loopback get copies as before, since the kernel would copy the
+     data for them anyway, and a local receiver with a small window
+     can stall zero-copy segments for a long time.  If the region
+     can't be registered every peer gets copies.
+
+     A connection whose peer isn't reading its echoes fast enough
+     only gets to hold URING_CONN_HOLD of the buffers.  Anything more
+     it receives is copied into a spill queue in the connection's own
+     arena and the buffer is given straight back, and the spill is
+     sent once the buffers ahead of it have gone.  The queue is a
+     list of segments that never move, so a send can be reading one
+     while more is added behind it.  Segments that have been sent are
+     used again, the queue is limited to NB_MAX_QUEUE bytes like an
+     nb_conn's, and the whole arena is reset when the connection
+     closes.
+
+     The signalfd from sig_events_open(), when there is one, is
+     polled through the ring as well.  Signals are counted when it
+     fires, and SIGTERM stops the server with ECANCELED.
+
+     Like the epoll(7) server, it keeps every connection it accepts
+     in conn_table_main() until the connection is closed, and with
+     SAMPLE_TCP_INFO it has the TCP_INFO sampler watch its TCP peers.
+
+     Written by Matthew Campbell.
+
+*/
+
+#ifndef _IO_URING_ENGINE_C
+#define _IO_URING_ENGINE_C
+
+#include "sockets.h"
+
+#ifdef USE_IO_URING
+
+/* The kinds of requests, kept in the top byte of each user_data. */
+
+#define TAG_ACCEPT  1ULL
+#define TAG_RECV    2ULL
+#define TAG_SEND    3ULL
+#define TAG_CTL     4ULL
+#define TAG_CONNECT 5ULL
+#define TAG_SIG     6ULL
+
+/* The buffer group ID used for the provided buffer ring. */
+
+#define URING_BGID 1
+
+#if URING_BUF_SIZE > IO_POOL_BUF_SIZE || URING_BUF_COUNT > IO_POOL_BUFS
+#error The io_uring buffers have to fit in the I/O buffer pool.
+#endif
+
+/*
+
+     The buffer ID a send from a connection's spill queue carries,
+     and how much each segment of the queue holds, which leaves room
+     for two segments and their headers in an arena chunk.
+
+*/
+
+#define URING_SPILL_BID 0xffff
+#define URING_SPILL_SEG ( ARENA_CHUNK_SIZE / 2 - 64 )
+
+#if URING_BUF_COUNT >= URING_SPILL_BID
+#error The io_uring buffer IDs have to leave room for URING_SPILL_BID.
+#endif
+
+/*
+
+     user_data layout: tag (8 bits), generation (16 bits), buffer ID
+     (16 bits) and file descriptor (24 bits).  The generation lets us
+     ignore completions for a connection that has since been closed
+     and had its file descriptor reused.
+
+*/
+
+#define MAKE_DATA( tag, gen, bid, fd ) \
+     ( ( ( uint64_t )( tag ) << 56 ) | \
+       ( ( uint64_t )( ( gen ) & 0xffff ) << 40 ) | \
+       ( ( uint64_t )( ( bid ) & 0xffff ) << 24 ) | \
+       ( uint64_t )( ( fd ) & 0xffffff ) )
+
+#define DATA_TAG( data ) ( ( int )( ( data ) >> 56 ) )
+#define DATA_GEN( data ) ( ( int )( ( ( data ) >> 40 ) & 0xffff ) )
+#define DATA_BID( data ) ( ( int )( ( ( data ) >> 24 ) & 0xffff ) )
+#define DATA_FD( data )  ( ( int )( ( data ) & 0xffffff ) )
+
+/* A submission queue and a completion queue mapped from the kernel. */
+
+struct uring
+{
+     int fd;
+     unsigned sq_entries;
+     unsigned sq_tail;          /* Our copy of the tail, not yet shared. */
+     unsigned to_submit;        /* Entries queued since the last enter.  */
+     unsigned *sq_head, *sq_ktail, *sq_mask, *sq_array;
+     unsigned *cq_head, *cq_tail, *cq_mask;
+     struct io_uring_sqe *sqes;
+     struct io_uring_cqe *cqes;
+     void *sq_ptr, *cq_ptr;
+     size_t sq_len, cq_len, sqes_len;
+     uint64_t enters;           /* Calls to io_uring_enter(2).           */
+};
+
+/* A piece of a connection's spill queue. */
+
+struct spill_seg
+{
+     struct spill_seg *next;
+     size_t len;      /* Bytes in data.                          */
+     size_t pos;      /* How many of those have been sent.       */
+     char data[ URING_SPILL_SEG ];
+};
+
+/* Per connection state, indexed by the connection's file descriptor. */
+
+struct uring_conn
+{
+     int open;
+     int gen;
+     int recv_armed;  /* A multishot recv is outstanding.        */
+     int inflight;    /* Sends submitted but not completed yet.  */
+     int head, tail;  /* Buffers waiting to be echoed, in order. */
+     int dirty;       /* Already on the list of things to do.    */
+     int held;        /* Ring buffers it has, queued or sent.    */
+     int zc;          /* Echo with SEND_ZC from the pool.        */
+     int tcp_slot;    /* The sampler's slot for it, or -1.       */
+     struct spill_seg *spill;       /* Oldest data copied out of the
+                                       ring, or NULL.              */
+     struct spill_seg *spill_tail;
+     struct spill_seg *spill_free;  /* Sent segments to reuse.     */
+     size_t spill_bytes;            /* Taken from arena for them.  */
+     struct arena arena;
+};
+
+/* The receive buffers handed to the kernel. */
+
+struct uring_bufs
+{
+     struct io_uring_buf_ring *ring;
+     size_t ring_len;
+     struct io_buf **buf;  /* The pool buffer for each buffer ID. */
+     int *next;       /* Links buffers waiting on one connection. */
+     int *len;        /* How much data each buffer holds.         */
+     unsigned tail;
+     int free;        /* Buffers the kernel can still pick from.  */
+     int fixed;       /* The pool is registered for SEND_ZC.      */
+};
+
+static int sys_uring_setup( unsigned entries, struct io_uring_params *p )
+{
+     return ( int )syscall( __NR_io_uring_setup, entries, p );
+}
+
+static int sys_uring_enter( int fd, unsigned to_submit,
+                            unsigned min_complete, unsigned flags )
+{
+     return ( int )syscall( __NR_io_uring_enter, fd, to_submit,
+                            min_complete, flags, NULL, 0 );
+}
+
+static int sys_uring_register( int fd, unsigned opcode, void *arg,
+                               unsigned nr_args )
+{
+     return ( int )syscall( __NR_io_uring_register, fd, opcode, arg,
+                            nr_args );
+}
+
+/* Unmaps the rings and closes the io_uring file descriptor. */
+
+static void uring_exit( struct uring *ring )
+{
+     if ( ring->sqes != NULL && ring->sqes != MAP_FAILED )
+     {
+          munmap( ring->sqes, ring->sqes_len );
+     }
+     if ( ring->cq_ptr != NULL && ring->cq_ptr != MAP_FAILED &&
+          ring->cq_ptr != ring->sq_ptr )
+     {
+          munmap( ring->cq_ptr, ring->cq_len );
+     }
+     if ( ring->sq_ptr != NULL && ring->sq_ptr != MAP_FAILED )
+     {
+          munmap( ring->sq_ptr, ring->sq_len );
+     }
+     if ( ring->fd >= 0 )
+     {
+          close( ring->fd );
+     }
+     memset( ring, 0, sizeof( struct uring ) );
+     ring->fd = ( -1 );
+     return;
+}
+
+/* Creates a ring.  Returns 0 on success or -1 if an error occurs. */
+
+static int uring_init( struct uring *ring, const unsigned entries )
+{
+     char *sq, *cq;
+     int save_errno;
+     struct io_uring_params params;
+
+     memset( ring, 0, sizeof( struct uring ) );
+     memset( &params, 0, sizeof( params ) );
+
+     /* Leave plenty of room for multishot completions to pile up. */
+
+     params.flags = IORING_SETUP_CQSIZE;
+     params.cq_entries = entries * 4;
+
+     ring->fd = sys_uring_setup( entries, &params );
+     if ( ring->fd < 0 )
+     {
+          return ( -1 );
+     }
+
+     ring->sq_len = params.sq_off.array +
+                    ( params.sq_entries * sizeof( unsigned ) );
+     ring->cq_len = params.cq_off.cqes +
+                    ( params.cq_entries * sizeof( struct io_uring_cqe ) );
+     if ( params.features & IORING_FEAT_SINGLE_MMAP )
+     {
+          if ( ring->cq_len > ring->sq_len )
+          {
+               ring->sq_len = ring->cq_len;
+          }
+          ring->cq_len = ring->sq_len;
+     }
+
+     ring->sq_ptr = mmap( NULL, ring->sq_len, ( PROT_READ | PROT_WRITE ),
+                          ( MAP_SHARED | MAP_POPULATE ), ring->fd,
+                          IORING_OFF_SQ_RING );
+     if ( ring->sq_ptr == MAP_FAILED )
+     {
+          save_errno = errno;
+          uring_exit( ring );
+          errno = save_errno;
+          return ( -1 );
+     }
+
+     if ( params.features & IORING_FEAT_SINGLE_MMAP )
+     {
+          ring->cq_ptr = ring->sq_ptr;
+     }
+     else
+     {
+          ring->cq_ptr = mmap( NULL, ring->cq_len,
+                               ( PROT_READ | PROT_WRITE ),
+                               ( MAP_SHARED | MAP_POPULATE ), ring->fd,
+                               IORING_OFF_CQ_RING );
+          if ( ring->cq_ptr == MAP_FAILED )
+          {
+               save_errno = errno;
+               uring_exit( ring );
+               errno = save_errno;
+               return ( -1 );
+          }
+     }
+
+     ring->sqes_len = params.sq_entries * sizeof( struct io_uring_sqe );
+     ring->sqes = mmap( NULL, ring->sqes_len, ( PROT_READ | PROT_WRITE ),
+                        ( MAP_SHARED | MAP_POPULATE ), ring->fd,
+                        IORING_OFF_SQES );
+     if ( ring->sqes == MAP_FAILED )
+     {
+          save_errno = errno;
+          uring_exit( ring );
+          errno = save_errno;
+          return ( -1 );
+     }
+
+     sq = ( char * )ring->sq_ptr;
+     cq = ( char * )ring->cq_ptr;
+     ring->sq_head = ( unsigned * )( sq + params.sq_off.head );
+     ring->sq_ktail = ( unsigned * )( sq + params.sq_off.tail );
+     ring->sq_mask = ( unsigned * )( sq + params.sq_off.ring_mask );
+     ring->sq_array = ( unsigned * )( sq + params.sq_off.array );
+     ring->cq_head = ( unsigned * )( cq + params.cq_off.head );
+     ring->cq_tail = ( unsigned * )( cq + params.cq_off.tail );
+     ring->cq_mask = ( unsigned * )( cq + params.cq_off.ring_mask );
+     ring->cqes = ( struct io_uring_cqe * )( cq + params.cq_off.cqes );
+     ring->sq_entries = params.sq_entries;
+     ring->sq_tail = *( ring->sq_ktail );
+
+     return 0;
+}
+
+/*
+
+     Submits everything queued so far and waits for at least
+     wait_nr completions.  Returns 0 on success or -1 if an
+     error occurs.
+
+*/
+
+static int uring_submit( struct uring *ring, const unsigned wait_nr )
+{
+     int ret;
+
+     __atomic_store_n( ring->sq_ktail, ring->sq_tail, __ATOMIC_RELEASE );
+
+     for( ; ; )
+     {
+          ring->enters++;
+          ret = sys_uring_enter( ring->fd, ring->to_submit, wait_nr,
+                                 ( ( wait_nr > 0 ) ?
+                                   IORING_ENTER_GETEVENTS : 0 ) );
+          if ( ret >= 0 )
+          {
+               ring->to_submit -= ( unsigned )ret;
+               return 0;
+          }
+          if ( errno != EINTR )
+          {
+               return ( -1 );
+          }
+          if ( wait_nr == 0 )
+          {
+               continue;
+          }
+          return 0;  /* A signal woke us up, just go look. */
+     }
+}
+
+/*
+
+     Returns a cleared submission queue entry, submitting what is
+     already queued first if the ring is full.  Returns NULL if an
+     error occurs.
+
+*/
+
+static struct io_uring_sqe *uring_get_sqe( struct uring *ring )
+{
+     struct io_uring_sqe *sqe;
+     unsigned head, index;
+
+     head = __atomic_load_n( ring->sq_head, __ATOMIC_ACQUIRE );
+     if ( ( ring->sq_tail - head ) >= ring->sq_entries )
+     {
+          if ( uring_submit( ring, 0 ) != 0 )
+          {
+               return NULL;
+          }
+          head = __atomic_load_n( ring->sq_head, __ATOMIC_ACQUIRE );
+          if ( ( ring->sq_tail - head ) >= ring->sq_entries )
+          {
+               errno = EBUSY;
+               return NULL;
+          }
+     }
+
+     index = ring->sq_tail & *( ring->sq_mask );
+     sqe = &( ring->sqes[ index ] );
+     memset( sqe, 0, sizeof( struct io_uring_sqe ) );
+     ring->sq_array[ index ] = index;
+     ring->sq_tail++;
+     ring->to_submit++;
+     return sqe;
+}
+
+/* Gives a buffer back to the kernel so it can receive into it again. */
+
+static void bufs_return( struct uring_bufs *bufs, const int bid )
+{
+     struct io_uring_buf *buf;
+
+     buf = &( bufs->ring->bufs[ bufs->tail & ( URING_BUF_COUNT - 1 ) ] );
+     buf->addr = ( uint64_t )( uintptr_t )bufs->buf[ bid ]->data;
+     buf->len = URING_BUF_SIZE;
+     buf->bid = ( uint16_t )bid;
+     bufs->tail++;
+     __atomic_store_n( &( bufs->ring->tail ), ( uint16_t )bufs->tail,
+                       __ATOMIC_RELEASE );
+     bufs->free++;
+     return;
+}
+
+/* Frees the receive buffers. */
+
+static void bufs_free( struct uring_bufs *bufs )
+{
+     int bid;
+
+     if ( bufs->ring != NULL && ( void * )bufs->ring != MAP_FAILED )
+     {
+          munmap( bufs->ring, bufs->ring_len );
+     }
+     if ( bufs->buf != NULL )
+     {
+          for( bid = 0; bid < URING_BUF_COUNT; bid++ )
+          {
+               io_buf_put( bufs->buf[ bid ] );
+          }
+          free( bufs->buf );
+          io_pool_flush();
+     }
+     free( bufs->next );
+     free( bufs->len );
+     memset( bufs, 0, sizeof( struct uring_bufs ) );
+     return;
+}
+
+/*
+
+     Takes the receive buffers from the I/O buffer pool, setting the
+     pool up first if nothing has yet, and registers them with the
+     ring as a provided buffer ring.  If fixed is 1 the pool's region
+     is registered as fixed buffer 0 as well, when the kernel lets
+     us.  Returns 0 on success or -1 if an error occurs.
+
+*/
+
+static int bufs_init( struct uring *ring, struct uring_bufs *bufs,
+                      const int fixed )
+{
+     int bid, save_errno;
+     struct io_uring_buf_reg reg;
+     struct iovec iov;
+
+     memset( bufs, 0, sizeof( struct uring_bufs ) );
+
+     if ( io_pool_init( IO_POOL_BUFS, IO_POOL_BUF_SIZE ) != 0 &&
+          errno != EALREADY )
+     {
+          return ( -1 );
+     }
+
+     bufs->ring_len = URING_BUF_COUNT * sizeof( struct io_uring_buf );
+     bufs->ring = mmap( NULL, bufs->ring_len, ( PROT_READ | PROT_WRITE ),
+                        ( MAP_PRIVATE | MAP_ANONYMOUS ), ( -1 ), 0 );
+     bufs->buf = calloc( URING_BUF_COUNT, sizeof( struct io_buf * ) );
+     bufs->next = calloc( URING_BUF_COUNT, sizeof( int ) );
+     bufs->len = calloc( URING_BUF_COUNT, sizeof( int ) );
+     if ( ( void * )bufs->ring == MAP_FAILED || bufs->buf == NULL ||
+          bufs->next == NULL || bufs->len == NULL )
+     {
+          bufs_free( bufs );
+          errno = ENOMEM;
+          return ( -1 );
+     }
+     for( bid = 0; bid < URING_BUF_COUNT; bid++ )
+     {
+          bufs->buf[ bid ] = io_buf_get();
+          if ( bufs->buf[ bid ] == NULL )
+          {
+               bufs_free( bufs );
+               errno = ENOBUFS;
+               return ( -1 );
+          }
+     }
+
+     memset( &reg, 0, sizeof( reg ) );
+     reg.ring_addr = ( uint64_t )( uintptr_t )bufs->ring;
+     reg.ring_entries = URING_BUF_COUNT;
+     reg.bgid = URING_BGID;
+     if ( sys_uring_register( ring->fd, IORING_REGISTER_PBUF_RING,
+                              &reg, 1 ) != 0 )
+     {
+          save_errno = errno;
+          bufs_free( bufs );
+          errno = save_errno;
+          return ( -1 );
+     }
+
+     /* Pinning the region can fail under RLIMIT_MEMLOCK.  That's OK. */
+
+     if ( fixed == 1 && io_pool_iovec( &iov ) == 0 &&
+          sys_uring_register( ring->fd, IORING_REGISTER_BUFFERS,
+                              &iov, 1 ) == 0 )
+     {
+          bufs->fixed = 1;
+     }
+
+     for( bid = 0; bid < URING_BUF_COUNT; bid++ )
+     {
+          bufs_return( bufs, bid );
+     }
+     return 0;
+}
+
+/* Queues a multishot accept on the listening socket. */
+
+static int arm_accept( struct uring *ring, const int lsock_fd )
+{
+     struct io_uring_sqe *sqe;
+
+     sqe = uring_get_sqe( ring );
+     if ( sqe == NULL )
+     {
+          return ( -1 );
+     }
+     sqe->opcode = IORING_OP_ACCEPT;
+     sqe->fd = lsock_fd;
+     sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+     sqe->accept_flags = SOCK_CLOEXEC;
+     sqe->user_data = MAKE_DATA( TAG_ACCEPT, 0, 0, 0 );
+     return 0;
+}
+
+/* Queues a poll for the signalfd.  It has to be queued again each time. */
+
+static int arm_signals( struct uring *ring, const int sig_fd )
+{
+     struct io_uring_sqe *sqe;
+
+     sqe = uring_get_sqe( ring );
+     if ( sqe == NULL )
+     {
+          return ( -1 );
+     }
+     sqe->opcode = IORING_OP_POLL_ADD;
+     sqe->fd = sig_fd;
+     sqe->poll32_events = POLLIN;
+     sqe->user_data = MAKE_DATA( TAG_SIG, 0, 0, 0 );
+     return 0;
+}
+
+/* Queues a multishot recv that picks its own buffers. */
+
+static int arm_recv( struct uring *ring, const int fd,
+                     struct uring_conn *conn )
+{
+     struct io_uring_sqe *sqe;
+
+     sqe = uring_get_sqe( ring );
+     if ( sqe == NULL )
+     {
+          return ( -1 );
+     }
+     sqe->opcode = IORING_OP_RECV;
+     sqe->fd = fd;
+     sqe->ioprio = IORING_RECV_MULTISHOT;
+     sqe->flags = IOSQE_BUFFER_SELECT;
+     sqe->buf_group = URING_BGID;
+     sqe->user_data = MAKE_DATA( TAG_RECV, conn->gen, 0, fd );
+     conn->recv_armed = 1;
+     return 0;
+}
+
+/*
+
+     Sends every buffer waiting on a connection.  The sends are
+     linked together so the kernel won't start one until the one
+     before it has finished, which keeps the echo in order.
+
+*/
+
+static int send_chain( struct uring *ring, struct uring_bufs *bufs,
+                       const int fd, struct uring_conn *conn )
+{
+     int bid;
+     struct io_uring_sqe *sqe;
+
+     while( conn->head >= 0 )
+     {
+          bid = conn->head;
+          sqe = uring_get_sqe( ring );
+          if ( sqe == NULL )
+          {
+               return ( -1 );
+          }
+          sqe->opcode = IORING_OP_SEND;
+          sqe->fd = fd;
+          sqe->addr = ( uint64_t )( uintptr_t )bufs->buf[ bid ]->data;
+          sqe->len = ( uint32_t )bufs->len[ bid ];
+          sqe->msg_flags = MSG_NOSIGNAL | MSG_WAITALL;
+          sqe->user_data = MAKE_DATA( TAG_SEND, conn->gen, bid, fd );
+          if ( conn->zc == 1 )
+          {
+               sqe->opcode = IORING_OP_SEND_ZC;
+               sqe->ioprio = IORING_RECVSEND_FIXED_BUF;
+               sqe->buf_index = 0;
+          }
+
+          conn->head = bufs->next[ bid ];
+          if ( conn->head >= 0 )
+          {
+               sqe->flags = IOSQE_IO_LINK;
+          }
+          conn->inflight++;
+     }
+     conn->tail = ( -1 );
+     return 0;
+}
+
+/*
+
+     Says whether a connection came in from another machine, going
+     by the address it was accepted on.  Returns 1 if it did, or 0 if
+     it came in over loopback or we can't tell.
+
+*/
+
+static int conn_remote( const int fd )
+{
+     socklen_t len;
+     struct sockaddr_in *sin;
+     struct sockaddr_in6 *sin6;
+     struct sockaddr_storage addr;
+
+     len = sizeof( addr );
+     if ( getsockname( fd, ( struct sockaddr * )&addr, &len ) != 0 )
+     {
+          return 0;
+     }
+     if ( addr.ss_family == AF_INET )
+     {
+          sin = ( struct sockaddr_in * )&addr;
+          return ( ( ntohl( sin->sin_addr.s_addr ) >> 24 ) != 127 );
+     }
+     if ( addr.ss_family == AF_INET6 )
+     {
+          sin6 = ( struct sockaddr_in6 * )&addr;
+          if ( IN6_IS_ADDR_V4MAPPED( &( sin6->sin6_addr ) ) )
+          {
+               return ( sin6->sin6_addr.s6_addr[ 12 ] != 127 );
+          }
+          return ( IN6_IS_ADDR_LOOPBACK( &( sin6->sin6_addr ) ) == 0 );
+     }
+     return 0;
+}
+
+/* Sends what is waiting in a connection's spill queue. */
+
+static int send_spill( struct uring *ring, const int fd,
+                       struct uring_conn *conn )
+{
+     struct io_uring_sqe *sqe;
+
+     sqe = uring_get_sqe( ring );
+     if ( sqe == NULL )
+     {
+          return ( -1 );
+     }
+     sqe->opcode = IORING_OP_SEND;
+     sqe->fd = fd;
+     sqe->addr = ( uint64_t )( uintptr_t )&( conn->spill->data[
+                                                  conn->spill->pos ] );
+     sqe->len = ( uint32_t )( conn->spill->len - conn->spill->pos );
+     sqe->msg_flags = MSG_NOSIGNAL | MSG_WAITALL;
+     sqe->user_data = MAKE_DATA( TAG_SEND, conn->gen, URING_SPILL_BID, fd );
+     conn->inflight++;
+     return 0;
+}
+
+/*
+
+     Copies data onto the end of a connection's spill queue.  Only
+     the end of the queue is ever written, so a send of what is
+     already there can still be in flight.  Returns 0 on success or
+     -1 if an error occurs.
+
+*/
+
+static int spill_data( struct uring_conn *conn, const char *data,
+                       size_t len )
+{
+     size_t room;
+     struct spill_seg *seg;
+
+     while( len > 0 )
+     {
+          seg = conn->spill_tail;
+          if ( seg == NULL || seg->len == URING_SPILL_SEG )
+          {
+               seg = conn->spill_free;
+               if ( seg != NULL )
+               {
+                    conn->spill_free = seg->next;
+               }
+               else
+               {
+                    if ( ( conn->spill_bytes + sizeof( struct spill_seg ) ) >
+                         NB_MAX_QUEUE )
+                    {
+                         errno = ENOBUFS;
+                         return ( -1 );
+                    }
+                    seg = arena_alloc( &( conn->arena ),
+                                       sizeof( struct spill_seg ) );
+                    if ( seg == NULL )
+                    {
+                         return ( -1 );
+                    }
+                    conn->spill_bytes += sizeof( struct spill_seg );
+               }
+               seg->next = NULL;
+               seg->len = 0;
+               seg->pos = 0;
+               if ( conn->spill_tail != NULL )
+               {
+                    conn->spill_tail->next = seg;
+               }
+               else
+               {
+                    conn->spill = seg;
+               }
+               conn->spill_tail = seg;
+          }
+
+          room = URING_SPILL_SEG - seg->len;
+          if ( room > len )
+          {
+               room = len;
+          }
+          memcpy( &( seg->data[ seg->len ] ), data, room );
+          seg->len += room;
+          data += room;
+          len -= room;
+     }
+     return 0;
+}
+
+/* Counts what a spill send got out, and reuses a segment it emptied. */
+
+static void spill_sent( struct uring_conn *conn, const size_t len )
+{
+     struct spill_seg *seg;
+
+     seg = conn->spill;
+     if ( seg == NULL )
+     {
+          return;
+     }
+     seg->pos += len;
+     if ( seg->pos < seg->len )
+     {
+          return;
+     }
+
+     conn->spill = seg->next;
+     if ( conn->spill == NULL )
+     {
+          conn->spill_tail = NULL;
+     }
+     seg->next = conn->spill_free;
+     conn->spill_free = seg;
+     return;
+}
+
+/*
+
+     Closes a connection.  shutdown(2) makes its multishot recv
+     finish, and any buffers still waiting to be echoed go back to
+     the kernel right away.  Sends that are still in flight give
+     their buffers back when they complete.  A spill send still in
+     flight fails on the shut down socket without reading from the
+     arena, so the arena can be reset right away.
+
+*/
+
+static void close_uring_conn( const int fd, struct uring_conn *conn,
+                              struct uring_bufs *bufs,
+                              struct tcp_sampler *sampler,
+                              struct server_stats *stats,
+                              uint64_t *open_now )
+{
+     int bid;
+
+     if ( conn->tcp_slot >= 0 )
+     {
+          if ( tcp_sampler_drop( sampler, conn->tcp_slot ) > 0 )
+          {
+               stats->tcp_flagged++;
+          }
+          conn->tcp_slot = ( -1 );
+     }
+     shutdown( fd, SHUT_RDWR );
+     metrics_forget( fd );
+     conn_remove_fd( conn_table_main(), fd );
+     close( fd );
+     while( conn->head >= 0 )
+     {
+          bid = conn->head;
+          conn->head = bufs->next[ bid ];
+          bufs_return( bufs, bid );
+     }
+     conn->tail = ( -1 );
+     conn->open = 0;
+     conn->recv_armed = 0;
+     conn->held = 0;
+     arena_reset( &( conn->arena ) );
+     conn->spill = NULL;
+     conn->spill_tail = NULL;
+     conn->spill_free = NULL;
+     conn->spill_bytes = 0;
+     ( *open_now )--;
+     return;
+}
+
+/*
+
+     Checks whether the kernel supports everything run_uring_server()
+     needs.  Returns 1 if it does or 0 if it doesn't.
+
+*/
+
+int uring_available( void )
+{
+     int ok;
+     size_t size;
+     struct io_uring_probe *probe;
+     struct uring ring;
+     struct uring_bufs bufs;
+
+     if ( uring_init( &ring, 8 ) != 0 )
+     {
+          return 0;
+     }
+
+     /*
+
+          Multishot recv came along in the same release as
+          IORING_OP_SEND_ZC, so use that to tell if it's there.
+
+     */
+
+     ok = 0;
+     size = sizeof( struct io_uring_probe ) +
+            ( 256 * sizeof( struct io_uring_probe_op ) );
+     probe = calloc( 1, size );
+     if ( probe != NULL )
+     {
+          if ( sys_uring_register( ring.fd, IORING_REGISTER_PROBE,
+                                   probe, 256 ) == 0 &&
+               probe->last_op >= IORING_OP_SEND_ZC &&
+               ( probe->ops[ IORING_OP_SEND_ZC ].flags &
+                 IO_URING_OP_SUPPORTED ) != 0 )
+          {
+               ok = 1;
+          }
+          free( probe );
+     }
+
+     if ( ok == 1 )
+     {
+          if ( bufs_init( &ring, &bufs, 0 ) == 0 )
+          {
+               bufs_free( &bufs );
+          }
+          else
+          {
+               ok = 0;
+          }
+     }
+
+     uring_exit( &ring );
+     return ok;
+}
+
+/*
+
+     Connects count client sockets to target.  All of the connects
+     are submitted with a single system call.  Returns the number of
+     sockets that got connected or -1 if an error occurs.
+
+*/
+
+int uring_connect_all( const int *sock_fds, const int count,
+                       const struct sockaddr *target,
+                       const socklen_t target_len )
+{
+     int connected, done, index, save_errno;
+     struct io_uring_cqe *cqe;
+     struct io_uring_sqe *sqe;
+     struct uring ring;
+     unsigned head;
+
+     if ( sock_fds == NULL || target == NULL )
+     {
+          errno = EFAULT;
+          return ( -1 );
+     }
+     if ( count < 1 || target_len < 1 )
+     {
+          errno = EINVAL;
+          return ( -1 );
+     }
+
+     if ( uring_init( &ring, URING_ENTRIES ) != 0 )
+     {
+          return ( -1 );
+     }
+
+     connected = 0;
+     done = 0;
+     index = 0;
+     while( done < count )
+     {
+          /* Queue as many as will fit in the ring. */
+
+          while( index < count &&
+                 ( ring.sq_tail - *( ring.sq_head ) ) < ring.sq_entries &&
+                 ( index - done ) < ( int )( ring.sq_entries * 2 ) )
+          {
+               sqe = uring_get_sqe( &ring );
+               if ( sqe == NULL )
+               {
+                    break;
+               }
+               sqe->opcode = IORING_OP_CONNECT;
+               sqe->fd = sock_fds[ index ];
+               sqe->addr = ( uint64_t )( uintptr_t )target;
+               sqe->off = target_len;
+               sqe->user_data = MAKE_DATA( TAG_CONNECT, 0, 0, index );
+               index++;
+          }
+
+          if ( uring_submit( &ring, 1 ) != 0 )
+          {
+               save_errno = errno;
+               uring_exit( &ring );
+               errno = save_errno;
+               return ( -1 );
+          }
+
+          head = *( ring.cq_head );
+          while( head != __atomic_load_n( ring.cq_tail, __ATOMIC_ACQUIRE ) )
+          {
+               cqe = &( ring.cqes[ head & *( ring.cq_mask ) ] );
+               if ( cqe->res == 0 )
+               {
+                    connected++;
+               }
+               done++;
+               head++;
+          }
+          __atomic_store_n( ring.cq_head, head, __ATOMIC_RELEASE );
+     }
+
+     uring_exit( &ring );
+     errno = 0;
+     return connected;
+}
+
+int run_uring_server( const int lsock_fd, const int ctl_fd,
+                      struct server_stats *stats )
+{
+     int bid, count, family, fd, index, max_conns, ndirty, ret, save_errno;
+     int sig_fd, stop, tag, term;
+     int *dirty;
+     struct conn_table *table;
+     struct io_uring_cqe *cqe;
+     struct io_uring_sqe *sqe;
+     struct uring ring;
+     struct uring_bufs bufs;
+     struct tcp_sampler sampler;
+     struct uring_conn *conn, *conns;
+     uint64_t data, open_now, start_ns;
+     unsigned head;
+
+     if ( lsock_fd < 0 || ctl_fd < 0 )
+     {
+          errno = EINVAL;
+          return ( -1 );
+     }
+     if ( stats == NULL )
+     {
+          errno = EFAULT;
+          return ( -1 );
+     }
+
+     memset( stats, 0, sizeof( struct server_stats ) );
+     memset( &sampler, 0, sizeof( sampler ) );
+
+     /* Make room for as many connections as we're allowed to open. */
+
+     max_conns = raise_fd_limit();
+     if ( max_conns < 0 )
+     {
+          return ( -1 );
+     }
+     if ( max_conns > 0xffffff )
+     {
+          max_conns = 0xffffff;
+     }
+
+     /* Connections share the listening socket's family. */
+
+     table = conn_table_main();
+     if ( table == NULL )
+     {
+          return ( -1 );
+     }
+     family = sock_family( lsock_fd );
+
+     conns = calloc( ( size_t )max_conns, sizeof( struct uring_conn ) );
+     dirty = calloc( ( size_t )max_conns, sizeof( int ) );
+     if ( conns == NULL || dirty == NULL )
+     {
+          free( conns );
+          free( dirty );
+          errno = ENOMEM;
+          return ( -1 );
+     }
+     for( fd = 0; fd < max_conns; fd++ )
+     {
+          conns[ fd ].head = ( -1 );
+          conns[ fd ].tail = ( -1 );
+     }
+
+     if ( uring_init( &ring, URING_ENTRIES ) != 0 )
+     {
+          save_errno = errno;
+          free( dirty );
+          free( conns );
+          errno = save_errno;
+          return ( -1 );
+     }
+     if ( bufs_init( &ring, &bufs,
+                     ( family == AF_INET || family == AF_INET6 ) ) != 0 )
+     {
+          save_errno = errno;
+          uring_exit( &ring );
+          free( dirty );
+          free( conns );
+          errno = save_errno;
+          return ( -1 );
+     }
+
+     /* Watch ctl_fd and start accepting. */
+
+     ret = ( -1 );
+     sqe = uring_get_sqe( &ring );
+     if ( sqe != NULL )
+     {
+          sqe->opcode = IORING_OP_POLL_ADD;
+          sqe->fd = ctl_fd;
+          sqe->poll32_events = POLLIN;
+          sqe->user_data = MAKE_DATA( TAG_CTL, 0, 0, 0 );
+          ret = arm_accept( &ring, lsock_fd );
+     }
+     sig_fd = sig_events_fd();
+     if ( ret == 0 && sig_fd >= 0 )
+     {
+          ret = arm_signals( &ring, sig_fd );
+     }
+     if ( ret != 0 )
+     {
+          save_errno = errno;
+          bufs_free( &bufs );
+          uring_exit( &ring );
+          free( dirty );
+          free( conns );
+          errno = save_errno;
+          return ( -1 );
+     }
+
+#ifdef DEBUG
+
+     /* On stderr, so it stays out of the benchmark tables. */
+
+     fprintf( stderr,
+              "The multi-connection server is running on io_uring%s.\n",
+              ( ( bufs.fixed == 1 ) ?
+                ", with registered buffers for remote peers" : "" ) );
+
+#endif
+
+     ndirty = 0;
+     open_now = 0;
+     start_ns = get_time_ns();
+     stop = 0;
+     term = 0;
+     save_errno = 0;
+
+     /* Hold SIGTERM for the signalfd while the loop can hear it. */
+
+     sig_events_hold();
+
+     while( stop == 0 )
+     {
+          /* Submit everything from the last pass and wait for more. */
+
+          if ( uring_submit( &ring, 1 ) != 0 )
+          {
+               save_errno = errno;
+               ret = ( -1 );
+               break;
+          }
+
+          head = *( ring.cq_head );
+          while( head != __atomic_load_n( ring.cq_tail, __ATOMIC_ACQUIRE ) )
+          {
+               cqe = &( ring.cqes[ head & *( ring.cq_mask ) ] );
+               data = cqe->user_data;
+               tag = DATA_TAG( data );
+               fd = DATA_FD( data );
+               conn = NULL;
+               if ( tag == TAG_RECV || tag == TAG_SEND )
+               {
+                    conn = &( conns[ fd ] );
+                    if ( conn->open == 0 || conn->gen != DATA_GEN( data ) )
+                    {
+                         conn = NULL;  /* It's from a closed connection. */
+                    }
+               }
+
+               if ( tag == TAG_CTL )
+               {
+                    stop = 1;
+               }
+               else if ( tag == TAG_SIG )
+               {
+                    if ( sig_events_read() == 1 )
+                    {
+                         stop = 1;
+                         term = 1;
+                    }
+                    else if ( arm_signals( &ring, sig_fd ) != 0 )
+                    {
+                         stats->errors++;
+                    }
+               }
+               else if ( tag == TAG_ACCEPT )
+               {
+                    if ( cqe->res >= 0 )
+                    {
+                         fd = cqe->res;
+                         if ( fd >= max_conns ||
+                              conn_insert( table, fd, CONN_ROLE_PEER, family,
+                                           SOCK_STREAM, NULL ) != 0 )
+                         {
+                              close( fd );
+                              stats->errors++;
+                         }
+                         else
+                         {
+                              metrics_inherit( fd, lsock_fd );
+                              conn = &( conns[ fd ] );
+                              conn->open = 1;
+                              conn->gen = ( conn->gen + 1 ) & 0xffff;
+                              conn->inflight = 0;
+                              conn->head = ( -1 );
+                              conn->tail = ( -1 );
+                              conn->recv_armed = 0;
+                              conn->held = 0;
+                              conn->zc = ( bufs.fixed == 1 &&
+                                           conn_remote( fd ) == 1 );
+                              conn->tcp_slot = ( -1 );
+                              arena_init( &( conn->arena ) );
+
+#ifdef SAMPLE_TCP_INFO
+
+                              if ( family == AF_INET || family == AF_INET6 )
+                              {
+                                   conn->tcp_slot =
+                                        tcp_sampler_watch( &sampler, fd,
+                                                           family,
+                                                           max_conns );
+                                   if ( conn->tcp_slot >= 0 )
+                                   {
+                                        stats->tcp_watched++;
+                                   }
+                              }
+
+#endif
+
+                              if ( conn->dirty == 0 )
+                              {
+                                   conn->dirty = 1;
+                                   dirty[ ndirty++ ] = fd;
+                              }
+                              stats->accepted++;
+                              open_now++;
+                              if ( open_now > stats->max_open )
+                              {
+                                   stats->max_open = open_now;
+                              }
+                         }
+                    }
+                    else if ( cqe->res == ( -EINVAL ) &&
+                              stats->accepted == 0 )
+                    {
+                         /* No multishot accept in this kernel. */
+
+                         save_errno = EOPNOTSUPP;
+                         ret = ( -1 );
+                         stop = 1;
+                    }
+                    else if ( cqe->res != ( -EAGAIN ) &&
+                              cqe->res != ( -ECONNABORTED ) &&
+                              cqe->res != ( -EINTR ) )
+                    {
+                         stats->errors++;
+                    }
+
+                    if ( ( cqe->flags & IORING_CQE_F_MORE ) == 0 &&
+                         stop == 0 )
+                    {
+                         if ( arm_accept( &ring, lsock_fd ) != 0 )
+                         {
+                              save_errno = errno;
+                              ret = ( -1 );
+                              stop = 1;
+                         }
+                    }
+               }
+               else if ( tag == TAG_RECV )
+               {
+                    bid = ( -1 );
+                    if ( cqe->flags & IORING_CQE_F_BUFFER )
+                    {
+                         bid = ( int )( cqe->flags >> IORING_CQE_BUFFER_SHIFT );
+                         bufs.free--;
+                    }
+
+                    if ( conn == NULL )
+                    {
+                         if ( bid >= 0 )
+                         {
+                              bufs_return( &bufs, bid );
+                         }
+                    }
+                    else if ( cqe->res > 0 && bid >= 0 )
+                    {
+                         stats->bytes_in += ( uint64_t )cqe->res;
+                         metrics_count( fd, METRIC_BYTES_IN,
+                                        ( uint64_t )cqe->res );
+                         if ( conn->spill == NULL &&
+                              conn->held < URING_CONN_HOLD )
+                         {
+                              /* Queue the data to be echoed. */
+
+                              bufs.len[ bid ] = cqe->res;
+                              bufs.next[ bid ] = ( -1 );
+                              if ( conn->tail >= 0 )
+                              {
+                                   bufs.next[ conn->tail ] = bid;
+                              }
+                              else
+                              {
+                                   conn->head = bid;
+                              }
+                              conn->tail = bid;
+                              conn->held++;
+                         }
+                         else if ( spill_data( conn, bufs.buf[ bid ]->data,
+                                               ( size_t )cqe->res ) == 0 )
+                         {
+                              bufs_return( &bufs, bid );
+                         }
+                         else
+                         {
+                              bufs_return( &bufs, bid );
+                              stats->errors++;
+                              metrics_count( fd, METRIC_ERRORS, 1 );
+                              close_uring_conn( fd, conn, &bufs, &sampler,
+                                                stats, &open_now );
+                              conn = NULL;
+                         }
+                    }
+                    else if ( cqe->res == 0 )  /* The peer hung up. */
+                    {
+                         stats->closed++;
+                         close_uring_conn( fd, conn, &bufs, &sampler, stats,
+                                          &open_now );
+                         conn = NULL;
+                    }
+                    else if ( cqe->res != ( -ENOBUFS ) )
+                    {
+                         stats->errors++;
+                         metrics_count( fd, METRIC_ERRORS, 1 );
+                         close_uring_conn( fd, conn, &bufs, &sampler, stats,
+                                          &open_now );
+                         conn = NULL;
+                    }
+
+                    if ( conn != NULL )
+                    {
+                         if ( ( cqe->flags & IORING_CQE_F_MORE ) == 0 )
+                         {
+                              conn->recv_armed = 0;
+                         }
+                         if ( conn->dirty == 0 )
+                         {
+                              conn->dirty = 1;
+                              dirty[ ndirty++ ] = fd;
+                         }
+                    }
+               }
+               else if ( tag == TAG_SEND &&
+                         ( cqe->flags & IORING_CQE_F_NOTIF ) != 0 )
+               {
+                    /* The kernel is done with a SEND_ZC's buffer. */
+
+                    bufs_return( &bufs, DATA_BID( data ) );
+               }
+               else if ( tag == TAG_SEND )
+               {
+                    /* With IORING_CQE_F_MORE, a notification follows. */
+
+                    bid = DATA_BID( data );
+                    if ( bid != URING_SPILL_BID &&
+                         ( cqe->flags & IORING_CQE_F_MORE ) == 0 )
+                    {
+                         bufs_return( &bufs, bid );
+                    }
+                    if ( conn != NULL )
+                    {
+                         conn->inflight--;
+                         if ( bid != URING_SPILL_BID )
+                         {
+                              conn->held--;
+                         }
+                         if ( cqe->res < 0 )
+                         {
+                              if ( cqe->res != ( -ECANCELED ) )
+                              {
+                                   stats->errors++;
+                                   metrics_count( fd, METRIC_ERRORS, 1 );
+                              }
+                              close_uring_conn( fd, conn, &bufs, &sampler,
+                                                stats, &open_now );
+                         }
+                         else
+                         {
+                              stats->bytes_out += ( uint64_t )cqe->res;
+                              metrics_count( fd, METRIC_BYTES_OUT,
+                                             ( uint64_t )cqe->res );
+                              if ( bid == URING_SPILL_BID )
+                              {
+                                   spill_sent( conn, ( size_t )cqe->res );
+                              }
+                              if ( conn->inflight == 0 &&
+                                   ( conn->head >= 0 ||
+                                     conn->spill != NULL ) &&
+                                   conn->dirty == 0 )
+                              {
+                                   conn->dirty = 1;
+                                   dirty[ ndirty++ ] = fd;
+                              }
+                         }
+                    }
+               }
+
+               head++;
+
+          }    /* while( head != cq_tail ) */
+
+          __atomic_store_n( ring.cq_head, head, __ATOMIC_RELEASE );
+
+          /*
+
+               Send what came in and rearm any recv that stopped.
+               A recv that ran out of buffers stays on the list until
+               some are given back.
+
+          */
+
+          count = ndirty;
+          ndirty = 0;
+          for( index = 0; index < count && ret == 0; index++ )
+          {
+               fd = dirty[ index ];
+               conn = &( conns[ fd ] );
+               conn->dirty = 0;
+               if ( conn->open == 0 )
+               {
+                    continue;
+               }
+               if ( conn->inflight == 0 && conn->head >= 0 )
+               {
+                    if ( send_chain( &ring, &bufs, fd, conn ) != 0 )
+                    {
+                         save_errno = errno;
+                         ret = ( -1 );
+                         break;
+                    }
+               }
+               else if ( conn->inflight == 0 && conn->spill != NULL )
+               {
+                    /* The spill goes once the buffers ahead of it have. */
+
+                    if ( send_spill( &ring, fd, conn ) != 0 )
+                    {
+                         save_errno = errno;
+                         ret = ( -1 );
+                         break;
+                    }
+               }
+               if ( conn->recv_armed == 0 )
+               {
+                    if ( bufs.free > 0 )
+                    {
+                         if ( arm_recv( &ring, fd, conn ) != 0 )
+                         {
+                              save_errno = errno;
+                              ret = ( -1 );
+                              break;
+                         }
+                    }
+                    else
+                    {
+                         conn->dirty = 1;
+                         dirty[ ndirty++ ] = fd;
+                    }
+               }
+          }
+          if ( ret != 0 )
+          {
+               break;
+          }
+
+     }    /* while( stop == 0 ) */
+     sig_events_release();
+
+     stats->elapsed_ns = get_time_ns() - start_ns;
+     stats->syscalls = ring.enters;
+     if ( term == 1 && ret == 0 )
+     {
+          ret = ( -1 );
+          save_errno = ECANCELED;
+     }
+
+     /* Close whatever is still open. */
+
+     for( fd = 0; fd < max_conns; fd++ )
+     {
+          if ( conns[ fd ].open == 1 )
+          {
+               close_uring_conn( fd, &( conns[ fd ] ), &bufs, &sampler,
+                                 stats, &open_now );
+          }
+     }
+
+     /* Closing the ring cancels anything still outstanding. */
+
+     tcp_sampler_free( &sampler );
+     uring_exit( &ring );
+     bufs_free( &bufs );
+     free( dirty );
+     free( conns );
+     arena_release();
+
+     if ( ret != 0 )
+     {
+          errno = save_errno;
+          return ( -1 );
+     }
+
+     errno = 0;
+     return 0;
+}
+
+#else  /* USE_IO_URING */
+
+int uring_available( void )
+{
+     return 0;
+}
+
+int uring_connect_all( const int *sock_fds, const int count,
+                       const struct sockaddr *target,
+                       const socklen_t target_len )
+{
+     errno = ENOSYS;
+     return ( -1 );
+}
+
+int run_uring_server( const int lsock_fd, const int ctl_fd,
+                      struct server_stats *stats )
+{
+     errno = ENOSYS;
+     return ( -1 );
+}
+
+#endif  /* USE_IO_URING */
+
+#endif  /* _IO_URING_ENGINE_C */
+
+/* EOF io_uring_engine.c */
@@ -1,7 +1,8 @@
 /*
 
      list_sockets.c
-     This function lists the socket file descriptor numbers.
+     This function lists the socket file descriptor numbers, and
+     then every connection in conn_table_main(), up to LIST_MAX.
      Written by Matthew Campbell.
 
 */
@@ -11,8 +12,40 @@
 
 #include "sockets.h"
 
+/* The most connections to show one by one. */
+
+#define LIST_MAX 32
+
+static const char *role_name( const int role )
+{
+     switch( role )
+     {
+          case CONN_ROLE_CLIENT:   return "client";
+          case CONN_ROLE_LISTENER: return "listener";
+          case CONN_ROLE_SERVER:   return "server";
+          default:                 return "peer";
+     }
+}
+
+static const char *type_name( const int sock_type )
+{
+     switch( sock_type )
+     {
+          case SOCK_STREAM:    return "stream";
+          case SOCK_DGRAM:     return "dgram";
+          case SOCK_SEQPACKET: return "seqpacket";
+          case SOCK_SHM_RING:  return "ring";
+          default:             return "other";
+     }
+}
+
 void list_sockets( int *csock_fd, int *lsock_fd, int *ssock_fd )
 {
+     int cursor, shown;
+     struct conn_rec *rec;
+     struct conn_table *table;
+     uint64_t now_ns;
+
      if ( csock_fd == NULL || lsock_fd == NULL || ssock_fd == NULL )
      {
           printf( "\nNull pointer passed to list_sockets().\n\n" );
@@ -21,6 +54,39 @@ void list_sockets( int *csock_fd, int *lsock_fd, int *ssock_fd )
      }
      printf( "\n*csock_fd: %d, *lsock_fd: %d, *ssock_fd: %d.\n\n",
              *csock_fd, *lsock_fd, *ssock_fd );
+
+     table = conn_table_main();
+     if ( table == NULL || table->live == 0 )
+     {
+          errno = 0;
+          return;
+     }
+
+     printf( "\
+Connection table: %d open, %d slab%s of %d records (%zu KB).\n\n\
+Handle             Fd  Role      Domain     Type       Open for\n",
+             table->live, table->slabs, ( ( table->slabs == 1 ) ? "" : "s" ),
+             CONN_SLAB_RECORDS, ( ( size_t )table->slabs *
+                                  CONN_SLAB_RECORDS *
+                                  sizeof( struct conn_rec ) ) / 1024 );
+
+     now_ns = get_time_ns();
+     cursor = 0;
+     shown = 0;
+     while( shown < LIST_MAX && ( rec = conn_next( table, &cursor ) ) != NULL )
+     {
+          printf( "%016" PRIx64 " %4d  %-9s %-10s %-10s %.3f ms\n",
+                  rec->handle, rec->fd, role_name( rec->role ),
+                  family_name( rec->domain ), type_name( rec->sock_type ),
+                  ( double )( now_ns - rec->open_ns ) / 1e6 );
+          shown++;
+     }
+     if ( table->live > shown )
+     {
+          printf( "And %d more.\n", table->live - shown );
+     }
+     printf( "\n" );
+
      errno = 0;
      return;
 }
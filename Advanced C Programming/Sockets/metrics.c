@@ -0,0 +1,801 @@
+/*
+
+     metrics.c
+
+     Functions for counting what each connection does and serving
+     the counts in Prometheus's text format on an AF_UNIX socket.
+
+     The counters live in a shared anonymous mapping made by
+     metrics_init(), so processes forked later, such as the
+     throughput sender, the prefork workers and the shards, count into
+     the same place.  Every thread of every one of those processes
+     takes a block of its own the first time it counts anything, and
+     within a block each connection's counters start on a cache line
+     of their own.  A counter only ever has one writer, so adding to
+     it is a plain load and store with no locked instruction, and no
+     two threads ever write to the same cache line.  If more than
+     METRICS_BLOCKS - 1 threads count, the rest share the last block
+     and add to it atomically instead.  Reading sums every block.
+
+     A connection is a label, such as "client", in a socket domain.
+     metrics_track() looks up or registers the connection for a label
+     and the domain of sock_fd, and routes sock_fd's counts to it.
+     metrics_track_family() takes the domain from its caller, which
+     is how the shared memory ring, which has no socket to ask, ends
+     up under AF_SHM_RING.
+     The connections are shared, but the routing belongs to the
+     process, since another process's descriptor with the same
+     number is a different socket.  A child starts with a copy of
+     its parent's, just as it starts with copies of its sockets.
+     A multi-connection server can have far more peers than
+     METRICS_CONNS, so they are all routed with metrics_inherit(),
+     which gives a new socket the same connection as the socket it
+     came from, to one "peers" connection in the listener's domain.
+     Only descriptors below METRICS_FDS, the most raise_fd_limit()
+     ever allows, can be routed.  metrics_forget()
+     stops routing a descriptor that is being closed.  The totals for
+     each domain are served as well as those for each connection.
+
+     metrics_io() is called after each send or receive with what it
+     returned.  It counts the system call, and the bytes moved or the
+     error, if it was a real one.  metrics_count() adds to any other
+     counter.  Counts for a descriptor that isn't tracked, or made
+     before metrics_init(), are ignored, and none of these change
+     errno.
+
+     metrics_serve() starts a thread that accepts connections on
+     name, an abstract name with USE_ABSTRACT_AF_UNIX or otherwise a
+     socket file in USE_DIR, and writes every counter to each one.  A
+     client that sends an HTTP GET first gets an HTTP response, so
+     a scraper can read it with curl --abstract-unix-socket, and one
+     that just connects gets the bare text.  metrics_stop() stops the
+     thread.
+
+     metrics_init(), metrics_serve() and metrics_stop() return 0 on
+     success and metrics_track() and metrics_track_family() return
+     the connection's number.
+     They return -1 if an error occurs.
+
+     Written by Matthew Campbell.
+
+*/
+
+#ifndef _METRICS_C
+#define _METRICS_C
+
+#include "sockets.h"
+
+/* One connection's counters in one block. */
+
+struct metrics_row
+{
+     _Alignas( 64 ) _Atomic uint64_t value[ METRICS_COUNTERS ];
+};
+
+struct metrics_block
+{
+     struct metrics_row rows[ METRICS_CONNS ];
+};
+
+struct metrics_conn
+{
+     _Atomic int ready;          /* 1 once family and label are set.   */
+     int family;
+     char label[ 16 ];
+};
+
+struct metrics_shared
+{
+     _Atomic int registering;    /* Held while a connection is added.  */
+     _Atomic uint32_t blocks_used;
+     _Atomic uint64_t scrapes;
+     struct metrics_conn conns[ METRICS_CONNS ];
+     struct metrics_block blocks[ METRICS_BLOCKS ];
+};
+
+/* The counters, described the way Prometheus wants them. */
+
+static const struct
+{
+     const char *name;
+     const char *help;
+     int in;                     /* Counter for direction="in", or    */
+     int out;                    /* the only one if out is -1.        */
+}    metric_families[] =
+{
+     { "bytes_total", "Bytes sent and received.",
+       METRIC_BYTES_IN, METRIC_BYTES_OUT },
+     { "messages_total", "Whole messages sent and received.",
+       METRIC_MSGS_IN, METRIC_MSGS_OUT },
+     { "syscalls_total", "Send and receive system calls made.",
+       METRIC_SYSCALLS, ( -1 ) },
+     { "errors_total", "Send and receive calls that failed.",
+       METRIC_ERRORS, ( -1 ) },
+     { "reconnects_total", "Times the connection was replaced.",
+       METRIC_RECONNECTS, ( -1 ) }
+};
+
+static struct metrics_shared *metrics_map = NULL;
+
+/* Descriptors are numbered per process, so each has its own routing. */
+
+static _Atomic uint8_t metrics_fds[ METRICS_FDS ];  /* Connection + 1. */
+static _Thread_local struct metrics_block *metrics_mine = NULL;
+static _Thread_local int metrics_sharing = 0;
+
+static char *metrics_text = NULL;
+static char metrics_path[ 108 ];
+static int metrics_fd = ( -1 );
+static int metrics_running = 0;
+static _Atomic int metrics_stopping;
+static pthread_t metrics_thread;
+
+/* A forked child has its own threads, and none of ours. */
+
+static void metrics_child( void )
+{
+     metrics_mine = NULL;
+     metrics_sharing = 0;
+     if ( metrics_fd >= 0 )
+     {
+          close( metrics_fd );
+          metrics_fd = ( -1 );
+     }
+     metrics_path[ 0 ] = 0;  /* The file is the parent's to remove. */
+     metrics_running = 0;
+}
+
+int metrics_init( void )
+{
+     int ret;
+
+     if ( metrics_map != NULL )
+     {
+          errno = EBUSY;
+          return ( -1 );
+     }
+
+     metrics_map = mmap( NULL, sizeof( struct metrics_shared ),
+                         ( PROT_READ | PROT_WRITE ),
+                         ( MAP_SHARED | MAP_ANONYMOUS ), -1, 0 );
+     if ( metrics_map == MAP_FAILED )
+     {
+          metrics_map = NULL;
+          return ( -1 );
+     }
+
+     ret = pthread_atfork( NULL, NULL, metrics_child );
+     if ( ret != 0 )
+     {
+          munmap( metrics_map, sizeof( struct metrics_shared ) );
+          metrics_map = NULL;
+          errno = ret;
+          return ( -1 );
+     }
+
+     errno = 0;
+     return 0;
+}
+
+void metrics_add( const int conn, const int counter, const uint64_t value )
+{
+     _Atomic uint64_t *slot;
+     uint32_t index;
+
+     if ( metrics_map == NULL || conn < 0 || conn >= METRICS_CONNS ||
+          counter < 0 || counter >= METRICS_COUNTERS )
+     {
+          return;
+     }
+
+     if ( metrics_mine == NULL )
+     {
+          index = atomic_fetch_add( &( metrics_map->blocks_used ), 1 );
+          if ( index >= METRICS_BLOCKS - 1 )
+          {
+               index = METRICS_BLOCKS - 1;
+               metrics_sharing = 1;
+          }
+          metrics_mine = &( metrics_map->blocks[ index ] );
+     }
+
+     slot = &( metrics_mine->rows[ conn ].value[ counter ] );
+     if ( metrics_sharing == 1 )
+     {
+          atomic_fetch_add_explicit( slot, value, memory_order_relaxed );
+     }
+     else
+     {
+          atomic_store_explicit( slot, atomic_load_explicit( slot,
+                                 memory_order_relaxed ) + value,
+                                 memory_order_relaxed );
+     }
+}
+
+void metrics_count( const int sock_fd, const int counter,
+                    const uint64_t value )
+{
+     if ( metrics_map == NULL || sock_fd < 0 || sock_fd >= METRICS_FDS )
+     {
+          return;
+     }
+     metrics_add( ( int )atomic_load_explicit( &( metrics_fds[
+                                               sock_fd ] ),
+                                               memory_order_relaxed ) - 1,
+                  counter, value );
+}
+
+void metrics_io( const int sock_fd, const int counter, const ssize_t result )
+{
+     int conn;
+
+     if ( metrics_map == NULL || sock_fd < 0 || sock_fd >= METRICS_FDS )
+     {
+          return;
+     }
+     conn = ( int )atomic_load_explicit( &( metrics_fds[ sock_fd ] ),
+                                         memory_order_relaxed ) - 1;
+     if ( conn < 0 )
+     {
+          return;
+     }
+
+     metrics_add( conn, METRIC_SYSCALLS, 1 );
+     if ( result > 0 )
+     {
+          metrics_add( conn, counter, ( uint64_t )result );
+     }
+     else if ( result < 0 && errno != EAGAIN && errno != EWOULDBLOCK &&
+               errno != EINTR )
+     {
+          metrics_add( conn, METRIC_ERRORS, 1 );
+     }
+}
+
+/* Returns the connection's number. */
+
+int metrics_track( const int sock_fd, const char *label )
+{
+     return metrics_track_family( sock_fd, label, sock_family( sock_fd ) );
+}
+
+/* The same, for a caller that already knows the family. */
+
+int metrics_track_family( const int sock_fd, const char *label,
+                          const int family )
+{
+     int conn, expected, free_conn;
+
+     if ( label == NULL )
+     {
+          errno = EFAULT;
+          return ( -1 );
+     }
+     if ( sock_fd < 0 || label[ 0 ] == 0 )
+     {
+          errno = EINVAL;
+          return ( -1 );
+     }
+     if ( metrics_map == NULL )
+     {
+          errno = ENODEV;
+          return ( -1 );
+     }
+
+     /* Only one process or thread adds a connection at a time. */
+
+     expected = 0;
+     while( atomic_compare_exchange_weak( &( metrics_map->registering ),
+                                          &expected, 1 ) == 0 )
+     {
+          expected = 0;
+          sched_yield();
+     }
+
+     free_conn = ( -1 );
+     for( conn = 0; conn < METRICS_CONNS; conn++ )
+     {
+          if ( atomic_load( &( metrics_map->conns[ conn ].ready ) ) == 0 )
+          {
+               if ( free_conn < 0 )
+               {
+                    free_conn = conn;
+               }
+               continue;
+          }
+          if ( metrics_map->conns[ conn ].family == family &&
+               strcmp( metrics_map->conns[ conn ].label, label ) == 0 )
+          {
+               break;
+          }
+     }
+     if ( conn == METRICS_CONNS && free_conn >= 0 )
+     {
+          conn = free_conn;
+          metrics_map->conns[ conn ].family = family;
+          snprintf( metrics_map->conns[ conn ].label,
+                    sizeof( metrics_map->conns[ conn ].label ), "%s",
+                    label );
+          atomic_store( &( metrics_map->conns[ conn ].ready ), 1 );
+     }
+     atomic_store( &( metrics_map->registering ), 0 );
+
+     if ( conn == METRICS_CONNS )
+     {
+          errno = ENOSPC;
+          return ( -1 );
+     }
+     if ( sock_fd < METRICS_FDS )
+     {
+          atomic_store( &( metrics_fds[ sock_fd ] ),
+                        ( uint8_t )( conn + 1 ) );
+     }
+
+     errno = 0;
+     return conn;
+}
+
+void metrics_inherit( const int sock_fd, const int from_fd )
+{
+     if ( metrics_map == NULL || sock_fd < 0 || sock_fd >= METRICS_FDS ||
+          from_fd < 0 || from_fd >= METRICS_FDS )
+     {
+          return;
+     }
+     atomic_store_explicit( &( metrics_fds[ sock_fd ] ),
+                            atomic_load_explicit( &( metrics_fds[
+                                                  from_fd ] ),
+                                                  memory_order_relaxed ),
+                            memory_order_relaxed );
+}
+
+void metrics_forget( const int sock_fd )
+{
+     if ( metrics_map == NULL || sock_fd < 0 || sock_fd >= METRICS_FDS )
+     {
+          return;
+     }
+     atomic_store_explicit( &( metrics_fds[ sock_fd ] ), 0,
+                            memory_order_relaxed );
+}
+
+/* Adds up one counter of one connection across every block. */
+
+static uint64_t metrics_total( const int conn, const int counter )
+{
+     int index;
+     uint64_t total;
+
+     total = 0;
+     for( index = 0; index < METRICS_BLOCKS; index++ )
+     {
+          total += atomic_load_explicit( &( metrics_map->blocks[ index ].
+                                            rows[ conn ].value[ counter ] ),
+                                         memory_order_relaxed );
+     }
+     return total;
+}
+
+/* Adds up one counter across the connections in a family. */
+
+static uint64_t metrics_family_total( const int family, const int counter )
+{
+     int conn;
+     uint64_t total;
+
+     total = 0;
+     for( conn = 0; conn < METRICS_CONNS; conn++ )
+     {
+          if ( atomic_load( &( metrics_map->conns[ conn ].ready ) ) == 1 &&
+               metrics_map->conns[ conn ].family == family )
+          {
+               total += metrics_total( conn, counter );
+          }
+     }
+     return total;
+}
+
+/*
+
+     Returns the address family of a socket, or AF_UNSPEC if it isn't
+     one, like a shared memory ring end, which is a memfd.  errno is
+     left alone.
+
+*/
+
+int sock_family( const int sock_fd )
+{
+     int family, save_errno;
+     socklen_t opt_len;
+
+     save_errno = errno;
+     family = AF_UNSPEC;
+     opt_len = sizeof( family );
+     if ( getsockopt( sock_fd, SOL_SOCKET, SO_DOMAIN, &family,
+                      &opt_len ) != 0 )
+     {
+          family = AF_UNSPEC;
+     }
+     errno = save_errno;
+     return family;
+}
+
+/* Names an address family the way the reports and list_sockets() do. */
+
+const char *family_name( const int family )
+{
+     switch( family )
+     {
+          case AF_BLUETOOTH: return "bluetooth";
+          case AF_INET:      return "inet";
+          case AF_INET6:     return "inet6";
+          case AF_UNIX:      return "unix";
+          case AF_SHM_RING:  return "shm";
+          case AF_UNSPEC:    return "unspec";
+          default:           return "other";
+     }
+}
+
+/* Appends to the text, and remembers if it ran out of room. */
+
+static void emit( char *buffer, const size_t size, size_t *used,
+                  const char *format, ... )
+{
+     int num;
+     va_list args;
+
+     if ( *used >= size )
+     {
+          return;
+     }
+     va_start( args, format );
+     num = vsnprintf( &( buffer[ *used ] ), size - *used, format, args );
+     va_end( args );
+     if ( num < 0 || ( size_t )num >= size - *used )
+     {
+          *used = size;
+          return;
+     }
+     *used += ( size_t )num;
+}
+
+/*
+
+     Writes one family of counters: one line per connection, or per
+     domain if by_domain is 1, and per direction if it has two.
+
+*/
+
+static void emit_family( char *buffer, const size_t size, size_t *used,
+                         const int index, const int by_domain )
+{
+     int conn, counter, dir, family, first;
+     const char *prefix;
+     uint64_t value;
+
+     prefix = ( ( by_domain == 1 ) ? "sockets_domain_" : "sockets_" );
+     emit( buffer, size, used, "# HELP %s%s %s\n# TYPE %s%s counter\n",
+           prefix, metric_families[ index ].name,
+           metric_families[ index ].help, prefix,
+           metric_families[ index ].name );
+
+     for( conn = 0; conn < METRICS_CONNS; conn++ )
+     {
+          if ( atomic_load( &( metrics_map->conns[ conn ].ready ) ) == 0 )
+          {
+               continue;
+          }
+          family = metrics_map->conns[ conn ].family;
+
+          /* Each domain only once, at its first connection. */
+
+          if ( by_domain == 1 )
+          {
+               for( first = 0; first < conn; first++ )
+               {
+                    if ( atomic_load( &( metrics_map->conns[ first ].
+                                         ready ) ) == 1 &&
+                         metrics_map->conns[ first ].family == family )
+                    {
+                         break;
+                    }
+               }
+               if ( first < conn )
+               {
+                    continue;
+               }
+          }
+
+          for( dir = 0; dir < 2; dir++ )
+          {
+               if ( dir == 1 && metric_families[ index ].out < 0 )
+               {
+                    break;
+               }
+               counter = ( ( dir == 0 ) ? metric_families[ index ].in :
+                                          metric_families[ index ].out );
+               value = ( ( by_domain == 1 ) ?
+                         metrics_family_total( family, counter ) :
+                         metrics_total( conn, counter ) );
+               emit( buffer, size, used, "%s%s{domain=\"%s\"", prefix,
+                     metric_families[ index ].name, family_name( family ) );
+               if ( by_domain == 0 )
+               {
+                    emit( buffer, size, used, ",conn=\"%s\"",
+                          metrics_map->conns[ conn ].label );
+               }
+               if ( metric_families[ index ].out >= 0 )
+               {
+                    emit( buffer, size, used, ",direction=\"%s\"",
+                          ( ( dir == 0 ) ? "in" : "out" ) );
+               }
+               emit( buffer, size, used, "} %" PRIu64 "\n", value );
+          }
+     }
+}
+
+/*
+
+     Writes every counter into buffer in Prometheus's text format.
+     Returns its length, or -1 with errno set to ENOSPC if it
+     doesn't fit.
+
+*/
+
+int metrics_format( char *buffer, const size_t size )
+{
+     int by_domain, conn, index;
+     size_t used;
+
+     if ( buffer == NULL )
+     {
+          errno = EFAULT;
+          return ( -1 );
+     }
+     if ( metrics_map == NULL || size < 1 )
+     {
+          errno = EINVAL;
+          return ( -1 );
+     }
+
+     used = 0;
+     for( by_domain = 0; by_domain < 2; by_domain++ )
+     {
+          for( index = 0; index < ( int )( sizeof( metric_families ) /
+                                           sizeof( metric_families[ 0 ] ) );
+               index++ )
+          {
+               emit_family( buffer, size, &used, index, by_domain );
+          }
+     }
+
+     /* How long setting up a connection took, as a summary. */
+
+     emit( buffer, size, &used, "\
+# HELP sockets_setup_seconds Time taken to set up or replace a connection.\n\
+# TYPE sockets_setup_seconds summary\n" );
+     for( conn = 0; conn < METRICS_CONNS; conn++ )
+     {
+          if ( atomic_load( &( metrics_map->conns[ conn ].ready ) ) == 0 )
+          {
+               continue;
+          }
+          emit( buffer, size, &used, "\
+sockets_setup_seconds_sum{domain=\"%s\",conn=\"%s\"} %.9f\n\
+sockets_setup_seconds_count{domain=\"%s\",conn=\"%s\"} %" PRIu64 "\n",
+                family_name( metrics_map->conns[ conn ].family ),
+                metrics_map->conns[ conn ].label,
+                ( double )metrics_total( conn, METRIC_SETUP_NS ) / 1e9,
+                family_name( metrics_map->conns[ conn ].family ),
+                metrics_map->conns[ conn ].label,
+                metrics_total( conn, METRIC_SETUPS ) );
+     }
+
+     emit( buffer, size, &used, "\
+# HELP sockets_metrics_scrapes_total Times these metrics were served.\n\
+# TYPE sockets_metrics_scrapes_total counter\n\
+sockets_metrics_scrapes_total %" PRIu64 "\n",
+           atomic_load( &( metrics_map->scrapes ) ) );
+
+     if ( used >= size )
+     {
+          errno = ENOSPC;
+          return ( -1 );
+     }
+     errno = 0;
+     return ( int )used;
+}
+
+/* Answers one client of the endpoint. */
+
+static void metrics_answer( const int fd )
+{
+     char header[ 160 ], request[ 512 ];
+     int http, len;
+     ssize_t num;
+     struct pollfd pfd;
+     struct timeval timeout;
+
+     /* Give a client a moment to say what it wants. */
+
+     http = 0;
+     pfd.fd = fd;
+     pfd.events = POLLIN;
+     pfd.revents = 0;
+     if ( poll( &pfd, 1, METRICS_WAIT_MS ) == 1 )
+     {
+          num = recv( fd, request, sizeof( request ), MSG_DONTWAIT );
+          if ( num >= 4 && memcmp( request, "GET ", 4 ) == 0 )
+          {
+               http = 1;
+          }
+     }
+
+     atomic_fetch_add( &( metrics_map->scrapes ), 1 );
+     len = metrics_format( metrics_text, METRICS_TEXT_MAX );
+     if ( len < 0 )
+     {
+          return;
+     }
+
+     /* Don't let a stuck client hold up the next one for long. */
+
+     timeout.tv_sec = 1;
+     timeout.tv_usec = 0;
+     setsockopt( fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof( timeout ) );
+
+     if ( http == 1 )
+     {
+          snprintf( header, sizeof( header ), "\
+HTTP/1.0 200 OK\r\n\
+Content-Type: text/plain; version=0.0.4\r\n\
+Content-Length: %d\r\n\r\n", len );
+          send( fd, header, strlen( header ), MSG_NOSIGNAL );
+     }
+     send( fd, metrics_text, ( size_t )len, MSG_NOSIGNAL );
+}
+
+/* The endpoint's thread. */
+
+static void *metrics_main( void *arg )
+{
+     int fd;
+     struct pollfd pfd;
+
+     ( void )arg;
+     sig_events_thread();
+     while( atomic_load( &metrics_stopping ) == 0 )
+     {
+          pfd.fd = metrics_fd;
+          pfd.events = POLLIN;
+          pfd.revents = 0;
+          if ( poll( &pfd, 1, METRICS_WAIT_MS ) != 1 )
+          {
+               continue;
+          }
+          fd = accept4( metrics_fd, NULL, NULL, SOCK_CLOEXEC );
+          if ( fd < 0 )
+          {
+               continue;
+          }
+          metrics_answer( fd );
+          close( fd );
+     }
+     return NULL;
+}
+
+int metrics_serve( const char *name )
+{
+     int ret, save_errno;
+     socklen_t addr_len;
+     struct sockaddr_storage addr;
+
+     if ( name == NULL )
+     {
+          errno = EFAULT;
+          return ( -1 );
+     }
+     if ( name[ 0 ] == 0 )
+     {
+          errno = EINVAL;
+          return ( -1 );
+     }
+     if ( metrics_map == NULL )
+     {
+          errno = ENODEV;
+          return ( -1 );
+     }
+     if ( metrics_running == 1 )
+     {
+          errno = EBUSY;
+          return ( -1 );
+     }
+
+#ifdef USE_ABSTRACT_AF_UNIX
+
+     ret = snprintf( metrics_path, sizeof( metrics_path ), "@%s", name );
+
+#else
+
+     ret = snprintf( metrics_path, sizeof( metrics_path ), "%s/%s",
+                     USE_DIR, name );
+
+#endif
+
+     if ( ret < 0 || ( size_t )ret >= sizeof( metrics_path ) )
+     {
+          metrics_path[ 0 ] = 0;
+          errno = ENAMETOOLONG;
+          return ( -1 );
+     }
+
+     metrics_text = malloc( METRICS_TEXT_MAX );
+     if ( metrics_text == NULL )
+     {
+          metrics_path[ 0 ] = 0;
+          errno = ENOMEM;
+          return ( -1 );
+     }
+
+     metrics_fd = open_local_listener( AF_UNIX, SOCK_STREAM, metrics_path,
+                                       &addr, &addr_len );
+     if ( metrics_fd < 0 )
+     {
+          save_errno = errno;
+          free( metrics_text );
+          metrics_text = NULL;
+          metrics_path[ 0 ] = 0;
+          errno = save_errno;
+          return ( -1 );
+     }
+
+     atomic_store( &metrics_stopping, 0 );
+     ret = pthread_create( &metrics_thread, NULL, metrics_main, NULL );
+     if ( ret != 0 )
+     {
+          metrics_stop();
+          errno = ret;
+          return ( -1 );
+     }
+     metrics_running = 1;
+
+     errno = 0;
+     return 0;
+}
+
+int metrics_stop( void )
+{
+     int ret;
+
+     ret = 0;
+     if ( metrics_running == 1 )
+     {
+          atomic_store( &metrics_stopping, 1 );
+          ret = pthread_join( metrics_thread, NULL );
+          metrics_running = 0;
+     }
+     if ( metrics_fd >= 0 )
+     {
+          close( metrics_fd );
+          metrics_fd = ( -1 );
+     }
+     if ( metrics_path[ 0 ] != 0 && metrics_path[ 0 ] != '@' )
+     {
+          unlink( metrics_path );
+     }
+     metrics_path[ 0 ] = 0;
+     free( metrics_text );
+     metrics_text = NULL;
+     if ( ret != 0 )
+     {
+          errno = ret;
+          return ( -1 );
+     }
+
+     errno = 0;
+     return 0;
+}
+
+#endif  /* _METRICS_C */
+
+/* EOF metrics.c */
@@ -0,0 +1,483 @@
+/*
+
+     nonblocking_io.c
+
+     Functions for doing I/O on nonblocking sockets.
+
+     set_nonblocking() turns on O_NONBLOCK in a socket's file status
+     flags.  The setup functions used to call fcntl( fd, F_SETFD,
+     O_NONBLOCK ) which changes the file descriptor flags instead, so
+     the sockets never actually stopped blocking.
+
+     send_nb() and recv_nb() wrap send(2) and recv(2).  They retry
+     when a signal interrupts them and they treat EAGAIN as "not right
+     now" instead of as an error.  Both count what they do with
+     metrics_io().
+
+     An nb_conn keeps a queue of data that couldn't be sent yet, in
+     an arena of its own that nb_conn_free() gives back all at once.
+     nb_queue_send() sends what it can right away and queues the rest,
+     and nb_flush() sends more of the queue when the socket becomes
+     writable again.  run_io_loop() uses poll(2) to wait until one
+     of its connections is ready and only ever touches connections
+     that are, so one slow peer can't stall all of the others.
+
+     Written by Matthew Campbell.
+
+*/
+
+#ifndef _NONBLOCKING_IO_C
+#define _NONBLOCKING_IO_C
+
+#include "sockets.h"
+
+/*
+
+     Sets O_NONBLOCK on a socket.  Returns 0 on success
+     or -1 if an error occurs.
+
+*/
+
+int set_nonblocking( const int sock_fd )
+{
+     int flags;
+
+     if ( sock_fd < 0 )
+     {
+          errno = EINVAL;
+          return ( -1 );
+     }
+
+     flags = fcntl( sock_fd, F_GETFL, 0 );
+     if ( flags == ( -1 ) )
+     {
+          return ( -1 );
+     }
+     if ( ( flags & O_NONBLOCK ) == 0 )
+     {
+          if ( fcntl( sock_fd, F_SETFL, ( flags | O_NONBLOCK ) ) == ( -1 ) )
+          {
+               return ( -1 );
+          }
+     }
+     return 0;
+}
+
+/*
+
+     Sends as much of data as the socket will take without blocking.
+     Returns the number of bytes sent, which may be less than len or
+     even 0 if the socket's send buffer is full, or -1 if an error
+     occurs.
+
+*/
+
+ssize_t send_nb( const int sock_fd, const void *data, const size_t len )
+{
+     size_t sent;
+     ssize_t num;
+
+     if ( sock_fd < 0 )
+     {
+          errno = EINVAL;
+          return ( -1 );
+     }
+     if ( data == NULL && len > 0 )
+     {
+          errno = EFAULT;
+          return ( -1 );
+     }
+
+     sent = 0;
+     while( sent < len )
+     {
+          num = send( sock_fd, ( const char * )data + sent, ( len - sent ),
+                      ( MSG_NOSIGNAL | MSG_DONTWAIT ) );
+          metrics_io( sock_fd, METRIC_BYTES_OUT, num );
+          if ( num < 0 )
+          {
+               if ( errno == EINTR )
+               {
+                    continue;
+               }
+               if ( errno == EAGAIN || errno == EWOULDBLOCK )
+               {
+                    break;
+               }
+               return ( -1 );
+          }
+          sent += ( size_t )num;
+     }
+     return ( ssize_t )sent;
+}
+
+/*
+
+     Receives whatever is waiting without blocking.  Returns the
+     number of bytes received, 0 if the peer has closed the
+     connection, or -1 with errno set to EAGAIN if nothing is
+     waiting.  Any other error also returns -1.
+
+*/
+
+ssize_t recv_nb( const int sock_fd, void *buffer, const size_t len )
+{
+     ssize_t num;
+
+     if ( sock_fd < 0 || len < 1 )
+     {
+          errno = EINVAL;
+          return ( -1 );
+     }
+     if ( buffer == NULL )
+     {
+          errno = EFAULT;
+          return ( -1 );
+     }
+
+     do
+     {
+          num = recv( sock_fd, buffer, len, MSG_DONTWAIT );
+          metrics_io( sock_fd, METRIC_BYTES_IN, num );
+     }    while( num < 0 && errno == EINTR );
+
+     if ( num < 0 && errno == EWOULDBLOCK )
+     {
+          errno = EAGAIN;
+     }
+     return num;
+}
+
+/* Gets an nb_conn ready to use.  Returns 0 or -1 on error. */
+
+int nb_conn_init( struct nb_conn *conn, const int sock_fd,
+                  nb_read_func on_read, void *user )
+{
+     if ( conn == NULL )
+     {
+          errno = EFAULT;
+          return ( -1 );
+     }
+     if ( sock_fd < 0 )
+     {
+          errno = EINVAL;
+          return ( -1 );
+     }
+
+     memset( conn, 0, sizeof( struct nb_conn ) );
+     conn->fd = sock_fd;
+     conn->on_read = on_read;
+     conn->user = user;
+     arena_init( &( conn->arena ) );
+
+     return set_nonblocking( sock_fd );
+}
+
+/*
+
+     Releases the output queue, and everything else in the
+     connection's arena.  The socket itself is left open.
+
+*/
+
+void nb_conn_free( struct nb_conn *conn )
+{
+     if ( conn == NULL )
+     {
+          return;
+     }
+     arena_reset( &( conn->arena ) );
+     conn->out = NULL;
+     conn->out_len = 0;
+     conn->out_pos = 0;
+     conn->out_size = 0;
+     return;
+}
+
+/*
+
+     Sends whatever is queued.  Returns 0 on success, even if some
+     data is still queued, or -1 if an error occurs.
+
+*/
+
+int nb_flush( struct nb_conn *conn )
+{
+     ssize_t num;
+
+     if ( conn == NULL )
+     {
+          errno = EFAULT;
+          return ( -1 );
+     }
+
+     if ( conn->out_pos < conn->out_len )
+     {
+          num = send_nb( conn->fd, &( conn->out[ conn->out_pos ] ),
+                         ( conn->out_len - conn->out_pos ) );
+          if ( num < 0 )
+          {
+               return ( -1 );
+          }
+          conn->out_pos += ( size_t )num;
+          conn->bytes_out += ( uint64_t )num;
+     }
+
+     if ( conn->out_pos == conn->out_len )
+     {
+          conn->out_pos = 0;
+          conn->out_len = 0;
+     }
+     return 0;
+}
+
+/*
+
+     Sends data if the socket will take it and queues whatever it
+     won't.  Each connection's queue is limited to NB_MAX_QUEUE bytes
+     so a peer that stops reading can't use up all of our memory.
+     Returns 0 on success or -1 if an error occurs.
+
+*/
+
+int nb_queue_send( struct nb_conn *conn, const void *data,
+                   const size_t len )
+{
+     char *bigger;
+     size_t new_size, queued;
+     ssize_t num;
+
+     if ( conn == NULL || ( data == NULL && len > 0 ) )
+     {
+          errno = EFAULT;
+          return ( -1 );
+     }
+
+     /* Only send right away if that won't jump ahead of the queue. */
+
+     num = 0;
+     if ( conn->out_len == 0 )
+     {
+          num = send_nb( conn->fd, data, len );
+          if ( num < 0 )
+          {
+               return ( -1 );
+          }
+          conn->bytes_out += ( uint64_t )num;
+          if ( ( size_t )num == len )
+          {
+               return 0;
+          }
+     }
+
+     /* Make room for the rest. */
+
+     if ( conn->out_pos > 0 )
+     {
+          memmove( conn->out, &( conn->out[ conn->out_pos ] ),
+                   ( conn->out_len - conn->out_pos ) );
+          conn->out_len -= conn->out_pos;
+          conn->out_pos = 0;
+     }
+
+     queued = len - ( size_t )num;
+     if ( ( conn->out_len + queued ) > NB_MAX_QUEUE )
+     {
+          errno = ENOBUFS;
+          return ( -1 );
+     }
+
+     if ( ( conn->out_len + queued ) > conn->out_size )
+     {
+          new_size = ( ( conn->out_size == 0 ) ? NB_READ_CHUNK :
+                                                 conn->out_size );
+          while( new_size < ( conn->out_len + queued ) )
+          {
+               new_size *= 2;
+          }
+          bigger = arena_realloc( &( conn->arena ), conn->out,
+                                  conn->out_size, new_size );
+          if ( bigger == NULL )
+          {
+               errno = ENOMEM;
+               return ( -1 );
+          }
+          conn->out = bigger;
+          conn->out_size = new_size;
+     }
+
+     memcpy( &( conn->out[ conn->out_len ] ), ( const char * )data + num,
+             queued );
+     conn->out_len += queued;
+
+     return 0;
+}
+
+/*
+
+     Waits for the connections to become ready and services the ones
+     that are.  Incoming data is handed to each connection's on_read
+     function, and a call with a length of 0 means the peer closed the
+     connection.  No connection is read from more than NB_READ_BUDGET
+     bytes at a time so a fast sender can't starve everyone else.
+
+     The loop ends when *done becomes nonzero, when every connection
+     has been closed, or when timeout_ms milliseconds have gone by.
+     Returns 0 on success, or -1 with errno set to ETIMEDOUT if time
+     ran out, or -1 if an error occurs.
+
+*/
+
+int run_io_loop( struct nb_conn **conns, const int count,
+                 const int timeout_ms, volatile int *done )
+{
+     char chunk[ NB_READ_CHUNK ];
+     int index, open, ret, wait_ms;
+     size_t budget;
+     ssize_t num;
+     struct pollfd *fds;
+     uint64_t deadline_ns, now_ns;
+
+     if ( conns == NULL || done == NULL )
+     {
+          errno = EFAULT;
+          return ( -1 );
+     }
+     if ( count < 1 || timeout_ms < 0 )
+     {
+          errno = EINVAL;
+          return ( -1 );
+     }
+
+     fds = calloc( ( size_t )count, sizeof( struct pollfd ) );
+     if ( fds == NULL )
+     {
+          errno = ENOMEM;
+          return ( -1 );
+     }
+
+     deadline_ns = get_time_ns() + ( ( uint64_t )timeout_ms * 1000000ULL );
+     ret = 0;
+
+     while( *done == 0 )
+     {
+          /* Only ask for the events each connection can use. */
+
+          open = 0;
+          for( index = 0; index < count; index++ )
+          {
+               fds[ index ].fd = ( -1 );
+               fds[ index ].events = 0;
+               fds[ index ].revents = 0;
+               if ( conns[ index ] == NULL || conns[ index ]->closed != 0 )
+               {
+                    continue;
+               }
+               open++;
+               fds[ index ].fd = conns[ index ]->fd;
+               if ( conns[ index ]->on_read != NULL )
+               {
+                    fds[ index ].events |= POLLIN;
+               }
+               if ( conns[ index ]->out_len > 0 )
+               {
+                    fds[ index ].events |= POLLOUT;
+               }
+          }
+          if ( open == 0 )
+          {
+               break;
+          }
+
+          now_ns = get_time_ns();
+          if ( now_ns >= deadline_ns )
+          {
+               errno = ETIMEDOUT;
+               ret = ( -1 );
+               break;
+          }
+          wait_ms = ( int )( ( deadline_ns - now_ns ) / 1000000ULL ) + 1;
+
+          num = poll( fds, ( nfds_t )count, wait_ms );
+          if ( num < 0 )
+          {
+               if ( errno == EINTR )
+               {
+                    continue;
+               }
+               ret = ( -1 );
+               break;
+          }
+
+          for( index = 0; index < count && *done == 0; index++ )
+          {
+               if ( fds[ index ].fd < 0 || fds[ index ].revents == 0 )
+               {
+                    continue;
+               }
+
+               if ( fds[ index ].revents & POLLOUT )
+               {
+                    if ( nb_flush( conns[ index ] ) != 0 )
+                    {
+                         conns[ index ]->closed = 1;
+                         if ( conns[ index ]->on_read != NULL )
+                         {
+                              conns[ index ]->on_read( conns[ index ],
+                                                       NULL, 0 );
+                         }
+                         continue;
+                    }
+               }
+
+               if ( fds[ index ].revents & ( POLLIN | POLLHUP | POLLERR ) )
+               {
+                    budget = 0;
+                    while( budget < NB_READ_BUDGET && *done == 0 &&
+                           conns[ index ]->closed == 0 )
+                    {
+                         num = recv_nb( conns[ index ]->fd, chunk,
+                                        NB_READ_CHUNK );
+                         if ( num > 0 )
+                         {
+                              budget += ( size_t )num;
+                              conns[ index ]->bytes_in += ( uint64_t )num;
+                              if ( conns[ index ]->on_read != NULL &&
+                                   conns[ index ]->on_read( conns[ index ],
+                                        chunk, ( size_t )num ) != 0 )
+                              {
+                                   conns[ index ]->closed = 1;
+                              }
+                         }
+                         else if ( num < 0 && errno == EAGAIN )
+                         {
+                              break;
+                         }
+                         else  /* The peer hung up or it failed. */
+                         {
+                              conns[ index ]->closed = 1;
+                              if ( conns[ index ]->on_read != NULL )
+                              {
+                                   conns[ index ]->on_read( conns[ index ],
+                                                            NULL, 0 );
+                              }
+                         }
+                    }
+
+               }    /* if ( fds[ index ].revents & ... ) */
+
+          }    /* for( index = 0; index < count; index++ ) */
+
+     }    /* while( *done == 0 ) */
+
+     free( fds );
+     if ( ret == 0 )
+     {
+          errno = 0;
+     }
+     return ret;
+}
+
+#endif  /* _NONBLOCKING_IO_C */
+
+/* EOF nonblocking_io.c */
@@ -0,0 +1,247 @@
+/*
+
+     oob_control.c
+
+     These functions carry one byte control codes on a TCP stream as
+     urgent data, with MSG_OOB, so they get past everything already
+     queued on the connection.  The codes are:
+
+     OOB_CANCEL  Drop the request in progress and what was queued
+                 for it, and carry on with the next one.
+     OOB_FLUSH   Drop everything queued, and carry on.
+     OOB_ABORT   Drop everything queued and close the connection.
+
+     What each one means is up to the receiver.  To the transport they
+     all say that whatever was sent ahead of them is no longer wanted.
+
+     oob_send() sends a code.  It still needs room in the send buffer
+     for the byte, so on a saturated stream it may have to wait for
+     some, but that is one byte's worth and not the whole queue.
+     poll(2) doesn't report POLLOUT on a TCP socket until a third of
+     the buffer is free, which takes far longer, so it tries again
+     every OOB_RETRY_US microseconds instead.
+
+     The receiver hears about urgent data as soon as a segment
+     carrying the urgent pointer arrives, before the byte itself
+     does, which is when SIGURG is sent to the socket's owner.
+     oob_set_owner() makes this process the owner.  sig_events.c
+     takes SIGURG through its signalfd.  Once the byte has arrived,
+     poll(2) also reports POLLPRI.
+
+     oob_recv() then throws away everything ahead of the urgent mark
+     with MSG_TRUNC, which doesn't even copy it, until SIOCATMARK says
+     it's there, and reads the code with MSG_OOB.  TCP only keeps
+     track of one urgent byte, so a second code sent before the first
+     is read takes its place.
+
+     oob_send() returns 0 on success and oob_recv() returns the code.
+     oob_recv() returns 0 if there isn't any urgent data.  They both
+     return -1 if an error occurs, with errno set to ETIMEDOUT if
+     timeout_ms milliseconds go by without any progress.
+
+     Written by Matthew Campbell.
+
+*/
+
+#ifndef _OOB_CONTROL_C
+#define _OOB_CONTROL_C
+
+#include "sockets.h"
+
+int oob_send( const int sock_fd, const int code, const int timeout_ms )
+{
+     char byte;
+     ssize_t num;
+     struct timespec pause;
+     uint64_t end_ns;
+
+     if ( sock_fd < 0 || timeout_ms < 0 )
+     {
+          errno = EINVAL;
+          return ( -1 );
+     }
+     if ( code != OOB_CANCEL && code != OOB_FLUSH && code != OOB_ABORT )
+     {
+          errno = EINVAL;
+          return ( -1 );
+     }
+
+     byte = ( char )code;
+     pause.tv_sec = 0;
+     pause.tv_nsec = OOB_RETRY_US * 1000L;
+     end_ns = get_time_ns() + ( uint64_t )timeout_ms * 1000000ULL;
+     for( ; ; )
+     {
+          num = send( sock_fd, &byte, 1,
+                      ( MSG_OOB | MSG_DONTWAIT | MSG_NOSIGNAL ) );
+          if ( num == 1 )
+          {
+               break;
+          }
+          if ( errno == EINTR )
+          {
+               continue;
+          }
+          if ( errno != EAGAIN && errno != EWOULDBLOCK )
+          {
+               return ( -1 );
+          }
+          if ( get_time_ns() >= end_ns )
+          {
+               errno = ETIMEDOUT;
+               return ( -1 );
+          }
+          nanosleep( &pause, NULL );
+     }
+
+     errno = 0;
+     return 0;
+}
+
+int oob_set_owner( const int sock_fd )
+{
+     if ( sock_fd < 0 )
+     {
+          errno = EINVAL;
+          return ( -1 );
+     }
+     if ( fcntl( sock_fd, F_SETOWN, getpid() ) != 0 )
+     {
+          return ( -1 );
+     }
+
+     errno = 0;
+     return 0;
+}
+
+int oob_recv( const int sock_fd, uint64_t *discarded, const int timeout_ms )
+{
+     char byte;
+     int arrived, at_mark, ret;
+     ssize_t num;
+     struct pollfd pfd;
+
+     if ( sock_fd < 0 || timeout_ms < 0 )
+     {
+          errno = EINVAL;
+          return ( -1 );
+     }
+     if ( discarded == NULL )
+     {
+          errno = EFAULT;
+          return ( -1 );
+     }
+
+     *discarded = 0;
+
+     /* EINVAL means there is no urgent data at all. */
+
+     num = recv( sock_fd, &byte, 1, ( MSG_OOB | MSG_PEEK | MSG_DONTWAIT ) );
+     if ( num < 0 && errno == EINVAL )
+     {
+          errno = 0;
+          return 0;
+     }
+     if ( num < 0 && errno != EAGAIN && errno != EWOULDBLOCK )
+     {
+          return ( -1 );
+     }
+
+     /*
+
+          Throw away what is ahead of the mark.  A read never goes past
+          the mark, and the urgent byte isn't part of the stream, so
+          once it has arrived and there is nothing left to read we are
+          past it as well.
+
+     */
+
+     for( ; ; )
+     {
+          if ( ioctl( sock_fd, SIOCATMARK, &at_mark ) != 0 )
+          {
+               return ( -1 );
+          }
+          if ( at_mark != 0 )
+          {
+               break;
+          }
+
+          num = recv( sock_fd, NULL, BULK_CHUNK, ( MSG_TRUNC | MSG_DONTWAIT ) );
+          if ( num > 0 )
+          {
+               *discarded += ( uint64_t )num;
+               continue;
+          }
+          if ( num == 0 )
+          {
+               errno = ECONNRESET;
+               return ( -1 );
+          }
+          if ( errno == EINTR )
+          {
+               continue;
+          }
+          if ( errno != EAGAIN && errno != EWOULDBLOCK )
+          {
+               return ( -1 );
+          }
+
+          arrived = ( recv( sock_fd, &byte, 1,
+                            ( MSG_OOB | MSG_PEEK | MSG_DONTWAIT ) ) == 1 );
+          if ( arrived == 1 )
+          {
+               break;
+          }
+
+          pfd.fd = sock_fd;
+          pfd.events = ( POLLIN | POLLPRI );
+          pfd.revents = 0;
+          ret = poll( &pfd, 1, timeout_ms );
+          if ( ret == 0 )
+          {
+               errno = ETIMEDOUT;
+               return ( -1 );
+          }
+     }
+
+     /* Now wait for the byte itself, if it isn't here yet. */
+
+     for( ; ; )
+     {
+          num = recv( sock_fd, &byte, 1, ( MSG_OOB | MSG_DONTWAIT ) );
+          if ( num == 1 )
+          {
+               break;
+          }
+          if ( num < 0 && errno == EINTR )
+          {
+               continue;
+          }
+          if ( num == 0 || ( errno != EAGAIN && errno != EWOULDBLOCK ) )
+          {
+               if ( num == 0 )
+               {
+                    errno = ECONNRESET;
+               }
+               return ( -1 );
+          }
+
+          pfd.fd = sock_fd;
+          pfd.events = POLLPRI;
+          pfd.revents = 0;
+          ret = poll( &pfd, 1, timeout_ms );
+          if ( ret == 0 )
+          {
+               errno = ETIMEDOUT;
+               return ( -1 );
+          }
+     }
+
+     errno = 0;
+     return ( int )( unsigned char )byte;
+}
+
+#endif  /* _OOB_CONTROL_C */
+
+/* EOF oob_control.c */
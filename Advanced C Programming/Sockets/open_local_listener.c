@@ -0,0 +1,110 @@
+/*
+
+     open_local_listener.c
+
+     This function opens a server socket on this device for the
+     benchmarks.  AF_INET and AF_INET6 use the loopback address with
+     a port picked by the kernel, and AF_UNIX uses the socket file
+     named by path, which is removed first if it is left over.  A
+     path starting with '@' is an abstract name instead, the rest of
+     it bound with unix_address(), and there is no file at all.
+     Stream and sequenced packet sockets are put into
+     the listening state with a backlog of EPOLL_BACKLOG, and datagram
+     sockets are just bound.
+
+     The address that was actually bound is stored in addr so a
+     client can use it as its target.  Returns the socket's file
+     descriptor or -1 if an error occurs.
+
+     Written by Matthew Campbell.
+
+*/
+
+#ifndef _OPEN_LOCAL_LISTENER_C
+#define _OPEN_LOCAL_LISTENER_C
+
+#include "sockets.h"
+
+int open_local_listener( const int domain, const int sock_type,
+                         const char *path, struct sockaddr_storage *addr,
+                         socklen_t *addr_len )
+{
+     int opt, save_errno, sock_fd;
+     struct sockaddr_in *in4;
+     struct sockaddr_in6 *in6;
+     struct sockaddr_un *un;
+
+     if ( addr == NULL || addr_len == NULL ||
+          ( domain == AF_UNIX && path == NULL ) )
+     {
+          errno = EFAULT;
+          return ( -1 );
+     }
+
+     memset( addr, 0, sizeof( struct sockaddr_storage ) );
+     if ( domain == AF_INET )
+     {
+          in4 = ( struct sockaddr_in * )addr;
+          in4->sin_family = AF_INET;
+          in4->sin_addr.s_addr = htonl( INADDR_LOOPBACK );
+          *addr_len = sizeof( struct sockaddr_in );
+     }
+     else if ( domain == AF_INET6 )
+     {
+          in6 = ( struct sockaddr_in6 * )addr;
+          in6->sin6_family = AF_INET6;
+          in6->sin6_addr = in6addr_loopback;
+          *addr_len = sizeof( struct sockaddr_in6 );
+     }
+     else if ( domain == AF_UNIX )
+     {
+          un = ( struct sockaddr_un * )addr;
+          if ( path[ 0 ] == '@' )
+          {
+               if ( unix_address( &( path[ 1 ] ), 1, un, addr_len ) != 0 )
+               {
+                    return ( -1 );
+               }
+          }
+          else
+          {
+               if ( unix_address( path, 0, un, addr_len ) != 0 )
+               {
+                    return ( -1 );
+               }
+               unlink( path );
+          }
+     }
+     else
+     {
+          errno = EAFNOSUPPORT;
+          return ( -1 );
+     }
+
+     sock_fd = socket( domain, sock_type, 0 );
+     if ( sock_fd < 0 )
+     {
+          return ( -1 );
+     }
+
+     opt = 1;
+     setsockopt( sock_fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof( opt ) );
+
+     if ( bind( sock_fd, ( struct sockaddr * )addr, *addr_len ) != 0 ||
+          ( sock_type != SOCK_DGRAM &&
+            listen( sock_fd, EPOLL_BACKLOG ) != 0 ) ||
+          getsockname( sock_fd, ( struct sockaddr * )addr,
+                       addr_len ) != 0 )
+     {
+          save_errno = errno;
+          close( sock_fd );
+          errno = save_errno;
+          return ( -1 );
+     }
+
+     return sock_fd;
+}
+
+#endif  /* _OPEN_LOCAL_LISTENER_C */
+
+/* EOF open_local_listener.c */
@@ -0,0 +1,147 @@
+/*
+
+     open_local_pair.c
+
+     This function creates a client socket and a server socket on
+     this device that are connected to each other, for the
+     benchmarks.  Stream and sequenced packet sockets go through a
+     listening socket and connect_pair(), and the listening socket is
+     closed once the connection has been accepted.  For datagram
+     sockets both ends are bound and each one is connected to the
+     other so either side can use send(2) and recv(2).
+
+     AF_UNIX uses the socket file named by path for the server, or
+     the abstract name after the '@' if path starts with one, and the
+     client is given an autobound abstract address.  The socket file
+     is removed before returning.
+
+     A sock_type of SOCK_SHM_RING makes a shared memory ring with
+     shm_ring_open() instead, and domain and path aren't used.
+
+     Returns 0 on success or -1 if an error occurs.
+
+     Written by Matthew Campbell.
+
+*/
+
+#ifndef _OPEN_LOCAL_PAIR_C
+#define _OPEN_LOCAL_PAIR_C
+
+#include "sockets.h"
+
+int open_local_pair( const int domain, const int sock_type,
+                     const char *path, int *csock_fd, int *ssock_fd )
+{
+     int lsock_fd, save_errno;
+     socklen_t addr_len, peer_len;
+     struct sockaddr_in *in4;
+     struct sockaddr_in6 *in6;
+     struct sockaddr_storage addr, peer;
+
+     if ( csock_fd == NULL || ssock_fd == NULL )
+     {
+          errno = EFAULT;
+          return ( -1 );
+     }
+     *csock_fd = ( -1 );
+     *ssock_fd = ( -1 );
+     save_errno = 0;
+
+     if ( sock_type == SOCK_SHM_RING )
+     {
+          return shm_ring_open( csock_fd, ssock_fd );
+     }
+
+     lsock_fd = open_local_listener( domain, sock_type, path, &addr,
+                                     &addr_len );
+     if ( lsock_fd < 0 )
+     {
+          return ( -1 );
+     }
+
+     *csock_fd = socket( domain, sock_type, 0 );
+     if ( *csock_fd < 0 )
+     {
+          save_errno = errno;
+          close( lsock_fd );
+          errno = save_errno;
+          return ( -1 );
+     }
+
+     if ( sock_type != SOCK_DGRAM )
+     {
+          *ssock_fd = connect_pair( *csock_fd, lsock_fd,
+                                    ( struct sockaddr * )( &addr ),
+                                    addr_len, NULL, NULL );
+          save_errno = errno;
+          close( lsock_fd );
+     }
+     else
+     {
+          /* The listening socket is just the bound server socket. */
+
+          *ssock_fd = lsock_fd;
+
+          memset( &peer, 0, sizeof( peer ) );
+          peer.ss_family = ( sa_family_t )domain;
+          if ( domain == AF_INET )
+          {
+               in4 = ( struct sockaddr_in * )( &peer );
+               in4->sin_addr.s_addr = htonl( INADDR_LOOPBACK );
+               peer_len = sizeof( struct sockaddr_in );
+          }
+          else if ( domain == AF_INET6 )
+          {
+               in6 = ( struct sockaddr_in6 * )( &peer );
+               in6->sin6_addr = in6addr_loopback;
+               peer_len = sizeof( struct sockaddr_in6 );
+          }
+          else  /* Ask for an autobound abstract address. */
+          {
+               peer_len = sizeof( sa_family_t );
+          }
+
+          if ( bind( *csock_fd, ( struct sockaddr * )( &peer ),
+                     peer_len ) != 0 ||
+               connect( *csock_fd, ( struct sockaddr * )( &addr ),
+                        addr_len ) != 0 )
+          {
+               save_errno = errno;
+               close( *ssock_fd );
+               *ssock_fd = ( -1 );
+          }
+          else
+          {
+               peer_len = sizeof( peer );
+               if ( getsockname( *csock_fd, ( struct sockaddr * )( &peer ),
+                                 &peer_len ) != 0 ||
+                    connect( *ssock_fd, ( struct sockaddr * )( &peer ),
+                             peer_len ) != 0 )
+               {
+                    save_errno = errno;
+                    close( *ssock_fd );
+                    *ssock_fd = ( -1 );
+               }
+          }
+     }
+
+     if ( domain == AF_UNIX && path[ 0 ] != '@' )
+     {
+          unlink( path );
+     }
+
+     if ( *ssock_fd < 0 )
+     {
+          close( *csock_fd );
+          *csock_fd = ( -1 );
+          errno = save_errno;
+          return ( -1 );
+     }
+
+     errno = 0;
+     return 0;
+}
+
+#endif  /* _OPEN_LOCAL_PAIR_C */
+
+/* EOF open_local_pair.c */
@@ -0,0 +1,92 @@
+/*
+
+     open_reuseport_listener.c
+
+     This function opens one of a group of stream listeners that all
+     share the address in addr with SO_REUSEPORT.  The kernel spreads
+     incoming connections across every listener in the group, and
+     each one has its own accept queue of up to backlog connections,
+     so no one queue or one accepting process has to keep up with all
+     of them.  Every socket in the group has to set SO_REUSEPORT
+     before it is bound, including the first one.
+
+     If the port in addr is 0 the kernel picks one, and the address
+     that was actually bound is stored back into addr so the rest of
+     the group can use it.  The socket is left nonblocking.  With
+     USE_DUAL_STACK_AF_INET6 an AF_INET6 listener also accepts IPv4
+     peers, the same as the one setup_af_inet6() opens.
+
+     Returns the socket's file descriptor or -1 if an error occurs.
+
+     Written by Matthew Campbell.
+
+*/
+
+#ifndef _OPEN_REUSEPORT_LISTENER_C
+#define _OPEN_REUSEPORT_LISTENER_C
+
+#include "sockets.h"
+
+int open_reuseport_listener( struct sockaddr_storage *addr,
+                             socklen_t *addr_len, const int backlog )
+{
+     int opt, save_errno, sock_fd;
+
+     if ( addr == NULL || addr_len == NULL )
+     {
+          errno = EFAULT;
+          return ( -1 );
+     }
+     if ( backlog < 1 || ( addr->ss_family != AF_INET &&
+                           addr->ss_family != AF_INET6 ) )
+     {
+          errno = EINVAL;
+          return ( -1 );
+     }
+
+     sock_fd = socket( addr->ss_family, SOCK_STREAM, 0 );
+     if ( sock_fd < 0 )
+     {
+          return ( -1 );
+     }
+
+#ifdef USE_DUAL_STACK_AF_INET6
+
+     /* Match the first listener so IPv4 peers reach every one. */
+
+     opt = 0;
+     if ( addr->ss_family == AF_INET6 &&
+          setsockopt( sock_fd, IPPROTO_IPV6, IPV6_V6ONLY, &opt,
+                      sizeof( opt ) ) != 0 )
+     {
+          save_errno = errno;
+          close( sock_fd );
+          errno = save_errno;
+          return ( -1 );
+     }
+
+#endif
+
+     opt = 1;
+     if ( setsockopt( sock_fd, SOL_SOCKET, SO_REUSEADDR, &opt,
+                      sizeof( opt ) ) != 0 ||
+          setsockopt( sock_fd, SOL_SOCKET, SO_REUSEPORT, &opt,
+                      sizeof( opt ) ) != 0 ||
+          bind( sock_fd, ( struct sockaddr * )addr, *addr_len ) != 0 ||
+          listen( sock_fd, backlog ) != 0 ||
+          getsockname( sock_fd, ( struct sockaddr * )addr,
+                       addr_len ) != 0 ||
+          set_nonblocking( sock_fd ) != 0 )
+     {
+          save_errno = errno;
+          close( sock_fd );
+          errno = save_errno;
+          return ( -1 );
+     }
+
+     return sock_fd;
+}
+
+#endif  /* _OPEN_REUSEPORT_LISTENER_C */
+
+/* EOF open_reuseport_listener.c */
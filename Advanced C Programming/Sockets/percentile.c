@@ -0,0 +1,59 @@
+/*
+
+     percentile.c
+
+     Helpers for summarizing latency samples.  sort_samples() puts
+     the samples in ascending order and percentile() picks the pct'th
+     percentile out of a sorted array.  percentile() returns 0 if
+     there aren't any samples.
+
+     Written by Matthew Campbell.
+
+*/
+
+#ifndef _PERCENTILE_C
+#define _PERCENTILE_C
+
+#include "sockets.h"
+
+static int compare_samples( const void *a, const void *b )
+{
+     uint64_t x = *( const uint64_t * )a, y = *( const uint64_t * )b;
+
+     return ( x > y ) - ( x < y );
+}
+
+void sort_samples( uint64_t *samples, const uint64_t count )
+{
+     if ( samples == NULL || count < 2 )
+     {
+          return;
+     }
+     qsort( samples, ( size_t )count, sizeof( uint64_t ), compare_samples );
+     return;
+}
+
+uint64_t percentile( const uint64_t *sorted, const uint64_t count,
+                     const uint64_t pct )
+{
+     uint64_t index;
+
+     if ( sorted == NULL || count == 0 )
+     {
+          return 0;
+     }
+     index = ( ( count * pct ) + 99 ) / 100;
+     if ( index > 0 )
+     {
+          index--;
+     }
+     if ( index >= count )
+     {
+          index = count - 1;
+     }
+     return sorted[ index ];
+}
+
+#endif  /* _PERCENTILE_C */
+
+/* EOF percentile.c */
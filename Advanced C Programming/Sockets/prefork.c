@@ -0,0 +1,436 @@
+/*
+
+     prefork.c
+
+     Functions for running the multi-connection server as one
+     acceptor process and a pool of long-lived worker processes.
+
+     prefork_start() forks count workers.  Each one is joined to the
+     acceptor by its own SOCK_SEQPACKET socket pair and runs
+     run_handoff_server() on its end of it.  The acceptor accepts
+     every connection itself and passes it to a worker with
+     prefork_dispatch(), which picks the worker with the fewest
+     connections still open and sends the descriptor over with
+     send_fd().  The workers say how many of those have closed, and
+     prefork_update() reads that to keep each worker's load up to
+     date.
+
+     A worker that dies only loses the connections it was serving.
+     prefork_update() sees its channel close, reaps it and forks a
+     new one in its place, unless ctl_fd says the pool is stopping.
+     The new worker is started from prefork_update() rather than
+     from prefork_dispatch() so it doesn't inherit a connection that
+     is on its way to someone else.
+
+     The workers stop when ctl_fd becomes readable or when their
+     channel closes.  prefork_finish() closes the channels, collects
+     each worker's statistics, adds them up and waits for the workers
+     to exit.
+
+     Written by Matthew Campbell.
+
+*/
+
+#ifndef _PREFORK_C
+#define _PREFORK_C
+
+#include "sockets.h"
+
+/* Forks the index'th worker.  Returns 0 on success or -1 on error. */
+
+static int spawn_worker( struct prefork_pool *pool, const int index )
+{
+     int chan_fd[ 2 ], other, result_fd[ 2 ], save_errno;
+     ssize_t len;
+     struct server_stats stats;
+
+     if ( socketpair( AF_UNIX, ( SOCK_SEQPACKET | SOCK_CLOEXEC ), 0,
+                      chan_fd ) != 0 )
+     {
+          return ( -1 );
+     }
+     metrics_inherit( chan_fd[ 1 ], pool->lsock_fd );
+     if ( pipe( result_fd ) != 0 )
+     {
+          save_errno = errno;
+          close( chan_fd[ 0 ] );
+          close( chan_fd[ 1 ] );
+          errno = save_errno;
+          return ( -1 );
+     }
+
+     fflush( stdout );  /* Don't let the child repeat our output. */
+
+     pool->pids[ index ] = fork();
+     if ( pool->pids[ index ] == ( -1 ) )
+     {
+          save_errno = errno;
+          close( chan_fd[ 0 ] );
+          close( chan_fd[ 1 ] );
+          close( result_fd[ 0 ] );
+          close( result_fd[ 1 ] );
+          pool->pids[ index ] = 0;
+          errno = save_errno;
+          return ( -1 );
+     }
+     else if ( pool->pids[ index ] == 0 )  /* Child process */
+     {
+          close( chan_fd[ 0 ] );
+          close( result_fd[ 0 ] );
+          close( pool->lsock_fd );
+          for( other = 0; other < pool->count; other++ )
+          {
+               if ( pool->chan_fds[ other ] >= 0 )
+               {
+                    close( pool->chan_fds[ other ] );
+               }
+               if ( pool->result_fds[ other ] >= 0 )
+               {
+                    close( pool->result_fds[ other ] );
+               }
+          }
+
+          memset( &stats, 0, sizeof( stats ) );
+          run_handoff_server( chan_fd[ 1 ], pool->ctl_fd, &stats );
+          len = write( result_fd[ 1 ], &stats, sizeof( stats ) );
+          close( result_fd[ 1 ] );
+          close( chan_fd[ 1 ] );
+          _exit( ( len == ( ssize_t )sizeof( stats ) ) ?
+                 EXIT_SUCCESS : EXIT_FAILURE );
+     }
+
+     /* Parent process, pid > 0 */
+
+     close( chan_fd[ 1 ] );
+     close( result_fd[ 1 ] );
+     pool->chan_fds[ index ] = chan_fd[ 0 ];
+     pool->result_fds[ index ] = result_fd[ 0 ];
+     pool->load[ index ] = 0;
+     return 0;
+}
+
+/*
+
+     Starts count workers for connections accepted on lsock_fd.
+     Returns 0 on success or -1 if an error occurs, in which case no
+     workers are left running.
+
+*/
+
+int prefork_start( struct prefork_pool *pool, const int lsock_fd,
+                   const int count, const int ctl_fd )
+{
+     int index, save_errno;
+
+     if ( pool == NULL )
+     {
+          errno = EFAULT;
+          return ( -1 );
+     }
+     if ( lsock_fd < 0 || ctl_fd < 0 || count < 1 || count > PREFORK_MAX )
+     {
+          errno = EINVAL;
+          return ( -1 );
+     }
+
+     memset( pool, 0, sizeof( struct prefork_pool ) );
+     pool->count = count;
+     pool->lsock_fd = lsock_fd;
+     pool->ctl_fd = ctl_fd;
+     for( index = 0; index < count; index++ )
+     {
+          pool->chan_fds[ index ] = ( -1 );
+          pool->result_fds[ index ] = ( -1 );
+     }
+
+     for( index = 0; index < count; index++ )
+     {
+          if ( spawn_worker( pool, index ) != 0 )
+          {
+               /* Closing the channels stops the ones already running. */
+
+               save_errno = errno;
+               prefork_finish( pool, NULL, NULL );
+               errno = save_errno;
+               return ( -1 );
+          }
+     }
+
+     errno = 0;
+     return 0;
+}
+
+/*
+
+     Hands fd to the least busy worker and closes the acceptor's copy
+     of it, whether or not that worked.  If every channel is full the
+     send waits for the least busy worker to make room.  Returns 0 on
+     success or -1 if an error occurs.
+
+*/
+
+int prefork_dispatch( struct prefork_pool *pool, const int fd )
+{
+     char skip[ PREFORK_MAX ];
+     int best, flags, index, save_errno, slot, tried;
+
+     if ( pool == NULL )
+     {
+          errno = EFAULT;
+          if ( fd >= 0 )
+          {
+               close( fd );
+          }
+          return ( -1 );
+     }
+     if ( fd < 0 )
+     {
+          errno = EINVAL;
+          return ( -1 );
+     }
+
+     memset( skip, 0, sizeof( skip ) );
+     flags = MSG_DONTWAIT;
+     for( tried = 0; tried <= pool->count; tried++ )
+     {
+          /*
+
+               Find the worker with the fewest open connections,
+               passing by the ones already tried unless every
+               channel turned out to be full.
+
+          */
+
+          if ( tried == pool->count )
+          {
+               memset( skip, 0, sizeof( skip ) );
+               flags = 0;
+          }
+          best = ( -1 );
+          for( index = 0; index < pool->count; index++ )
+          {
+               slot = ( pool->next + index ) % pool->count;
+               if ( pool->chan_fds[ slot ] >= 0 && skip[ slot ] == 0 &&
+                    ( best < 0 || pool->load[ slot ] < pool->load[ best ] ) )
+               {
+                    best = slot;
+               }
+          }
+          if ( best < 0 )  /* No worker is running. */
+          {
+               close( fd );
+               errno = ECHILD;
+               return ( -1 );
+          }
+
+          if ( send_fd( pool->chan_fds[ best ], fd, flags ) == 0 )
+          {
+               pool->load[ best ]++;
+               pool->handed[ best ]++;
+               pool->next = ( best + 1 ) % pool->count;
+               close( fd );
+               errno = 0;
+               return 0;
+          }
+          save_errno = errno;
+          if ( save_errno != EAGAIN && save_errno != EWOULDBLOCK &&
+               save_errno != EPIPE && save_errno != ECONNRESET )
+          {
+               close( fd );
+               errno = save_errno;
+               return ( -1 );
+          }
+
+          /*
+
+               Its channel is full, or the worker died, in which case
+               prefork_update() will replace it.  Try another one.
+
+          */
+
+          skip[ best ] = 1;
+     }
+
+     close( fd );
+     errno = EAGAIN;
+     return ( -1 );
+}
+
+/*
+
+     Reads the close notices waiting on the index'th worker's channel.
+     If the worker has gone away it is reaped and a new one started,
+     and 1 is returned so the caller knows chan_fds[ index ] changed.
+     Otherwise returns 0, or -1 if an error occurs.
+
+*/
+
+int prefork_update( struct prefork_pool *pool, const int index )
+{
+     ssize_t len;
+     struct pollfd pfd;
+     uint32_t closed;
+
+     if ( pool == NULL )
+     {
+          errno = EFAULT;
+          return ( -1 );
+     }
+     if ( index < 0 || index >= pool->count ||
+          pool->chan_fds[ index ] < 0 )
+     {
+          errno = EINVAL;
+          return ( -1 );
+     }
+
+     for( ; ; )
+     {
+          len = recv( pool->chan_fds[ index ], &closed, sizeof( closed ),
+                      MSG_DONTWAIT );
+          if ( len == ( ssize_t )sizeof( closed ) )
+          {
+               pool->load[ index ] -= ( ( closed < pool->load[ index ] ) ?
+                                        closed : pool->load[ index ] );
+               continue;
+          }
+          if ( len < 0 && errno == EINTR )
+          {
+               continue;
+          }
+          if ( len < 0 && ( errno == EAGAIN || errno == EWOULDBLOCK ) )
+          {
+               errno = 0;
+               return 0;
+          }
+          if ( len < 0 && errno != ECONNRESET )
+          {
+               return ( -1 );
+          }
+          break;  /* The worker has gone away. */
+     }
+
+     close( pool->chan_fds[ index ] );
+     pool->chan_fds[ index ] = ( -1 );
+
+     /* A worker that stopped because we're stopping stays stopped. */
+
+     pfd.fd = pool->ctl_fd;
+     pfd.events = POLLIN;
+     pfd.revents = 0;
+     if ( poll( &pfd, 1, 0 ) != 0 )
+     {
+          errno = 0;
+          return 0;
+     }
+
+     close( pool->result_fds[ index ] );
+     pool->result_fds[ index ] = ( -1 );
+     waitpid( pool->pids[ index ], NULL, 0 );
+     pool->pids[ index ] = 0;
+
+     if ( spawn_worker( pool, index ) != 0 )
+     {
+          return ( -1 );
+     }
+     pool->respawned++;
+     errno = 0;
+     return 1;
+}
+
+/*
+
+     Stops the workers, adds their statistics up into total and
+     stores how many connections each one was handed in handed[ 0 ]
+     through handed[ count - 1 ].  Either may be NULL.  A worker that
+     was replaced only reports what its replacement did.  Returns 0
+     on success or -1 with errno set to EIO if a worker didn't report.
+
+*/
+
+int prefork_finish( struct prefork_pool *pool, struct server_stats *total,
+                    uint64_t *handed )
+{
+     int index, missing;
+     ssize_t len;
+     struct server_stats stats;
+
+     if ( pool == NULL )
+     {
+          errno = EFAULT;
+          return ( -1 );
+     }
+     if ( total != NULL )
+     {
+          memset( total, 0, sizeof( struct server_stats ) );
+     }
+
+     /* A closed channel stops a worker even if ctl_fd hasn't. */
+
+     for( index = 0; index < pool->count; index++ )
+     {
+          if ( pool->chan_fds[ index ] >= 0 )
+          {
+               close( pool->chan_fds[ index ] );
+               pool->chan_fds[ index ] = ( -1 );
+          }
+     }
+
+     missing = 0;
+     for( index = 0; index < pool->count; index++ )
+     {
+          memset( &stats, 0, sizeof( stats ) );
+          if ( pool->result_fds[ index ] >= 0 )
+          {
+               do
+               {
+                    len = read( pool->result_fds[ index ], &stats,
+                                sizeof( stats ) );
+               }    while( len < 0 && errno == EINTR );
+               close( pool->result_fds[ index ] );
+               pool->result_fds[ index ] = ( -1 );
+               if ( len != ( ssize_t )sizeof( stats ) )
+               {
+                    memset( &stats, 0, sizeof( stats ) );
+                    missing++;
+               }
+          }
+          if ( pool->pids[ index ] > 0 )
+          {
+               waitpid( pool->pids[ index ], NULL, 0 );
+               pool->pids[ index ] = 0;
+          }
+
+          if ( handed != NULL )
+          {
+               handed[ index ] = pool->handed[ index ];
+          }
+          if ( total != NULL )
+          {
+               total->accepted += stats.accepted;
+               total->closed += stats.closed;
+               total->max_open += stats.max_open;
+               total->bytes_in += stats.bytes_in;
+               total->bytes_out += stats.bytes_out;
+               total->errors += stats.errors;
+               total->syscalls += stats.syscalls;
+               total->tcp_watched += stats.tcp_watched;
+               total->tcp_flagged += stats.tcp_flagged;
+               if ( stats.elapsed_ns > total->elapsed_ns )
+               {
+                    total->elapsed_ns = stats.elapsed_ns;
+               }
+          }
+     }
+
+     if ( missing > 0 )
+     {
+          errno = EIO;
+          return ( -1 );
+     }
+     errno = 0;
+     return 0;
+}
+
+#endif  /* _PREFORK_C */
+
+/* EOF prefork.c */
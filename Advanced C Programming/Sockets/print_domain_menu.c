@@ -18,7 +18,8 @@ void print_domain_menu( void )
      printf( "2) AF_INET (IPv4)\n" );
      printf( "3) AF_INET6 (IPv6)\n" );
      printf( "4) AF_UNIX or AF_LOCAL (Local communications)\n" );
-     printf( "5) Exit\n\n" );
+     printf( "5) Shared memory ring (Local communications without sockets)\n" );
+     printf( "6) Exit\n\n" );
      return;
 }
 
@@ -0,0 +1,52 @@
+/*
+
+     raise_fd_limit.c
+
+     This function raises the soft limit on open file descriptors
+     to the hard limit so the multi-connection server and the load
+     generator can each hold thousands of sockets open at once.
+     Returns the new limit on success or -1 if an error occurs.
+
+     Written by Matthew Campbell.
+
+*/
+
+#ifndef _RAISE_FD_LIMIT_C
+#define _RAISE_FD_LIMIT_C
+
+#include "sockets.h"
+
+int raise_fd_limit( void )
+{
+     struct rlimit limit;
+
+     errno = 0;
+     if ( getrlimit( RLIMIT_NOFILE, &limit ) != 0 )
+     {
+          return ( -1 );
+     }
+
+     if ( limit.rlim_cur < limit.rlim_max )
+     {
+          limit.rlim_cur = limit.rlim_max;
+          errno = 0;
+          if ( setrlimit( RLIMIT_NOFILE, &limit ) != 0 )
+          {
+               return ( -1 );
+          }
+     }
+
+     /* Don't claim more than an int can hold. */
+
+     if ( limit.rlim_cur == RLIM_INFINITY || limit.rlim_cur > 1048576 )
+     {
+          return 1048576;
+     }
+
+     errno = 0;
+     return ( int )limit.rlim_cur;
+}
+
+#endif  /* _RAISE_FD_LIMIT_C */
+
+/* EOF raise_fd_limit.c */
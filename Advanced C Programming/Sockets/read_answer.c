@@ -0,0 +1,96 @@
+/*
+
+     read_answer.c
+
+     This function reads the answer to a question, either from stdin
+     with read_stdin() or, when a configuration has been loaded, from
+     the value config.c holds for key.  The question itself has
+     already been printed by the caller.
+
+     names lists the options of a menu in order, so a configured
+     value can name an option instead of giving its number.  A name
+     is turned into the option's number, starting from 1, before it
+     is copied into buffer.  Use NULL and 0 for questions that aren't
+     menus.
+
+     Without anyone to answer, the program can't ask again, so the
+     same key being asked for twice in a row means the configured
+     value wasn't accepted and this function fails with EINVAL.  A
+     key that has no value fails with ENODATA.  Waiting for stdin
+     fails with ECANCELED if SIGTERM arrives first.
+
+     Returns 0 on success and 1 on error, the same as read_stdin().
+
+     Written by Matthew Campbell.
+
+*/
+
+#ifndef _READ_ANSWER_C
+#define _READ_ANSWER_C
+
+#include "sockets.h"
+
+int read_answer( const char *key, const char * const *names,
+                 const int count, char *buffer, const int length )
+{
+     static const char *last_key = NULL;
+     const char *value;
+     int index;
+
+     if ( key == NULL || buffer == NULL )
+     {
+          errno = EFAULT;
+          return 1;
+     }
+     if ( length < 3 || count < 0 || ( count > 0 && names == NULL ) )
+     {
+          errno = EINVAL;
+          return 1;
+     }
+
+     if ( config_active() == 0 )
+     {
+          /* Wait with sig_events_wait_input() so SIGTERM can end it. */
+
+          printf( ">> " );
+          fflush( stdout );
+          if ( sig_events_wait_input( STDIN_FILENO ) != 0 )
+          {
+               return 1;
+          }
+          return read_stdin( buffer, length, NULL, 0 );
+     }
+
+     value = config_get( key );
+     if ( value == NULL )
+     {
+          printf( "No value was given for \"%s\".\n", key );
+          errno = ENODATA;
+          return 1;
+     }
+     if ( last_key != NULL && strcmp( last_key, key ) == 0 )
+     {
+          printf( "\nThe value \"%s\" for \"%s\" was not accepted.\n",
+                  value, key );
+          errno = EINVAL;
+          return 1;
+     }
+     last_key = key;
+
+     snprintf( buffer, ( size_t )length, "%s", value );
+     for( index = 0; index < count; index++ )
+     {
+          if ( strcmp( names[ index ], value ) == 0 )
+          {
+               snprintf( buffer, ( size_t )length, "%d", index + 1 );
+               break;
+          }
+     }
+
+     printf( ">> %s\n", value );
+     return 0;
+}
+
+#endif  /* _READ_ANSWER_C */
+
+/* EOF read_answer.c */
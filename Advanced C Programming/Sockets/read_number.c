@@ -0,0 +1,81 @@
+/*
+
+     read_number.c
+
+     This function asks the user for a whole number and keeps asking
+     until it gets one between min and max, inclusive.  The question
+     is printed before each attempt.
+
+     key names the answer in a loaded configuration and names lists
+     the options of a menu, as read_answer() describes.  Menus given
+     names should number their options from 1.
+
+     Returns 0 on success or -1 if an error occurs.
+
+     Written by Matthew Campbell.
+
+*/
+
+#ifndef _READ_NUMBER_C
+#define _READ_NUMBER_C
+
+#include "sockets.h"
+
+int read_number( const char *key, const char * const *names,
+                 const int count, const char *question,
+                 const long long min, const long long max,
+                 long long *value )
+{
+     char buffer[ 80 ];
+     int ret, save_errno;
+     long long num;
+
+     if ( key == NULL || question == NULL || value == NULL )
+     {
+          errno = EFAULT;
+          return ( -1 );
+     }
+     if ( min > max )
+     {
+          errno = EINVAL;
+          return ( -1 );
+     }
+
+     for( ; ; )
+     {
+          printf( "\n%s\n\n", question );
+          errno = 0;
+          ret = read_answer( key, names, count, buffer, 80 );
+          if ( ret != 0 )
+          {
+               save_errno = errno;
+               printf( "\n\
+Something went wrong while reading your input.\n" );
+               if ( save_errno != 0 )
+               {
+                    printf( "Error: %s.\n", strerror( save_errno ) );
+               }
+               printf( "\n" );
+               errno = 0;  /* Don't show the same error twice. */
+               return ( -1 );
+          }
+          if ( sscanf( buffer, "%lld", &num ) != 1 )
+          {
+               printf( "\nThat is not a valid input.  Please try again.\n" );
+          }
+          else if ( num < min || num > max )
+          {
+               printf( "\n\
+Please enter a number from %lld to %lld.\n", min, max );
+          }
+          else
+          {
+               *value = num;
+               return 0;
+          }
+     }
+}
+
+#endif  /* _READ_NUMBER_C */
+
+/* EOF read_number.c */
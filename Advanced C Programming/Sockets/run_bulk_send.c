@@ -0,0 +1,448 @@
+/*
+
+     run_bulk_send.c
+
+     This function measures what it costs the sender to move
+     total_bytes from the client socket to the server socket with one
+     of the bulk send methods:
+
+     BULK_WRITE     write(2) from one buffer, which copies every byte
+                    into the kernel.
+     BULK_ZEROCOPY  send(2) with MSG_ZEROCOPY from a pool of buffers
+                    the kernel reads in place.  See zerocopy.c.
+     BULK_SENDFILE  sendfile(2) from a file.
+     BULK_SPLICE    splice(2) from a file through a pipe.
+
+     The file is a memfd_create(2) file of BULK_FILE_SIZE bytes, so it
+     is always in the page cache and the disk isn't being measured.
+     It is sent over and over until total_bytes have gone out.
+
+     A child process created with fork(2) receives and throws the
+     data away, then writes what it got into a pipe.  This process
+     does the sending so its CPU time is the sender's.  A zero-copy run
+     isn't done until every completion has come back.  SIGPIPE is
+     ignored during the run so a receiver that dies shows up as EPIPE.
+
+     Only stream sockets are supported.
+
+     Returns 0 on success or -1 if an error occurs.
+
+     Written by Matthew Campbell.
+
+*/
+
+#ifndef _RUN_BULK_SEND_C
+#define _RUN_BULK_SEND_C
+
+#include "sockets.h"
+
+/* The child's side: receive total_bytes and report what arrived. */
+
+static void receive_all( const int sock_fd, const uint64_t total_bytes,
+                         struct bulk_stats *got )
+{
+     char *buffer;
+     int ret;
+     ssize_t num;
+     struct pollfd pfd;
+
+     buffer = malloc( BULK_CHUNK );
+     if ( buffer == NULL )
+     {
+          got->error = ENOMEM;
+          return;
+     }
+
+     while( got->bytes_received < total_bytes )
+     {
+          num = recv( sock_fd, buffer, BULK_CHUNK, MSG_DONTWAIT );
+          if ( num > 0 )
+          {
+               got->bytes_received += ( uint64_t )num;
+               continue;
+          }
+          if ( num == 0 )
+          {
+               got->error = ECONNRESET;
+               break;
+          }
+          if ( errno == EINTR )
+          {
+               continue;
+          }
+          if ( errno != EAGAIN && errno != EWOULDBLOCK )
+          {
+               got->error = errno;
+               break;
+          }
+
+          pfd.fd = sock_fd;
+          pfd.events = POLLIN;
+          pfd.revents = 0;
+          ret = poll( &pfd, 1, BENCH_STALL_MS );
+          if ( ret == 0 )
+          {
+               got->error = ETIMEDOUT;
+               break;
+          }
+     }
+     free( buffer );
+     return;
+}
+
+/* Sends with write(2).  Returns 0 or -1 on error. */
+
+static int write_all( const int sock_fd, const char *buffer,
+                      const uint64_t total_bytes, struct bulk_stats *stats )
+{
+     size_t len;
+     ssize_t num;
+     struct pollfd pfd;
+
+     while( stats->bytes_sent < total_bytes )
+     {
+          len = BULK_CHUNK;
+          if ( ( total_bytes - stats->bytes_sent ) < len )
+          {
+               len = ( size_t )( total_bytes - stats->bytes_sent );
+          }
+          num = write( sock_fd, buffer, len );
+          stats->send_calls++;
+          if ( num < 0 )
+          {
+               if ( errno == EINTR )
+               {
+                    continue;
+               }
+               if ( errno != EAGAIN && errno != EWOULDBLOCK )
+               {
+                    return ( -1 );
+               }
+               pfd.fd = sock_fd;
+               pfd.events = POLLOUT;
+               pfd.revents = 0;
+               if ( poll( &pfd, 1, BENCH_STALL_MS ) == 0 )
+               {
+                    errno = ETIMEDOUT;
+                    return ( -1 );
+               }
+               continue;
+          }
+          stats->bytes_sent += ( uint64_t )num;
+     }
+     return 0;
+}
+
+/* Sends with MSG_ZEROCOPY.  Returns 0 or -1 on error. */
+
+static int zerocopy_all( struct zc_sender *zc, const uint64_t total_bytes,
+                         struct bulk_stats *stats )
+{
+     size_t len;
+     struct zc_buf *buf;
+
+     while( stats->bytes_sent < total_bytes )
+     {
+          buf = zc_acquire( zc, BENCH_STALL_MS );
+          if ( buf == NULL )
+          {
+               return ( -1 );
+          }
+          len = buf->size;
+          if ( ( total_bytes - stats->bytes_sent ) < len )
+          {
+               len = ( size_t )( total_bytes - stats->bytes_sent );
+          }
+          if ( zc_send( zc, buf, len ) != 0 )
+          {
+               return ( -1 );
+          }
+          stats->bytes_sent += len;
+     }
+     return zc_drain( zc, BENCH_STALL_MS );
+}
+
+/* Sends the file with sendfile(2) or splice(2).  Returns 0 or -1. */
+
+static int file_all( const int sock_fd, const int file_fd,
+                     const int method, const uint64_t total_bytes,
+                     struct bulk_stats *stats )
+{
+     size_t len;
+
+     while( stats->bytes_sent < total_bytes )
+     {
+          len = BULK_FILE_SIZE;
+          if ( ( total_bytes - stats->bytes_sent ) < len )
+          {
+               len = ( size_t )( total_bytes - stats->bytes_sent );
+          }
+          if ( send_file( sock_fd, file_fd, 0, len, method,
+                          &( stats->send_calls ) ) != 0 )
+          {
+               return ( -1 );
+          }
+          stats->bytes_sent += len;
+     }
+     return 0;
+}
+
+/* Makes the file sendfile(2) and splice(2) read from. */
+
+static int make_file( void )
+{
+     char *buffer;
+     int file_fd, save_errno;
+     size_t written;
+     ssize_t num;
+
+     buffer = malloc( BULK_CHUNK );
+     if ( buffer == NULL )
+     {
+          errno = ENOMEM;
+          return ( -1 );
+     }
+     memset( buffer, 'x', BULK_CHUNK );
+
+     file_fd = memfd_create( "bulk_send", MFD_CLOEXEC );
+     if ( file_fd < 0 )
+     {
+          save_errno = errno;
+          free( buffer );
+          errno = save_errno;
+          return ( -1 );
+     }
+
+     written = 0;
+     while( written < BULK_FILE_SIZE )
+     {
+          num = write( file_fd, buffer, BULK_CHUNK );
+          if ( num < 0 )
+          {
+               if ( errno == EINTR )
+               {
+                    continue;
+               }
+               save_errno = errno;
+               close( file_fd );
+               free( buffer );
+               errno = save_errno;
+               return ( -1 );
+          }
+          written += ( size_t )num;
+     }
+     free( buffer );
+     return file_fd;
+}
+
+int run_bulk_send( const int csock_fd, const int ssock_fd,
+                   const int method, const uint64_t total_bytes,
+                   struct bulk_stats *stats )
+{
+     char *buffer;
+     int done_fd[ 2 ], file_fd, index, piece, ret, save_errno, sock_type;
+     pid_t pid;
+     socklen_t size;
+     ssize_t num;
+     struct bulk_stats got;
+     struct sigaction old_pipe, pipe_new;
+     struct zc_sender zc;
+     uint64_t child_cpu, self_cpu, start_ns;
+
+     if ( csock_fd < 0 || ssock_fd < 0 || total_bytes < 1 ||
+          method < BULK_WRITE || method > BULK_SPLICE )
+     {
+          errno = EINVAL;
+          return ( -1 );
+     }
+     if ( stats == NULL )
+     {
+          errno = EFAULT;
+          return ( -1 );
+     }
+     memset( stats, 0, sizeof( struct bulk_stats ) );
+
+     size = sizeof( sock_type );
+     if ( getsockopt( csock_fd, SOL_SOCKET, SO_TYPE, &sock_type,
+                      &size ) != 0 )
+     {
+          return ( -1 );
+     }
+     if ( sock_type != SOCK_STREAM )
+     {
+          errno = EPROTOTYPE;
+          return ( -1 );
+     }
+
+     /* Get the source ready before the clock starts. */
+
+     buffer = NULL;
+     file_fd = ( -1 );
+     if ( method == BULK_WRITE )
+     {
+          buffer = malloc( BULK_CHUNK );
+          if ( buffer == NULL )
+          {
+               errno = ENOMEM;
+               return ( -1 );
+          }
+          memset( buffer, 'x', BULK_CHUNK );
+     }
+     else if ( method == BULK_ZEROCOPY )
+     {
+          if ( zc_init( &zc, csock_fd, ZC_BUFFERS, BULK_CHUNK ) != 0 )
+          {
+               return ( -1 );
+          }
+          for( index = 0; index < zc.count; index++ )
+          {
+               for( piece = 0; piece < zc.bufs[ index ].pieces; piece++ )
+               {
+                    memset( zc.bufs[ index ].iov[ piece ].iov_base, 'x',
+                            zc.bufs[ index ].iov[ piece ].iov_len );
+               }
+          }
+     }
+     else
+     {
+          file_fd = make_file();
+          if ( file_fd < 0 )
+          {
+               return ( -1 );
+          }
+     }
+
+     if ( pipe( done_fd ) != 0 )
+     {
+          save_errno = errno;
+          free( buffer );
+          if ( method == BULK_ZEROCOPY )
+          {
+               zc_free( &zc );
+          }
+          if ( file_fd >= 0 )
+          {
+               close( file_fd );
+          }
+          errno = save_errno;
+          return ( -1 );
+     }
+
+     memset( &pipe_new, 0, sizeof( pipe_new ) );
+     pipe_new.sa_handler = SIG_IGN;
+     sigemptyset( &pipe_new.sa_mask );
+     sigaction( SIGPIPE, &pipe_new, &old_pipe );
+
+     self_cpu = get_cpu_ns( RUSAGE_SELF );
+     child_cpu = get_cpu_ns( RUSAGE_CHILDREN );
+
+     fflush( stdout );  /* Don't let the child repeat our output. */
+
+     start_ns = get_time_ns();
+     pid = fork();
+     if ( pid == ( -1 ) )
+     {
+          save_errno = errno;
+          sigaction( SIGPIPE, &old_pipe, NULL );
+          close( done_fd[ 0 ] );
+          close( done_fd[ 1 ] );
+          free( buffer );
+          if ( method == BULK_ZEROCOPY )
+          {
+               zc_free( &zc );
+          }
+          if ( file_fd >= 0 )
+          {
+               close( file_fd );
+          }
+          errno = save_errno;
+          return ( -1 );
+     }
+     else if ( pid == 0 )  /* Child process */
+     {
+          close( done_fd[ 0 ] );
+          memset( &got, 0, sizeof( got ) );
+          receive_all( ssock_fd, total_bytes, &got );
+          num = write( done_fd[ 1 ], &got, sizeof( got ) );
+          close( done_fd[ 1 ] );
+          _exit( ( num == ( ssize_t )sizeof( got ) && got.error == 0 ) ?
+                 EXIT_SUCCESS : EXIT_FAILURE );
+     }
+
+     /* Parent process, pid > 0 */
+
+     close( done_fd[ 1 ] );
+
+     if ( method == BULK_WRITE )
+     {
+          ret = write_all( csock_fd, buffer, total_bytes, stats );
+     }
+     else if ( method == BULK_ZEROCOPY )
+     {
+          ret = zerocopy_all( &zc, total_bytes, stats );
+          stats->send_calls = zc.calls;
+          stats->zc_completions = zc.completions;
+          stats->zc_copied = zc.copied;
+     }
+     else
+     {
+          ret = file_all( csock_fd, file_fd, method, total_bytes, stats );
+     }
+     save_errno = errno;
+     stats->send_cpu_ns = get_cpu_ns( RUSAGE_SELF ) - self_cpu;
+
+     /* Wait for the receiver to say everything arrived. */
+
+     memset( &got, 0, sizeof( got ) );
+     if ( ret == 0 )
+     {
+          do
+          {
+               num = read( done_fd[ 0 ], &got, sizeof( got ) );
+          }    while( num < 0 && errno == EINTR );
+          stats->elapsed_ns = get_time_ns() - start_ns;
+          if ( num != ( ssize_t )sizeof( got ) )
+          {
+               save_errno = EIO;
+               ret = ( -1 );
+          }
+          else if ( got.error != 0 )
+          {
+               save_errno = got.error;
+               ret = ( -1 );
+          }
+     }
+     else
+     {
+          kill( pid, SIGTERM );
+     }
+     close( done_fd[ 0 ] );
+     waitpid( pid, NULL, 0 );
+     sigaction( SIGPIPE, &old_pipe, NULL );
+
+     stats->bytes_received = got.bytes_received;
+     stats->recv_cpu_ns = get_cpu_ns( RUSAGE_CHILDREN ) - child_cpu;
+
+     free( buffer );
+     if ( method == BULK_ZEROCOPY )
+     {
+          zc_free( &zc );
+     }
+     if ( file_fd >= 0 )
+     {
+          close( file_fd );
+     }
+
+     if ( ret != 0 )
+     {
+          errno = save_errno;
+          return ( -1 );
+     }
+
+     errno = 0;
+     return 0;
+}
+
+#endif  /* _RUN_BULK_SEND_C */
+
+/* EOF run_bulk_send.c */
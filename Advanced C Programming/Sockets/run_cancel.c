@@ -0,0 +1,517 @@
+/*
+
+     run_cancel.c
+
+     This function measures how long a cancel takes to get from the
+     client socket to the server socket while the stream between
+     them is saturated.
+
+     Each round the client keeps CANCEL_QUEUE bytes queued between
+     the two sockets for CANCEL_FILL_MS and then cancels.  If urgent
+     is 0 the cancel is an OOB_CANCEL byte sent in line, and the
+     receiver can't see it until it has worked through everything
+     queued ahead of it.  If urgent is 1 it goes with oob_send() as
+     urgent data.  The receiver is told about
+     it with SIGURG, taken through a signalfd(2), and oob_recv()
+     throws away the stale data without reading it.  While the mark
+     is more than 64 KB away every segment moves the urgent pointer
+     and sends another SIGURG, so one can be left over from the last
+     round with no urgent data behind it.  Those are ignored.
+
+     Urgent data doesn't skip the network, only the queue.  The
+     urgent pointer still has to travel in a segment, and while the
+     receive window is shut nothing is sent.  Linux keeps it shut
+     until a sixteenth of the receive buffer is free, so how soon a
+     cancel is heard depends on how big that buffer has grown, and
+     how fast the receiver frees it.
+
+     A child process created with fork(2) is the receiver.  It reads
+     CANCEL_CHUNK bytes at a time, no faster than CANCEL_DRAIN_RATE
+     bytes per second, the way a busy consumer would, and writes the
+     time it saw each cancel and the time it was done with it into a
+     pipe.  That also tells the sender to start the next round.  What
+     is queued is what SIOCINQ says is waiting on the server socket
+     plus what SIOCOUTQ says hasn't left the client socket.  Holding
+     it steady gives both kinds of cancel the same queue to get past,
+     which letting the buffers fill up wouldn't: throwing data away
+     makes the receiver look fast, and TCP grows its buffer to match.
+
+     Only TCP connections are supported.
+
+     Returns 0 on success or -1 if an error occurs.
+
+     Written by Matthew Campbell.
+
+*/
+
+#ifndef _RUN_CANCEL_C
+#define _RUN_CANCEL_C
+
+#include "sockets.h"
+
+/* What the receiver reports for each round. */
+
+struct cancel_report
+{
+     int error;           /* errno from the receiver, or 0. */
+     uint64_t signal_ns;  /* When it heard about the cancel. */
+     uint64_t acted_ns;   /* When it was done with it.       */
+     uint64_t discarded;  /* Bytes it threw away unread.     */
+};
+
+/* Reads and forgets whatever the signalfd has for us. */
+
+static void drain_signals( const int sig_fd )
+{
+     struct signalfd_siginfo info[ 4 ];
+
+     while( read( sig_fd, info, sizeof( info ) ) > 0 )
+     {
+          ;
+     }
+}
+
+/* The child's side: one report for being ready, then one per round. */
+
+static void receive_rounds( const int sock_fd, const int urgent,
+                            const uint64_t rounds, const int report_fd )
+{
+     char *buffer;
+     int code, nfds, ret, sig_fd;
+     ssize_t num;
+     sigset_t mask;
+     struct cancel_report report;
+     struct pollfd fds[ 2 ];
+     struct timespec wait;
+     uint64_t next_ns, now_ns, round;
+
+     memset( &report, 0, sizeof( report ) );
+     sig_fd = ( -1 );
+     buffer = malloc( CANCEL_CHUNK );
+     if ( buffer == NULL )
+     {
+          report.error = ENOMEM;
+     }
+     if ( report.error == 0 && urgent == 1 )
+     {
+          sigemptyset( &mask );
+          sigaddset( &mask, SIGURG );
+          sig_fd = signalfd( -1, &mask, ( SFD_NONBLOCK | SFD_CLOEXEC ) );
+          if ( sig_fd < 0 || oob_set_owner( sock_fd ) != 0 )
+          {
+               report.error = errno;
+          }
+          else
+          {
+               /* pthread_sigmask() returns its error, not errno. */
+
+               ret = pthread_sigmask( SIG_BLOCK, &mask, NULL );
+               if ( ret != 0 )
+               {
+                    report.error = ret;
+               }
+          }
+     }
+     if ( write( report_fd, &report, sizeof( report ) ) !=
+          ( ssize_t )sizeof( report ) || report.error != 0 )
+     {
+          free( buffer );
+          return;
+     }
+
+     fds[ 0 ].fd = sock_fd;
+     fds[ 1 ].fd = sig_fd;
+     fds[ 1 ].events = POLLIN;
+     nfds = ( ( urgent == 1 ) ? 2 : 1 );
+
+     for( round = 0; round < rounds; round++ )
+     {
+          memset( &report, 0, sizeof( report ) );
+          next_ns = get_time_ns();
+          for( ; ; )
+          {
+               /* Between reads only an urgent cancel can wake us. */
+
+               now_ns = get_time_ns();
+               if ( now_ns < next_ns )
+               {
+                    fds[ 0 ].events = POLLPRI;
+                    wait.tv_sec = ( time_t )( ( next_ns - now_ns ) /
+                                              1000000000ULL );
+                    wait.tv_nsec = ( long )( ( next_ns - now_ns ) %
+                                             1000000000ULL );
+               }
+               else
+               {
+                    fds[ 0 ].events = ( POLLIN | POLLPRI );
+                    wait.tv_sec = BENCH_STALL_MS / 1000;
+                    wait.tv_nsec = ( BENCH_STALL_MS % 1000 ) * 1000000L;
+               }
+               fds[ 0 ].revents = 0;
+               fds[ 1 ].revents = 0;
+               ret = ppoll( fds, ( nfds_t )nfds, &wait, NULL );
+               if ( ret < 0 && errno != EINTR )
+               {
+                    report.error = errno;
+                    break;
+               }
+               if ( ret == 0 && now_ns >= next_ns )
+               {
+                    report.error = ETIMEDOUT;
+                    break;
+               }
+
+               if ( urgent == 1 && ( fds[ 1 ].revents != 0 ||
+                                     ( fds[ 0 ].revents & POLLPRI ) != 0 ) )
+               {
+                    report.signal_ns = get_time_ns();
+                    drain_signals( sig_fd );
+                    code = oob_recv( sock_fd, &( report.discarded ),
+                                     BENCH_STALL_MS );
+                    report.acted_ns = get_time_ns();
+                    if ( code == 0 )
+                    {
+                         continue;  /* Left over from the last round. */
+                    }
+                    if ( code != OOB_CANCEL )
+                    {
+                         report.error = ( ( code < 0 ) ? errno : EPROTO );
+                    }
+                    break;
+               }
+               if ( ( fds[ 0 ].revents & ( POLLIN | POLLHUP | POLLERR ) ) ==
+                    0 || get_time_ns() < next_ns )
+               {
+                    continue;
+               }
+
+               num = recv( sock_fd, buffer, CANCEL_CHUNK, MSG_DONTWAIT );
+               if ( num == 0 )
+               {
+                    report.error = ECONNRESET;
+                    break;
+               }
+               if ( num < 0 )
+               {
+                    if ( errno != EINTR && errno != EAGAIN &&
+                         errno != EWOULDBLOCK )
+                    {
+                         report.error = errno;
+                         break;
+                    }
+                    continue;
+               }
+               if ( urgent == 0 &&
+                    memchr( buffer, OOB_CANCEL, ( size_t )num ) != NULL )
+               {
+                    report.signal_ns = get_time_ns();
+                    report.acted_ns = report.signal_ns;
+                    break;
+               }
+               next_ns += ( uint64_t )num * 1000000000ULL /
+                          CANCEL_DRAIN_RATE;
+          }
+
+          if ( write( report_fd, &report, sizeof( report ) ) !=
+               ( ssize_t )sizeof( report ) || report.error != 0 )
+          {
+               break;
+          }
+     }
+
+     if ( sig_fd >= 0 )
+     {
+          close( sig_fd );
+     }
+     free( buffer );
+     return;
+}
+
+/* What SIOCINQ and SIOCOUTQ say is queued between the two sockets. */
+
+static uint64_t queued_bytes( const int csock_fd, const int ssock_fd )
+{
+     int inq, outq;
+
+     inq = 0;
+     outq = 0;
+     ioctl( ssock_fd, SIOCINQ, &inq );
+     ioctl( csock_fd, SIOCOUTQ, &outq );
+     return ( uint64_t )inq + ( uint64_t )outq;
+}
+
+/*
+
+     Keeps CANCEL_QUEUE bytes queued for CANCEL_FILL_MS, checking
+     every OOB_RETRY_US microseconds once there are.  Returns 0 or -1
+     on error.
+
+*/
+
+static int fill( const int csock_fd, const int ssock_fd, const char *buffer )
+{
+     size_t len;
+     ssize_t num;
+     struct timespec pause;
+     uint64_t end_ns, queued;
+
+     pause.tv_sec = 0;
+     pause.tv_nsec = OOB_RETRY_US * 1000L;
+     end_ns = get_time_ns() + CANCEL_FILL_MS * 1000000ULL;
+     while( get_time_ns() < end_ns )
+     {
+          queued = queued_bytes( csock_fd, ssock_fd );
+          if ( queued >= CANCEL_QUEUE )
+          {
+               nanosleep( &pause, NULL );
+               continue;
+          }
+
+          len = CANCEL_CHUNK;
+          if ( CANCEL_QUEUE - queued < len )
+          {
+               len = ( size_t )( CANCEL_QUEUE - queued );
+          }
+          num = send( csock_fd, buffer, len,
+                      ( MSG_DONTWAIT | MSG_NOSIGNAL ) );
+          if ( num < 0 && errno != EINTR && errno != EAGAIN &&
+               errno != EWOULDBLOCK )
+          {
+               return ( -1 );
+          }
+          if ( num < 0 && errno != EINTR )
+          {
+               nanosleep( &pause, NULL );
+          }
+     }
+     return 0;
+}
+
+/* Sends the cancel in line, waiting for room.  Returns 0 or -1. */
+
+static int send_in_line( const int sock_fd )
+{
+     char byte;
+     ssize_t num;
+     struct pollfd pfd;
+
+     byte = OOB_CANCEL;
+     for( ; ; )
+     {
+          num = send( sock_fd, &byte, 1, ( MSG_DONTWAIT | MSG_NOSIGNAL ) );
+          if ( num == 1 )
+          {
+               return 0;
+          }
+          if ( errno == EINTR )
+          {
+               continue;
+          }
+          if ( errno != EAGAIN && errno != EWOULDBLOCK )
+          {
+               return ( -1 );
+          }
+
+          pfd.fd = sock_fd;
+          pfd.events = POLLOUT;
+          pfd.revents = 0;
+          if ( poll( &pfd, 1, BENCH_STALL_MS ) == 0 )
+          {
+               errno = ETIMEDOUT;
+               return ( -1 );
+          }
+     }
+}
+
+/* Reads one report from the receiver.  Returns 0 or -1 on error. */
+
+static int read_report( const int report_fd, struct cancel_report *report )
+{
+     ssize_t num;
+
+     do
+     {
+          num = read( report_fd, report, sizeof( struct cancel_report ) );
+     }    while( num < 0 && errno == EINTR );
+
+     if ( num != ( ssize_t )sizeof( struct cancel_report ) )
+     {
+          errno = EIO;
+          return ( -1 );
+     }
+     if ( report->error != 0 )
+     {
+          errno = report->error;
+          return ( -1 );
+     }
+     return 0;
+}
+
+int run_cancel( const int csock_fd, const int ssock_fd, const int urgent,
+                const uint64_t rounds, struct cancel_stats *stats )
+{
+     char *buffer;
+     int protocol, report_fd[ 2 ], ret, save_errno;
+     pid_t pid;
+     socklen_t opt_len;
+     struct cancel_report report;
+     uint64_t count, discarded, queued, sent_ns;
+     uint64_t *acted, *heard;
+
+     if ( csock_fd < 0 || ssock_fd < 0 || rounds < 1 )
+     {
+          errno = EINVAL;
+          return ( -1 );
+     }
+     if ( urgent != 0 && urgent != 1 )
+     {
+          errno = EINVAL;
+          return ( -1 );
+     }
+     if ( stats == NULL )
+     {
+          errno = EFAULT;
+          return ( -1 );
+     }
+
+     memset( stats, 0, sizeof( struct cancel_stats ) );
+
+     opt_len = sizeof( protocol );
+     if ( getsockopt( csock_fd, SOL_SOCKET, SO_PROTOCOL, &protocol,
+                      &opt_len ) != 0 )
+     {
+          return ( -1 );
+     }
+     if ( protocol != IPPROTO_TCP )
+     {
+          errno = EPROTONOSUPPORT;
+          return ( -1 );
+     }
+
+     buffer = malloc( CANCEL_CHUNK );
+     acted = calloc( ( size_t )rounds, sizeof( uint64_t ) );
+     heard = calloc( ( size_t )rounds, sizeof( uint64_t ) );
+     if ( buffer == NULL || acted == NULL || heard == NULL )
+     {
+          free( buffer );
+          free( acted );
+          free( heard );
+          errno = ENOMEM;
+          return ( -1 );
+     }
+     memset( buffer, 'x', CANCEL_CHUNK );
+
+     if ( pipe( report_fd ) != 0 )
+     {
+          save_errno = errno;
+          free( buffer );
+          free( acted );
+          free( heard );
+          errno = save_errno;
+          return ( -1 );
+     }
+
+     fflush( stdout );  /* Don't let the child repeat our output. */
+
+     pid = fork();
+     if ( pid == ( -1 ) )
+     {
+          save_errno = errno;
+          close( report_fd[ 0 ] );
+          close( report_fd[ 1 ] );
+          free( buffer );
+          free( acted );
+          free( heard );
+          errno = save_errno;
+          return ( -1 );
+     }
+     else if ( pid == 0 )  /* Child process */
+     {
+          close( report_fd[ 0 ] );
+          receive_rounds( ssock_fd, urgent, rounds, report_fd[ 1 ] );
+          close( report_fd[ 1 ] );
+          _exit( EXIT_SUCCESS );
+     }
+
+     /* Parent process, pid > 0 */
+
+     close( report_fd[ 1 ] );
+
+     discarded = 0;
+     queued = 0;
+     ret = read_report( report_fd[ 0 ], &report );  /* Ready. */
+     for( count = 0; ret == 0 && count < rounds; count++ )
+     {
+          ret = fill( csock_fd, ssock_fd, buffer );
+          if ( ret != 0 )
+          {
+               break;
+          }
+          queued += queued_bytes( csock_fd, ssock_fd );
+
+          sent_ns = get_time_ns();
+          if ( urgent == 1 )
+          {
+               ret = oob_send( csock_fd, OOB_CANCEL, BENCH_STALL_MS );
+          }
+          else
+          {
+               ret = send_in_line( csock_fd );
+          }
+          if ( ret == 0 )
+          {
+               ret = read_report( report_fd[ 0 ], &report );
+          }
+          if ( ret != 0 )
+          {
+               break;
+          }
+
+          heard[ count ] = report.signal_ns - sent_ns;
+          acted[ count ] = report.acted_ns - sent_ns;
+          discarded += report.discarded;
+     }
+     save_errno = errno;
+
+     if ( ret != 0 )
+     {
+          kill( pid, SIGTERM );
+     }
+     close( report_fd[ 0 ] );
+     waitpid( pid, NULL, 0 );
+     if ( urgent == 1 )
+     {
+          fcntl( ssock_fd, F_SETOWN, 0 );  /* The owner is gone. */
+     }
+
+     if ( ret == 0 )
+     {
+          sort_samples( acted, rounds );
+          sort_samples( heard, rounds );
+          stats->rounds = rounds;
+          stats->queued = queued / rounds;
+          stats->p50_ns = percentile( acted, rounds, 50 );
+          stats->p99_ns = percentile( acted, rounds, 99 );
+          stats->max_ns = acted[ rounds - 1 ];
+          stats->signal_ns = ( ( urgent == 1 ) ?
+                               percentile( heard, rounds, 50 ) : 0 );
+          stats->discarded = discarded / rounds;
+     }
+
+     free( buffer );
+     free( acted );
+     free( heard );
+
+     if ( ret != 0 )
+     {
+          errno = save_errno;
+          return ( -1 );
+     }
+
+     errno = 0;
+     return 0;
+}
+
+#endif  /* _RUN_CANCEL_C */
+
+/* EOF run_cancel.c */
@@ -0,0 +1,783 @@
+/*
+
+     run_epoll_server.c
+
+     This function runs the multi-connection server.  The listening
+     socket and every accepted connection are kept in one edge
+     triggered epoll(7) set so a single process can serve thousands
+     of peers.  Each connection is an echo service: whatever a peer
+     sends is written straight back to it.  What comes in is read
+     into a buffer on the stack and echoed at once.  Only what send(2)
+     won't take right away is kept, in the connection's nb_conn queue,
+     which comes out of the connection's own arena and is given back
+     all at once when the connection closes.  A peer that is keeping
+     up never takes any memory for its data at all.
+
+     The event loop keeps running until ctl_fd becomes readable,
+     which is how the caller tells the server to stop.  Returns 0
+     on success or -1 if an error occurs.
+
+     run_handoff_server() runs the same event loop in a prefork
+     worker.  Instead of accepting connections itself it receives
+     them from the acceptor over chan_fd with recv_fd(), and after
+     each pass through the loop tells the acceptor how many have
+     closed since it last said, as a uint32_t, so the acceptor knows
+     how busy it is.  It also stops if the acceptor goes away.
+
+     run_threaded_server() runs the same event loop, but hands the
+     requests on each connection to a pool of threads from
+     work_pool.c, so one busy peer doesn't hold up every other.  Each
+     connection is in the set with EPOLLONESHOT, so only one task for
+     it is ever queued or running.  The loop submits a task to the
+     worker that owns the connection, which another worker can steal
+     if that one is backed up.  The task echoes whatever has come in
+     and arms the connection again, or if the connection has to be
+     closed, puts it on a list and wakes the loop with a byte on a
+     pipe, since only the loop changes the tables a connection is in.
+     Each connection counts what its tasks did, and that is added to
+     the server's statistics when it is closed.  If a worker's deque
+     is full the loop runs the task itself.
+
+     In the main process the signalfd from sig_events_open() is in
+     the set as well.  Signals are counted as they come in, and
+     SIGTERM stops the server, which then fails with ECANCELED.
+
+     Every connection is put into conn_table_main() when it is
+     accepted and taken out again when it is closed.  With
+     SAMPLE_TCP_INFO a TCP connection is also given to the TCP_INFO
+     sampler for as long as it is open, and the server counts how
+     many peers it watched and how many of them were flagged.
+
+     Written by Matthew Campbell.
+
+*/
+
+#ifndef _RUN_EPOLL_SERVER_C
+#define _RUN_EPOLL_SERVER_C
+
+#include "sockets.h"
+
+struct epoll_threads;
+
+/* Per connection state, indexed by the connection's file descriptor. */
+
+struct epoll_conn
+{
+     int open;
+     int tcp_slot;        /* The sampler's slot for it, or -1.    */
+     struct nb_conn nb;   /* The echo still waiting to go out.    */
+     struct epoll_threads *threads;  /* Its tasks' pool, or NULL. */
+     struct server_stats stats;      /* What its tasks did.       */
+};
+
+/* What run_threaded_server()'s tasks share with the event loop. */
+
+struct epoll_threads
+{
+     struct work_pool pool;
+     int epoll_fd;
+     int wake_fd[ 2 ];        /* A byte here means done has some.  */
+     pthread_mutex_t lock;    /* Guards done and done_count.       */
+     int *done;               /* Connections for the loop to close. */
+     int *spare;              /* The loop swaps this with done.    */
+     int done_count;
+};
+
+/* Close a connection and forget about it. */
+
+static void close_conn( const int epoll_fd, const int fd,
+                        struct epoll_conn *conn, struct tcp_sampler *sampler,
+                        struct server_stats *stats, uint64_t *open_now )
+{
+     /* Count what its tasks did, if it had any. */
+
+     stats->closed += conn->stats.closed;
+     stats->bytes_in += conn->stats.bytes_in;
+     stats->bytes_out += conn->stats.bytes_out;
+     stats->errors += conn->stats.errors;
+     stats->syscalls += conn->stats.syscalls;
+     memset( &( conn->stats ), 0, sizeof( struct server_stats ) );
+
+     if ( conn->tcp_slot >= 0 )
+     {
+          if ( tcp_sampler_drop( sampler, conn->tcp_slot ) > 0 )
+          {
+               stats->tcp_flagged++;
+          }
+          conn->tcp_slot = ( -1 );
+     }
+     epoll_ctl( epoll_fd, EPOLL_CTL_DEL, fd, NULL );
+     metrics_forget( fd );
+     conn_remove_fd( conn_table_main(), fd );
+     close( fd );
+     nb_conn_free( &( conn->nb ) );
+     conn->open = 0;
+     ( *open_now )--;
+     return;
+}
+
+/*
+
+     Echo everything the peer has sent.  Since the connection is
+     edge triggered we have to keep going until either recv(2) or
+     send(2) reports EAGAIN, otherwise we won't hear about it again.
+     Returns 1 if the connection has to be closed, otherwise 0.
+
+*/
+
+static int service_conn( const int fd, struct epoll_conn *conn,
+                         struct server_stats *stats )
+{
+     char buffer[ EPOLL_CONN_BUFFER ];
+     int ret;
+     ssize_t num;
+     uint64_t sent;
+
+     for( ; ; )
+     {
+          /* Flush anything still waiting to be echoed. */
+
+          if ( conn->nb.out_len > 0 )
+          {
+               sent = conn->nb.bytes_out;
+               stats->syscalls++;
+               ret = nb_flush( &( conn->nb ) );
+               stats->bytes_out += conn->nb.bytes_out - sent;
+               if ( ret != 0 )
+               {
+                    stats->errors++;
+                    return 1;
+               }
+               if ( conn->nb.out_len > 0 )
+               {
+                    return 0;  /* Wait for EPOLLOUT. */
+               }
+          }
+
+          stats->syscalls++;
+          num = recv_nb( fd, buffer, EPOLL_CONN_BUFFER );
+          if ( num > 0 )
+          {
+               /* Whatever send(2) won't take yet goes in the arena. */
+
+               stats->bytes_in += ( uint64_t )num;
+               sent = conn->nb.bytes_out;
+               stats->syscalls++;
+               ret = nb_queue_send( &( conn->nb ), buffer, ( size_t )num );
+               stats->bytes_out += conn->nb.bytes_out - sent;
+               if ( ret != 0 )
+               {
+                    stats->errors++;
+                    return 1;
+               }
+               if ( conn->nb.out_len > 0 )
+               {
+                    return 0;  /* Wait for EPOLLOUT. */
+               }
+          }
+          else if ( num == 0 )  /* The peer hung up. */
+          {
+               stats->closed++;
+               return 1;
+          }
+          else if ( errno == EAGAIN )
+          {
+               return 0;  /* Wait for EPOLLIN. */
+          }
+          else
+          {
+               stats->errors++;
+               return 1;
+          }
+     }
+}
+
+/*
+
+     What the pool runs for a connection with something to do.  Only
+     ask for EPOLLOUT while an echo is waiting to go out, since a
+     one-shot connection that is writable would otherwise come
+     straight back.
+
+*/
+
+static void conn_task( void *arg )
+{
+     int fd;
+     ssize_t len;
+     struct epoll_conn *conn;
+     struct epoll_event event;
+     struct epoll_threads *threads;
+
+     conn = ( struct epoll_conn * )arg;
+     threads = conn->threads;
+     fd = conn->nb.fd;
+
+     if ( service_conn( fd, conn, &( conn->stats ) ) == 0 )
+     {
+          memset( &event, 0, sizeof( event ) );
+          event.events = EPOLLIN | EPOLLRDHUP | EPOLLET | EPOLLONESHOT;
+          if ( conn->nb.out_len > 0 )
+          {
+               event.events |= EPOLLOUT;
+          }
+          event.data.fd = fd;
+          conn->stats.syscalls++;
+          if ( epoll_ctl( threads->epoll_fd, EPOLL_CTL_MOD, fd,
+                          &event ) == 0 )
+          {
+               return;
+          }
+          conn->stats.errors++;
+     }
+
+     /* Leave closing it to the event loop. */
+
+     pthread_mutex_lock( &( threads->lock ) );
+     threads->done[ threads->done_count ] = fd;
+     threads->done_count++;
+     pthread_mutex_unlock( &( threads->lock ) );
+
+     /* If the pipe is full the loop already has a byte to wake it. */
+
+     conn->stats.syscalls++;
+     len = write( threads->wake_fd[ 1 ], "", 1 );
+     ( void )len;
+     return;
+}
+
+/* Starts count threads and everything they share with the loop. */
+
+static int threads_start( struct epoll_threads *threads, const int count,
+                          const int epoll_fd, const int max_conns )
+{
+     int save_errno;
+
+     memset( threads, 0, sizeof( struct epoll_threads ) );
+     threads->epoll_fd = epoll_fd;
+     threads->done = calloc( ( size_t )max_conns, sizeof( int ) );
+     threads->spare = calloc( ( size_t )max_conns, sizeof( int ) );
+     if ( threads->done == NULL || threads->spare == NULL )
+     {
+          free( threads->done );
+          free( threads->spare );
+          errno = ENOMEM;
+          return ( -1 );
+     }
+     if ( pipe( threads->wake_fd ) != 0 )
+     {
+          save_errno = errno;
+          free( threads->done );
+          free( threads->spare );
+          errno = save_errno;
+          return ( -1 );
+     }
+     if ( set_nonblocking( threads->wake_fd[ 0 ] ) != 0 ||
+          set_nonblocking( threads->wake_fd[ 1 ] ) != 0 ||
+          wp_start( &( threads->pool ), count, 1 ) != 0 )
+     {
+          save_errno = errno;
+          close( threads->wake_fd[ 0 ] );
+          close( threads->wake_fd[ 1 ] );
+          free( threads->done );
+          free( threads->spare );
+          errno = save_errno;
+          return ( -1 );
+     }
+     pthread_mutex_init( &( threads->lock ), NULL );
+     return 0;
+}
+
+/*
+
+     Closes every connection the tasks have finished with, after
+     emptying the pipe that said there were some.
+
+*/
+
+static void close_done( struct epoll_threads *threads,
+                        struct epoll_conn *conns,
+                        struct tcp_sampler *sampler,
+                        struct server_stats *stats, uint64_t *open_now )
+{
+     char drain[ 64 ];
+     int count, index, *list;
+
+     stats->syscalls++;
+     while( read( threads->wake_fd[ 0 ], drain, sizeof( drain ) ) > 0 )
+     {
+          stats->syscalls++;
+     }
+
+     pthread_mutex_lock( &( threads->lock ) );
+     list = threads->done;
+     count = threads->done_count;
+     threads->done = threads->spare;
+     threads->done_count = 0;
+     threads->spare = list;
+     pthread_mutex_unlock( &( threads->lock ) );
+
+     for( index = 0; index < count; index++ )
+     {
+          close_conn( threads->epoll_fd, list[ index ],
+                      &( conns[ list[ index ] ] ), sampler, stats,
+                      open_now );
+     }
+     return;
+}
+
+/*
+
+     Waits for every task and stops the threads, closes whatever the
+     last tasks finished with, and frees what the threads shared.
+
+*/
+
+static void threads_stop( struct epoll_threads *threads,
+                          struct epoll_conn *conns,
+                          struct tcp_sampler *sampler,
+                          struct server_stats *stats, uint64_t *open_now )
+{
+     wp_stop( &( threads->pool ) );
+     close_done( threads, conns, sampler, stats, open_now );
+     pthread_mutex_destroy( &( threads->lock ) );
+     close( threads->wake_fd[ 0 ] );
+     close( threads->wake_fd[ 1 ] );
+     free( threads->done );
+     free( threads->spare );
+     return;
+}
+
+/*
+
+     The event loop.  lsock_fd is a listening socket, or if handoff
+     is 1, the channel connections are handed over on.  If workers
+     is more than 0 that many threads handle the requests.
+
+*/
+
+static int serve( const int lsock_fd, const int handoff, const int workers,
+                  const int ctl_fd, struct server_stats *stats )
+{
+     int count, epoll_fd, family, fd, max_conns, num, ret, save_errno;
+     int sig_fd, stop, term, wake_fd;
+     struct conn_table *table;
+     struct epoll_conn *conns;
+     struct epoll_event event, *events;
+     struct epoll_threads pool, *threads;
+     struct tcp_sampler sampler;
+     uint32_t closed;
+     uint64_t open_now, reported, start_ns;
+
+     if ( lsock_fd < 0 || ctl_fd < 0 || workers < 0 ||
+          workers > WP_MAX_WORKERS )
+     {
+          errno = EINVAL;
+          return ( -1 );
+     }
+     if ( stats == NULL )
+     {
+          errno = EFAULT;
+          return ( -1 );
+     }
+
+     memset( stats, 0, sizeof( struct server_stats ) );
+     memset( &sampler, 0, sizeof( sampler ) );
+     open_now = 0;
+
+     /* Make room for as many connections as we're allowed to open. */
+
+     max_conns = raise_fd_limit();
+     if ( max_conns < 0 )
+     {
+          return ( -1 );
+     }
+
+     /*
+
+          Connections share the listening socket's family.  One that
+          was handed over has its own, since lsock_fd is a channel.
+
+     */
+
+     table = conn_table_main();
+     if ( table == NULL )
+     {
+          return ( -1 );
+     }
+     family = sock_family( lsock_fd );
+
+     conns = calloc( ( size_t )max_conns, sizeof( struct epoll_conn ) );
+     if ( conns == NULL )
+     {
+          errno = ENOMEM;
+          return ( -1 );
+     }
+
+     events = calloc( EPOLL_MAX_EVENTS, sizeof( struct epoll_event ) );
+     if ( events == NULL )
+     {
+          free( conns );
+          errno = ENOMEM;
+          return ( -1 );
+     }
+
+     /*
+
+          The listening socket has to be nonblocking so we can
+          drain its accept queue without getting stuck.
+
+     */
+
+     if ( set_nonblocking( lsock_fd ) != 0 )
+     {
+          save_errno = errno;
+          free( events );
+          free( conns );
+          errno = save_errno;
+          return ( -1 );
+     }
+
+     epoll_fd = epoll_create1( EPOLL_CLOEXEC );
+     if ( epoll_fd < 0 )
+     {
+          save_errno = errno;
+          free( events );
+          free( conns );
+          errno = save_errno;
+          return ( -1 );
+     }
+
+     memset( &event, 0, sizeof( event ) );
+     event.events = EPOLLIN | EPOLLET;
+     event.data.fd = lsock_fd;
+     ret = epoll_ctl( epoll_fd, EPOLL_CTL_ADD, lsock_fd, &event );
+     if ( ret == 0 )
+     {
+          memset( &event, 0, sizeof( event ) );
+          event.events = EPOLLIN;
+          event.data.fd = ctl_fd;
+          ret = epoll_ctl( epoll_fd, EPOLL_CTL_ADD, ctl_fd, &event );
+     }
+     sig_fd = sig_events_fd();
+     if ( ret == 0 && sig_fd >= 0 )
+     {
+          memset( &event, 0, sizeof( event ) );
+          event.events = EPOLLIN;
+          event.data.fd = sig_fd;
+          ret = epoll_ctl( epoll_fd, EPOLL_CTL_ADD, sig_fd, &event );
+     }
+
+     /* The threads tell the loop about closed connections on a pipe. */
+
+     threads = NULL;
+     wake_fd = ( -1 );
+     if ( ret == 0 && workers > 0 )
+     {
+          ret = threads_start( &pool, workers, epoll_fd, max_conns );
+          if ( ret == 0 )
+          {
+               threads = &pool;
+               wake_fd = pool.wake_fd[ 0 ];
+               memset( &event, 0, sizeof( event ) );
+               event.events = EPOLLIN;
+               event.data.fd = wake_fd;
+               ret = epoll_ctl( epoll_fd, EPOLL_CTL_ADD, wake_fd, &event );
+          }
+     }
+     if ( ret != 0 )
+     {
+          save_errno = errno;
+          if ( threads != NULL )
+          {
+               threads_stop( threads, conns, &sampler, stats, &open_now );
+          }
+          close( epoll_fd );
+          free( events );
+          free( conns );
+          errno = save_errno;
+          return ( -1 );
+     }
+
+#ifdef DEBUG
+
+     /* On stderr, so it stays out of the benchmark tables. */
+
+     if ( threads != NULL )
+     {
+          fprintf( stderr, "\
+The multi-connection server is running, with %d threads.\n", workers );
+     }
+     else
+     {
+          fprintf( stderr, "The multi-connection server is running.\n" );
+     }
+
+#endif
+
+     reported = 0;
+     start_ns = get_time_ns();
+     stop = 0;
+     term = 0;
+     ret = 0;
+
+     /* Hold SIGTERM for the signalfd while the loop can hear it. */
+
+     sig_events_hold();
+
+     while( stop == 0 )
+     {
+          stats->syscalls++;
+          num = epoll_wait( epoll_fd, events, EPOLL_MAX_EVENTS, ( -1 ) );
+          if ( num < 0 )
+          {
+               if ( errno == EINTR )
+               {
+                    continue;
+               }
+               ret = ( -1 );
+               break;
+          }
+
+          for( count = 0; count < num; count++ )
+          {
+               fd = events[ count ].data.fd;
+
+               if ( fd == ctl_fd )
+               {
+                    stop = 1;
+               }
+               else if ( fd == sig_fd )
+               {
+                    stats->syscalls++;
+                    if ( sig_events_read() == 1 )
+                    {
+                         stop = 1;
+                         term = 1;
+                    }
+               }
+               else if ( fd == wake_fd )
+               {
+                    close_done( threads, conns, &sampler, stats,
+                                &open_now );
+               }
+               else if ( fd == lsock_fd )
+               {
+                    /* Accept, or receive, everything that is waiting. */
+
+                    for( ; ; )
+                    {
+                         stats->syscalls++;
+                         if ( handoff == 0 )
+                         {
+                              fd = accept4( lsock_fd, NULL, NULL,
+                                            ( SOCK_NONBLOCK |
+                                              SOCK_CLOEXEC ) );
+                         }
+                         else
+                         {
+                              fd = recv_fd( lsock_fd, MSG_DONTWAIT );
+                         }
+                         if ( fd < 0 )
+                         {
+                              if ( errno == EINTR ||
+                                   errno == ECONNABORTED )
+                              {
+                                   continue;
+                              }
+                              if ( handoff == 1 && errno == ECONNRESET )
+                              {
+                                   stop = 1;  /* The acceptor is gone. */
+                                   break;
+                              }
+                              if ( errno != EAGAIN &&
+                                   errno != EWOULDBLOCK )
+                              {
+                                   stats->errors++;
+                              }
+                              break;
+                         }
+                         if ( handoff == 1 && fd < max_conns )
+                         {
+                              stats->syscalls++;
+                              family = sock_family( fd );
+                         }
+                         if ( fd >= max_conns ||
+                              conn_insert( table, fd, CONN_ROLE_PEER, family,
+                                           SOCK_STREAM, NULL ) != 0 )
+                         {
+                              close( fd );
+                              stats->errors++;
+                              continue;
+                         }
+                         stats->syscalls++;
+                         if ( nb_conn_init( &( conns[ fd ].nb ), fd, NULL,
+                                            NULL ) != 0 )
+                         {
+                              conn_remove_fd( table, fd );
+                              close( fd );
+                              stats->errors++;
+                              continue;
+                         }
+
+                         memset( &event, 0, sizeof( event ) );
+                         event.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP |
+                                        EPOLLET;
+                         if ( threads != NULL )
+                         {
+                              event.events = EPOLLIN | EPOLLRDHUP |
+                                             EPOLLET | EPOLLONESHOT;
+                         }
+                         event.data.fd = fd;
+                         stats->syscalls++;
+                         if ( epoll_ctl( epoll_fd, EPOLL_CTL_ADD, fd,
+                                         &event ) != 0 )
+                         {
+                              conn_remove_fd( table, fd );
+                              close( fd );
+                              nb_conn_free( &( conns[ fd ].nb ) );
+                              stats->errors++;
+                              continue;
+                         }
+
+                         metrics_inherit( fd, lsock_fd );
+                         conns[ fd ].open = 1;
+                         conns[ fd ].tcp_slot = ( -1 );
+                         conns[ fd ].threads = threads;
+
+#ifdef SAMPLE_TCP_INFO
+
+                         if ( family == AF_INET || family == AF_INET6 )
+                         {
+                              stats->syscalls++;
+                              conns[ fd ].tcp_slot =
+                                   tcp_sampler_watch( &sampler, fd, family,
+                                                      max_conns );
+                              if ( conns[ fd ].tcp_slot >= 0 )
+                              {
+                                   stats->tcp_watched++;
+                              }
+                         }
+
+#endif
+
+                         stats->accepted++;
+                         open_now++;
+                         if ( open_now > stats->max_open )
+                         {
+                              stats->max_open = open_now;
+                         }
+
+                    }    /* for( ; ; ) */
+               }
+               else if ( fd >= 0 && fd < max_conns &&
+                         conns[ fd ].open == 1 )
+               {
+                    if ( events[ count ].events & EPOLLERR )
+                    {
+                         stats->errors++;
+                         close_conn( epoll_fd, fd, &( conns[ fd ] ),
+                                     &sampler, stats, &open_now );
+                    }
+                    else if ( threads == NULL )
+                    {
+                         if ( service_conn( fd, &( conns[ fd ] ),
+                                            stats ) != 0 )
+                         {
+                              close_conn( epoll_fd, fd, &( conns[ fd ] ),
+                                          &sampler, stats, &open_now );
+                         }
+                    }
+                    else if ( wp_submit( &( threads->pool ), fd, conn_task,
+                                         &( conns[ fd ] ) ) != 0 )
+                    {
+                         conn_task( &( conns[ fd ] ) );  /* It's full. */
+                    }
+
+               }    /* if ( fd == ctl_fd ) */
+
+          }    /* for( count = 0; count < num; count++ ) */
+
+          /* Tell the acceptor how many connections have closed. */
+
+          if ( handoff == 1 && ( stats->accepted - open_now ) > reported )
+          {
+               closed = ( uint32_t )( stats->accepted - open_now -
+                                      reported );
+               stats->syscalls++;
+               if ( send( lsock_fd, &closed, sizeof( closed ),
+                          ( MSG_DONTWAIT | MSG_NOSIGNAL ) ) ==
+                    ( ssize_t )sizeof( closed ) )
+               {
+                    reported += closed;
+               }
+          }
+
+     }    /* while( stop == 0 ) */
+     sig_events_release();
+
+     save_errno = errno;
+     stats->elapsed_ns = get_time_ns() - start_ns;
+     if ( term == 1 )
+     {
+          ret = ( -1 );
+          save_errno = ECANCELED;
+     }
+
+     /* Close whatever is still open, once no task is using it. */
+
+     if ( threads != NULL )
+     {
+          threads_stop( threads, conns, &sampler, stats, &open_now );
+     }
+     for( fd = 0; fd < max_conns; fd++ )
+     {
+          if ( conns[ fd ].open == 1 )
+          {
+               close_conn( epoll_fd, fd, &( conns[ fd ] ), &sampler, stats,
+                           &open_now );
+          }
+     }
+
+     tcp_sampler_free( &sampler );
+     close( epoll_fd );
+     free( events );
+     free( conns );
+     arena_release();
+
+     if ( ret != 0 )
+     {
+          errno = save_errno;
+          return ( -1 );
+     }
+
+     errno = 0;
+     return 0;
+}
+
+int run_epoll_server( const int lsock_fd, const int ctl_fd,
+                      struct server_stats *stats )
+{
+     return serve( lsock_fd, 0, 0, ctl_fd, stats );
+}
+
+int run_handoff_server( const int chan_fd, const int ctl_fd,
+                        struct server_stats *stats )
+{
+     return serve( chan_fd, 1, 0, ctl_fd, stats );
+}
+
+int run_threaded_server( const int lsock_fd, const int ctl_fd,
+                         const int workers, struct server_stats *stats )
+{
+     if ( workers < 1 )
+     {
+          errno = EINVAL;
+          return ( -1 );
+     }
+     return serve( lsock_fd, 0, workers, ctl_fd, stats );
+}
+
+#endif  /* _RUN_EPOLL_SERVER_C */
+
+/* EOF run_epoll_server.c */
@@ -0,0 +1,499 @@
+/*
+
+     run_latency.c
+
+     This function measures round trip latency over a connected pair.
+     A child process created with fork(2) echoes every message that
+     arrives on ssock_fd, while this process sends a message of
+     msg_size bytes on csock_fd, waits for the whole echo to come
+     back, and then sends the next one.  The first LATENCY_WARMUP
+     round trips aren't counted.
+
+     Every round trip is recorded in a log-linear histogram so
+     millions of them can be measured without storing them all.  The
+     cost of reading the clock is measured first with calibrate_clock()
+     and taken off of each sample.
+
+     Both sockets are switched to blocking mode with a receive timeout
+     of BENCH_STALL_MS for the run, so each round trip is just one
+     send(2) and one recv(2) on each side.  Their original settings
+     are restored afterwards.
+
+     Datagram echoes go back to whatever address the message came
+     from, so a datagram client needs an address of its own.
+
+     A shared memory ring, with SOCK_SHM_RING for its type, has no
+     socket settings to change.  Each round trip is one shm_send()
+     and one shm_recv() on each side instead, and how often either
+     side slept and had to be woken up is counted too.
+
+     Returns 0 on success or -1 if an error occurs.
+
+     Written by Matthew Campbell.
+
+*/
+
+#ifndef _RUN_LATENCY_C
+#define _RUN_LATENCY_C
+
+#include "sockets.h"
+
+/* Sends a whole message.  Returns 0 on success or -1 on error. */
+
+static int send_message( const int sock_fd, const char *buffer,
+                         const size_t msg_size, const struct sockaddr *to,
+                         const socklen_t to_len )
+{
+     size_t sent;
+     ssize_t num;
+
+     sent = 0;
+     while( sent < msg_size )
+     {
+          if ( to != NULL )
+          {
+               num = sendto( sock_fd, &( buffer[ sent ] ), msg_size - sent,
+                             MSG_NOSIGNAL, to, to_len );
+          }
+          else
+          {
+               num = send( sock_fd, &( buffer[ sent ] ), msg_size - sent,
+                           MSG_NOSIGNAL );
+          }
+          metrics_io( sock_fd, METRIC_BYTES_OUT, num );
+          if ( num < 0 )
+          {
+               if ( errno == EINTR )
+               {
+                    continue;
+               }
+               return ( -1 );
+          }
+          sent += ( size_t )num;
+     }
+     metrics_count( sock_fd, METRIC_MSGS_OUT, 1 );
+     return 0;
+}
+
+/*
+
+     Receives a whole message.  A stream may hand it over in pieces.
+     The sender's address is stored in from if it isn't NULL.
+     Returns 0 on success or -1 on error.
+
+*/
+
+static int recv_message( const int sock_fd, char *buffer,
+                         const size_t msg_size, const int sock_type,
+                         struct sockaddr_storage *from,
+                         socklen_t *from_len )
+{
+     size_t received;
+     ssize_t num;
+
+     received = 0;
+     while( received < msg_size )
+     {
+          if ( from != NULL )
+          {
+               *from_len = sizeof( struct sockaddr_storage );
+          }
+          num = recvfrom( sock_fd, &( buffer[ received ] ),
+                          msg_size - received, 0,
+                          ( struct sockaddr * )from, from_len );
+          metrics_io( sock_fd, METRIC_BYTES_IN, num );
+          if ( num < 0 )
+          {
+               if ( errno == EINTR )
+               {
+                    continue;
+               }
+               return ( -1 );
+          }
+          if ( num == 0 && sock_type != SOCK_DGRAM )
+          {
+               errno = ECONNRESET;
+               return ( -1 );
+          }
+          received += ( size_t )num;
+          if ( sock_type != SOCK_STREAM && received != msg_size )
+          {
+               errno = EMSGSIZE;  /* Datagrams arrive whole or not at all. */
+               return ( -1 );
+          }
+     }
+     metrics_count( sock_fd, METRIC_MSGS_IN, 1 );
+     return 0;
+}
+
+/* The child's side: echo every message back to where it came from. */
+
+static void echo_messages( const int sock_fd, char *buffer,
+                           const size_t msg_size, const int sock_type,
+                           const uint64_t count )
+{
+     socklen_t from_len;
+     struct sockaddr_storage from;
+     uint64_t index;
+
+     for( index = 0; index < count; index++ )
+     {
+          if ( sock_type == SOCK_DGRAM )
+          {
+               if ( recv_message( sock_fd, buffer, msg_size, sock_type,
+                                  &from, &from_len ) != 0 )
+               {
+                    return;
+               }
+
+               /* Unnamed AF_UNIX peers can only be answered if connected. */
+
+               if ( from_len <= sizeof( sa_family_t ) )
+               {
+                    if ( send_message( sock_fd, buffer, msg_size,
+                                       NULL, 0 ) != 0 )
+                    {
+                         return;
+                    }
+               }
+               else if ( send_message( sock_fd, buffer, msg_size,
+                                       ( struct sockaddr * )( &from ),
+                                       from_len ) != 0 )
+               {
+                    return;
+               }
+          }
+          else if ( recv_message( sock_fd, buffer, msg_size, sock_type,
+                                  NULL, NULL ) != 0 ||
+                    send_message( sock_fd, buffer, msg_size,
+                                  NULL, 0 ) != 0 )
+          {
+               return;
+          }
+     }
+     return;
+}
+
+/*
+
+     Puts a socket in blocking mode with a receive timeout.  The old
+     file status flags and timeout are saved so they can be restored.
+
+*/
+
+static int make_blocking( const int sock_fd, int *old_flags,
+                          struct timeval *old_timeout )
+{
+     socklen_t size;
+     struct timeval timeout;
+
+     *old_flags = fcntl( sock_fd, F_GETFL, 0 );
+     if ( *old_flags == ( -1 ) )
+     {
+          return ( -1 );
+     }
+     size = sizeof( struct timeval );
+     if ( getsockopt( sock_fd, SOL_SOCKET, SO_RCVTIMEO, old_timeout,
+                      &size ) != 0 )
+     {
+          return ( -1 );
+     }
+
+     timeout.tv_sec = BENCH_STALL_MS / 1000;
+     timeout.tv_usec = ( BENCH_STALL_MS % 1000 ) * 1000;
+     if ( setsockopt( sock_fd, SOL_SOCKET, SO_RCVTIMEO, &timeout,
+                      sizeof( timeout ) ) != 0 ||
+          fcntl( sock_fd, F_SETFL, ( *old_flags & ~O_NONBLOCK ) ) != 0 )
+     {
+          return ( -1 );
+     }
+     return 0;
+}
+
+/* Undoes make_blocking(). */
+
+static void restore_blocking( const int sock_fd, const int old_flags,
+                              const struct timeval *old_timeout )
+{
+     setsockopt( sock_fd, SOL_SOCKET, SO_RCVTIMEO, old_timeout,
+                 sizeof( struct timeval ) );
+     fcntl( sock_fd, F_SETFL, old_flags );
+     return;
+}
+
+/* Fills in the rest of stats from what hist recorded. */
+
+static void summarize( const struct hdr_hist *hist,
+                       struct latency_stats *stats )
+{
+     stats->samples = hist->total;
+     if ( hist->total > 0 )
+     {
+          stats->min_ns = hist->min;
+          stats->mean_ns = hist->sum / hist->total;
+          stats->p50_ns = hdr_value_at( hist, 50.0 );
+          stats->p99_ns = hdr_value_at( hist, 99.0 );
+          stats->p999_ns = hdr_value_at( hist, 99.9 );
+          stats->max_ns = hist->max;
+     }
+     return;
+}
+
+/*
+
+     The same run over a shared memory ring, recorded in hist.
+     Returns 0 on success or -1 on error.
+
+*/
+
+static int latency_shm( const int csock_fd, const int ssock_fd,
+                        char *buffer, const size_t msg_size,
+                        const uint64_t iterations, struct hdr_hist *hist,
+                        struct latency_stats *stats )
+{
+     int ret, save_errno;
+     pid_t pid;
+     ssize_t num;
+     struct shm_end client, server;
+     uint64_t elapsed, index, parks, start_ns, start_parks;
+     uint64_t start_wakeups, total, wakeups, warmup;
+
+     if ( shm_attach( csock_fd, SHM_CLIENT, &client ) != 0 )
+     {
+          return ( -1 );
+     }
+
+     stats->overhead_ns = calibrate_clock();
+     warmup = LATENCY_WARMUP;
+     total = warmup + iterations;
+     shm_stats( &client, &start_parks, &start_wakeups );
+
+     fflush( stdout );  /* Don't let the child repeat our output. */
+
+     pid = fork();
+     if ( pid == ( -1 ) )
+     {
+          save_errno = errno;
+          shm_detach( &client );
+          errno = save_errno;
+          return ( -1 );
+     }
+     else if ( pid == 0 )  /* Child process */
+     {
+          if ( shm_attach( ssock_fd, SHM_SERVER, &server ) == 0 )
+          {
+               for( index = 0; index < total; index++ )
+               {
+                    num = shm_recv( &server, buffer, msg_size,
+                                    BENCH_STALL_MS );
+                    if ( num < 0 ||
+                         shm_send( &server, buffer, ( size_t )num,
+                                   BENCH_STALL_MS ) != 0 )
+                    {
+                         break;
+                    }
+               }
+          }
+          _exit( EXIT_SUCCESS );
+     }
+
+     /* Parent process, pid > 0 */
+
+     ret = 0;
+     save_errno = 0;
+     for( index = 0; index < total; index++ )
+     {
+          start_ns = get_time_ns();
+          if ( shm_send( &client, buffer, msg_size, BENCH_STALL_MS ) != 0 ||
+               ( num = shm_recv( &client, buffer, msg_size,
+                                 BENCH_STALL_MS ) ) < 0 )
+          {
+               save_errno = errno;
+               ret = ( -1 );
+               break;
+          }
+          elapsed = get_time_ns() - start_ns;
+          if ( num != ( ssize_t )msg_size )
+          {
+               save_errno = EMSGSIZE;
+               ret = ( -1 );
+               break;
+          }
+
+          if ( index >= warmup )
+          {
+               elapsed = ( ( elapsed > stats->overhead_ns ) ?
+                           ( elapsed - stats->overhead_ns ) : 0 );
+               hdr_record( hist, elapsed );
+          }
+     }
+
+     if ( ret != 0 )
+     {
+          kill( pid, SIGTERM );
+     }
+     waitpid( pid, NULL, 0 );
+
+     shm_stats( &client, &parks, &wakeups );
+     stats->parks = parks - start_parks;
+     stats->wakeups = wakeups - start_wakeups;
+     shm_detach( &client );
+
+     if ( ret != 0 )
+     {
+          errno = save_errno;
+          return ( -1 );
+     }
+
+     errno = 0;
+     return 0;
+}
+
+int run_latency( const int csock_fd, const int ssock_fd,
+                 const int sock_type, const size_t msg_size,
+                 const uint64_t iterations, struct latency_stats *stats )
+{
+     char *buffer;
+     int cflags, ret, save_errno, sflags;
+     pid_t pid;
+     struct hdr_hist hist;
+     struct timeval ctimeout, stimeout;
+     uint64_t elapsed, index, start_ns, total, warmup;
+
+     if ( csock_fd < 0 || ssock_fd < 0 || msg_size < 1 ||
+          msg_size > BENCH_MAX_MESSAGE || iterations < 1 )
+     {
+          errno = EINVAL;
+          return ( -1 );
+     }
+     if ( stats == NULL )
+     {
+          errno = EFAULT;
+          return ( -1 );
+     }
+     if ( sock_type == SOCK_DGRAM && msg_size > BENCH_MAX_DGRAM )
+     {
+          errno = EMSGSIZE;
+          return ( -1 );
+     }
+
+     memset( stats, 0, sizeof( struct latency_stats ) );
+
+     if ( hdr_init( &hist, LATENCY_SUB_BITS, LATENCY_MAX_BITS ) != 0 )
+     {
+          return ( -1 );
+     }
+     buffer = malloc( msg_size );
+     if ( buffer == NULL )
+     {
+          hdr_free( &hist );
+          errno = ENOMEM;
+          return ( -1 );
+     }
+     memset( buffer, 'x', msg_size );
+
+     if ( sock_type == SOCK_SHM_RING )
+     {
+          ret = latency_shm( csock_fd, ssock_fd, buffer, msg_size,
+                             iterations, &hist, stats );
+          save_errno = errno;
+          free( buffer );
+          summarize( &hist, stats );
+          hdr_free( &hist );
+          errno = ( ( ret == 0 ) ? 0 : save_errno );
+          return ret;
+     }
+
+     if ( make_blocking( csock_fd, &cflags, &ctimeout ) != 0 )
+     {
+          save_errno = errno;
+          free( buffer );
+          hdr_free( &hist );
+          errno = save_errno;
+          return ( -1 );
+     }
+     if ( make_blocking( ssock_fd, &sflags, &stimeout ) != 0 )
+     {
+          save_errno = errno;
+          restore_blocking( csock_fd, cflags, &ctimeout );
+          free( buffer );
+          hdr_free( &hist );
+          errno = save_errno;
+          return ( -1 );
+     }
+
+     stats->overhead_ns = calibrate_clock();
+     warmup = LATENCY_WARMUP;
+     total = warmup + iterations;
+
+     fflush( stdout );  /* Don't let the child repeat our output. */
+
+     pid = fork();
+     if ( pid == ( -1 ) )
+     {
+          save_errno = errno;
+          restore_blocking( ssock_fd, sflags, &stimeout );
+          restore_blocking( csock_fd, cflags, &ctimeout );
+          free( buffer );
+          hdr_free( &hist );
+          errno = save_errno;
+          return ( -1 );
+     }
+     else if ( pid == 0 )  /* Child process */
+     {
+          echo_messages( ssock_fd, buffer, msg_size, sock_type, total );
+          _exit( EXIT_SUCCESS );
+     }
+
+     /* Parent process, pid > 0 */
+
+     ret = 0;
+     save_errno = 0;
+     for( index = 0; index < total; index++ )
+     {
+          start_ns = get_time_ns();
+          if ( send_message( csock_fd, buffer, msg_size, NULL, 0 ) != 0 ||
+               recv_message( csock_fd, buffer, msg_size, sock_type,
+                             NULL, NULL ) != 0 )
+          {
+               save_errno = ( ( errno == EAGAIN || errno == EWOULDBLOCK ) ?
+                              ETIMEDOUT : errno );
+               ret = ( -1 );
+               break;
+          }
+          elapsed = get_time_ns() - start_ns;
+
+          if ( index >= warmup )
+          {
+               elapsed = ( ( elapsed > stats->overhead_ns ) ?
+                           ( elapsed - stats->overhead_ns ) : 0 );
+               hdr_record( &hist, elapsed );
+          }
+     }
+
+     if ( ret != 0 )
+     {
+          kill( pid, SIGTERM );
+     }
+     waitpid( pid, NULL, 0 );
+
+     restore_blocking( ssock_fd, sflags, &stimeout );
+     restore_blocking( csock_fd, cflags, &ctimeout );
+     free( buffer );
+
+     summarize( &hist, stats );
+     hdr_free( &hist );
+
+     if ( ret != 0 )
+     {
+          errno = save_errno;
+          return ( -1 );
+     }
+
+     errno = 0;
+     return 0;
+}
+
+#endif  /* _RUN_LATENCY_C */
+
+/* EOF run_latency.c */
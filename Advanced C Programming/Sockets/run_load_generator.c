@@ -0,0 +1,424 @@
+/*
+
+     run_load_generator.c
+
+     This function is the client side of the multi-connection server
+     benchmark.  It opens peers connections to target, all of them
+     nonblocking and all of them watched by one epoll(7) set.  Each
+     peer sends one request of EPOLL_MESSAGE_SIZE bytes and waits for
+     it to be echoed back.  The time from calling connect(2) until the
+     whole echo has arrived is recorded for every peer.  Finished
+     peers are left open until every peer is done so the server
+     really does see all of them at the same time.
+
+     With USE_DUAL_STACK_AF_INET6, when target is the AF_INET6
+     wildcard address every other peer connects over IPv4 to
+     127.0.0.1 instead, so one dual-stack listener is seen serving
+     both families at once.
+
+     Returns 0 on success or -1 if an error occurs.
+
+     Written by Matthew Campbell.
+
+*/
+
+#ifndef _RUN_LOAD_GENERATOR_C
+#define _RUN_LOAD_GENERATOR_C
+
+#include "sockets.h"
+
+/* Peer states: */
+
+#define PEER_UNUSED     0
+#define PEER_CONNECTING 1
+#define PEER_WAITING    2
+#define PEER_DONE       3
+#define PEER_FAILED     4
+
+struct load_peer
+{
+     int fd;
+     int state;
+     int received;
+     uint64_t start_ns;
+};
+
+static void fail_peer( const int epoll_fd, struct load_peer *peer,
+                       struct client_stats *stats, int *in_flight,
+                       uint64_t *open_now )
+{
+     if ( peer->state == PEER_CONNECTING || peer->state == PEER_WAITING )
+     {
+          ( *in_flight )--;
+     }
+     epoll_ctl( epoll_fd, EPOLL_CTL_DEL, peer->fd, NULL );
+     metrics_count( peer->fd, METRIC_ERRORS, 1 );
+     metrics_forget( peer->fd );
+     close( peer->fd );
+     peer->fd = ( -1 );
+     peer->state = PEER_FAILED;
+     stats->failed++;
+     ( *open_now )--;
+     return;
+}
+
+int run_load_generator( const int domain, const void *target,
+                        const socklen_t target_len, const int peers,
+                        struct client_stats *stats )
+{
+     char message[ EPOLL_MESSAGE_SIZE ], scratch[ EPOLL_CONN_BUFFER ];
+     int backoff, count, epoll_fd, error, fd, in_flight, num, ret;
+     int mixed, peer_domain, save_errno, started;
+     socklen_t peer_len, size;
+     ssize_t len;
+     struct epoll_event event, *events;
+     struct load_peer *peer, *peer_list;
+     uint64_t first_ns, last_ns, now_ns, open_now, progress_ns;
+     uint64_t *samples;
+     const void *peer_target;
+     struct sockaddr_in ipv4;
+
+     if ( target == NULL || stats == NULL )
+     {
+          errno = EFAULT;
+          return ( -1 );
+     }
+     if ( target_len < 1 || peers < 1 )
+     {
+          errno = EINVAL;
+          return ( -1 );
+     }
+
+     memset( stats, 0, sizeof( struct client_stats ) );
+
+     /* See if half the peers can come in over IPv4. */
+
+     mixed = 0;
+     memset( &ipv4, 0, sizeof( ipv4 ) );
+
+#ifdef USE_DUAL_STACK_AF_INET6
+
+     if ( domain == AF_INET6 &&
+          target_len >= ( socklen_t )sizeof( struct sockaddr_in6 ) &&
+          IN6_IS_ADDR_UNSPECIFIED( &( ( ( const struct sockaddr_in6 * )
+                                        target )->sin6_addr ) ) )
+     {
+          ipv4.sin_family = AF_INET;
+          ipv4.sin_port = ( ( const struct sockaddr_in6 * )
+                            target )->sin6_port;
+          ipv4.sin_addr.s_addr = htonl( INADDR_LOOPBACK );
+          mixed = 1;
+     }
+
+#endif
+
+     if ( raise_fd_limit() < 0 )
+     {
+          return ( -1 );
+     }
+
+     peer_list = calloc( ( size_t )peers, sizeof( struct load_peer ) );
+     samples = calloc( ( size_t )peers, sizeof( uint64_t ) );
+     events = calloc( EPOLL_MAX_EVENTS, sizeof( struct epoll_event ) );
+     if ( peer_list == NULL || samples == NULL || events == NULL )
+     {
+          free( events );
+          free( samples );
+          free( peer_list );
+          errno = ENOMEM;
+          return ( -1 );
+     }
+
+     epoll_fd = epoll_create1( EPOLL_CLOEXEC );
+     if ( epoll_fd < 0 )
+     {
+          save_errno = errno;
+          free( events );
+          free( samples );
+          free( peer_list );
+          errno = save_errno;
+          return ( -1 );
+     }
+
+     memset( message, 'x', EPOLL_MESSAGE_SIZE );
+
+     first_ns = get_time_ns();
+     last_ns = first_ns;
+     progress_ns = first_ns;
+     open_now = 0;
+     in_flight = 0;
+     started = 0;
+     ret = 0;
+
+     while( ( stats->completed + stats->failed ) < ( uint64_t )peers )
+     {
+          /*
+
+               Start new connections, but don't have more of them
+               in flight than the server's accept queue can hold.
+
+          */
+
+          backoff = 0;
+          while( started < peers && in_flight < EPOLL_BACKLOG )
+          {
+               peer = &( peer_list[ started ] );
+
+               peer_domain = domain;
+               peer_target = target;
+               peer_len = target_len;
+               if ( mixed == 1 && ( started % 2 ) == 1 )
+               {
+                    peer_domain = AF_INET;
+                    peer_target = &ipv4;
+                    peer_len = sizeof( ipv4 );
+               }
+
+               fd = socket( peer_domain,
+                            ( SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC ),
+                            0 );
+               if ( fd >= 0 && tuning_apply( fd, tuning_current() ) < 0 )
+               {
+                    close( fd );
+                    fd = ( -1 );
+               }
+               if ( fd < 0 )
+               {
+                    peer->state = PEER_FAILED;
+                    stats->attempted++;
+                    stats->failed++;
+                    started++;
+                    continue;
+               }
+
+               peer->start_ns = get_time_ns();
+               if ( connect( fd, ( const struct sockaddr * )peer_target,
+                             peer_len ) != 0 &&
+                    errno != EINPROGRESS )
+               {
+                    error = errno;
+                    close( fd );
+                    if ( error == EAGAIN )
+                    {
+                         /* An AF_UNIX accept queue is full.  Try later. */
+
+                         backoff = 1;
+                         break;
+                    }
+                    peer->state = PEER_FAILED;
+                    stats->attempted++;
+                    stats->failed++;
+                    started++;
+                    continue;
+               }
+
+               memset( &event, 0, sizeof( event ) );
+               event.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+               event.data.u32 = ( uint32_t )started;
+               if ( epoll_ctl( epoll_fd, EPOLL_CTL_ADD, fd, &event ) != 0 )
+               {
+                    close( fd );
+                    peer->state = PEER_FAILED;
+                    stats->attempted++;
+                    stats->failed++;
+                    started++;
+                    continue;
+               }
+
+               metrics_track( fd, "load" );
+               peer->fd = fd;
+               peer->state = PEER_CONNECTING;
+               peer->received = 0;
+               stats->attempted++;
+               if ( peer_domain != domain )
+               {
+                    stats->ipv4++;
+               }
+               in_flight++;
+               started++;
+               open_now++;
+               if ( open_now > stats->max_open )
+               {
+                    stats->max_open = open_now;
+               }
+
+          }    /* while( started < peers && in_flight < EPOLL_BACKLOG ) */
+
+          if ( ( stats->completed + stats->failed ) >= ( uint64_t )peers )
+          {
+               break;
+          }
+
+          num = epoll_wait( epoll_fd, events, EPOLL_MAX_EVENTS,
+                            ( ( backoff == 1 ) ? 1 : 1000 ) );
+          if ( num < 0 )
+          {
+               if ( errno == EINTR )
+               {
+                    continue;
+               }
+               ret = ( -1 );
+               break;
+          }
+
+          now_ns = get_time_ns();
+          if ( num == 0 && backoff == 0 )
+          {
+               if ( ( now_ns - progress_ns ) >
+                    ( EPOLL_STALL_TIMEOUT * 1000000000ULL ) )
+               {
+                    errno = ETIMEDOUT;
+                    ret = ( -1 );
+                    break;
+               }
+               continue;
+          }
+
+          for( count = 0; count < num; count++ )
+          {
+               peer = &( peer_list[ events[ count ].data.u32 ] );
+
+               if ( peer->state != PEER_CONNECTING &&
+                    peer->state != PEER_WAITING )
+               {
+                    continue;
+               }
+
+               if ( events[ count ].events & EPOLLERR )
+               {
+                    fail_peer( epoll_fd, peer, stats, &in_flight,
+                               &open_now );
+                    progress_ns = now_ns;
+                    continue;
+               }
+
+               /* The connection is up.  Send the request. */
+
+               if ( peer->state == PEER_CONNECTING &&
+                    ( events[ count ].events & EPOLLOUT ) )
+               {
+                    error = 0;
+                    size = sizeof( error );
+                    if ( getsockopt( peer->fd, SOL_SOCKET, SO_ERROR,
+                                     &error, &size ) != 0 || error != 0 )
+                    {
+                         fail_peer( epoll_fd, peer, stats, &in_flight,
+                                    &open_now );
+                         progress_ns = now_ns;
+                         continue;
+                    }
+
+                    metrics_count( peer->fd, METRIC_SETUPS, 1 );
+                    metrics_count( peer->fd, METRIC_SETUP_NS,
+                                   now_ns - peer->start_ns );
+
+                    len = send( peer->fd, message, EPOLL_MESSAGE_SIZE,
+                                MSG_NOSIGNAL );
+                    metrics_io( peer->fd, METRIC_BYTES_OUT, len );
+                    if ( len != EPOLL_MESSAGE_SIZE )
+                    {
+                         fail_peer( epoll_fd, peer, stats, &in_flight,
+                                    &open_now );
+                         progress_ns = now_ns;
+                         continue;
+                    }
+                    metrics_count( peer->fd, METRIC_MSGS_OUT, 1 );
+                    peer->state = PEER_WAITING;
+               }
+
+               /* Collect the echo. */
+
+               if ( peer->state == PEER_WAITING &&
+                    ( events[ count ].events &
+                      ( EPOLLIN | EPOLLRDHUP | EPOLLHUP ) ) )
+               {
+                    error = 0;
+                    for( ; ; )
+                    {
+                         len = recv( peer->fd, scratch, EPOLL_CONN_BUFFER,
+                                     0 );
+                         metrics_io( peer->fd, METRIC_BYTES_IN, len );
+                         if ( len > 0 )
+                         {
+                              peer->received += ( int )len;
+                              continue;
+                         }
+                         if ( len < 0 && errno == EINTR )
+                         {
+                              continue;
+                         }
+                         if ( len == 0 ||
+                              ( errno != EAGAIN && errno != EWOULDBLOCK ) )
+                         {
+                              error = 1;  /* Closed early or failed. */
+                         }
+                         break;
+                    }
+
+                    if ( peer->received >= EPOLL_MESSAGE_SIZE )
+                    {
+                         samples[ stats->completed ] =
+                              now_ns - peer->start_ns;
+                         stats->completed++;
+                         metrics_count( peer->fd, METRIC_MSGS_IN, 1 );
+                         peer->state = PEER_DONE;
+                         in_flight--;
+                         last_ns = now_ns;
+                         progress_ns = now_ns;
+                    }
+                    else if ( error == 1 )
+                    {
+                         fail_peer( epoll_fd, peer, stats, &in_flight,
+                                    &open_now );
+                         progress_ns = now_ns;
+                    }
+
+               }    /* if ( peer->state == PEER_WAITING && ... ) */
+
+          }    /* for( count = 0; count < num; count++ ) */
+
+     }    /* while( ( stats->completed + stats->failed ) < peers ) */
+
+     save_errno = errno;
+
+     stats->elapsed_ns = last_ns - first_ns;
+
+     sort_samples( samples, stats->completed );
+     stats->p50_ns = percentile( samples, stats->completed, 50 );
+     stats->p99_ns = percentile( samples, stats->completed, 99 );
+     if ( stats->completed > 0 )
+     {
+          stats->max_ns = samples[ stats->completed - 1 ];
+     }
+
+     /* Now let every peer go. */
+
+     for( count = 0; count < peers; count++ )
+     {
+          if ( peer_list[ count ].state == PEER_CONNECTING ||
+               peer_list[ count ].state == PEER_WAITING ||
+               peer_list[ count ].state == PEER_DONE )
+          {
+               metrics_forget( peer_list[ count ].fd );
+               close( peer_list[ count ].fd );
+          }
+     }
+
+     close( epoll_fd );
+     free( events );
+     free( samples );
+     free( peer_list );
+
+     if ( ret != 0 )
+     {
+          errno = save_errno;
+          return ( -1 );
+     }
+
+     errno = 0;
+     return 0;
+}
+
+#endif  /* _RUN_LOAD_GENERATOR_C */
+
+/* EOF run_load_generator.c */
@@ -0,0 +1,413 @@
+/*
+
+     run_pair_benchmark.c
+
+     This function offers to run a benchmark over the client and
+     server sockets that setup_sockets() just connected, asks for the
+     details, runs it, and prints the results.  Choosing not to run a
+     benchmark is not an error.  The bulk send comparison only works
+     on stream sockets, and the cancel latency comparison only on TCP.
+     For a shared memory ring the results also say how often a side
+     went to sleep and how many futex(2) wakeups that took.
+     With SAMPLE_TCP_INFO, a TCP connection is watched with the
+     TCP_INFO sampler while the benchmark runs, and what it saw is
+     shown after the results.
+
+     Returns 0 on success or -1 if an error occurs.
+
+     Written by Matthew Campbell.
+
+*/
+
+#ifndef _RUN_PAIR_BENCHMARK_C
+#define _RUN_PAIR_BENCHMARK_C
+
+#include "sockets.h"
+
+/* The names of the bulk send methods, by number. */
+
+static const char *bulk_names[] =
+{
+     "", "write", "zerocopy", "sendfile", "splice"
+};
+
+/* The names a configuration can use for the benchmark menu. */
+
+static const char * const benchmark_names[] =
+{
+     "none", "throughput", "latency", "bulk", "cancel"
+};
+
+/* Print what run_throughput() found. */
+
+static void print_throughput( const struct throughput_stats *stats,
+                              const size_t msg_size, const int sock_type )
+{
+     double seconds;
+
+     seconds = ( double )stats->elapsed_ns / 1e9;
+
+     printf( "\nThroughput results:\n\n" );
+     printf( "Message size:            %zu bytes\n", msg_size );
+     printf( "Messages sent:           %" PRIu64 "\n", stats->msgs_sent );
+     printf( "Messages received:       %" PRIu64 "\n",
+             stats->msgs_received );
+     printf( "Bytes received:          %" PRIu64 "\n",
+             stats->bytes_received );
+     if ( stats->bytes_sent > stats->bytes_received )
+     {
+          printf( "Lost:                    %.2f%%\n",
+                  100.0 * ( double )( stats->bytes_sent -
+                                      stats->bytes_received ) /
+                  ( double )stats->bytes_sent );
+     }
+     printf( "Elapsed time:            %.3f seconds\n", seconds );
+     if ( seconds > 0.0 )
+     {
+          printf( "Throughput:              %.3f GB/s\n",
+                  ( double )stats->bytes_received / seconds / 1e9 );
+          printf( "Messages per second:     %.0f\n",
+                  ( double )stats->msgs_received / seconds );
+     }
+     printf( "Sender CPU time:         %.3f seconds\n",
+             ( double )stats->send_cpu_ns / 1e9 );
+     printf( "Receiver CPU time:       %.3f seconds\n",
+             ( double )stats->recv_cpu_ns / 1e9 );
+     if ( sock_type == SOCK_SHM_RING )
+     {
+          printf( "Times a side slept:      %" PRIu64 "\n", stats->parks );
+          printf( "Wakeups sent:            %" PRIu64 "\n",
+                  stats->wakeups );
+     }
+     printf( "\n" );
+     return;
+}
+
+/* Print what run_latency() found. */
+
+static void print_latency( const struct latency_stats *stats,
+                           const size_t msg_size, const int sock_type )
+{
+     printf( "\nRound trip latency results:\n\n" );
+     printf( "Message size:            %zu bytes\n", msg_size );
+     printf( "Round trips measured:    %" PRIu64 "\n", stats->samples );
+     printf( "Clock overhead removed:  %" PRIu64 " ns\n",
+             stats->overhead_ns );
+     printf( "Minimum:                 %.2f us\n",
+             ( double )stats->min_ns / 1000.0 );
+     printf( "Mean:                    %.2f us\n",
+             ( double )stats->mean_ns / 1000.0 );
+     printf( "p50:                     %.2f us\n",
+             ( double )stats->p50_ns / 1000.0 );
+     printf( "p99:                     %.2f us\n",
+             ( double )stats->p99_ns / 1000.0 );
+     printf( "p99.9:                   %.2f us\n",
+             ( double )stats->p999_ns / 1000.0 );
+     printf( "Maximum:                 %.2f us\n",
+             ( double )stats->max_ns / 1000.0 );
+     if ( sock_type == SOCK_SHM_RING )
+     {
+          printf( "Times a side slept:      %" PRIu64 "\n", stats->parks );
+          printf( "Wakeups sent:            %" PRIu64 "\n",
+                  stats->wakeups );
+     }
+     printf( "\n" );
+     return;
+}
+
+/* Print what run_cancel() found for one way of cancelling. */
+
+static void print_cancel( const char *name, const struct cancel_stats *stats )
+{
+     printf( "%-9s %10.1f %10.1f %10.1f %10.1f", name,
+             ( double )stats->queued / 1024.0,
+             ( double )stats->p50_ns / 1000.0,
+             ( double )stats->p99_ns / 1000.0,
+             ( double )stats->max_ns / 1000.0 );
+     if ( stats->signal_ns > 0 )
+     {
+          printf( " %10.1f %10.1f", ( double )stats->signal_ns / 1000.0,
+                  ( double )stats->discarded / 1024.0 );
+     }
+     printf( "\n" );
+     return;
+}
+
+/* Print what run_bulk_send() found for one method. */
+
+static void print_bulk( const char *name, const struct bulk_stats *stats )
+{
+     double gigabytes, seconds;
+
+     gigabytes = ( double )stats->bytes_sent / 1e9;
+     seconds = ( double )stats->elapsed_ns / 1e9;
+
+     printf( "%-9s %8.3f %12.1f %12.1f %10" PRIu64, name,
+             ( ( seconds > 0.0 ) ? ( gigabytes / seconds ) : 0.0 ),
+             ( double )stats->send_cpu_ns / 1e6 / gigabytes,
+             ( double )stats->recv_cpu_ns / 1e6 / gigabytes,
+             stats->send_calls );
+     if ( stats->zc_completions > 0 )
+     {
+          printf( " %7.1f%%", 100.0 * ( double )stats->zc_copied /
+                                     ( double )stats->zc_completions );
+     }
+     printf( "\n" );
+     return;
+}
+
+/* Asks for the details of the chosen benchmark, runs it and shows it. */
+
+static int run_choice( const int csock_fd, const int ssock_fd,
+                       const int sock_type, const long long choice )
+{
+     int method, protocol;
+     long long batch, iterations, max_size, megabytes, msg_size;
+     socklen_t opt_len;
+     struct bulk_stats bulk;
+     struct cancel_stats cancel;
+     struct latency_stats latency;
+     struct throughput_stats stats;
+
+     if ( choice == 4 )
+     {
+          if ( sock_type != SOCK_STREAM )
+          {
+               printf( "\n\
+The bulk send methods only work on stream sockets.\n\n" );
+               return 0;
+          }
+          if ( read_number( "megabytes", NULL, 0,
+                            "How many megabytes should each method send?",
+                            1, 1048576, &megabytes ) != 0 )
+          {
+               return ( -1 );
+          }
+
+          printf( "\nSending %lld megabytes with each method.\n\n",
+                  megabytes );
+          printf( "%-9s %8s %12s %12s %10s %8s\n", "Method", "GB/s",
+                  "Send ms/GB", "Recv ms/GB", "Calls", "Copied" );
+
+          for( method = BULK_WRITE; method <= BULK_SPLICE; method++ )
+          {
+               memset( &bulk, 0, sizeof( bulk ) );
+               if ( run_bulk_send( csock_fd, ssock_fd, method,
+                                   ( uint64_t )megabytes * 1048576ULL,
+                                   &bulk ) != 0 )
+               {
+                    printf( "%-9s failed (%s)\n", bulk_names[ method ],
+                            strerror( errno ) );
+                    if ( bulk.bytes_sent > 0 )
+                    {
+                         break;  /* What is left in the stream would
+                                    confuse the next run. */
+                    }
+                    continue;
+               }
+               print_bulk( bulk_names[ method ], &bulk );
+          }
+          printf( "\n\
+CPU time is in milliseconds per gigabyte.  Copied is how many\n\
+zero-copy sends the kernel ended up copying anyway.\n\n" );
+
+          errno = 0;
+          return 0;
+     }
+
+     if ( choice == 5 )
+     {
+          protocol = 0;
+          opt_len = sizeof( protocol );
+          if ( sock_type != SOCK_STREAM ||
+               getsockopt( csock_fd, SOL_SOCKET, SO_PROTOCOL, &protocol,
+                           &opt_len ) != 0 || protocol != IPPROTO_TCP )
+          {
+               printf( "\n\
+Urgent data only works on TCP connections.\n\n" );
+               return 0;
+          }
+          if ( read_number( "cancels", NULL, 0,
+                            "How many cancels should each way send?",
+                            1, 100000, &iterations ) != 0 )
+          {
+               return ( -1 );
+          }
+
+          printf( "\n\
+Cancelling %lld times in line and %lld times as urgent data.\n\n",
+                  iterations, iterations );
+          printf( "%-9s %10s %10s %10s %10s %10s %10s\n", "Cancel",
+                  "Queued KB", "p50 us", "p99 us", "Max us", "SIGURG us",
+                  "Thrown KB" );
+
+          for( method = 0; method < 2; method++ )
+          {
+               if ( run_cancel( csock_fd, ssock_fd, method,
+                                ( uint64_t )iterations, &cancel ) != 0 )
+               {
+                    printf( "%-9s failed (%s)\n",
+                            ( ( method == 1 ) ? "urgent" : "in line" ),
+                            strerror( errno ) );
+                    break;  /* The stream is no longer in step. */
+               }
+               print_cancel( ( ( method == 1 ) ? "urgent" : "in line" ),
+                             &cancel );
+          }
+          printf( "\n\
+Times run from sending the cancel to the receiver being done with it.\n\
+Queued is what was ahead of it, and Thrown is what the receiver threw\n\
+away unread.  An urgent cancel is heard when the receive window next\n\
+opens, so it waits on the receiver too, but not for the whole queue.\n\n" );
+
+          errno = 0;
+          return 0;
+     }
+
+     max_size = ( ( sock_type == SOCK_DGRAM ) ? BENCH_MAX_DGRAM :
+                                                BENCH_MAX_MESSAGE );
+
+     if ( choice == 3 )
+     {
+          if ( read_number( "size", NULL, 0,
+                            "How many bytes should each message hold?",
+                            1, max_size, &msg_size ) != 0 ||
+               read_number( "round_trips", NULL, 0,
+                            "How many round trips should be measured?",
+                            1, 1000000000, &iterations ) != 0 )
+          {
+               return ( -1 );
+          }
+
+          printf( "\nMeasuring %lld round trips of %lld bytes.\n",
+                  iterations, msg_size );
+
+          if ( run_latency( csock_fd, ssock_fd, sock_type,
+                            ( size_t )msg_size, ( uint64_t )iterations,
+                            &latency ) != 0 )
+          {
+               return ( -1 );
+          }
+
+          print_latency( &latency, ( size_t )msg_size, sock_type );
+
+          errno = 0;
+          return 0;
+     }
+
+     if ( read_number( "size", NULL, 0,
+                       "How many bytes should each message hold?",
+                       1, max_size, &msg_size ) != 0 ||
+          read_number( "megabytes", NULL, 0,
+                       "How many megabytes should be sent?",
+                       1, 1048576, &megabytes ) != 0 )
+     {
+          return ( -1 );
+     }
+
+     /* Datagrams can be sent and received many at a time. */
+
+     batch = 1;
+     if ( sock_type != SOCK_STREAM && sock_type != SOCK_SHM_RING &&
+          read_number( "batch", NULL, 0,
+                       "How many messages should each system call carry?",
+                       1, DGRAM_BATCH_MAX, &batch ) != 0 )
+     {
+          return ( -1 );
+     }
+
+     printf( "\nSending %lld megabytes in %lld byte messages.\n",
+             megabytes, msg_size );
+
+     if ( run_throughput( csock_fd, ssock_fd, sock_type,
+                          ( size_t )msg_size, ( int )batch,
+                          ( uint64_t )megabytes * 1048576ULL,
+                          &stats ) != 0 )
+     {
+          return ( -1 );
+     }
+
+     print_throughput( &stats, ( size_t )msg_size, sock_type );
+
+     errno = 0;
+     return 0;
+}
+
+int run_pair_benchmark( const int csock_fd, const int ssock_fd,
+                        const int sock_type )
+{
+     int ret;
+     long long choice;
+
+#ifdef SAMPLE_TCP_INFO
+
+     int protocol, sampling, save_errno;
+     socklen_t opt_len;
+     struct tcp_sampler sampler;
+
+#endif
+
+     if ( csock_fd < 0 || ssock_fd < 0 )
+     {
+          errno = EINVAL;
+          return ( -1 );
+     }
+
+     if ( read_number( "benchmark", benchmark_names, 5, "\
+Would you like to run a benchmark on this connection?\n\n\
+1) No.\n\
+2) Measure throughput.\n\
+3) Measure round trip latency.\n\
+4) Compare bulk send methods.\n\
+5) Compare cancel latency.", 1, 5, &choice ) != 0 )
+     {
+          return ( -1 );
+     }
+     if ( choice == 1 )
+     {
+          return 0;
+     }
+
+#ifdef SAMPLE_TCP_INFO
+
+     /* Watch both ends of a TCP connection while the benchmark runs. */
+
+     sampling = 0;
+     protocol = 0;
+     opt_len = sizeof( protocol );
+     if ( sock_type == SOCK_STREAM &&
+          getsockopt( csock_fd, SOL_SOCKET, SO_PROTOCOL, &protocol,
+                      &opt_len ) == 0 && protocol == IPPROTO_TCP &&
+          tcp_sampler_start( &sampler, TCPINFO_INTERVAL_MS, 2 ) == 0 )
+     {
+          sampling = 1;
+          tcp_sampler_add( &sampler, csock_fd, "client" );
+          tcp_sampler_add( &sampler, ssock_fd, "server" );
+     }
+
+#endif
+
+     ret = run_choice( csock_fd, ssock_fd, sock_type, choice );
+
+#ifdef SAMPLE_TCP_INFO
+
+     if ( sampling == 1 )
+     {
+          save_errno = errno;
+          tcp_sampler_stop( &sampler );
+          if ( ret == 0 )
+          {
+               tcp_sampler_print( &sampler );
+          }
+          tcp_sampler_free( &sampler );
+          errno = save_errno;
+     }
+
+#endif
+
+     return ret;
+}
+
+#endif  /* _RUN_PAIR_BENCHMARK_C */
+
+/* EOF run_pair_benchmark.c */
@@ -0,0 +1,264 @@
+/*
+
+     run_prefork_server.c
+
+     This function is the acceptor half of the prefork server.  It
+     watches lsock_fd, every worker's channel and ctl_fd in one
+     epoll(7) set.  Each connection it accepts goes straight to a
+     worker with prefork_dispatch().  Close notices coming back on a
+     channel are passed to prefork_update(), which also replaces a
+     worker that has died, after which the new channel is watched
+     instead of the old one.
+
+     The loop keeps running until ctl_fd becomes readable, the same
+     as run_epoll_server().  ctl_fd is not read from.  The workers in
+     pool must already be running.  stats only counts what the
+     acceptor did; the workers report the rest to prefork_finish().
+     The signalfd from sig_events_open() is watched too, and SIGTERM
+     stops the acceptor with ECANCELED.
+
+     Returns 0 on success or -1 if an error occurs.
+
+     Written by Matthew Campbell.
+
+*/
+
+#ifndef _RUN_PREFORK_SERVER_C
+#define _RUN_PREFORK_SERVER_C
+
+#include "sockets.h"
+
+/* Adds fd to the epoll set, watching for input. */
+
+static int watch_fd( const int epoll_fd, const int fd )
+{
+     struct epoll_event event;
+
+     memset( &event, 0, sizeof( event ) );
+     event.events = EPOLLIN;
+     event.data.fd = fd;
+     return epoll_ctl( epoll_fd, EPOLL_CTL_ADD, fd, &event );
+}
+
+int run_prefork_server( const int lsock_fd, const int ctl_fd,
+                        struct prefork_pool *pool,
+                        struct server_stats *stats )
+{
+     int count, epoll_fd, fd, index, num, replaced, ret, save_errno;
+     int sig_fd, stop, term;
+     struct epoll_event *events;
+     uint64_t start_ns;
+
+     if ( lsock_fd < 0 || ctl_fd < 0 )
+     {
+          errno = EINVAL;
+          return ( -1 );
+     }
+     if ( pool == NULL || stats == NULL )
+     {
+          errno = EFAULT;
+          return ( -1 );
+     }
+
+     memset( stats, 0, sizeof( struct server_stats ) );
+
+     events = calloc( EPOLL_MAX_EVENTS, sizeof( struct epoll_event ) );
+     if ( events == NULL )
+     {
+          errno = ENOMEM;
+          return ( -1 );
+     }
+
+     if ( set_nonblocking( lsock_fd ) != 0 )
+     {
+          save_errno = errno;
+          free( events );
+          errno = save_errno;
+          return ( -1 );
+     }
+
+     epoll_fd = epoll_create1( EPOLL_CLOEXEC );
+     if ( epoll_fd < 0 )
+     {
+          save_errno = errno;
+          free( events );
+          errno = save_errno;
+          return ( -1 );
+     }
+
+     ret = watch_fd( epoll_fd, lsock_fd );
+     if ( ret == 0 )
+     {
+          ret = watch_fd( epoll_fd, ctl_fd );
+     }
+     sig_fd = sig_events_fd();
+     if ( ret == 0 && sig_fd >= 0 )
+     {
+          ret = watch_fd( epoll_fd, sig_fd );
+     }
+     for( index = 0; ret == 0 && index < pool->count; index++ )
+     {
+          if ( pool->chan_fds[ index ] >= 0 )
+          {
+               ret = watch_fd( epoll_fd, pool->chan_fds[ index ] );
+          }
+     }
+     if ( ret != 0 )
+     {
+          save_errno = errno;
+          close( epoll_fd );
+          free( events );
+          errno = save_errno;
+          return ( -1 );
+     }
+
+#ifdef DEBUG
+
+     printf( "\
+The acceptor is handing connections to %d workers.\n", pool->count );
+     fflush( stdout );
+
+#endif
+
+     start_ns = get_time_ns();
+     stop = 0;
+     term = 0;
+     ret = 0;
+
+     /* Hold SIGTERM for the signalfd while the loop can hear it. */
+
+     sig_events_hold();
+
+     while( stop == 0 )
+     {
+          stats->syscalls++;
+          num = epoll_wait( epoll_fd, events, EPOLL_MAX_EVENTS, ( -1 ) );
+          if ( num < 0 )
+          {
+               if ( errno == EINTR )
+               {
+                    continue;
+               }
+               ret = ( -1 );
+               break;
+          }
+
+          /*
+
+               Look for ctl_fd and SIGTERM first.  The workers stop on
+               ctl_fd too, and a channel closing then must not look
+               like a crash.
+
+          */
+
+          for( count = 0; count < num; count++ )
+          {
+               if ( events[ count ].data.fd == ctl_fd )
+               {
+                    stop = 1;
+               }
+               else if ( events[ count ].data.fd == sig_fd )
+               {
+                    stats->syscalls++;
+                    if ( sig_events_read() == 1 )
+                    {
+                         stop = 1;
+                         term = 1;
+                    }
+               }
+          }
+          if ( stop == 1 )
+          {
+               break;
+          }
+
+          for( count = 0; count < num; count++ )
+          {
+               fd = events[ count ].data.fd;
+
+               if ( fd == sig_fd )
+               {
+                    continue;
+               }
+               if ( fd == lsock_fd )
+               {
+                    for( ; ; )
+                    {
+                         stats->syscalls++;
+                         fd = accept4( lsock_fd, NULL, NULL,
+                                       ( SOCK_NONBLOCK | SOCK_CLOEXEC ) );
+                         if ( fd < 0 )
+                         {
+                              if ( errno == EINTR ||
+                                   errno == ECONNABORTED )
+                              {
+                                   continue;
+                              }
+                              if ( errno != EAGAIN &&
+                                   errno != EWOULDBLOCK )
+                              {
+                                   stats->errors++;
+                              }
+                              break;
+                         }
+                         stats->accepted++;
+                         stats->syscalls++;
+                         if ( prefork_dispatch( pool, fd ) != 0 )
+                         {
+                              stats->errors++;
+                         }
+                    }
+                    continue;
+               }
+
+               for( index = 0; index < pool->count; index++ )
+               {
+                    if ( pool->chan_fds[ index ] == fd )
+                    {
+                         break;
+                    }
+               }
+               if ( index == pool->count )
+               {
+                    continue;  /* Closed earlier in this pass. */
+               }
+
+               stats->syscalls++;
+               replaced = prefork_update( pool, index );
+               if ( replaced < 0 )
+               {
+                    stats->errors++;
+               }
+               else if ( replaced == 1 &&
+                         watch_fd( epoll_fd, pool->chan_fds[ index ] ) != 0 )
+               {
+                    stats->errors++;
+               }
+          }
+     }
+     sig_events_release();
+
+     save_errno = errno;
+     stats->elapsed_ns = get_time_ns() - start_ns;
+     if ( term == 1 )
+     {
+          ret = ( -1 );
+          save_errno = ECANCELED;
+     }
+
+     close( epoll_fd );
+     free( events );
+
+     if ( ret != 0 )
+     {
+          errno = save_errno;
+          return ( -1 );
+     }
+
+     errno = 0;
+     return 0;
+}
+
+#endif  /* _RUN_PREFORK_SERVER_C */
+
+/* EOF run_prefork_server.c */
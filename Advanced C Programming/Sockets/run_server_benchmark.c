@@ -0,0 +1,431 @@
+/*
+
+     run_server_benchmark.c
+
+     This function runs the multi-connection server on lsock_fd and
+     points a load generator at it.  The load generator runs in a
+     child process created with fork(2) so the two don't share an
+     event loop.  When the child is done it writes its statistics
+     into a pipe, which also tells the server's event loop to stop.
+     The results from both sides are then printed together.
+
+     The server uses whichever event engine choose_engine() picks.
+     If the io_uring engine can't get started it falls back to epoll.
+     The prefork engine asks how many workers to start and hands
+     them the connections with run_prefork_server().  The threads
+     engine asks how many threads should handle requests and runs
+     run_threaded_server().
+
+     The accept backlog is asked for and applied to lsock_fd with
+     listen(2) again, which a listening socket allows.  For AF_INET
+     and AF_INET6 the server can also be split across several
+     SO_REUSEPORT listeners, each with its own pinned worker process,
+     with shards_start().  lsock_fd must have SO_REUSEPORT set for
+     that, which the setup functions do in this mode.
+
+     The tuning profile from tuning_choose() is applied to every
+     listener, so the connections they accept inherit it, and to the
+     load generator's peers.
+
+     With SAMPLE_TCP_INFO the results also say how many TCP peers the
+     server watched with the TCP_INFO sampler and how many of them
+     had their RTT or retransmissions flagged.
+
+     Returns 0 on success or -1 if an error occurs.
+
+     Written by Matthew Campbell.
+
+*/
+
+#ifndef _RUN_SERVER_BENCHMARK_C
+#define _RUN_SERVER_BENCHMARK_C
+
+#include "sockets.h"
+
+int run_server_benchmark( const int lsock_fd, const int domain,
+                          const void *target, const socklen_t target_len,
+                          const int peers )
+{
+     char question[ 160 ];
+     double seconds;
+     int count, ctl_fd[ 2 ], engine, ret, save_errno, somaxconn;
+     long long backlog, shards, threads, workers;
+     pid_t pid;
+     ssize_t len;
+     struct client_stats client;
+     struct prefork_pool pool;
+     struct server_stats acceptor, server;
+     struct shard_set set;
+     uint64_t accepted[ SHARD_MAX ], handed[ PREFORK_MAX ];
+
+     if ( lsock_fd < 0 || peers < 1 )
+     {
+          errno = EINVAL;
+          return ( -1 );
+     }
+     if ( target == NULL )
+     {
+          errno = EFAULT;
+          return ( -1 );
+     }
+
+     if ( raise_fd_limit() < ( peers + 16 ) )
+     {
+          printf( "\n\
+Warning: The open file limit is lower than the number of peers.\n\
+Some connections are likely to fail.\n" );
+     }
+
+     engine = choose_engine();
+     if ( engine < 0 )
+     {
+          return ( -1 );
+     }
+     if ( tuning_apply( lsock_fd, tuning_current() ) < 0 )
+     {
+          return ( -1 );
+     }
+     /* Every connection it accepts is counted under "peers". */
+
+     metrics_track_family( lsock_fd, "peers", domain );
+
+     /* The listener is in the table before any peer, not after setup. */
+
+     if ( conn_by_fd( conn_table_main(), lsock_fd ) == NULL &&
+          conn_insert( conn_table_main(), lsock_fd, CONN_ROLE_LISTENER,
+                       domain, SOCK_STREAM, NULL ) != 0 )
+     {
+          return ( -1 );
+     }
+
+     /* Find out how the connections should be accepted. */
+
+     if ( read_number( "backlog", NULL, 0, "\
+How many connections should each accept queue hold?", 1, 65535,
+                       &backlog ) != 0 )
+     {
+          return ( -1 );
+     }
+     somaxconn = get_somaxconn();
+     if ( backlog > somaxconn )
+     {
+          printf( "\n\
+Warning: The kernel will cut the backlog down to %d.\n\
+Raise net.core.somaxconn to allow more.\n", somaxconn );
+     }
+
+     shards = 1;
+     threads = 0;
+     workers = 0;
+     if ( engine == ENGINE_THREADS )
+     {
+          snprintf( question, sizeof( question ), "\
+How many threads should handle the connections' requests?\n\
+This device has %ld cores.", sysconf( _SC_NPROCESSORS_ONLN ) );
+          if ( read_number( "workers", NULL, 0, question, 1, WP_MAX_WORKERS,
+                            &threads ) != 0 )
+          {
+               return ( -1 );
+          }
+     }
+     else if ( engine == ENGINE_PREFORK )
+     {
+          snprintf( question, sizeof( question ), "\
+How many worker processes should the acceptor hand connections to?\n\
+This device has %ld cores.", sysconf( _SC_NPROCESSORS_ONLN ) );
+          if ( read_number( "workers", NULL, 0, question, 1, PREFORK_MAX,
+                            &workers ) != 0 )
+          {
+               return ( -1 );
+          }
+     }
+     else if ( domain == AF_INET || domain == AF_INET6 )
+     {
+          snprintf( question, sizeof( question ), "\
+How many listeners should share the port?\n\
+One per core works best.  This device has %ld.",
+                    sysconf( _SC_NPROCESSORS_ONLN ) );
+          if ( read_number( "shards", NULL, 0, question, 1, SHARD_MAX,
+                            &shards ) != 0 )
+          {
+               return ( -1 );
+          }
+     }
+
+     errno = 0;
+     if ( pipe( ctl_fd ) != 0 )
+     {
+          return ( -1 );
+     }
+
+     /* Start the workers before any connections show up. */
+
+     if ( shards > 1 )
+     {
+          if ( shards_start( &set, lsock_fd, ( int )shards, ( int )backlog,
+                             engine, ctl_fd[ 0 ] ) != 0 )
+          {
+               save_errno = errno;
+               close( ctl_fd[ 0 ] );
+               close( ctl_fd[ 1 ] );
+               errno = save_errno;
+               return ( -1 );
+          }
+
+#ifdef DEBUG
+
+          printf( "\
+Started %lld workers, each with its own listener.\n", shards );
+
+#endif
+
+     }
+     else if ( listen( lsock_fd, ( int )backlog ) != 0 )
+     {
+          save_errno = errno;
+          close( ctl_fd[ 0 ] );
+          close( ctl_fd[ 1 ] );
+          errno = save_errno;
+          return ( -1 );
+     }
+     else if ( workers > 0 )
+     {
+          if ( prefork_start( &pool, lsock_fd, ( int )workers,
+                              ctl_fd[ 0 ] ) != 0 )
+          {
+               save_errno = errno;
+               close( ctl_fd[ 0 ] );
+               close( ctl_fd[ 1 ] );
+               errno = save_errno;
+               return ( -1 );
+          }
+
+#ifdef DEBUG
+
+          printf( "Started %lld prefork workers.\n", workers );
+
+#endif
+
+     }
+
+#ifdef DEBUG
+
+     printf( "\
+Starting a load generator with %d concurrent peers.\n", peers );
+
+#endif
+
+     fflush( stdout );  /* Don't let the child repeat our output. */
+
+     errno = 0;
+     pid = fork();
+     if ( pid == ( -1 ) )
+     {
+          save_errno = errno;
+          if ( shards > 1 )
+          {
+               /* The workers hold the write end, so send them a byte. */
+
+               len = write( ctl_fd[ 1 ], "", 1 );
+               shards_finish( &set, NULL, NULL );
+          }
+          else if ( workers > 0 )
+          {
+               len = write( ctl_fd[ 1 ], "", 1 );
+               prefork_finish( &pool, NULL, NULL );
+          }
+          close( ctl_fd[ 0 ] );
+          close( ctl_fd[ 1 ] );
+          errno = save_errno;
+          return ( -1 );
+     }
+     else if ( pid == 0 )  /* Child process */
+     {
+          close( ctl_fd[ 0 ] );
+          close( lsock_fd );
+          for( count = 1; count < ( int )shards; count++ )
+          {
+               close( set.lsock_fds[ count ] );
+          }
+          for( count = 0; count < ( int )workers; count++ )
+          {
+               close( pool.chan_fds[ count ] );
+               close( pool.result_fds[ count ] );
+          }
+
+          ret = run_load_generator( domain, target, target_len, peers,
+                                    &client );
+          if ( ret != 0 )
+          {
+               save_errno = errno;
+               printf( "\n\
+Something went wrong in the load generator.\n" );
+               if ( save_errno != 0 )
+               {
+                    printf( "Error: %s.\n", strerror( save_errno ) );
+               }
+               fflush( stdout );
+          }
+
+          /* Hand the results to the parent and stop the server. */
+
+          len = write( ctl_fd[ 1 ], &client, sizeof( client ) );
+          close( ctl_fd[ 1 ] );
+
+          if ( ret != 0 || len != ( ssize_t )sizeof( client ) )
+          {
+               _exit( EXIT_FAILURE );
+          }
+          _exit( EXIT_SUCCESS );
+     }
+
+     /* Parent process, pid > 0 */
+
+     close( ctl_fd[ 1 ] );
+
+     ret = ( -1 );
+     save_errno = 0;
+     if ( shards > 1 )
+     {
+          /* The workers stop once the load generator reports. */
+
+          ret = shards_finish( &set, &server, accepted );
+          save_errno = errno;
+     }
+     else if ( workers > 0 )
+     {
+          ret = run_prefork_server( lsock_fd, ctl_fd[ 0 ], &pool,
+                                    &acceptor );
+          save_errno = errno;
+          if ( prefork_finish( &pool, &server, handed ) != 0 && ret == 0 )
+          {
+               ret = ( -1 );
+               save_errno = errno;
+          }
+          server.errors += acceptor.errors;
+          server.syscalls += acceptor.syscalls;
+     }
+     else if ( engine == ENGINE_IO_URING )
+     {
+          ret = run_uring_server( lsock_fd, ctl_fd[ 0 ], &server );
+          save_errno = errno;
+          if ( ret != 0 && server.accepted == 0 &&
+               ( save_errno == EOPNOTSUPP || save_errno == EINVAL ||
+                 save_errno == ENOSYS ) )
+          {
+               printf( "\n\
+The io_uring engine is not supported here.  Falling back to epoll.\n" );
+               fflush( stdout );
+               engine = ENGINE_EPOLL;
+          }
+     }
+     else if ( engine == ENGINE_THREADS )
+     {
+          ret = run_threaded_server( lsock_fd, ctl_fd[ 0 ], ( int )threads,
+                                     &server );
+          save_errno = errno;
+     }
+     if ( shards == 1 && engine == ENGINE_EPOLL )
+     {
+          ret = run_epoll_server( lsock_fd, ctl_fd[ 0 ], &server );
+          save_errno = errno;
+     }
+
+     if ( ret != 0 )
+     {
+          kill( pid, SIGTERM );
+     }
+     else
+     {
+          memset( &client, 0, sizeof( client ) );
+          len = read( ctl_fd[ 0 ], &client, sizeof( client ) );
+          if ( len != ( ssize_t )sizeof( client ) )
+          {
+               printf( "\n\
+The load generator did not report any results.\n" );
+               memset( &client, 0, sizeof( client ) );
+          }
+     }
+
+     close( ctl_fd[ 0 ] );
+     waitpid( pid, NULL, 0 );
+
+     if ( ret != 0 )
+     {
+          errno = save_errno;
+          return ( -1 );
+     }
+
+     seconds = ( double )client.elapsed_ns / 1e9;
+
+     printf( "\nMulti-connection server results:\n\n" );
+     printf( "Event engine:            %s\n",
+             ( ( engine == ENGINE_IO_URING ) ? "io_uring" :
+               ( ( engine == ENGINE_PREFORK ) ? "prefork" :
+                 ( ( engine == ENGINE_THREADS ) ? "threads" : "epoll" ) ) ) );
+     printf( "Listeners:               %lld\n", shards );
+     if ( threads > 0 )
+     {
+          printf( "Threads:                 %lld\n", threads );
+     }
+     if ( workers > 0 )
+     {
+          printf( "Workers:                 %lld\n", workers );
+          printf( "Handed to each worker:  " );
+          for( count = 0; count < ( int )workers; count++ )
+          {
+               printf( " %" PRIu64, handed[ count ] );
+          }
+          printf( "\n" );
+          printf( "Workers replaced:        %" PRIu64 "\n",
+                  pool.respawned );
+     }
+     printf( "Accept backlog:          %lld\n", backlog );
+     printf( "Peers requested:         %d\n", peers );
+     printf( "Connections accepted:    %" PRIu64 "\n", server.accepted );
+     if ( shards > 1 )
+     {
+          printf( "Accepted per listener:  " );
+          for( count = 0; count < ( int )shards; count++ )
+          {
+               printf( " %" PRIu64, accepted[ count ] );
+          }
+          printf( "\n" );
+     }
+     printf( "Most open at once:       %" PRIu64 " (server), %" PRIu64
+             " (load generator)\n", server.max_open, client.max_open );
+     printf( "Peers completed:         %" PRIu64 "\n", client.completed );
+     printf( "Peers failed:            %" PRIu64 "\n", client.failed );
+     if ( client.ipv4 > 0 )
+     {
+          printf( "Peers over IPv4:         %" PRIu64 "\n", client.ipv4 );
+     }
+     printf( "Server errors:           %" PRIu64 "\n", server.errors );
+     printf( "Bytes echoed:            %" PRIu64 "\n", server.bytes_out );
+     printf( "Server system calls:     %" PRIu64 "\n", server.syscalls );
+     if ( server.tcp_watched > 0 )
+     {
+          printf( "TCP_INFO peers watched:  %" PRIu64 "\n",
+                  server.tcp_watched );
+          printf( "TCP_INFO peers flagged:  %" PRIu64 "\n",
+                  server.tcp_flagged );
+     }
+     if ( seconds > 0.0 )
+     {
+          printf( "Connections per second:  %.0f\n",
+                  ( double )client.completed / seconds );
+     }
+     printf( "Latency p50:             %.1f us\n",
+             ( double )client.p50_ns / 1000.0 );
+     printf( "Latency p99:             %.1f us\n",
+             ( double )client.p99_ns / 1000.0 );
+     printf( "Latency max:             %.1f us\n",
+             ( double )client.max_ns / 1000.0 );
+
+     errno = 0;
+     return 0;
+}
+
+#endif  /* _RUN_SERVER_BENCHMARK_C */
+
+/* EOF run_server_benchmark.c */
@@ -0,0 +1,612 @@
+/*
+
+     run_throughput.c
+
+     This function measures how fast data moves from the client socket
+     to the server socket.  A child process created with fork(2) sends
+     total_bytes of data on csock_fd in messages of msg_size bytes
+     while this process receives it on ssock_fd, so the sender and the
+     receiver don't take turns.  When the child is done it writes what
+     it sent into a pipe.
+
+     Stream and sequenced packet sockets don't lose anything, so the
+     run ends when every byte has arrived.  Datagrams can be dropped
+     when the receiver falls behind, so for those the run ends once
+     the sender is done and nothing more has shown up for
+     BENCH_IDLE_MS milliseconds.  The difference is reported as loss.
+
+     When batch is more than 1 the datagrams are sent and received
+     batch at a time with sendmmsg(2) and recvmmsg(2) through a
+     dgram_batch, instead of one send(2) or recv(2) per datagram.
+     Batches aren't allowed on stream sockets, which have no
+     datagrams to batch.
+
+     A shared memory ring, with SOCK_SHM_RING for its type, is run
+     the same way with shm_send() and shm_recv().  Its messages
+     arrive whole and shm_recv() does its own waiting, so there's no
+     poll(2) loop.  How often either side slept and had to be woken
+     up is counted too.
+
+     The time is taken from just before the child starts sending to
+     the last byte received.  The CPU time of both processes is
+     measured with getrusage(2).
+
+     Returns 0 on success or -1 if an error occurs.
+
+     Written by Matthew Campbell.
+
+*/
+
+#ifndef _RUN_THROUGHPUT_C
+#define _RUN_THROUGHPUT_C
+
+#include "sockets.h"
+
+/* The child's side: send every message, waiting when the socket is full. */
+
+static void send_messages( const int sock_fd, const char *buffer,
+                           const size_t msg_size, const uint64_t messages,
+                           struct throughput_stats *stats )
+{
+     int ret;
+     size_t offset;
+     ssize_t num;
+     struct pollfd pfd;
+
+     offset = 0;
+     while( stats->msgs_sent < messages )
+     {
+          num = send( sock_fd, &( buffer[ offset ] ), ( msg_size - offset ),
+                      ( MSG_NOSIGNAL | MSG_DONTWAIT ) );
+          metrics_io( sock_fd, METRIC_BYTES_OUT, num );
+          if ( num < 0 )
+          {
+               if ( errno == EINTR )
+               {
+                    continue;
+               }
+               if ( errno != EAGAIN && errno != EWOULDBLOCK &&
+                    errno != ENOBUFS )
+               {
+                    stats->error = errno;
+                    return;
+               }
+
+               /* The socket is full.  Wait for some room. */
+
+               pfd.fd = sock_fd;
+               pfd.events = POLLOUT;
+               pfd.revents = 0;
+               ret = poll( &pfd, 1, BENCH_STALL_MS );
+               if ( ret == 0 )
+               {
+                    stats->error = ETIMEDOUT;
+                    return;
+               }
+               continue;
+          }
+
+          offset += ( size_t )num;
+          stats->bytes_sent += ( uint64_t )num;
+          if ( offset == msg_size )
+          {
+               metrics_count( sock_fd, METRIC_MSGS_OUT, 1 );
+               stats->msgs_sent++;
+               offset = 0;
+          }
+     }
+     return;
+}
+
+/* Like send_messages(), but batch->count datagrams per system call. */
+
+static void send_batches( const int sock_fd, struct dgram_batch *batch,
+                          const size_t msg_size, const uint64_t messages,
+                          struct throughput_stats *stats )
+{
+     int count, num;
+     struct pollfd pfd;
+
+     while( stats->msgs_sent < messages )
+     {
+          count = batch->count;
+          if ( ( messages - stats->msgs_sent ) < ( uint64_t )count )
+          {
+               count = ( int )( messages - stats->msgs_sent );
+          }
+
+          num = dgram_send_batch( sock_fd, batch, 0, count, NULL, 0 );
+          metrics_count( sock_fd, METRIC_SYSCALLS, 1 );
+          if ( num < 0 && errno != ENOBUFS )
+          {
+               metrics_count( sock_fd, METRIC_ERRORS, 1 );
+               stats->error = errno;
+               return;
+          }
+          if ( num > 0 )
+          {
+               stats->msgs_sent += ( uint64_t )num;
+               stats->bytes_sent += ( uint64_t )num * msg_size;
+               metrics_count( sock_fd, METRIC_MSGS_OUT, ( uint64_t )num );
+               metrics_count( sock_fd, METRIC_BYTES_OUT,
+                              ( uint64_t )num * msg_size );
+               continue;
+          }
+
+          /* The socket is full.  Wait for some room. */
+
+          pfd.fd = sock_fd;
+          pfd.events = POLLOUT;
+          pfd.revents = 0;
+          if ( poll( &pfd, 1, BENCH_STALL_MS ) == 0 )
+          {
+               stats->error = ETIMEDOUT;
+               return;
+          }
+     }
+     return;
+}
+
+/* The same run over a shared memory ring.  Returns 0 or -1 on error. */
+
+static int throughput_shm( const int csock_fd, const int ssock_fd,
+                           const size_t msg_size, const uint64_t messages,
+                           struct throughput_stats *stats )
+{
+     char *buffer;
+     int done_fd[ 2 ], ret, save_errno;
+     pid_t pid;
+     ssize_t num;
+     struct shm_end client, server;
+     struct throughput_stats sent;
+     uint64_t child_cpu, last_ns, parks, self_cpu, start_ns, start_parks;
+     uint64_t start_wakeups, wakeups;
+
+     buffer = malloc( msg_size );
+     if ( buffer == NULL )
+     {
+          errno = ENOMEM;
+          return ( -1 );
+     }
+     memset( buffer, 'x', msg_size );
+
+     if ( shm_attach( ssock_fd, SHM_SERVER, &server ) != 0 )
+     {
+          save_errno = errno;
+          free( buffer );
+          errno = save_errno;
+          return ( -1 );
+     }
+     if ( pipe( done_fd ) != 0 )
+     {
+          save_errno = errno;
+          shm_detach( &server );
+          free( buffer );
+          errno = save_errno;
+          return ( -1 );
+     }
+
+     shm_stats( &server, &start_parks, &start_wakeups );
+     self_cpu = get_cpu_ns( RUSAGE_SELF );
+     child_cpu = get_cpu_ns( RUSAGE_CHILDREN );
+
+     fflush( stdout );  /* Don't let the child repeat our output. */
+
+     start_ns = get_time_ns();
+     pid = fork();
+     if ( pid == ( -1 ) )
+     {
+          save_errno = errno;
+          close( done_fd[ 0 ] );
+          close( done_fd[ 1 ] );
+          shm_detach( &server );
+          free( buffer );
+          errno = save_errno;
+          return ( -1 );
+     }
+     else if ( pid == 0 )  /* Child process */
+     {
+          close( done_fd[ 0 ] );
+          memset( &sent, 0, sizeof( sent ) );
+          if ( shm_attach( csock_fd, SHM_CLIENT, &client ) != 0 )
+          {
+               sent.error = errno;
+          }
+          while( sent.error == 0 && sent.msgs_sent < messages )
+          {
+               if ( shm_send( &client, buffer, msg_size,
+                              BENCH_STALL_MS ) != 0 )
+               {
+                    sent.error = errno;
+                    break;
+               }
+               sent.msgs_sent++;
+               sent.bytes_sent += msg_size;
+          }
+          num = write( done_fd[ 1 ], &sent, sizeof( sent ) );
+          close( done_fd[ 1 ] );
+          _exit( ( num == ( ssize_t )sizeof( sent ) && sent.error == 0 ) ?
+                 EXIT_SUCCESS : EXIT_FAILURE );
+     }
+
+     /* Parent process, pid > 0 */
+
+     close( done_fd[ 1 ] );
+
+     ret = 0;
+     save_errno = 0;
+     while( stats->msgs_received < messages )
+     {
+          num = shm_recv( &server, buffer, msg_size, BENCH_STALL_MS );
+          if ( num < 0 )
+          {
+               save_errno = errno;
+               ret = ( -1 );
+               break;
+          }
+          stats->msgs_received++;
+          stats->bytes_received += ( uint64_t )num;
+     }
+     last_ns = get_time_ns();
+
+     /* A sender stuck on a full ring would keep us waiting. */
+
+     if ( ret != 0 )
+     {
+          kill( pid, SIGTERM );
+     }
+     memset( &sent, 0, sizeof( sent ) );
+     do
+     {
+          num = read( done_fd[ 0 ], &sent, sizeof( sent ) );
+     }    while( num < 0 && errno == EINTR );
+     if ( ret == 0 && num != ( ssize_t )sizeof( sent ) )
+     {
+          save_errno = EIO;
+          ret = ( -1 );
+     }
+     else if ( num == ( ssize_t )sizeof( sent ) && sent.error != 0 )
+     {
+          save_errno = sent.error;  /* The real reason, if it failed. */
+          ret = ( -1 );
+     }
+     close( done_fd[ 0 ] );
+     waitpid( pid, NULL, 0 );
+
+     shm_stats( &server, &parks, &wakeups );
+     stats->parks = parks - start_parks;
+     stats->wakeups = wakeups - start_wakeups;
+     shm_detach( &server );
+     free( buffer );
+
+     stats->msgs_sent = sent.msgs_sent;
+     stats->bytes_sent = sent.bytes_sent;
+     stats->elapsed_ns = last_ns - start_ns;
+     stats->recv_cpu_ns = get_cpu_ns( RUSAGE_SELF ) - self_cpu;
+     stats->send_cpu_ns = get_cpu_ns( RUSAGE_CHILDREN ) - child_cpu;
+
+     if ( ret != 0 )
+     {
+          errno = save_errno;
+          return ( -1 );
+     }
+
+     errno = 0;
+     return 0;
+}
+
+int run_throughput( const int csock_fd, const int ssock_fd,
+                    const int sock_type, const size_t msg_size,
+                    const int batch, const uint64_t total_bytes,
+                    struct throughput_stats *stats )
+{
+     char *buffer;
+     int done_fd[ 2 ], index, ret, save_errno, sender_done, wait_ms;
+     pid_t pid;
+     size_t chunk;
+     ssize_t num;
+     struct dgram_batch dgrams;
+     struct pollfd fds[ 2 ];
+     struct throughput_stats sent;
+     uint64_t budget, child_cpu, expected, last_ns, messages, self_cpu;
+     uint64_t start_ns;
+
+     if ( csock_fd < 0 || ssock_fd < 0 || msg_size < 1 ||
+          msg_size > BENCH_MAX_MESSAGE || total_bytes < 1 ||
+          batch < 1 || batch > DGRAM_BATCH_MAX ||
+          ( batch > 1 && ( sock_type == SOCK_STREAM ||
+                           sock_type == SOCK_SHM_RING ) ) )
+     {
+          errno = EINVAL;
+          return ( -1 );
+     }
+     if ( stats == NULL )
+     {
+          errno = EFAULT;
+          return ( -1 );
+     }
+     if ( sock_type == SOCK_DGRAM && msg_size > BENCH_MAX_DGRAM )
+     {
+          errno = EMSGSIZE;
+          return ( -1 );
+     }
+
+     memset( stats, 0, sizeof( struct throughput_stats ) );
+
+     /* Send whole messages only, and at least one of them. */
+
+     messages = total_bytes / msg_size;
+     if ( messages < 1 )
+     {
+          messages = 1;
+     }
+     expected = messages * msg_size;
+
+     if ( sock_type == SOCK_SHM_RING )
+     {
+          return throughput_shm( csock_fd, ssock_fd, msg_size, messages,
+                                 stats );
+     }
+
+     /* A stream can be read in bigger pieces than it was sent in. */
+
+     chunk = msg_size;
+     if ( sock_type == SOCK_STREAM && chunk < NB_READ_CHUNK )
+     {
+          chunk = NB_READ_CHUNK;
+     }
+     buffer = malloc( chunk );
+     if ( buffer == NULL )
+     {
+          errno = ENOMEM;
+          return ( -1 );
+     }
+     memset( buffer, 'x', chunk );
+
+     memset( &dgrams, 0, sizeof( dgrams ) );
+     if ( batch > 1 )
+     {
+          if ( dgram_batch_init( &dgrams, batch, msg_size ) != 0 )
+          {
+               save_errno = errno;
+               free( buffer );
+               errno = save_errno;
+               return ( -1 );
+          }
+          memset( dgrams.data, 'x', ( ( size_t )batch * msg_size ) );
+     }
+
+     if ( pipe( done_fd ) != 0 )
+     {
+          save_errno = errno;
+          dgram_batch_free( &dgrams );
+          free( buffer );
+          errno = save_errno;
+          return ( -1 );
+     }
+
+     self_cpu = get_cpu_ns( RUSAGE_SELF );
+     child_cpu = get_cpu_ns( RUSAGE_CHILDREN );
+
+     fflush( stdout );  /* Don't let the child repeat our output. */
+
+     start_ns = get_time_ns();
+     pid = fork();
+     if ( pid == ( -1 ) )
+     {
+          save_errno = errno;
+          close( done_fd[ 0 ] );
+          close( done_fd[ 1 ] );
+          dgram_batch_free( &dgrams );
+          free( buffer );
+          errno = save_errno;
+          return ( -1 );
+     }
+     else if ( pid == 0 )  /* Child process */
+     {
+          close( done_fd[ 0 ] );
+          memset( &sent, 0, sizeof( sent ) );
+          if ( batch > 1 )
+          {
+               send_batches( csock_fd, &dgrams, msg_size, messages, &sent );
+          }
+          else
+          {
+               send_messages( csock_fd, buffer, msg_size, messages, &sent );
+          }
+          num = write( done_fd[ 1 ], &sent, sizeof( sent ) );
+          close( done_fd[ 1 ] );
+          _exit( ( num == ( ssize_t )sizeof( sent ) && sent.error == 0 ) ?
+                 EXIT_SUCCESS : EXIT_FAILURE );
+     }
+
+     /* Parent process, pid > 0 */
+
+     close( done_fd[ 1 ] );
+
+     memset( &sent, 0, sizeof( sent ) );
+     last_ns = start_ns;
+     sender_done = 0;
+     ret = 0;
+     save_errno = 0;
+
+     for( ; ; )
+     {
+          if ( stats->bytes_received >= expected ||
+               ( sender_done == 1 &&
+                 stats->bytes_received >= sent.bytes_sent ) )
+          {
+               break;
+          }
+
+          fds[ 0 ].fd = ssock_fd;
+          fds[ 0 ].events = POLLIN;
+          fds[ 0 ].revents = 0;
+          fds[ 1 ].fd = ( ( sender_done == 0 ) ? done_fd[ 0 ] : ( -1 ) );
+          fds[ 1 ].events = POLLIN;
+          fds[ 1 ].revents = 0;
+
+          wait_ms = BENCH_STALL_MS;
+          if ( sender_done == 1 && sock_type == SOCK_DGRAM )
+          {
+               wait_ms = BENCH_IDLE_MS;
+          }
+
+          num = poll( fds, 2, wait_ms );
+          if ( num < 0 )
+          {
+               if ( errno == EINTR )
+               {
+                    continue;
+               }
+               save_errno = errno;
+               ret = ( -1 );
+               break;
+          }
+          if ( num == 0 )
+          {
+               if ( sender_done == 1 && sock_type == SOCK_DGRAM )
+               {
+                    break;  /* The rest were dropped. */
+               }
+               save_errno = ETIMEDOUT;
+               ret = ( -1 );
+               break;
+          }
+
+          /* Read everything that is waiting, up to a limit. */
+
+          if ( fds[ 0 ].revents != 0 )
+          {
+               budget = 0;
+               while( batch > 1 && budget < NB_READ_BUDGET )
+               {
+                    num = dgram_recv_batch( ssock_fd, &dgrams, batch );
+                    metrics_count( ssock_fd, METRIC_SYSCALLS, 1 );
+                    if ( num < 0 )
+                    {
+                         if ( errno != EAGAIN )
+                         {
+                              metrics_count( ssock_fd, METRIC_ERRORS, 1 );
+                              save_errno = errno;
+                              ret = ( -1 );
+                         }
+                         break;
+                    }
+                    for( index = 0; index < ( int )num; index++ )
+                    {
+                         budget += dgrams.msgs[ index ].msg_len;
+                         stats->bytes_received +=
+                              dgrams.msgs[ index ].msg_len;
+                         metrics_count( ssock_fd, METRIC_BYTES_IN,
+                                        dgrams.msgs[ index ].msg_len );
+                    }
+                    stats->msgs_received += ( uint64_t )num;
+                    metrics_count( ssock_fd, METRIC_MSGS_IN, ( uint64_t )num );
+               }
+               while( batch == 1 && budget < NB_READ_BUDGET )
+               {
+                    num = recv( ssock_fd, buffer, chunk, MSG_DONTWAIT );
+                    metrics_io( ssock_fd, METRIC_BYTES_IN, num );
+                    if ( num < 0 )
+                    {
+                         if ( errno == EINTR )
+                         {
+                              continue;
+                         }
+                         if ( errno != EAGAIN && errno != EWOULDBLOCK )
+                         {
+                              save_errno = errno;
+                              ret = ( -1 );
+                         }
+                         break;
+                    }
+                    if ( num == 0 && sock_type != SOCK_DGRAM )
+                    {
+                         save_errno = ECONNRESET;
+                         ret = ( -1 );
+                         break;
+                    }
+                    budget += ( uint64_t )num;
+                    stats->bytes_received += ( uint64_t )num;
+                    if ( sock_type != SOCK_STREAM )
+                    {
+                         metrics_count( ssock_fd, METRIC_MSGS_IN, 1 );
+                         stats->msgs_received++;
+                    }
+               }
+               last_ns = get_time_ns();
+               if ( ret != 0 )
+               {
+                    break;
+               }
+          }
+
+          /* The sender has finished. */
+
+          if ( fds[ 1 ].revents != 0 )
+          {
+               num = read( done_fd[ 0 ], &sent, sizeof( sent ) );
+               if ( num != ( ssize_t )sizeof( sent ) )
+               {
+                    save_errno = EIO;
+                    ret = ( -1 );
+                    break;
+               }
+               sender_done = 1;
+               if ( sent.error != 0 )
+               {
+                    save_errno = sent.error;
+                    ret = ( -1 );
+                    break;
+               }
+          }
+
+     }    /* for( ; ; ) */
+
+     /* Everything arrived, so the sender is about to report in. */
+
+     if ( ret == 0 && sender_done == 0 )
+     {
+          do
+          {
+               num = read( done_fd[ 0 ], &sent, sizeof( sent ) );
+          }    while( num < 0 && errno == EINTR );
+          if ( num == ( ssize_t )sizeof( sent ) )
+          {
+               sender_done = 1;
+          }
+     }
+     if ( sender_done == 0 )
+     {
+          kill( pid, SIGTERM );
+     }
+     close( done_fd[ 0 ] );
+     waitpid( pid, NULL, 0 );
+     dgram_batch_free( &dgrams );
+     free( buffer );
+
+     stats->msgs_sent = sent.msgs_sent;
+     stats->bytes_sent = sent.bytes_sent;
+     if ( sock_type == SOCK_STREAM )
+     {
+          stats->msgs_received = stats->bytes_received / msg_size;
+          metrics_count( ssock_fd, METRIC_MSGS_IN, stats->msgs_received );
+     }
+     stats->elapsed_ns = last_ns - start_ns;
+     stats->recv_cpu_ns = get_cpu_ns( RUSAGE_SELF ) - self_cpu;
+     stats->send_cpu_ns = get_cpu_ns( RUSAGE_CHILDREN ) - child_cpu;
+
+     if ( ret != 0 )
+     {
+          errno = save_errno;
+          return ( -1 );
+     }
+
+     errno = 0;
+     return 0;
+}
+
+#endif  /* _RUN_THROUGHPUT_C */
+
+/* EOF run_throughput.c */
@@ -0,0 +1,196 @@
+/*
+
+     send_file.c
+
+     This function sends count bytes of the file file_fd, starting at
+     offset, on the stream socket sock_fd without the data ever
+     passing through a buffer of ours.  method is BULK_SENDFILE to use
+     sendfile(2) or BULK_SPLICE to use splice(2) through a pipe, from
+     the file into the pipe and from the pipe into the socket.  The
+     pipe is grown to BULK_PIPE_SIZE if the system allows it.  If
+     sendfile(2) can't read from file_fd it falls back to splice(2).
+
+     The socket may be nonblocking.  Whenever it is full this waits
+     up to BENCH_STALL_MS milliseconds for room.  The number of system
+     calls made is added to *calls if calls isn't NULL.
+
+     Returns 0 on success or -1 if an error occurs.
+
+     Written by Matthew Campbell.
+
+*/
+
+#ifndef _SEND_FILE_C
+#define _SEND_FILE_C
+
+#include "sockets.h"
+
+/* Waits until the socket has room.  Returns 0, or -1 on timeout. */
+
+static int wait_writable( const int sock_fd )
+{
+     int ret;
+     struct pollfd pfd;
+
+     pfd.fd = sock_fd;
+     pfd.events = POLLOUT;
+     pfd.revents = 0;
+     ret = poll( &pfd, 1, BENCH_STALL_MS );
+     if ( ret < 0 && errno != EINTR )
+     {
+          return ( -1 );
+     }
+     if ( ret == 0 )
+     {
+          errno = ETIMEDOUT;
+          return ( -1 );
+     }
+     return 0;
+}
+
+/* Moves the data with splice(2).  Returns 0 or -1 on error. */
+
+static int splice_file( const int sock_fd, const int file_fd, loff_t offset,
+                        const size_t count, uint64_t *calls )
+{
+     int pipe_fd[ 2 ], save_errno;
+     size_t in_pipe, left;
+     ssize_t num;
+
+     if ( pipe( pipe_fd ) != 0 )
+     {
+          return ( -1 );
+     }
+     fcntl( pipe_fd[ 1 ], F_SETPIPE_SZ, BULK_PIPE_SIZE );  /* If allowed. */
+
+     in_pipe = 0;
+     left = count;
+     save_errno = 0;
+     while( left > 0 || in_pipe > 0 )
+     {
+          /* Fill the pipe from the file. */
+
+          if ( in_pipe == 0 )
+          {
+               num = splice( file_fd, &offset, pipe_fd[ 1 ], NULL, left,
+                             SPLICE_F_MOVE );
+               ( *calls )++;
+               if ( num < 0 )
+               {
+                    if ( errno == EINTR )
+                    {
+                         continue;
+                    }
+                    save_errno = errno;
+                    break;
+               }
+               if ( num == 0 )
+               {
+                    save_errno = EIO;  /* The file is shorter than that. */
+                    break;
+               }
+               in_pipe = ( size_t )num;
+               left -= ( size_t )num;
+          }
+
+          /* Empty it into the socket. */
+
+          num = splice( pipe_fd[ 0 ], NULL, sock_fd, NULL, in_pipe,
+                        ( SPLICE_F_MOVE | SPLICE_F_NONBLOCK |
+                          SPLICE_F_MORE ) );
+          ( *calls )++;
+          if ( num < 0 )
+          {
+               if ( errno == EINTR )
+               {
+                    continue;
+               }
+               if ( errno == EAGAIN || errno == EWOULDBLOCK )
+               {
+                    if ( wait_writable( sock_fd ) != 0 )
+                    {
+                         save_errno = errno;
+                         break;
+                    }
+                    continue;
+               }
+               save_errno = errno;
+               break;
+          }
+          in_pipe -= ( size_t )num;
+     }
+
+     close( pipe_fd[ 0 ] );
+     close( pipe_fd[ 1 ] );
+     if ( save_errno != 0 )
+     {
+          errno = save_errno;
+          return ( -1 );
+     }
+     return 0;
+}
+
+int send_file( const int sock_fd, const int file_fd, off_t offset,
+               const size_t count, const int method, uint64_t *calls )
+{
+     size_t left;
+     ssize_t num;
+     uint64_t ignored;
+
+     if ( sock_fd < 0 || file_fd < 0 || offset < 0 ||
+          ( method != BULK_SENDFILE && method != BULK_SPLICE ) )
+     {
+          errno = EINVAL;
+          return ( -1 );
+     }
+     if ( calls == NULL )
+     {
+          ignored = 0;
+          calls = &ignored;
+     }
+
+     if ( method == BULK_SPLICE )
+     {
+          return splice_file( sock_fd, file_fd, ( loff_t )offset, count,
+                              calls );
+     }
+
+     left = count;
+     while( left > 0 )
+     {
+          num = sendfile( sock_fd, file_fd, &offset, left );
+          ( *calls )++;
+          if ( num < 0 )
+          {
+               if ( errno == EINTR )
+               {
+                    continue;
+               }
+               if ( errno == EAGAIN || errno == EWOULDBLOCK )
+               {
+                    if ( wait_writable( sock_fd ) != 0 )
+                    {
+                         return ( -1 );
+                    }
+                    continue;
+               }
+               if ( ( errno == EINVAL || errno == ENOSYS ) && left == count )
+               {
+                    return splice_file( sock_fd, file_fd, ( loff_t )offset,
+                                        count, calls );
+               }
+               return ( -1 );
+          }
+          if ( num == 0 )
+          {
+               errno = EIO;  /* The file is shorter than that. */
+               return ( -1 );
+          }
+          left -= ( size_t )num;
+     }
+     return 0;
+}
+
+#endif  /* _SEND_FILE_C */
+
+/* EOF send_file.c */
@@ -16,6 +16,18 @@
 
 #include "sockets.h"
 
+/* The names a configuration can use for each menu option, in order. */
+
+static const char * const mode_names[] =
+{
+     "pair", "client", "server", "multi", "name"
+};
+
+static const char * const type_names[] =
+{
+     "stream", "dgram"
+};
+
 int setup_af_inet6( int *csock_fd, int *lsock_fd, int *ssock_fd,
                     int domain, int *type, void *address, int initial )
 {
@@ -23,14 +35,15 @@ int setup_af_inet6( int *csock_fd, int *lsock_fd, int *ssock_fd,
      char ip_str[ 48 ];
      int already_listening, endian, exit_loop;
      int num, opt, ret, save_errno, setup_address, sock_type;
-     pid_t pid;
      unsigned short int server_port;
      socklen_t size;
-     static int use_client = ( -1 ), use_server = ( -1 );
+     static int use_client = ( -1 ), use_epoll = 0, use_server = ( -1 );
+     static int use_name = 0;
      struct sockaddr_in6 server;
 
 #if defined( SHOW_CONNECTIONS ) && defined( DEBUG )
 
+     char addr_str[ ADDR_STR_SIZE ];
      struct sockaddr_in6 client_addr, listen_addr, server_addr;
 
 #endif
@@ -82,6 +95,13 @@ int setup_af_inet6( int *csock_fd, int *lsock_fd, int *ssock_fd,
           return ( -1 );
      }
 
+     /* A client connected by host name reconnects the same way. */
+
+     if ( initial == 0 && use_name == 1 )
+     {
+          return connect_by_name( csock_fd, 0 );
+     }
+
      already_listening = 0;
 
      /* Determine whether this system uses big or little endianess. */
@@ -140,9 +160,14 @@ Something went wrong when calling inet_ntop(3).\n" );
                printf( "\
 2) Run a client on this device and a server on another device.\n" );
                printf( "\
-3) Run a client on another device and a server on this device.\n\n" );
+3) Run a client on another device and a server on this device.\n" );
+               printf( "\
+4) Run a multi-connection server and a load generator on this device.\n" );
+               printf( "\
+5) Run a client on this device that connects to a host name over\n\
+   IPv6 or IPv4, whichever answers first.\n\n" );
                errno = 0;
-               ret = read_stdin( buffer, 64, ">> ", 1 );
+               ret = read_answer( "mode", mode_names, 5, buffer, 64 );
                if ( ret != 0 )
                {
                     save_errno = errno;
@@ -168,14 +193,28 @@ That is not a valid input.  Please try again.\n\n" );
                     {
                           case 1: use_client = 1;
                                   use_server = 1;
+                                  use_epoll = 0;
                                   exit_loop = 1;
                                   break;
                           case 2: use_client = 1;
                                   use_server = 0;
+                                  use_epoll = 0;
                                   exit_loop = 1;
                                   break;
                           case 3: use_client = 0;
                                   use_server = 1;
+                                  use_epoll = 0;
+                                  exit_loop = 1;
+                                  break;
+                          case 4: use_client = 0;
+                                  use_server = 1;
+                                  use_epoll = 1;
+                                  exit_loop = 1;
+                                  break;
+                          case 5: use_client = 1;
+                                  use_server = 0;
+                                  use_epoll = 0;
+                                  use_name = 1;
                                   exit_loop = 1;
                                   break;
                          default: printf( "\n\
@@ -187,17 +226,36 @@ That is not a valid option.  Please try again.\n\n" );
 
           }    while( exit_loop == 0 );
 
-          /* Find out what type of AF_INET6 socket to use. */
+          if ( use_name == 1 )
+          {
+               *type = SOCK_STREAM;
+               return connect_by_name( csock_fd, 1 );
+          }
 
-          exit_loop = 0;
-          do
+          /*
+
+               Find out what type of AF_INET6 socket to use.  The
+               multi-connection server only uses stream sockets.
+
+          */
+
+          if ( use_epoll == 1 )
+          {
+               sock_type = SOCK_STREAM;
+               exit_loop = 1;
+          }
+          else
+          {
+               exit_loop = 0;
+          }
+          while( exit_loop == 0 )
           {
                printf( "\n\
 What type of AF_INET6 socket would you like to use?\n\n" );
                printf( "1) Stream\n" );
                printf( "2) Datagram\n\n" );
                errno = 0;
-               ret = read_stdin( buffer, 64, ">> ", 1 );
+               ret = read_answer( "type", type_names, 2, buffer, 64 );
                if ( ret != 0 )
                {
                     save_errno = errno;
@@ -234,7 +292,7 @@ That is not a valid option.  Please try again.\n" );
 
                }    /* if ( ret != 1 ) */
 
-          }    while( exit_loop == 0 );
+          }    /* while( exit_loop == 0 ) */
 
           *type = sock_type;
           setup_address = 1;
@@ -276,7 +334,7 @@ Please use hexadecimal words and colons.  Do not specify a port number.\n\
 \n" );
                     }
                     errno = 0;
-                    ret = read_stdin( buffer, 64, ">> ", 1 );
+                    ret = read_answer( "address", NULL, 0, buffer, 64 );
                     if ( ret != 0 )
                     {
                          save_errno = errno;
@@ -374,7 +432,7 @@ Please specify a number that is greater than 1024 and less than 65536.\
 \n\n" );
                     }
                     errno = 0;
-                    ret = read_stdin( buffer, 64, ">> ", 1 );
+                    ret = read_answer( "port", NULL, 0, buffer, 64 );
                     if ( ret != 0 )
                     {
                          save_errno = errno;
@@ -436,6 +494,27 @@ That is not an acceptable port number.  Please try again.\n" );
 
      }    /* if ( initial == 1 ) */
 
+     /*
+
+          The multi-connection server doesn't keep a
+          connection around that would need to be restored.
+
+     */
+
+     if ( use_epoll == 1 && initial == 0 )
+     {
+
+#ifdef DEBUG
+
+          printf( "\
+The multi-connection server has nothing to reconnect.\n" );
+
+#endif
+
+          errno = 0;
+          return 0;
+     }
+
 #if defined( DEBUG ) && defined( SHOW_CONNECTIONS )
 
      if ( sock_type != SOCK_DGRAM )
@@ -738,7 +817,7 @@ Something went wrong when opening the server socket.\n" );
                     /* Set the new server socket to nonblocking mode. */
 
                     errno = 0;
-                    ret = fcntl( *ssock_fd, F_SETFD, O_NONBLOCK );
+                    ret = set_nonblocking( *ssock_fd );
                     if ( ret != 0 )
                     {
                          save_errno = errno;
@@ -909,6 +988,133 @@ The SO_DONTROUTE option has been set on the server socket.\n" );
 
           if ( already_listening == 0 )
           {
+
+#ifdef USE_DUAL_STACK_AF_INET6
+
+               /*
+
+                    Let the socket that gets bound accept IPv4 peers
+                    too, as IPv4-mapped addresses.  This has to be
+                    done before it is bound.  The system default comes
+                    from net.ipv6.bindv6only, so don't count on it.
+
+               */
+
+               opt = 0;
+               errno = 0;
+               ret = setsockopt( ( ( sock_type != SOCK_DGRAM ) ? *lsock_fd :
+                                                                 *ssock_fd ),
+                                 IPPROTO_IPV6, IPV6_V6ONLY, &opt,
+                                 sizeof( opt ) );
+               if ( ret != 0 )
+               {
+                    save_errno = errno;
+                    printf( "\n\
+Something went wrong when turning off the IPV6_V6ONLY option.\n" );
+                    if ( save_errno != 0 )
+                    {
+                         printf( "Error: %s.\n", strerror( save_errno ) );
+                    }
+
+#ifdef DEBUG
+
+                    printf( "\nShutting down sockets.\n" );
+
+#else
+
+                    printf( "\n" );
+
+#endif
+
+                    ret = shutdown_sockets( csock_fd, lsock_fd, ssock_fd,
+                                            domain, *type );
+
+#ifdef DEBUG
+
+                    if ( ret == 0 )
+                    {
+                         printf( "\n" );
+                    }
+
+#endif
+
+                    errno = 0;
+                    return ( -1 );
+
+               }    /* if ( ret != 0 ) */
+
+#ifdef DEBUG
+
+               printf( "\
+The IPV6_V6ONLY option is off, so IPv4 peers can connect too.\n" );
+
+#endif
+
+#endif  /* USE_DUAL_STACK_AF_INET6 */
+
+               /*
+
+                    The multi-connection server can add more listeners
+                    on this address with SO_REUSEPORT.  Every one of
+                    them has to set it before it is bound, this one
+                    included.
+
+               */
+
+               if ( use_epoll == 1 )
+               {
+                    opt = 1;
+                    errno = 0;
+                    ret = setsockopt( *lsock_fd, SOL_SOCKET, SO_REUSEPORT,
+                                      &opt, sizeof( opt ) );
+                    if ( ret != 0 )
+                    {
+                         save_errno = errno;
+                         printf( "\n\
+Something went wrong when setting the SO_REUSEPORT\n\
+option on the server's listening socket.\n" );
+                         if ( save_errno != 0 )
+                         {
+                              printf( "Error: %s.\n",
+                                      strerror( save_errno ) );
+                         }
+
+#ifdef DEBUG
+
+                         printf( "\nShutting down sockets.\n" );
+
+#else
+
+                         printf( "\n" );
+
+#endif
+
+                         ret = shutdown_sockets( csock_fd, lsock_fd,
+                                                 ssock_fd, domain, *type );
+
+#ifdef DEBUG
+
+                         if ( ret == 0 )
+                         {
+                              printf( "\n" );
+                         }
+
+#endif
+
+                         errno = 0;
+                         return ( -1 );
+
+                    }    /* if ( ret != 0 ) */
+
+#ifdef DEBUG
+
+                    printf( "\
+The SO_REUSEPORT option has been set on the server's listening socket.\n" );
+
+#endif
+
+               }    /* if ( use_epoll == 1 ) */
+
                /*
 
                     Bind the server's listening socket to an address so
@@ -1003,7 +1209,9 @@ The server's listening socket has been bound.\n" );
                if ( sock_type != SOCK_DGRAM )
                {
                     errno = 0;
-                    ret = listen( *lsock_fd, LISTEN_BACKLOG );
+                    ret = listen( *lsock_fd, ( ( use_epoll == 1 ) ?
+                                               EPOLL_BACKLOG :
+                                               LISTEN_BACKLOG ) );
                     if ( ret != 0 )
                     {
                          save_errno = errno;
@@ -1057,6 +1265,62 @@ The server's listening socket is listening for new connections.\n" );
 
      }    /* if ( use_server == 1 ) */
 
+     /* Hand the listening socket over to the multi-connection server. */
+
+     if ( use_epoll == 1 )
+     {
+          errno = 0;
+          ret = run_server_benchmark( *lsock_fd, AF_INET6, &server,
+                                      sizeof( server ), EPOLL_PEERS );
+          if ( ret != 0 )
+          {
+               save_errno = errno;
+               printf( "\n\
+Something went wrong while running the multi-connection server.\n" );
+               if ( save_errno != 0 )
+               {
+                    printf( "Error: %s.\n", strerror( save_errno ) );
+               }
+
+#ifdef DEBUG
+
+               printf( "\nShutting down sockets.\n" );
+
+#else
+
+               printf( "\n" );
+
+#endif
+
+               ret = shutdown_sockets( csock_fd, lsock_fd, ssock_fd,
+                                       domain, *type );
+
+#ifdef DEBUG
+
+               if ( ret == 0 )
+               {
+                    printf( "\n" );
+               }
+
+#endif
+
+               errno = 0;
+               return ( -1 );
+
+          }    /* if ( ret != 0 ) */
+
+#ifdef DEBUG
+
+          printf( "\nSetup complete.\n" );
+          list_sockets( csock_fd, lsock_fd, ssock_fd );
+
+#endif
+
+          errno = 0;
+          return 0;
+
+     }    /* if ( use_epoll == 1 ) */
+
      if ( use_client == 1 )
      {
           /* Open the client socket if it is currently closed. */
@@ -1180,16 +1444,41 @@ The SO_DONTROUTE option has been set on the client socket.\n" );
 
                if ( use_server == 1 )
                {
+                    /*
+
+                         Connect the client socket to the server and
+                         accept the new connection without creating a
+                         child process.  The peer's address replaces
+                         the server's address, just like accept(2)
+                         would do.
+
+                    */
+
+#ifdef DEBUG
+
+                    if ( initial == 1 )
+                    {
+                         printf( "Trying to connect to %s...\n", ip_str );
+                    }
+                    else
+                    {
+                         printf( "Trying to reconnect to %s...\n", ip_str );
+                    }
 
-                    /* Create a child process to call connect(2). */
+#endif
 
+                    size = sizeof( server );
                     errno = 0;
-                    pid = fork();
-                    save_errno = errno;
-                    if ( pid == ( -1 ) )
+                    ret = connect_pair( *csock_fd, *lsock_fd,
+                                        ( struct sockaddr * )( &server ),
+                                        sizeof( server ),
+                                        ( struct sockaddr * )( &server ),
+                                        &size );
+                    if ( ret < 0 )
                     {
+                         save_errno = errno;
                          printf( "\n\
-Something went wrong when trying to create the child process.\n" );
+Something went wrong while trying to connect to the server.\n" );
                          if ( save_errno != 0 )
                          {
                               printf( "Error: %s.\n",
@@ -1207,8 +1496,7 @@ Something went wrong when trying to create the child process.\n" );
 #endif
 
                          ret = shutdown_sockets( csock_fd, lsock_fd,
-                                                 ssock_fd, domain,
-                                                 *type );
+                                                 ssock_fd, domain, *type );
 
 #ifdef DEBUG
 
@@ -1222,284 +1510,23 @@ Something went wrong when trying to create the child process.\n" );
                          errno = 0;
                          return ( -1 );
 
-                    }
-                    else if ( pid == 0 )  /* Child process */
-                    {
-
-                         /* Give the server a chance to call accept(2). */
-
-                         sleep( 1 );
-
-#ifdef DEBUG
-
-                         if ( initial == 1 )
-                         {
-                              printf( "Trying to connect to %s...\n",
-                                      ip_str );
-                         }
-                         else
-                         {
-                              printf( "Trying to reconnect to %s...\n",
-                                      ip_str );
-                         }
-
-#endif
-
-                         errno = 0;
-                         ret = connect( *csock_fd,
-                                        ( struct sockaddr * )( &server ),
-                                        sizeof( server ) );
-                         if ( ret != 0 )
-                         {
-                              save_errno = errno;
-                              printf( "\n\
-Something went wrong while trying to connect to the server.\n" );
-                              if ( save_errno != 0 )
-                              {
-                                   printf( "Error: %s.\n",
-                                           strerror( save_errno ) );
-                              }
-
-                              /* Wake up the parent process. */
-
-                              errno = 0;
-                              ret = kill( getppid(), SIGALRM );
-                              save_errno = errno;
-
-                              if ( ret != 0 )
-                              {
-                                   printf( "\n\
-Something went wrong when trying to wake up the parent process.\n" );
-                                   if ( save_errno != 0 )
-                                   {
-                                        printf( "Error: %s.\n",
-                                                strerror( save_errno ) );
-                                   }
-
-#ifdef DEBUG
-
-                                   printf( "\nShutting down sockets.\n" );
-
-#else
-
-                                   printf( "\n" );
-
-#endif
+                    }    /* if ( ret < 0 ) */
 
-                                   ret = shutdown_sockets( csock_fd,
-                                                           lsock_fd,
-                                                           ssock_fd, domain,
-                                                           *type );
+                    *ssock_fd = ret;
 
 #ifdef DEBUG
 
-                                   if ( ret == 0 )
-                                   {
-                                        printf( "\n" );
-                                   }
-#endif
-
-                                   errno = 0;
-                                   return ( -1 );
-
-                              }  /* if ( ret != 0 ) */
-
-                              /* Stop the child process. */
-
-                              _exit( EXIT_FAILURE );
-
-                         }  /* if ( ret != 0 ) */
-
-                         /* Stop the child process. */
-
-                         _exit( EXIT_SUCCESS );
-
+                    if ( initial == 1 )
+                    {
+                         printf( "Connection to %s accepted.\n", ip_str );
                     }
-                    else  /* Parent process, pid > 0. */
+                    else
                     {
-
-#ifdef DEBUG
-
-                         printf( "\
-The server is ready and waiting to accept a new connection.\n" );
-
-#endif
-
-                         size = sizeof( server );
-                         errno = 0;
-                         ret = accept( *lsock_fd,
-                                       ( struct sockaddr * )( &server ),
-                                       &size );
-                         if ( ret < 0 )
-                         {
-                              save_errno = errno;
-                              printf( "\n\
-Something went wrong when calling accept(2).\n" );
-                              if ( save_errno != 0 )
-                              {
-                                   printf( "Error: %s.\n",
-                                           strerror( save_errno ) );
-                              }
-
-                              /* Shut down the child process. */
-
-                              errno = 0;
-                              ret = kill( pid, SIGTERM );
-                              save_errno = errno;
-
-                              if ( ret != 0 )
-                              {
-                                   printf( "\n\
-Something went wrong while trying to shut down the child process.\n" );
-                                   if ( save_errno != 0 )
-                                   {
-                                        printf( "Error: %s.\n",
-                                                strerror( save_errno ) );
-                                   }
-                              }
-                              else  /* Wait for the child process. */
-                              {
-
-#ifdef WAIT_FOR_CHILD
-
-#ifdef DEBUG
-
-                                   printf( "\n\
-Waiting for the child process...\n" );
-
-#endif
-
-                                   errno = 0;
-                                   ret = waitpid( ( -1 ), NULL, 0 );
-                                   save_errno = errno;
-
-#ifdef SHOW_WAIT_ERRORS
-
-                                   if ( ret == ( -1 ) )
-                                   {
-                                        printf( "\n\
-Something went wrong while waiting for the child process.\n" );
-                                        if ( save_errno != 0 )
-                                        {
-                                             printf( "Error: %s.\n",
-                                                     strerror( save_errno )
-                                                   );
-                                        }
-                                   }
-
-#endif
-
-#ifdef DEBUG
-
-                                   else if ( ret == pid )
-                                   {
-                                        printf( "\
-The child process has exited.\n" );
-                                   }
-
-#endif
-
-#endif  /* WAIT_FOR_CHILD */
-
-#ifdef DEBUG
-
-                                   printf( "\nShutting down sockets.\n" );
-
-#else
-
-                                   printf( "\n" );
-
-#endif
-
-                                   ret = shutdown_sockets( csock_fd,
-                                                           lsock_fd,
-                                                           ssock_fd, domain,
-                                                           *type );
-
-#ifdef DEBUG
-
-                                   if ( ret == 0 )
-                                   {
-                                        printf( "\n" );
-                                   }
-
-#endif
-
-                                   errno = 0;
-                                   return ( -1 );
-
-                              }    /* if ( ret != 0 ) */
-
-                         }    /* if ( ret < 0 ) */
-
-                         *ssock_fd = ret;
-
-#ifdef DEBUG
-
-                         if ( initial == 1 )
-                         {
-                              printf( "Connection to %s accepted.\n",
-                                      ip_str );
-                         }
-                         else
-                         {
-                              printf( "Reconnected to %s.\n", ip_str );
-                         }
-
-#endif
-
-                         /* Wait for the child process. */
-
-#ifdef WAIT_FOR_CHILD
-
-#ifdef DEBUG
-
-                         printf( "Waiting for the child process...\n" );
-
-#endif
-
-                         errno = 0;
-                         ret = waitpid( ( -1 ), NULL, 0 );
-                         save_errno = errno;
-
-#ifdef SHOW_WAIT_ERRORS
-
-                         if ( ret == ( -1 ) )
-                         {
-                              printf( "\n\
-Something went wrong while waiting for the child process.\n" );
-                              if ( save_errno != 0 )
-                              {
-                                   printf( "Error: %s.\n",
-                                           strerror( save_errno ) );
-                              }
-                         }
-
-#endif
-
-#ifdef DEBUG
-
-                         else if ( ret == pid )
-                         {
-                              printf( "The child process has exited.\n" );
-                         }
-
-#endif
-
-#endif  /* WAIT_FOR_CHILD */
-
-#if defined( DEBUG ) && defined( SHOW_CONNECTIONS )
-
-                         /* Save the server's address information. */
-
-                         memcpy( ( void * )( &server_addr ),
-                                 ( void * )( &server ),
-                                 sizeof( server ) );
+                         printf( "Reconnected to %s.\n", ip_str );
+                    }
 
 #endif
 
-                    }    /* if ( pid == ( -1 ) ) */
-
                }
                else  /* use_server == 0 */
                {
@@ -1645,22 +1672,12 @@ Something went wrong while trying to accept the new connection.\n" );
 
                     *ssock_fd = ret;
 
-#if defined( DEBUG ) && defined( SHOW_CONNECTIONS )
-
-                    /* Save the server's address information. */
-
-                    memcpy( ( void * )( &server_addr ),
-                            ( void * )( &server ),
-                            sizeof( server ) );
-
-#endif
-
                }  /* if ( use_client == 0 ) */
 
                /* Set the server socket to nonblocking mode. */
 
                errno = 0;
-               ret = fcntl( *ssock_fd, F_SETFD, O_NONBLOCK );
+               ret = set_nonblocking( *ssock_fd );
                if ( ret != 0 )
                {
                     save_errno = errno;
@@ -1823,7 +1840,7 @@ The SO_DONTROUTE option has been set on the server socket.\n" );
                /* Set the client socket to nonblocking mode. */
 
                errno = 0;
-               ret = fcntl( *csock_fd, F_SETFD, O_NONBLOCK );
+               ret = set_nonblocking( *csock_fd );
                if ( ret != 0 )
                {
                     save_errno = errno;
@@ -1926,7 +1943,7 @@ The SO_KEEPALIVE option has been set on the client socket.\n" );
                /* Set the client socket to nonblocking mode. */
 
                errno = 0;
-               ret = fcntl( *csock_fd, F_SETFD, O_NONBLOCK );
+               ret = set_nonblocking( *csock_fd );
                if ( ret != 0 )
                {
                     save_errno = errno;
@@ -2192,16 +2209,30 @@ The server's listening socket address is listed as:\n[%s]:", buffer );
                                        &( listen_addr.sin6_addr.s6_addr ),
                                        buffer, 64 ) == NULL ) */
 
-               /* Show the server socket. */
+               /*
+
+                    Show the server socket and the peer it was
+                    accepted from.  With IPV6_V6ONLY off an IPv4 peer
+                    shows up here as an IPv4-mapped address.
 
+               */
+
+               size = sizeof( server_addr );
                errno = 0;
-               if ( inet_ntop( AF_INET6,
-                               &( server_addr.sin6_addr.s6_addr ), buffer,
-                               64 ) == NULL )
+               ret = getsockname( *ssock_fd,
+                                  ( struct sockaddr * )( &server_addr ),
+                                  &size );
+               if ( ret == 0 )
+               {
+                    ret = format_address( ( struct sockaddr * )
+                                          ( &server_addr ), addr_str,
+                                          ADDR_STR_SIZE );
+               }
+               if ( ret != 0 )
                {
                     save_errno = errno;
                     printf( "\
-Something went wrong while using inet_ntop(3).\n" );
+Something went wrong while finding the server socket's address.\n" );
                     if ( save_errno != 0 )
                     {
                          printf( "Error: %s.\n", strerror( save_errno ) );
@@ -2211,35 +2242,57 @@ Something went wrong while using inet_ntop(3).\n" );
                else
                {
                     printf( "\
-The server socket's address is listed as:\n[%s]:", buffer );
-                    if ( endian == 1 )
-                    {
-                         printf( "\
-%u.\n\n", ( uint16_t )ntohs( server_addr.sin6_port ) );
-                    }
-                    else
+The server socket's address is listed as:\n%s.\n\n", addr_str );
+               }
+
+               size = sizeof( server_addr );
+               errno = 0;
+               ret = getpeername( *ssock_fd,
+                                  ( struct sockaddr * )( &server_addr ),
+                                  &size );
+               if ( ret == 0 )
+               {
+                    ret = format_address( ( struct sockaddr * )
+                                          ( &server_addr ), addr_str,
+                                          ADDR_STR_SIZE );
+               }
+               if ( ret != 0 )
+               {
+                    save_errno = errno;
+                    printf( "\
+Something went wrong while finding the server socket's peer.\n" );
+                    if ( save_errno != 0 )
                     {
-                         printf( "\
-%u.\n\n", ( uint16_t )server_addr.sin6_port );
+                         printf( "Error: %s.\n", strerror( save_errno ) );
                     }
-               }    /* if ( inet_ntop( AF_INET6,
-                                       &( server_addr.sin6_addr.s6_addr ),
-                                       buffer, 64 ) == NULL ) */
+                    printf( "\n" );
+               }
+               else
+               {
+                    printf( "\
+The server socket's peer is listed as:\n%s.\n\n", addr_str );
+               }
 
           }    /* if ( use_server == 1 ) */
 
           if ( use_client == 1 )
           {
+               size = sizeof( client_addr );
                errno = 0;
                ret = getsockname( *csock_fd,
                                   ( struct sockaddr * )( &client_addr ),
                                   &size );
+               if ( ret == 0 )
+               {
+                    ret = format_address( ( struct sockaddr * )
+                                          ( &client_addr ), addr_str,
+                                          ADDR_STR_SIZE );
+               }
                if ( ret != 0 )
                {
                     save_errno = errno;
                     printf( "\
-Something went wrong when calling getsockname(3) for the client socket.\
-\n" );
+Something went wrong while finding the client socket's address.\n" );
                     if ( save_errno != 0 )
                     {
                          printf( "Error: %s.\n", strerror( save_errno ) );
@@ -2247,40 +2300,9 @@ Something went wrong when calling getsockname(3) for the client socket.\
                }
                else
                {
-                    errno = 0;
-                    if ( inet_ntop( AF_INET6,
-                                    &( client_addr.sin6_addr.s6_addr ),
-                                    buffer, 64 ) == NULL )
-                    {
-                         save_errno = errno;
-                         printf( "\
-Something went wrong while using inet_ntop(3).\n" );
-                         if ( save_errno != 0 )
-                         {
-                              printf( "Error: %s.\n",
-                                      strerror( save_errno ) );
-                         }
-                    }
-                    else
-                    {
-                         printf( "\
-The client socket's address is listed as\n[%s]:", buffer );
-                         if ( endian == 1 )
-                         {
-                              printf( "\
-%u.\n", ( uint16_t )ntohs( client_addr.sin6_port ) );
-                         }
-                         else
-                         {
-                              printf( "\
-%u.\n", ( uint16_t )client_addr.sin6_port );
-                         }
-
-                    }    /* if ( inet_ntop( AF_INET6,
-                                    &( client_addr.sin6_addr.s6_addr ),
-                                    buffer, 64 ) == NULL ) */
-
-               }    /* if ( ret != 0 ) */
+                    printf( "\
+The client socket's address is listed as\n%s.\n", addr_str );
+               }
 
           }    /* if ( use_client == 1 ) */
 
@@ -13,6 +13,12 @@
      process version was created.  You must define one and only
      one version to use in the Makefile.
 
+     The server is bound to SOCK_NAME.  With USE_ABSTRACT_AF_UNIX
+     that name is in the abstract namespace, built by unix_address(),
+     so nothing is created in USE_DIR and there's no need to change
+     to it.  Otherwise it is a socket file in USE_DIR that
+     shutdown_sockets() removes.
+
      Written by Matthew Campbell.
 
 */
@@ -22,14 +28,34 @@
 
 #include "sockets.h"
 
+/* The names a configuration can use for each menu option, in order. */
+
+static const char * const type_names[] =
+{
+     "stream", "dgram", "seqpacket"
+};
+
+static const char * const mode_names[] =
+{
+     "pair", "multi"
+};
+
 int setup_af_unix( int *csock_fd, int *lsock_fd, int *ssock_fd,
                    int domain, int *type, void *address, int initial )
 {
-     static char buffer[ 80 ], path[ 1025 ];
-     int already_listening = 0, exit_loop, len = 1025;
+     static char buffer[ 80 ];
+     int already_listening = 0, exit_loop;
      int num, opt, ret, save_errno, sock_type;
+     static int use_epoll = 0;
      socklen_t size;
-     struct sockaddr server;
+     struct sockaddr_un server;
+
+#ifndef USE_ABSTRACT_AF_UNIX
+
+     static char path[ 1025 ];
+     int len = 1025;
+
+#endif
 
      if ( csock_fd == NULL || lsock_fd == NULL || ssock_fd == NULL )
      {
@@ -75,7 +101,7 @@ What type of AF_UNIX socket would you like to use?\n\n" );
                printf( "2) Datagram\n" );
                printf( "3) Sequential Packet\n\n" );
                errno = 0;
-               ret = read_stdin( buffer, 80, ">> ", 1 );
+               ret = read_answer( "type", type_names, 3, buffer, 80 );
                if ( ret != 0 )
                {
                     save_errno = errno;
@@ -118,10 +144,81 @@ That is not a valid option.  Please try again.\n\n" );
           }    while( exit_loop == 0 );
 
           *type = sock_type;
+
+          /*
+
+               Stream sockets can also be handed over
+               to the multi-connection server.
+
+          */
+
+          use_epoll = 0;
+          if ( sock_type == SOCK_STREAM )
+          {
+               exit_loop = 0;
+               do
+               {
+                    printf( "\nHow would you like to set this up?\n\n" );
+                    printf( "\
+1) Connect a client socket to a server socket.\n" );
+                    printf( "\
+2) Run a multi-connection server and a load generator.\n\n" );
+                    errno = 0;
+                    ret = read_answer( "mode", mode_names, 2, buffer, 80 );
+                    if ( ret != 0 )
+                    {
+                         save_errno = errno;
+                         printf( "\n\
+Something went wrong while reading your input.\n" );
+                         if ( save_errno != 0 )
+                         {
+                              printf( "Error: %s.\n",
+                                      strerror( save_errno ) );
+                         }
+                         printf( "\n" );
+                         errno = 0;
+                         return ( -1 );
+                    }
+                    ret = sscanf( buffer, "%d", &num );
+                    if ( ret != 1 || num < 1 || num > 2 )
+                    {
+                         printf( "\n\
+That is not a valid option.  Please try again.\n" );
+                    }
+                    else
+                    {
+                         use_epoll = num - 1;
+                         exit_loop = 1;
+                    }
+
+               }    while( exit_loop == 0 );
+
+          }    /* if ( sock_type == SOCK_STREAM ) */
      }
      else  /* initial == 0 */
      {
           sock_type = *type;
+
+          /*
+
+               The multi-connection server doesn't keep a
+               connection around that would need to be restored.
+
+          */
+
+          if ( use_epoll == 1 )
+          {
+
+#ifdef DEBUG
+
+               printf( "\
+The multi-connection server has nothing to reconnect.\n" );
+
+#endif
+
+               errno = 0;
+               return 0;
+          }
      }
 
 #ifdef DEBUG
@@ -142,7 +239,7 @@ That is not a valid option.  Please try again.\n\n" );
 
 #endif
 
-     size = sizeof( server );
+#ifndef USE_ABSTRACT_AF_UNIX
 
      /* Set the current working directory. */
 
@@ -162,6 +259,8 @@ Failed to change the current working directory to \"%s/\"\n", USE_DIR );
           return ( -1 );
      }
 
+#endif
+
      /* Open the server's listening socket if it is currently closed. */
 
      if ( sock_type != SOCK_DGRAM )
@@ -230,7 +329,7 @@ Something went wrong when opening the server socket.\n" );
                /* Set the server socket to nonblocking mode. */
 
                errno = 0;
-               ret = fcntl( *ssock_fd, F_SETFD, O_NONBLOCK );
+               ret = set_nonblocking( *ssock_fd );
                if ( ret != 0 )
                {
                     save_errno = errno;
@@ -286,20 +385,49 @@ The server socket has been set to nonblocking mode.\n" );
 
      /* Set up the server's listening socket's address/name. */
 
-     memset( &server, 0, size );  /* Clear the data space. */
-     server.sa_family = AF_UNIX;
-     strncpy( server.sa_data, SOCK_NAME, ( strlen( SOCK_NAME ) + 1 ) );
+#ifdef USE_ABSTRACT_AF_UNIX
+
+     ret = unix_address( SOCK_NAME, 1, &server, &size );
+
+#else
+
+     ret = unix_address( SOCK_NAME, 0, &server, &size );
+
+#endif
+
+     if ( ret != 0 )
+     {
+          save_errno = errno;
+          printf( "\n\
+The socket name \"%s\" can't be used.\n", SOCK_NAME );
+          if ( save_errno != 0 )
+          {
+               printf( "Error: %s.\n", strerror( save_errno ) );
+          }
+          printf( "\n" );
+          errno = 0;
+          return ( -1 );
+     }
 
      if ( already_listening == 0 )
      {
           memset( address, 0, ADDR_SIZE );   /* Clear the data space. */
-          memcpy( address, &server, size );  /* Make a copy.          */
+          memcpy( address, &server, ( ( size < ADDR_SIZE ) ?
+                                      size : ADDR_SIZE ) );
 
 #ifdef DEBUG
 
+#ifdef USE_ABSTRACT_AF_UNIX
+
           printf( "\
-Using: server.sa_family: %d (AF_UNIX), server.sa_data: \"%s\"\n",
-                  server.sa_family, server.sa_data );
+Using: server.sun_family: %d (AF_UNIX), abstract name: \"@%s\"\n",
+                  server.sun_family, &( server.sun_path[ 1 ] ) );
+
+#else
+
+          printf( "\
+Using: server.sun_family: %d (AF_UNIX), server.sun_path: \"%s\"\n",
+                  server.sun_family, server.sun_path );
 
           if ( getcwd( path, len ) == NULL )
           {
@@ -313,7 +441,9 @@ Failed to determine the current working directory.\n" );
                        path, SOCK_NAME );
           }
 
-#endif
+#endif  /* USE_ABSTRACT_AF_UNIX */
+
+#endif  /* DEBUG */
 
           /*
 
@@ -322,18 +452,19 @@ Failed to determine the current working directory.\n" );
                in which case we need to bind the server socket to the
                socket file instead.
 
-               bind(2) creates the socket file.
+               bind(2) creates the socket file, unless the
+               name is an abstract one.
 
           */
 
           errno = 0;
           if ( sock_type != SOCK_DGRAM )
           {
-               ret = bind( *lsock_fd, &server, size );
+               ret = bind( *lsock_fd, ( struct sockaddr * )( &server ), size );
           }
           else
           {
-               ret = bind( *ssock_fd, &server, size );
+               ret = bind( *ssock_fd, ( struct sockaddr * )( &server ), size );
           }
           if ( ret != 0 )
           {
@@ -404,7 +535,9 @@ Something went wrong when binding the server socket.\n" );
           if ( sock_type != SOCK_DGRAM )
           {
                errno = 0;
-               ret = listen( *lsock_fd, LISTEN_BACKLOG );
+               ret = listen( *lsock_fd, ( ( use_epoll == 1 ) ?
+                                          EPOLL_BACKLOG :
+                                          LISTEN_BACKLOG ) );
                if ( ret != 0 )
                {
                     save_errno = errno;
@@ -454,6 +587,62 @@ The server's listening socket is listening for new connections.\n" );
 
      }    /* if ( already_listening == 0 ) */
 
+     /* Hand the listening socket over to the multi-connection server. */
+
+     if ( use_epoll == 1 )
+     {
+          errno = 0;
+          ret = run_server_benchmark( *lsock_fd, AF_UNIX, &server, size,
+                                      EPOLL_PEERS );
+          if ( ret != 0 )
+          {
+               save_errno = errno;
+               printf( "\n\
+Something went wrong while running the multi-connection server.\n" );
+               if ( save_errno != 0 )
+               {
+                    printf( "Error: %s.\n", strerror( save_errno ) );
+               }
+
+#ifdef DEBUG
+
+               printf( "\nShutting down sockets.\n" );
+
+#else
+
+               printf( "\n" );
+
+#endif
+
+               ret = shutdown_sockets( csock_fd, lsock_fd, ssock_fd, domain,
+                                       *type );
+
+#ifdef DEBUG
+
+               if ( ret == 0 )
+               {
+                    printf( "\n" );
+               }
+
+#endif
+
+               errno = 0;
+               return ( -1 );
+
+          }    /* if ( ret != 0 ) */
+
+#ifdef DEBUG
+
+          printf( "\nSetup complete.\n" );
+          list_sockets( csock_fd, lsock_fd, ssock_fd );
+
+#endif
+
+          errno = 0;
+          return 0;
+
+     }    /* if ( use_epoll == 1 ) */
+
      /* Open the client side if it is currently closed. */
 
      if ( *csock_fd == ( -1 ) )
@@ -520,7 +709,7 @@ Something went wrong when opening the client socket.\n" );
      /* Set the client socket to nonblocking mode. */
 
      errno = 0;
-     ret = fcntl( *csock_fd, F_SETFD, O_NONBLOCK );
+     ret = set_nonblocking( *csock_fd );
      if ( ret != 0 )
      {
           save_errno = errno;
@@ -583,7 +772,7 @@ The client socket will now attempt to connect to the server.\n" );
 #endif
 
           errno = 0;
-          ret = connect( *csock_fd, &server, size );
+          ret = connect( *csock_fd, ( struct sockaddr * )( &server ), size );
           if ( ret != 0 )
           {
                save_errno = errno;
@@ -630,7 +819,8 @@ The server will now attempt to accept the connection.\n" );
 #endif
 
           errno = 0;
-          ret = accept( *lsock_fd, &server, &size );
+          ret = accept( *lsock_fd, ( struct sockaddr * )( &server ),
+                        &size );
           if ( ret < 0 )
           {
                save_errno = errno;
@@ -679,7 +869,7 @@ Something went wrong while trying to accept the new connection.\n" );
           /* Set the new server socket to nonblocking mode. */
 
           errno = 0;
-          ret = fcntl( *ssock_fd, F_SETFD, O_NONBLOCK );
+          ret = set_nonblocking( *ssock_fd );
           if ( ret != 0 )
           {
                save_errno = errno;
@@ -845,7 +1035,7 @@ The SO_KEEPALIVE option has been set on the client socket.\n" );
           */
 
           errno = 0;
-          ret = connect( *csock_fd, &server, size );
+          ret = connect( *csock_fd, ( struct sockaddr * )( &server ), size );
           if ( ret != 0 )
           {
                save_errno = errno;
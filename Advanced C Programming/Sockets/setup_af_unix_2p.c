@@ -1,6 +1,6 @@
 /*
 
-     setup_af_unix_1p.c
+     setup_af_unix_2p.c
 
      This function creates sockets in the AF_UNIX domain and
      connects them to each other.  If a socket file descriptor
@@ -10,8 +10,16 @@
      There are two files that define setup_af_unix().  The single
      process version might be unstable because the call to connect(2)
      might cause the program to hang on some systems so the two
-     process version was created.  You must define one and only
-     one version to use in the Makefile.
+     process version was created.  It used to call connect(2) from
+     a child process.  Now it uses connect_pair() which does a
+     nonblocking connect(2) in this process instead.  You must define
+     one and only one version to use in the Makefile.
+
+     The server is bound to SOCK_NAME.  With USE_ABSTRACT_AF_UNIX
+     that name is in the abstract namespace, built by unix_address(),
+     so nothing is created in USE_DIR and there's no need to change
+     to it.  Otherwise it is a socket file in USE_DIR that
+     shutdown_sockets() removes.
 
      Written by Matthew Campbell.
 
@@ -22,15 +30,34 @@
 
 #include "sockets.h"
 
+/* The names a configuration can use for each menu option, in order. */
+
+static const char * const type_names[] =
+{
+     "stream", "dgram", "seqpacket"
+};
+
+static const char * const mode_names[] =
+{
+     "pair", "multi"
+};
+
 int setup_af_unix( int *csock_fd, int *lsock_fd, int *ssock_fd,
                    int domain, int *type, void *address, int initial )
 {
-     static char buffer[ 80 ], path[ 1025 ];
-     int already_listening = 0, exit_loop, len = 1025;
+     static char buffer[ 80 ];
+     int already_listening = 0, exit_loop;
      int num, opt, ret, save_errno, sock_type;
-     pid_t pid;
+     static int use_epoll = 0;
      socklen_t size;
-     struct sockaddr server;
+     struct sockaddr_un server;
+
+#ifndef USE_ABSTRACT_AF_UNIX
+
+     static char path[ 1025 ];
+     int len = 1025;
+
+#endif
 
      if ( csock_fd == NULL || lsock_fd == NULL || ssock_fd == NULL )
      {
@@ -76,7 +103,7 @@ What type of AF_UNIX socket would you like to use?\n\n" );
                printf( "2) Datagram\n" );
                printf( "3) Sequential Packet\n\n" );
                errno = 0;
-               ret = read_stdin( buffer, 80, ">> ", 1 );
+               ret = read_answer( "type", type_names, 3, buffer, 80 );
                if ( ret != 0 )
                {
                     save_errno = errno;
@@ -119,10 +146,81 @@ That is not a valid option.  Please try again.\n\n" );
           }    while( exit_loop == 0 );
 
           *type = sock_type;
+
+          /*
+
+               Stream sockets can also be handed over
+               to the multi-connection server.
+
+          */
+
+          use_epoll = 0;
+          if ( sock_type == SOCK_STREAM )
+          {
+               exit_loop = 0;
+               do
+               {
+                    printf( "\nHow would you like to set this up?\n\n" );
+                    printf( "\
+1) Connect a client socket to a server socket.\n" );
+                    printf( "\
+2) Run a multi-connection server and a load generator.\n\n" );
+                    errno = 0;
+                    ret = read_answer( "mode", mode_names, 2, buffer, 80 );
+                    if ( ret != 0 )
+                    {
+                         save_errno = errno;
+                         printf( "\n\
+Something went wrong while reading your input.\n" );
+                         if ( save_errno != 0 )
+                         {
+                              printf( "Error: %s.\n",
+                                      strerror( save_errno ) );
+                         }
+                         printf( "\n" );
+                         errno = 0;
+                         return ( -1 );
+                    }
+                    ret = sscanf( buffer, "%d", &num );
+                    if ( ret != 1 || num < 1 || num > 2 )
+                    {
+                         printf( "\n\
+That is not a valid option.  Please try again.\n" );
+                    }
+                    else
+                    {
+                         use_epoll = num - 1;
+                         exit_loop = 1;
+                    }
+
+               }    while( exit_loop == 0 );
+
+          }    /* if ( sock_type == SOCK_STREAM ) */
      }
      else  /* initial == 0 */
      {
           sock_type = *type;
+
+          /*
+
+               The multi-connection server doesn't keep a
+               connection around that would need to be restored.
+
+          */
+
+          if ( use_epoll == 1 )
+          {
+
+#ifdef DEBUG
+
+               printf( "\
+The multi-connection server has nothing to reconnect.\n" );
+
+#endif
+
+               errno = 0;
+               return 0;
+          }
      }
 
 #ifdef DEBUG
@@ -143,7 +241,7 @@ That is not a valid option.  Please try again.\n\n" );
 
 #endif
 
-     size = sizeof( server );
+#ifndef USE_ABSTRACT_AF_UNIX
 
      /* Set the current working directory. */
 
@@ -163,6 +261,8 @@ Failed to change the current working directory to \"%s/\"\n", USE_DIR );
           return ( -1 );
      }
 
+#endif
+
      /* Open the server's listening socket if it is currently closed. */
 
      if ( sock_type != SOCK_DGRAM )
@@ -231,7 +331,7 @@ Something went wrong when opening the server socket.\n" );
                /* Set the server socket to nonblocking mode. */
 
                errno = 0;
-               ret = fcntl( *ssock_fd, F_SETFD, O_NONBLOCK );
+               ret = set_nonblocking( *ssock_fd );
                if ( ret != 0 )
                {
                     save_errno = errno;
@@ -287,20 +387,49 @@ The server socket has been set to nonblocking mode.\n" );
 
      /* Set up the server's listening socket's address/name. */
 
-     memset( &server, 0, size );  /* Clear the data space. */
-     server.sa_family = AF_UNIX;
-     strncpy( server.sa_data, SOCK_NAME, ( strlen( SOCK_NAME ) + 1 ) );
+#ifdef USE_ABSTRACT_AF_UNIX
+
+     ret = unix_address( SOCK_NAME, 1, &server, &size );
+
+#else
+
+     ret = unix_address( SOCK_NAME, 0, &server, &size );
+
+#endif
+
+     if ( ret != 0 )
+     {
+          save_errno = errno;
+          printf( "\n\
+The socket name \"%s\" can't be used.\n", SOCK_NAME );
+          if ( save_errno != 0 )
+          {
+               printf( "Error: %s.\n", strerror( save_errno ) );
+          }
+          printf( "\n" );
+          errno = 0;
+          return ( -1 );
+     }
 
      if ( already_listening == 0 )
      {
           memset( address, 0, ADDR_SIZE );   /* Clear the data space. */
-          memcpy( address, &server, size );  /* Make a copy.          */
+          memcpy( address, &server, ( ( size < ADDR_SIZE ) ?
+                                      size : ADDR_SIZE ) );
 
 #ifdef DEBUG
 
+#ifdef USE_ABSTRACT_AF_UNIX
+
+          printf( "\
+Using: server.sun_family: %d (AF_UNIX), abstract name: \"@%s\"\n",
+                  server.sun_family, &( server.sun_path[ 1 ] ) );
+
+#else
+
           printf( "\
-Using: server.sa_family: %d (AF_UNIX), server.sa_data: \"%s\"\n",
-                  server.sa_family, server.sa_data );
+Using: server.sun_family: %d (AF_UNIX), server.sun_path: \"%s\"\n",
+                  server.sun_family, server.sun_path );
 
           if ( getcwd( path, len ) == NULL )
           {
@@ -314,7 +443,9 @@ Failed to determine the current working directory.\n" );
                        path, SOCK_NAME );
           }
 
-#endif
+#endif  /* USE_ABSTRACT_AF_UNIX */
+
+#endif  /* DEBUG */
 
           /*
 
@@ -323,18 +454,19 @@ Failed to determine the current working directory.\n" );
                in which case we need to bind the server socket to the
                socket file instead.
 
-               bind(2) creates the socket file.
+               bind(2) creates the socket file, unless the
+               name is an abstract one.
 
           */
 
           errno = 0;
           if ( sock_type != SOCK_DGRAM )
           {
-               ret = bind( *lsock_fd, &server, size );
+               ret = bind( *lsock_fd, ( struct sockaddr * )( &server ), size );
           }
           else
           {
-               ret = bind( *ssock_fd, &server, size );
+               ret = bind( *ssock_fd, ( struct sockaddr * )( &server ), size );
           }
           if ( ret != 0 )
           {
@@ -405,7 +537,9 @@ Something went wrong when binding the server socket.\n" );
           if ( sock_type != SOCK_DGRAM )
           {
                errno = 0;
-               ret = listen( *lsock_fd, LISTEN_BACKLOG );
+               ret = listen( *lsock_fd, ( ( use_epoll == 1 ) ?
+                                          EPOLL_BACKLOG :
+                                          LISTEN_BACKLOG ) );
                if ( ret != 0 )
                {
                     save_errno = errno;
@@ -455,27 +589,18 @@ The server's listening socket is listening for new connections.\n" );
 
      }    /* if ( already_listening == 0 ) */
 
-     /* Open the client side if it is currently closed. */
+     /* Hand the listening socket over to the multi-connection server. */
 
-     if ( *csock_fd == ( -1 ) )
+     if ( use_epoll == 1 )
      {
-          /*
-
-               I am well aware of the fact that I could use
-               ( sock_type | O_NONBLOCK ) in the socket(2)
-               function call which could save me a call to fcntl(2)
-               afterwards, but I did it this way because I wanted
-               to take things step by step.
-
-          */
-
           errno = 0;
-          ret = socket( AF_UNIX, sock_type, 0 );
-          if ( ret < 0 )
+          ret = run_server_benchmark( *lsock_fd, AF_UNIX, &server, size,
+                                      EPOLL_PEERS );
+          if ( ret != 0 )
           {
                save_errno = errno;
                printf( "\n\
-Something went wrong when opening the client socket.\n" );
+Something went wrong while running the multi-connection server.\n" );
                if ( save_errno != 0 )
                {
                     printf( "Error: %s.\n", strerror( save_errno ) );
@@ -506,38 +631,41 @@ Something went wrong when opening the client socket.\n" );
                errno = 0;
                return ( -1 );
 
-          }    /* if ( ret < 0 ) */
-
-          *csock_fd = ret;
+          }    /* if ( ret != 0 ) */
 
 #ifdef DEBUG
 
-          printf( "The client socket has been opened.\n" );
+          printf( "\nSetup complete.\n" );
+          list_sockets( csock_fd, lsock_fd, ssock_fd );
 
 #endif
 
-     }
+          errno = 0;
+          return 0;
 
-     /*
+     }    /* if ( use_epoll == 1 ) */
 
-          Connect the two sockets to each
-          other, unless we are using datagrams.
-
-     */
+     /* Open the client side if it is currently closed. */
 
-     if ( sock_type != SOCK_DGRAM )
+     if ( *csock_fd == ( -1 ) )
      {
-          /* Create a child process with fork(2) to call connect(2). */
+          /*
 
-          errno  = 0;
-          pid = fork();
-          save_errno = errno;
+               I am well aware of the fact that I could use
+               ( sock_type | O_NONBLOCK ) in the socket(2)
+               function call which could save me a call to fcntl(2)
+               afterwards, but I did it this way because I wanted
+               to take things step by step.
+
+          */
 
-          if ( pid == ( -1 ) )
+          errno = 0;
+          ret = socket( AF_UNIX, sock_type, 0 );
+          if ( ret < 0 )
           {
+               save_errno = errno;
                printf( "\n\
-Something went wrong when trying to create the child process with fork(2).\
-\n" );
+Something went wrong when opening the client socket.\n" );
                if ( save_errno != 0 )
                {
                     printf( "Error: %s.\n", strerror( save_errno ) );
@@ -562,248 +690,101 @@ Something went wrong when trying to create the child process with fork(2).\
                {
                     printf( "\n" );
                }
-#endif
-
-               errno = 0;
-               return ( -1 );
-
-          }
-          else if ( pid == 0 )  /* Child process */
-          {
-               /* Give the server a chance to call accept(2). */
-
-               sleep( 1 );
-
-               /* Request a connection. */
-
-#ifdef DEBUG
-
-               printf( "\
-The client will now attempt to connect to the server.\n" );
 
 #endif
 
                errno = 0;
-               ret = connect( *csock_fd, &server, size );
-               if ( ret != 0 )
-               {
-                    save_errno = errno;
-                    printf( "\n\
-Something went wrong when trying to connect to the server.\n" );
-                    if ( save_errno != 0 )
-                    {
-                         printf( "Error: %s.\n", strerror( save_errno ) );
-                    }
-
-                    /* Wake up the parent process. */
+               return ( -1 );
 
-                    errno = 0;
-                    ret = kill( getppid(), SIGALRM );
-                    save_errno = errno;
+          }    /* if ( ret < 0 ) */
 
-                    if ( ret != 0 )
-                    {
-                         printf( "\n\
-Something went wrong when trying to wake up the parent process.\n" );
-                         if ( save_errno != 0 )
-                         {
-                              printf( "Error: %s.\n",
-                                      strerror( save_errno ) );
-                         }
+          *csock_fd = ret;
 
 #ifdef DEBUG
 
-                         printf( "\nShutting down sockets.\n" );
-
-#else
-
-                         printf( "\n" );
+          printf( "The client socket has been opened.\n" );
 
 #endif
 
-                         ret = shutdown_sockets( csock_fd, lsock_fd,
-                                                 ssock_fd, domain, *type );
-
-#ifdef DEBUG
+     }
 
-                         if ( ret == 0 )
-                         {
-                              printf( "\n" );
-                         }
-#endif
+     /*
 
-                         errno = 0;
-                         return ( -1 );
+          Connect the two sockets to each
+          other, unless we are using datagrams.
 
-                    }  /* if ( ret != 0 ) */
+     */
 
-                    _exit( EXIT_FAILURE );  /* Stop the child process. */
+     if ( sock_type != SOCK_DGRAM )
+     {
+          /*
 
-               }  /* if ( ret != 0 ) */
+               Connect the client socket to the server and accept the
+               new connection.  connect_pair() uses a nonblocking
+               connect(2) so this can't hang the way the single process
+               version can, and we no longer need a child process.
 
-               _exit( EXIT_SUCCESS );  /* Stop the child process. */
-          }
-          else  /* Parent process, pid > 0 */
-          {
-               /* Accept the new connection from the client. */
+          */
 
 #ifdef DEBUG
 
-               printf( "\
-The server is ready and waiting for a new connection.\n" );
+          printf( "\
+The client will now attempt to connect to the server.\n" );
 
 #endif
 
-               errno = 0;
-               ret = accept( *lsock_fd, &server, &size );
-               if ( ret < 0 )
+          errno = 0;
+          ret = connect_pair( *csock_fd, *lsock_fd,
+                              ( struct sockaddr * )( &server ), size,
+                              ( struct sockaddr * )( &server ), &size );
+          if ( ret < 0 )
+          {
+               save_errno = errno;
+               printf( "\n\
+Something went wrong when trying to connect to the server.\n" );
+               if ( save_errno != 0 )
                {
-                    save_errno = errno;
-                    printf( "\n\
-Something went wrong while trying to accept the new connection.\n" );
-                    if ( save_errno != 0 )
-                    {
-                         printf( "Error: %s.\n", strerror( save_errno ) );
-                    }
-
-                    /* Shut down the child process. */
-
-                    errno = 0;
-                    ret = kill( pid, SIGTERM );
-                    save_errno = errno;
-
-                    if ( ret != 0 )
-                    {
-                         printf( "\n\
-Something went wrong when trying to shut down the child process.\n" );
-                         if ( save_errno != 0 )
-                         {
-                              printf( "Error: %s.\n",
-                                      strerror( save_errno ) );
-                         }
-                    }
-                    else  /* Wait for the child process. */
-                    {
-
-#ifdef WAIT_FOR_CHILD
-
-#ifdef DEBUG
-
-                         printf( "\nWaiting for the child process...\n" );
-
-#endif
-
-                         errno = 0;
-                         ret = waitpid( ( -1 ), NULL, 0 );
-                         save_errno = errno;
-
-#ifdef SHOW_WAIT_ERRORS
-
-                         if ( ret == ( -1 ) )
-                         {
-                              printf( "\n\
-Something went wrong while waiting for the child process.\n" );
-                              if ( save_errno != 0 )
-                              {
-                                   printf( "Error: %s.\n",
-                                           strerror( save_errno ) );
-                              }
-                         }
-
-#endif
-
-#ifdef DEBUG
-
-                         else if ( ret == pid )
-                         {
-                              printf( "The child process has exited.\n" );
-                         }
-
-#endif
-
-#endif  /* WAIT_FOR_CHILD */
-
-                    }  /* if ( ret != 0 ) */
+                    printf( "Error: %s.\n", strerror( save_errno ) );
+               }
 
 #ifdef DEBUG
 
-                    printf( "\nShutting down sockets.\n" );
+               printf( "\nShutting down sockets.\n" );
 
 #else
 
-                    printf( "\n" );
-
-#endif
-
-                    ret = shutdown_sockets( csock_fd, lsock_fd, ssock_fd,
-                                            domain, *type );
-
-#ifdef DEBUG
-
-                    if ( ret == 0 )
-                    {
-                         printf( "\n" );
-                    }
-#endif
-
-                    errno = 0;
-                    return ( -1 );
-
-               }    /* if ( ret < 0 ) */
-
-               *ssock_fd = ret;
-
-#ifdef DEBUG
-
-               printf( "The new connection has been accepted.\n" );
+               printf( "\n" );
 
 #endif
 
-          }  /* if ( pid == ( -1 ) ) */
-
-          /* Wait for the child process. */
-
-#ifdef WAIT_FOR_CHILD
+               ret = shutdown_sockets( csock_fd, lsock_fd, ssock_fd, domain,
+                                       *type );
 
 #ifdef DEBUG
 
-          printf( "Waiting for the child process...\n" );
-
+               if ( ret == 0 )
+               {
+                    printf( "\n" );
+               }
 #endif
 
-          errno = 0;
-          ret = waitpid( ( -1 ), NULL, 0 );
-          save_errno = errno;
-
-#ifdef SHOW_WAIT_ERRORS
+               errno = 0;
+               return ( -1 );
 
-          if ( ret == ( -1 ) )
-          {
-               printf( "\n\
-Something went wrong when waiting for the child process.\n" );
-               if ( save_errno != 0 )
-               {
-                    printf( "Error: %s.\n", strerror( save_errno ) );
-               }
-          }
+          }    /* if ( ret < 0 ) */
 
-#endif
+          *ssock_fd = ret;
 
 #ifdef DEBUG
 
-          else if ( ret == pid )
-          {
-               printf( "The child process has exited.\n" );
-          }
+          printf( "The new connection has been accepted.\n" );
 
 #endif
 
-#endif  /* WAIT_FOR_CHILD */
-
           /* Set the new server socket to nonblocking mode. */
 
           errno = 0;
-          ret = fcntl( *ssock_fd, F_SETFD, O_NONBLOCK );
+          ret = set_nonblocking( *ssock_fd );
           if ( ret != 0 )
           {
                save_errno = errno;
@@ -852,7 +833,7 @@ The server socket has been set to nonblocking mode.\n" );
           /* Set the client socket to nonblocking mode. */
 
           errno = 0;
-          ret = fcntl( *csock_fd, F_SETFD, O_NONBLOCK );
+          ret = set_nonblocking( *csock_fd );
           if ( ret != 0 )
           {
                save_errno = errno;
@@ -1017,7 +998,7 @@ The SO_KEEPALIVE option has been set on the client socket.\n" );
           */
 
           errno = 0;
-          ret = connect( *csock_fd, &server, size );
+          ret = connect( *csock_fd, ( struct sockaddr * )( &server ), size );
           if ( ret != 0 )
           {
                save_errno = errno;
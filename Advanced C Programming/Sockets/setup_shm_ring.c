@@ -0,0 +1,110 @@
+/*
+
+     setup_shm_ring.c
+
+     This function sets up the shared memory ring domain.  There is
+     no listening socket and nothing to choose: shm_ring_open() makes
+     a channel in a memfd(2), and its two ends become the client and
+     server "sockets", with SOCK_SHM_RING as their type.  If both
+     ends are already open they are presumed to be working.  A
+     channel can't have one end replaced, so if only one of them is
+     open it is closed and a new channel is made.
+
+     Written by Matthew Campbell.
+
+*/
+
+#ifndef _SETUP_SHM_RING_C
+#define _SETUP_SHM_RING_C
+
+#include "sockets.h"
+
+int setup_shm_ring( int *csock_fd, int *lsock_fd, int *ssock_fd,
+                    int domain, int *type, void *address, int initial )
+{
+     int ret, save_errno;
+
+     if ( csock_fd == NULL || lsock_fd == NULL || ssock_fd == NULL )
+     {
+          errno = EFAULT;
+          return ( -1 );
+     }
+     if ( *csock_fd < ( -1 ) || *lsock_fd < ( -1 ) || *ssock_fd < ( -1 ) )
+     {
+          errno = EINVAL;
+          return ( -1 );
+     }
+     if ( domain < 1 || domain > MAX_DOMAINS )
+     {
+          errno = EINVAL;
+          return ( -1 );
+     }
+     if ( type == NULL )
+     {
+          errno = EFAULT;
+          return ( -1 );
+     }
+     if ( address == NULL )
+     {
+          errno = EFAULT;
+          return ( -1 );
+     }
+     if ( initial != 0 && initial != 1 )
+     {
+          errno = EINVAL;
+          return ( -1 );
+     }
+
+     *type = SOCK_SHM_RING;
+
+     if ( *csock_fd != ( -1 ) && *ssock_fd != ( -1 ) )
+     {
+          errno = 0;
+          return 0;
+     }
+     if ( *csock_fd != ( -1 ) )
+     {
+          close( *csock_fd );
+          *csock_fd = ( -1 );
+     }
+     if ( *ssock_fd != ( -1 ) )
+     {
+          close( *ssock_fd );
+          *ssock_fd = ( -1 );
+     }
+
+     errno = 0;
+     ret = shm_ring_open( csock_fd, ssock_fd );
+     if ( ret != 0 )
+     {
+          save_errno = errno;
+          printf( "\n\
+Something went wrong when creating the shared memory ring.\n" );
+          if ( save_errno != 0 )
+          {
+               printf( "Error: %s.\n", strerror( save_errno ) );
+          }
+          printf( "\n" );
+          errno = 0;
+          return ( -1 );
+     }
+
+     /* There is no address to show or to reconnect to. */
+
+     memset( address, 0, ADDR_SIZE );
+
+#ifdef DEBUG
+
+     printf( "\
+The shared memory ring is ready.  It holds %d messages of up to %d\n\
+bytes each way, or fewer longer ones.\n", SHM_RING_SLOTS, SHM_SLOT_DATA );
+
+#endif
+
+     errno = 0;
+     return 0;
+}
+
+#endif /* _SETUP_SHM_RING_C */
+
+/* EOF setup_shm_ring.c */
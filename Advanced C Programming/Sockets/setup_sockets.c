@@ -7,6 +7,21 @@
      beginning of the program to get everything started, or later on
      if a connection is lost.
 
+     The first time, it asks which tuning profile to use, unless the
+     domain is the shared memory ring, which has no socket options.
+     Each time, the profile is applied to the sockets it opened.  See
+     tuning_profile.c.
+
+     The sockets it opened are put into conn_table_main(), where a
+     reconnect replaces the ones that were closed and leaves the rest
+     alone.  See conn_table.c.
+
+     The client and server sockets are tracked by the metrics
+     registry as "client" and "server".  How long a first setup took
+     is counted there too, but only when it comes from a
+     configuration, since otherwise it would include however long
+     the questions took to answer.  See metrics.c.
+
      Written by Matthew Campbell.
 
 */
@@ -16,10 +31,28 @@
 
 #include "sockets.h"
 
+/* The address family of each domain, in order. */
+
+static const int setup_families[ MAX_DOMAINS ] =
+{
+     AF_BLUETOOTH, AF_INET, AF_INET6, AF_UNIX, AF_SHM_RING
+};
+
+/* Which role each of the sockets plays. */
+
+static const int setup_roles[ 3 ] =
+{
+     CONN_ROLE_LISTENER, CONN_ROLE_SERVER, CONN_ROLE_CLIENT
+};
+
 int setup_sockets( int *csock_fd, int *lsock_fd, int *ssock_fd,
                    int domain, int *type, void *address, int initial )
 {
-     int ret;
+     int index, ret, skipped;
+     int *sock_fds[ 3 ];
+     struct conn_rec *rec;
+     struct conn_table *table;
+     uint64_t start_ns;
 
      if ( domain < 1 || domain > MAX_DOMAINS )
      {
@@ -52,6 +85,12 @@ int setup_sockets( int *csock_fd, int *lsock_fd, int *ssock_fd,
           return ( -1 );
      }
 
+     if ( initial == 1 && domain != MAX_DOMAINS && tuning_choose() < 0 )
+     {
+          return ( -1 );
+     }
+
+     start_ns = get_time_ns();
      switch( domain )
      {
            case 1: ret = setup_af_bluetooth( csock_fd, lsock_fd,
@@ -70,13 +109,111 @@ int setup_sockets( int *csock_fd, int *lsock_fd, int *ssock_fd,
                                         ssock_fd, domain, type,
                                         address, initial );
                    break;
+           case 5: ret = setup_shm_ring( csock_fd, lsock_fd,
+                                         ssock_fd, domain, type,
+                                         address, initial );
+                   break;
           default: printf( "\n\
 setup_sockets(): Error: Default case reached in switch() statement.\n\n" );
                    errno = 0;
                    ret = ( -1 );
                    break;
      }
-     return ret;
+     if ( ret != 0 )
+     {
+          return ret;
+     }
+
+     /*
+
+          Keep track of whichever sockets are open.  One that is
+          already in the table in the same role, like the listener
+          after a reconnect, keeps its record and its handle.
+
+     */
+
+     sock_fds[ 0 ] = lsock_fd;
+     sock_fds[ 1 ] = ssock_fd;
+     sock_fds[ 2 ] = csock_fd;
+     table = conn_table_main();
+     for( index = 0; index < 3 && table != NULL; index++ )
+     {
+          if ( *( sock_fds[ index ] ) < 0 )
+          {
+               continue;
+          }
+          rec = conn_by_fd( table, *( sock_fds[ index ] ) );
+          if ( rec != NULL && rec->role == setup_roles[ index ] )
+          {
+               continue;
+          }
+          if ( conn_insert( table, *( sock_fds[ index ] ),
+                            setup_roles[ index ], setup_families[ domain - 1 ],
+                            *type, NULL ) != 0 )
+          {
+               return ( -1 );
+          }
+     }
+
+     /*
+
+          Only the first setup is counted, and only when a
+          configuration was loaded with config_active() == 1.
+          Without one the setup functions ask for the address, port
+          and type, so the time would mostly be how long the answers
+          took to type.  The caller times reconnects.
+
+     */
+
+     metrics_track_family( *csock_fd, "client",
+                           setup_families[ domain - 1 ] );
+     metrics_track_family( *ssock_fd, "server",
+                           setup_families[ domain - 1 ] );
+     if ( initial == 1 && config_active() == 1 )
+     {
+          start_ns = get_time_ns() - start_ns;
+          metrics_count( *csock_fd, METRIC_SETUPS, 1 );
+          metrics_count( *csock_fd, METRIC_SETUP_NS, start_ns );
+          metrics_count( *ssock_fd, METRIC_SETUPS, 1 );
+          metrics_count( *ssock_fd, METRIC_SETUP_NS, start_ns );
+     }
+     if ( *type == SOCK_SHM_RING )
+     {
+          errno = 0;
+          return 0;
+     }
+
+     /* Tune them too. */
+
+     skipped = 0;
+     for( index = 0; index < 3; index++ )
+     {
+          if ( *( sock_fds[ index ] ) < 0 )
+          {
+               continue;
+          }
+          ret = tuning_apply( *( sock_fds[ index ] ), tuning_current() );
+          if ( ret < 0 )
+          {
+               return ( -1 );
+          }
+          skipped += ret;
+     }
+
+#ifdef DEBUG
+
+     if ( skipped > 0 )
+     {
+          printf( "\
+The kernel refused %d of the %s profile's socket options.\n\
+Some of them need CAP_NET_ADMIN.\n\n", skipped,
+                  tuning_name( tuning_current() ) );
+     }
+
+#endif
+
+     errno = 0;
+     return 0;
 }
 
 #endif /* _SETUP_SOCKETS_C */
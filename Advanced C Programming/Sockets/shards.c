@@ -0,0 +1,334 @@
+/*
+
+     shards.c
+
+     Functions for running the multi-connection server as a group of
+     SO_REUSEPORT listeners, one per worker process.
+
+     shards_start() takes a listener that already has SO_REUSEPORT
+     set, opens count - 1 more on the same address with
+     open_reuseport_listener(), and forks one worker for each of them.
+     The new listeners get the current tuning profile as well.
+     Each worker is pinned to its own CPU with sched_setaffinity(2),
+     going around the CPUs this process may use, and runs its own
+     event loop on its own listener with the engine it is given.  So
+     every worker has its own accept queue and nothing is shared
+     between them but the port.
+
+     The workers keep going until ctl_fd becomes readable, the same
+     as run_epoll_server().  None of them read from it, so the caller
+     can still read whatever was written.  The workers inherit every
+     descriptor the caller had, including the write end of that pipe,
+     so closing it won't stop them: something has to be written to
+     it.  shards_finish() then
+     collects each worker's statistics, adds them up and waits for
+     the workers to exit.
+
+     Written by Matthew Campbell.
+
+*/
+
+#ifndef _SHARDS_C
+#define _SHARDS_C
+
+#include "sockets.h"
+
+/* Pins this process to the index'th CPU it is allowed to use. */
+
+static void pin_worker( const int index )
+{
+     cpu_set_t allowed, chosen;
+     int cpu, found, seen;
+
+     if ( sched_getaffinity( 0, sizeof( allowed ), &allowed ) != 0 )
+     {
+          return;
+     }
+     found = CPU_COUNT( &allowed );
+     if ( found < 1 )
+     {
+          return;
+     }
+
+     seen = 0;
+     for( cpu = 0; cpu < CPU_SETSIZE; cpu++ )
+     {
+          if ( CPU_ISSET( cpu, &allowed ) )
+          {
+               if ( seen == ( index % found ) )
+               {
+                    CPU_ZERO( &chosen );
+                    CPU_SET( cpu, &chosen );
+                    sched_setaffinity( 0, sizeof( chosen ), &chosen );
+                    return;
+               }
+               seen++;
+          }
+     }
+     return;
+}
+
+/* One worker's event loop.  This runs in the child process. */
+
+static void run_worker( const int lsock_fd, const int ctl_fd,
+                        const int engine, struct server_stats *stats )
+{
+     int ret;
+
+     memset( stats, 0, sizeof( struct server_stats ) );
+     ret = ( -1 );
+     if ( engine == ENGINE_IO_URING )
+     {
+          ret = run_uring_server( lsock_fd, ctl_fd, stats );
+          if ( ret == 0 || stats->accepted > 0 ||
+               ( errno != EOPNOTSUPP && errno != EINVAL &&
+                 errno != ENOSYS ) )
+          {
+               return;
+          }
+     }
+     run_epoll_server( lsock_fd, ctl_fd, stats );
+     return;
+}
+
+/*
+
+     Starts count workers, the first one on lsock_fd.  Each listener
+     is given a backlog of backlog connections.  Returns 0 on success
+     or -1 if an error occurs, in which case no workers are left
+     running.
+
+*/
+
+int shards_start( struct shard_set *set, const int lsock_fd,
+                  const int count, const int backlog, const int engine,
+                  const int ctl_fd )
+{
+     int index, other, result_fd[ 2 ], save_errno;
+     socklen_t addr_len;
+     ssize_t len;
+     struct server_stats stats;
+     struct sockaddr_storage addr;
+
+     if ( set == NULL )
+     {
+          errno = EFAULT;
+          return ( -1 );
+     }
+     if ( lsock_fd < 0 || ctl_fd < 0 || count < 1 || count > SHARD_MAX ||
+          backlog < 1 )
+     {
+          errno = EINVAL;
+          return ( -1 );
+     }
+
+     memset( set, 0, sizeof( struct shard_set ) );
+     set->lsock_fds = calloc( ( size_t )count, sizeof( int ) );
+     set->result_fds = calloc( ( size_t )count, sizeof( int ) );
+     set->pids = calloc( ( size_t )count, sizeof( pid_t ) );
+     if ( set->lsock_fds == NULL || set->result_fds == NULL ||
+          set->pids == NULL )
+     {
+          free( set->lsock_fds );
+          free( set->result_fds );
+          free( set->pids );
+          memset( set, 0, sizeof( struct shard_set ) );
+          errno = ENOMEM;
+          return ( -1 );
+     }
+     for( index = 0; index < count; index++ )
+     {
+          set->lsock_fds[ index ] = ( -1 );
+          set->result_fds[ index ] = ( -1 );
+     }
+
+     /* Open the rest of the group on the first listener's address. */
+
+     addr_len = sizeof( addr );
+     if ( getsockname( lsock_fd, ( struct sockaddr * )( &addr ),
+                       &addr_len ) != 0 ||
+          listen( lsock_fd, backlog ) != 0 )
+     {
+          save_errno = errno;
+          shards_finish( set, NULL, NULL );
+          errno = save_errno;
+          return ( -1 );
+     }
+     set->lsock_fds[ 0 ] = lsock_fd;
+     for( index = 1; index < count; index++ )
+     {
+          set->lsock_fds[ index ] = open_reuseport_listener( &addr,
+                                                             &addr_len,
+                                                             backlog );
+          if ( set->lsock_fds[ index ] < 0 ||
+               tuning_apply( set->lsock_fds[ index ],
+                             tuning_current() ) < 0 )
+          {
+               save_errno = errno;
+               set->count = index;
+               shards_finish( set, NULL, NULL );
+               errno = save_errno;
+               return ( -1 );
+          }
+          metrics_inherit( set->lsock_fds[ index ], lsock_fd );
+     }
+
+     fflush( stdout );  /* Don't let the children repeat our output. */
+
+     for( index = 0; index < count; index++ )
+     {
+          if ( pipe( result_fd ) != 0 )
+          {
+               break;
+          }
+
+          set->pids[ index ] = fork();
+          if ( set->pids[ index ] == ( -1 ) )
+          {
+               close( result_fd[ 0 ] );
+               close( result_fd[ 1 ] );
+               break;
+          }
+          else if ( set->pids[ index ] == 0 )  /* Child process */
+          {
+               close( result_fd[ 0 ] );
+               for( other = 0; other < count; other++ )
+               {
+                    if ( other != index )
+                    {
+                         close( set->lsock_fds[ other ] );
+                    }
+               }
+               pin_worker( index );
+               run_worker( set->lsock_fds[ index ], ctl_fd, engine,
+                           &stats );
+               len = write( result_fd[ 1 ], &stats, sizeof( stats ) );
+               close( result_fd[ 1 ] );
+               _exit( ( len == ( ssize_t )sizeof( stats ) ) ?
+                      EXIT_SUCCESS : EXIT_FAILURE );
+          }
+
+          /* Parent process, pid > 0 */
+
+          close( result_fd[ 1 ] );
+          set->result_fds[ index ] = result_fd[ 0 ];
+     }
+
+     set->count = count;
+     if ( index < count )
+     {
+          save_errno = errno;
+          for( other = 0; other < count; other++ )
+          {
+               if ( other < index )
+               {
+                    kill( set->pids[ other ], SIGTERM );
+               }
+               else if ( other > 0 )
+               {
+                    close( set->lsock_fds[ other ] );
+               }
+          }
+          set->count = index;
+          shards_finish( set, NULL, NULL );
+          errno = save_errno;
+          return ( -1 );
+     }
+
+     errno = 0;
+     return 0;
+}
+
+/*
+
+     Waits for the workers to stop, adds their statistics up into
+     total and stores how many connections each one accepted in
+     accepted[ 0 ] through accepted[ count - 1 ].  Either may be NULL.
+     Closes every listener the group opened, but not the one passed
+     to shards_start().  Returns 0 on success or -1 with errno set to
+     EIO if a worker didn't report.
+
+*/
+
+int shards_finish( struct shard_set *set, struct server_stats *total,
+                   uint64_t *accepted )
+{
+     int index, missing;
+     ssize_t len;
+     struct server_stats stats;
+
+     if ( set == NULL )
+     {
+          errno = EFAULT;
+          return ( -1 );
+     }
+     if ( total != NULL )
+     {
+          memset( total, 0, sizeof( struct server_stats ) );
+     }
+
+     missing = 0;
+     for( index = 0; index < set->count; index++ )
+     {
+          memset( &stats, 0, sizeof( stats ) );
+          if ( set->result_fds != NULL && set->result_fds[ index ] >= 0 )
+          {
+               do
+               {
+                    len = read( set->result_fds[ index ], &stats,
+                                sizeof( stats ) );
+               }    while( len < 0 && errno == EINTR );
+               close( set->result_fds[ index ] );
+               if ( len != ( ssize_t )sizeof( stats ) )
+               {
+                    missing++;
+               }
+          }
+          if ( set->pids != NULL && set->pids[ index ] > 0 )
+          {
+               waitpid( set->pids[ index ], NULL, 0 );
+          }
+          if ( index > 0 && set->lsock_fds[ index ] >= 0 )
+          {
+               close( set->lsock_fds[ index ] );
+          }
+
+          if ( accepted != NULL )
+          {
+               accepted[ index ] = stats.accepted;
+          }
+          if ( total != NULL )
+          {
+               total->accepted += stats.accepted;
+               total->closed += stats.closed;
+               total->max_open += stats.max_open;
+               total->bytes_in += stats.bytes_in;
+               total->bytes_out += stats.bytes_out;
+               total->errors += stats.errors;
+               total->syscalls += stats.syscalls;
+               total->tcp_watched += stats.tcp_watched;
+               total->tcp_flagged += stats.tcp_flagged;
+               if ( stats.elapsed_ns > total->elapsed_ns )
+               {
+                    total->elapsed_ns = stats.elapsed_ns;
+               }
+          }
+     }
+
+     free( set->lsock_fds );
+     free( set->result_fds );
+     free( set->pids );
+     memset( set, 0, sizeof( struct shard_set ) );
+
+     if ( missing > 0 )
+     {
+          errno = EIO;
+          return ( -1 );
+     }
+     errno = 0;
+     return 0;
+}
+
+#endif  /* _SHARDS_C */
+
+/* EOF shards.c */
@@ -0,0 +1,597 @@
+/*
+
+     shm_ring.c
+
+     Functions for the shared memory ring, a same-host transport that
+     moves messages through memory both processes have mapped instead
+     of through the kernel.  Even AF_UNIX makes a system call on each
+     side for every message.  A ring copies the message in and out
+     of shared memory and that's all, as long as neither side has to
+     wait for the other.
+
+     shm_ring_open() creates a channel in a memfd(2) and returns two
+     descriptors for it, one for each end, to stand in for a client
+     and a server socket.  Like sockets they are inherited across
+     fork(2) and can be closed with close(2).  shm_attach() maps a
+     channel and picks which end of it to use, shm_send() and
+     shm_recv() move one message, and shm_detach() unmaps it again.
+     The memory is freed once every descriptor is closed and every
+     mapping is gone.  shm_test_connection() is test_connection() for
+     a channel.
+
+     Each direction is a bounded queue of SHM_RING_SLOTS slots, and
+     each slot has a sequence number that says whose turn it is.  It
+     is the position in the queue where the ring's current lap past
+     the slot started while the slot is free, and one more than that
+     once the slot holds data.  So a freshly zeroed memfd is already
+     an empty ring, and none of its pages are touched until they are
+     used.  A sender
+     claims every slot its message needs at once by moving tail
+     forward with a compare-and-swap, so any number of processes can
+     send on the same ring.  It fills the slots and publishes the
+     first one last, so the reader never sees half a message.  Only
+     one process may read from a ring at a time.
+
+     Nobody sleeps while there is something to do.  A reader finding
+     its ring empty looks again SHM_SPIN times, then says it is
+     parked and sleeps in futex(2).  With only one CPU online the
+     other side can't run while it looks, so it sleeps right away.
+     A sender only makes the futex(2) call to wake it if it is
+     parked, and takes the parked flag down as it does so, so each
+     sleep costs one wakeup at most and a busy ring costs no system
+     calls at all.  Senders waiting for room are parked and woken the
+     same way.  The futexes live in shared memory, so they are not
+     FUTEX_PRIVATE_FLAG ones.
+
+     The functions return 0 on success or -1 if an error occurs,
+     except for shm_recv(), which returns the length of the message.
+
+     Written by Matthew Campbell.
+
+*/
+
+#ifndef _SHM_RING_C
+#define _SHM_RING_C
+
+#include "sockets.h"
+
+/* Marks a memfd that shm_ring_open() has set up. */
+
+#define SHM_MAGIC 0x53484d52
+
+#define SHM_MASK ( SHM_RING_SLOTS - 1 )
+
+/* Where the lap that reaches position pos started. */
+
+#define SHM_LAP( pos ) ( ( pos ) & ~( ( uint64_t )SHM_MASK ) )
+
+/* What shm_test_connection() sends, and how long it waits for it. */
+
+#define SHM_TEST_MESSAGE "Can you hear me?"
+#define SHM_TEST_TIMEOUT 3000
+
+/*
+
+     Sleeps on word for as long as it still holds value, until
+     deadline_ns at the latest.  Waking up early is fine because the
+     caller looks again either way.  Returns 0, or -1 with errno set
+     to ETIMEDOUT if the deadline has already passed.
+
+*/
+
+static int park( struct shm_ring *ring, _Atomic uint32_t *word,
+                 const uint32_t value, const uint64_t deadline_ns )
+{
+     struct timespec timeout;
+     uint64_t left_ns, now_ns;
+
+     now_ns = get_time_ns();
+     if ( now_ns >= deadline_ns )
+     {
+          errno = ETIMEDOUT;
+          return ( -1 );
+     }
+     left_ns = deadline_ns - now_ns;
+     timeout.tv_sec = ( time_t )( left_ns / 1000000000ULL );
+     timeout.tv_nsec = ( long )( left_ns % 1000000000ULL );
+
+     atomic_fetch_add_explicit( &( ring->parks ), 1, memory_order_relaxed );
+     syscall( __NR_futex, ( uint32_t * )word, FUTEX_WAIT, value, &timeout,
+              NULL, 0 );
+     return 0;
+}
+
+/* Moves word on and wakes up to count processes sleeping on it. */
+
+static void wake( struct shm_ring *ring, _Atomic uint32_t *word,
+                  const int count )
+{
+     atomic_fetch_add_explicit( word, 1, memory_order_release );
+     atomic_fetch_add_explicit( &( ring->wakeups ), 1,
+                                memory_order_relaxed );
+     syscall( __NR_futex, ( uint32_t * )word, FUTEX_WAKE, count, NULL,
+              NULL, 0 );
+     return;
+}
+
+/* Creates a channel.  *csock_fd and *ssock_fd are its two ends. */
+
+int shm_ring_open( int *csock_fd, int *ssock_fd )
+{
+     int fd, save_errno;
+     uint32_t magic;
+
+     if ( csock_fd == NULL || ssock_fd == NULL )
+     {
+          errno = EFAULT;
+          return ( -1 );
+     }
+     *csock_fd = ( -1 );
+     *ssock_fd = ( -1 );
+
+     fd = memfd_create( "shm_ring", MFD_CLOEXEC );
+     if ( fd < 0 )
+     {
+          return ( -1 );
+     }
+     if ( ftruncate( fd, ( off_t )sizeof( struct shm_channel ) ) != 0 )
+     {
+          save_errno = errno;
+          close( fd );
+          errno = save_errno;
+          return ( -1 );
+     }
+
+     /* A memfd starts out zeroed, so only the magic number is needed. */
+
+     magic = SHM_MAGIC;
+     errno = EIO;  /* In case the write comes up short. */
+     if ( pwrite( fd, &magic, sizeof( magic ),
+                  ( off_t )offsetof( struct shm_channel, magic ) ) !=
+          ( ssize_t )sizeof( magic ) )
+     {
+          save_errno = errno;
+          close( fd );
+          errno = save_errno;
+          return ( -1 );
+     }
+
+     *ssock_fd = fcntl( fd, F_DUPFD_CLOEXEC, 0 );
+     if ( *ssock_fd < 0 )
+     {
+          save_errno = errno;
+          close( fd );
+          errno = save_errno;
+          return ( -1 );
+     }
+     *csock_fd = fd;
+
+     errno = 0;
+     return 0;
+}
+
+/* Maps the channel fd so this process can use its side of it. */
+
+int shm_attach( const int fd, const int side, struct shm_end *end )
+{
+     struct shm_channel *chan;
+
+     if ( fd < 0 || ( side != SHM_CLIENT && side != SHM_SERVER ) )
+     {
+          errno = EINVAL;
+          return ( -1 );
+     }
+     if ( end == NULL )
+     {
+          errno = EFAULT;
+          return ( -1 );
+     }
+     memset( end, 0, sizeof( struct shm_end ) );
+
+     chan = mmap( NULL, sizeof( struct shm_channel ),
+                  ( PROT_READ | PROT_WRITE ), MAP_SHARED, fd, 0 );
+     if ( chan == MAP_FAILED )
+     {
+          return ( -1 );
+     }
+     if ( chan->magic != SHM_MAGIC )
+     {
+          munmap( chan, sizeof( struct shm_channel ) );
+          errno = EINVAL;
+          return ( -1 );
+     }
+
+     end->chan = chan;
+     end->tx = &( chan->rings[ side ] );
+     end->rx = &( chan->rings[ 1 - side ] );
+     end->spin = ( ( sysconf( _SC_NPROCESSORS_ONLN ) > 1 ) ? SHM_SPIN : 0 );
+
+     errno = 0;
+     return 0;
+}
+
+/* Unmaps what shm_attach() mapped. */
+
+void shm_detach( struct shm_end *end )
+{
+     if ( end != NULL && end->chan != NULL )
+     {
+          munmap( end->chan, sizeof( struct shm_channel ) );
+          memset( end, 0, sizeof( struct shm_end ) );
+     }
+     return;
+}
+
+/*
+
+     Sends len bytes from data as one message, waiting up to
+     timeout_ms milliseconds for room on the ring if it is full.
+
+*/
+
+int shm_send( struct shm_end *end, const void *data, const size_t len,
+              const int timeout_ms )
+{
+     const char *from;
+     int spin;
+     int64_t diff;
+     size_t chunk, offset;
+     struct shm_ring *ring;
+     struct shm_slot *slot;
+     uint32_t count, index, value;
+     uint64_t deadline_ns, last, pos;
+
+     if ( end == NULL || end->tx == NULL || ( data == NULL && len > 0 ) )
+     {
+          errno = EFAULT;
+          return ( -1 );
+     }
+     if ( timeout_ms < 0 )
+     {
+          errno = EINVAL;
+          return ( -1 );
+     }
+     if ( len > SHM_MAX_MESSAGE )
+     {
+          errno = EMSGSIZE;
+          return ( -1 );
+     }
+
+     ring = end->tx;
+     from = data;
+     count = ( uint32_t )( ( len + SHM_SLOT_DATA - 1 ) / SHM_SLOT_DATA );
+     if ( count == 0 )
+     {
+          count = 1;
+     }
+
+     /*
+
+          Claim count slots.  Slots are freed in order, so once the
+          last of them is free the rest of them are too.
+
+     */
+
+     deadline_ns = 0;
+     spin = 0;
+     for( ; ; )
+     {
+          pos = atomic_load_explicit( &( ring->tail ), memory_order_relaxed );
+          last = pos + count - 1;
+          slot = &( ring->slots[ last & SHM_MASK ] );
+          diff = ( int64_t )( atomic_load_explicit( &( slot->seq ),
+                                                    memory_order_acquire ) -
+                              SHM_LAP( last ) );
+          if ( diff == 0 )
+          {
+               if ( atomic_compare_exchange_weak_explicit(
+                         &( ring->tail ), &pos, pos + count,
+                         memory_order_relaxed, memory_order_relaxed ) )
+               {
+                    break;
+               }
+               continue;
+          }
+          if ( diff > 0 )
+          {
+               continue;  /* Another sender got there first. */
+          }
+
+          /* The ring is full.  Look again for a while, then sleep. */
+
+          if ( spin < end->spin )
+          {
+               spin++;
+               continue;
+          }
+          if ( deadline_ns == 0 )
+          {
+               deadline_ns = get_time_ns() +
+                             ( uint64_t )timeout_ms * 1000000ULL;
+          }
+          value = atomic_load_explicit( &( ring->room_futex ),
+                                        memory_order_acquire );
+          atomic_store_explicit( &( ring->senders_parked ), 1,
+                                 memory_order_relaxed );
+          atomic_thread_fence( memory_order_seq_cst );
+          diff = ( int64_t )( atomic_load_explicit( &( slot->seq ),
+                                                    memory_order_relaxed ) -
+                              SHM_LAP( last ) );
+          if ( diff < 0 && atomic_load_explicit( &( ring->tail ),
+                                                 memory_order_relaxed ) ==
+                           pos &&
+               park( ring, &( ring->room_futex ), value,
+                     deadline_ns ) != 0 )
+          {
+               return ( -1 );
+          }
+     }
+
+     /* Fill the slots from the last one back, so the first goes last. */
+
+     for( index = count; index > 0; index-- )
+     {
+          slot = &( ring->slots[ ( pos + index - 1 ) & SHM_MASK ] );
+          offset = ( size_t )( index - 1 ) * SHM_SLOT_DATA;
+          chunk = len - offset;
+          if ( chunk > SHM_SLOT_DATA )
+          {
+               chunk = SHM_SLOT_DATA;
+          }
+          memcpy( slot->data, &( from[ offset ] ), chunk );
+          slot->len = ( uint32_t )len;
+          slot->count = count;
+          atomic_store_explicit( &( slot->seq ),
+                                 SHM_LAP( pos + index - 1 ) + 1,
+                                 memory_order_release );
+     }
+
+     /* Only make the system call if the reader is asleep. */
+
+     atomic_thread_fence( memory_order_seq_cst );
+     if ( atomic_load_explicit( &( ring->reader_parked ),
+                                memory_order_relaxed ) != 0 &&
+          atomic_exchange_explicit( &( ring->reader_parked ), 0,
+                                    memory_order_relaxed ) != 0 )
+     {
+          wake( ring, &( ring->data_futex ), 1 );
+     }
+
+     errno = 0;
+     return 0;
+}
+
+/*
+
+     Receives one message into buffer, waiting up to timeout_ms
+     milliseconds for it.  A message longer than size is left on the
+     ring and errno is set to EMSGSIZE.
+
+*/
+
+ssize_t shm_recv( struct shm_end *end, void *buffer, const size_t size,
+                  const int timeout_ms )
+{
+     char *to;
+     int spin;
+     size_t chunk, len, offset;
+     struct shm_ring *ring;
+     struct shm_slot *first, *slot;
+     uint32_t count, index, value;
+     uint64_t deadline_ns, pos;
+
+     if ( end == NULL || end->rx == NULL || ( buffer == NULL && size > 0 ) )
+     {
+          errno = EFAULT;
+          return ( -1 );
+     }
+     if ( timeout_ms < 0 )
+     {
+          errno = EINVAL;
+          return ( -1 );
+     }
+
+     ring = end->rx;
+     to = buffer;
+     pos = atomic_load_explicit( &( ring->head ), memory_order_relaxed );
+     first = &( ring->slots[ pos & SHM_MASK ] );
+
+     /* Wait for the first slot.  The rest were filled before it. */
+
+     deadline_ns = 0;
+     spin = 0;
+     while( atomic_load_explicit( &( first->seq ), memory_order_acquire ) !=
+            SHM_LAP( pos ) + 1 )
+     {
+          if ( spin < end->spin )
+          {
+               spin++;
+               continue;
+          }
+          if ( deadline_ns == 0 )
+          {
+               deadline_ns = get_time_ns() +
+                             ( uint64_t )timeout_ms * 1000000ULL;
+          }
+
+          /*
+
+               Say we're parked before looking one last time.  A
+               sender publishes before it looks at reader_parked, so
+               one of us is bound to see the other.
+
+          */
+
+          value = atomic_load_explicit( &( ring->data_futex ),
+                                        memory_order_acquire );
+          atomic_store_explicit( &( ring->reader_parked ), 1,
+                                 memory_order_relaxed );
+          atomic_thread_fence( memory_order_seq_cst );
+          if ( atomic_load_explicit( &( first->seq ),
+                                     memory_order_acquire ) !=
+               SHM_LAP( pos ) + 1 &&
+               park( ring, &( ring->data_futex ), value,
+                     deadline_ns ) != 0 )
+          {
+               atomic_store_explicit( &( ring->reader_parked ), 0,
+                                      memory_order_relaxed );
+               return ( -1 );
+          }
+     }
+     atomic_store_explicit( &( ring->reader_parked ), 0,
+                            memory_order_relaxed );
+
+     len = first->len;
+     count = first->count;
+     if ( len > size )
+     {
+          errno = EMSGSIZE;
+          return ( -1 );
+     }
+
+     for( index = 0; index < count; index++ )
+     {
+          slot = &( ring->slots[ ( pos + index ) & SHM_MASK ] );
+          offset = ( size_t )index * SHM_SLOT_DATA;
+          chunk = len - offset;
+          if ( chunk > SHM_SLOT_DATA )
+          {
+               chunk = SHM_SLOT_DATA;
+          }
+          memcpy( &( to[ offset ] ), slot->data, chunk );
+     }
+
+     /* Hand the slots back for the next trip around the ring. */
+
+     for( index = 0; index < count; index++ )
+     {
+          slot = &( ring->slots[ ( pos + index ) & SHM_MASK ] );
+          atomic_store_explicit( &( slot->seq ),
+                                 SHM_LAP( pos + index ) + SHM_RING_SLOTS,
+                                 memory_order_release );
+     }
+     atomic_store_explicit( &( ring->head ), pos + count,
+                            memory_order_relaxed );
+
+     atomic_thread_fence( memory_order_seq_cst );
+     if ( atomic_load_explicit( &( ring->senders_parked ),
+                                memory_order_relaxed ) != 0 &&
+          atomic_exchange_explicit( &( ring->senders_parked ), 0,
+                                    memory_order_relaxed ) != 0 )
+     {
+          wake( ring, &( ring->room_futex ), INT32_MAX );
+     }
+
+     errno = 0;
+     return ( ssize_t )len;
+}
+
+/* How often anyone has slept on either ring, and been woken up. */
+
+void shm_stats( const struct shm_end *end, uint64_t *parks,
+                uint64_t *wakeups )
+{
+     int side;
+
+     if ( parks != NULL )
+     {
+          *parks = 0;
+     }
+     if ( wakeups != NULL )
+     {
+          *wakeups = 0;
+     }
+     if ( end == NULL || end->chan == NULL )
+     {
+          return;
+     }
+     for( side = 0; side < 2; side++ )
+     {
+          if ( parks != NULL )
+          {
+               *parks += atomic_load_explicit(
+                              &( end->chan->rings[ side ].parks ),
+                              memory_order_relaxed );
+          }
+          if ( wakeups != NULL )
+          {
+               *wakeups += atomic_load_explicit(
+                                &( end->chan->rings[ side ].wakeups ),
+                                memory_order_relaxed );
+          }
+     }
+     return;
+}
+
+/*
+
+     Makes sure a channel works, the way test_connection() does for
+     a pair of sockets.  The client end sends a short message, the
+     server end echoes it back, and the client checks what it got.
+
+*/
+
+int shm_test_connection( const int csock_fd, const int ssock_fd )
+{
+     char reply[ sizeof( SHM_TEST_MESSAGE ) ];
+     int ret, save_errno;
+     ssize_t len;
+     struct shm_end client, server;
+
+     if ( shm_attach( csock_fd, SHM_CLIENT, &client ) != 0 )
+     {
+          return ( -1 );
+     }
+     if ( shm_attach( ssock_fd, SHM_SERVER, &server ) != 0 )
+     {
+          save_errno = errno;
+          shm_detach( &client );
+          errno = save_errno;
+          return ( -1 );
+     }
+
+     ret = ( -1 );
+     memset( reply, 0, sizeof( reply ) );
+     len = ( -1 );
+     if ( shm_send( &client, SHM_TEST_MESSAGE, sizeof( SHM_TEST_MESSAGE ),
+                    SHM_TEST_TIMEOUT ) == 0 )
+     {
+          len = shm_recv( &server, reply, sizeof( reply ),
+                          SHM_TEST_TIMEOUT );
+     }
+     if ( len >= 0 &&
+          shm_send( &server, reply, ( size_t )len, SHM_TEST_TIMEOUT ) == 0 )
+     {
+          memset( reply, 0, sizeof( reply ) );
+          len = shm_recv( &client, reply, sizeof( reply ),
+                          SHM_TEST_TIMEOUT );
+          if ( len == ( ssize_t )sizeof( SHM_TEST_MESSAGE ) &&
+               memcmp( reply, SHM_TEST_MESSAGE, ( size_t )len ) == 0 )
+          {
+               ret = 0;
+          }
+          else if ( len >= 0 )
+          {
+               errno = EIO;
+          }
+     }
+     save_errno = errno;
+     shm_detach( &server );
+     shm_detach( &client );
+
+#ifdef DEBUG
+
+     if ( ret == 0 )
+     {
+          printf( "The shared memory ring passed the echo test.\n" );
+     }
+
+#endif
+
+     errno = ( ( ret == 0 ) ? 0 : save_errno );
+     return ret;
+}
+
+#endif  /* _SHM_RING_C */
+
+/* EOF shm_ring.c */
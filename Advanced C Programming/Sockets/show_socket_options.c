@@ -1,7 +1,20 @@
 /*
 
      show_socket_options.c
-     Displays some socket data.
+
+     This function shows the options that matter for tuning on
+     sock_fd: its buffers and low water marks, keepalive and its
+     timers, lingering, timeouts, busy polling and, on a TCP socket,
+     Nagle's algorithm, delayed acknowledgements, the unsent data
+     limit and the congestion control algorithm.  domain is the
+     socket's address family and sock_type its type.  sock_name says
+     which socket it is, such as "client socket".  A sock_fd of -1
+     is shown as not open.
+
+     The kernel reports SO_SNDBUF and SO_RCVBUF as twice what was
+     asked for, since it counts its own bookkeeping as well.  An
+     option the socket doesn't support is left out.
+
      Written by Matthew Campbell.
 
 */
@@ -13,9 +26,61 @@
 
 #ifdef SHOW_SOCKET_OPTIONS
 
+/* How each option's value is shown. */
+
+#define SHOW_INT    0
+#define SHOW_LINGER 1
+#define SHOW_TIME   2
+#define SHOW_TEXT   3
+
+static const struct
+{
+     int level;
+     int name;
+     const char *label;
+     int kind;
+}    show_options[] =
+{
+     { SOL_SOCKET, SO_SNDBUF, "SO_SNDBUF", SHOW_INT },
+     { SOL_SOCKET, SO_RCVBUF, "SO_RCVBUF", SHOW_INT },
+     { SOL_SOCKET, SO_SNDLOWAT, "SO_SNDLOWAT", SHOW_INT },
+     { SOL_SOCKET, SO_RCVLOWAT, "SO_RCVLOWAT", SHOW_INT },
+     { SOL_SOCKET, SO_SNDTIMEO, "SO_SNDTIMEO", SHOW_TIME },
+     { SOL_SOCKET, SO_RCVTIMEO, "SO_RCVTIMEO", SHOW_TIME },
+     { SOL_SOCKET, SO_KEEPALIVE, "SO_KEEPALIVE", SHOW_INT },
+     { SOL_SOCKET, SO_LINGER, "SO_LINGER", SHOW_LINGER },
+     { SOL_SOCKET, SO_REUSEADDR, "SO_REUSEADDR", SHOW_INT },
+     { SOL_SOCKET, SO_REUSEPORT, "SO_REUSEPORT", SHOW_INT },
+     { SOL_SOCKET, SO_OOBINLINE, "SO_OOBINLINE", SHOW_INT },
+     { SOL_SOCKET, SO_DONTROUTE, "SO_DONTROUTE", SHOW_INT },
+     { SOL_SOCKET, SO_BROADCAST, "SO_BROADCAST", SHOW_INT },
+     { SOL_SOCKET, SO_PRIORITY, "SO_PRIORITY", SHOW_INT },
+     { SOL_SOCKET, SO_BUSY_POLL, "SO_BUSY_POLL", SHOW_INT },
+     { SOL_SOCKET, SO_INCOMING_CPU, "SO_INCOMING_CPU", SHOW_INT },
+     { SOL_SOCKET, SO_ZEROCOPY, "SO_ZEROCOPY", SHOW_INT },
+     { IPPROTO_TCP, TCP_NODELAY, "TCP_NODELAY", SHOW_INT },
+     { IPPROTO_TCP, TCP_QUICKACK, "TCP_QUICKACK", SHOW_INT },
+     { IPPROTO_TCP, TCP_CORK, "TCP_CORK", SHOW_INT },
+     { IPPROTO_TCP, TCP_NOTSENT_LOWAT, "TCP_NOTSENT_LOWAT", SHOW_INT },
+     { IPPROTO_TCP, TCP_MAXSEG, "TCP_MAXSEG", SHOW_INT },
+     { IPPROTO_TCP, TCP_KEEPIDLE, "TCP_KEEPIDLE", SHOW_INT },
+     { IPPROTO_TCP, TCP_KEEPINTVL, "TCP_KEEPINTVL", SHOW_INT },
+     { IPPROTO_TCP, TCP_KEEPCNT, "TCP_KEEPCNT", SHOW_INT },
+     { IPPROTO_TCP, TCP_USER_TIMEOUT, "TCP_USER_TIMEOUT", SHOW_INT },
+     { IPPROTO_TCP, TCP_DEFER_ACCEPT, "TCP_DEFER_ACCEPT", SHOW_INT },
+     { IPPROTO_TCP, TCP_CONGESTION, "TCP_CONGESTION", SHOW_TEXT },
+     { IPPROTO_IPV6, IPV6_V6ONLY, "IPV6_V6ONLY", SHOW_INT }
+};
+
 void show_socket_options( const int sock_fd, const int domain,
                           const int sock_type, const char *sock_name )
 {
+     char text[ 32 ], value[ 40 ];
+     int column, index, num, protocol;
+     socklen_t opt_len;
+     struct linger linger;
+     struct timeval timeout;
+
      if ( sock_fd < ( -1 ) )
      {
           errno = EINVAL;
@@ -42,7 +107,115 @@ void show_socket_options( const int sock_fd, const int domain,
           return;
      }
 
-     errno = ENOSYS;
+     if ( sock_fd == ( -1 ) )
+     {
+          printf( "The %s is not open.\n\n", sock_name );
+          errno = 0;
+          return;
+     }
+
+     protocol = 0;
+     opt_len = sizeof( protocol );
+     getsockopt( sock_fd, SOL_SOCKET, SO_PROTOCOL, &protocol, &opt_len );
+
+     printf( "Socket options for the %s (fd %d, %s%s):\n", sock_name,
+             sock_fd, ( ( sock_type == SOCK_STREAM ) ? "stream" :
+                        ( ( sock_type == SOCK_DGRAM ) ? "datagram" :
+                          "seqpacket" ) ),
+             ( ( protocol == IPPROTO_TCP ) ? ", TCP" : "" ) );
+
+     column = 0;
+     for( index = 0; index < ( int )( sizeof( show_options ) /
+                                      sizeof( show_options[ 0 ] ) );
+          index++ )
+     {
+          if ( ( show_options[ index ].level == IPPROTO_TCP &&
+                 protocol != IPPROTO_TCP ) ||
+               ( show_options[ index ].level == IPPROTO_IPV6 &&
+                 domain != AF_INET6 ) )
+          {
+               continue;
+          }
+
+          if ( show_options[ index ].kind == SHOW_LINGER )
+          {
+               opt_len = sizeof( linger );
+               if ( getsockopt( sock_fd, show_options[ index ].level,
+                                show_options[ index ].name, &linger,
+                                &opt_len ) != 0 )
+               {
+                    continue;
+               }
+               if ( linger.l_onoff == 0 )
+               {
+                    snprintf( value, sizeof( value ), "off" );
+               }
+               else
+               {
+                    snprintf( value, sizeof( value ), "%d s",
+                              linger.l_linger );
+               }
+          }
+          else if ( show_options[ index ].kind == SHOW_TIME )
+          {
+               opt_len = sizeof( timeout );
+               if ( getsockopt( sock_fd, show_options[ index ].level,
+                                show_options[ index ].name, &timeout,
+                                &opt_len ) != 0 )
+               {
+                    continue;
+               }
+               if ( timeout.tv_sec == 0 && timeout.tv_usec == 0 )
+               {
+                    snprintf( value, sizeof( value ), "none" );
+               }
+               else
+               {
+                    snprintf( value, sizeof( value ), "%ld.%06ld s",
+                              ( long )timeout.tv_sec,
+                              ( long )timeout.tv_usec );
+               }
+          }
+          else if ( show_options[ index ].kind == SHOW_TEXT )
+          {
+               memset( text, 0, sizeof( text ) );
+               opt_len = sizeof( text ) - 1;
+               if ( getsockopt( sock_fd, show_options[ index ].level,
+                                show_options[ index ].name, text,
+                                &opt_len ) != 0 )
+               {
+                    continue;
+               }
+               snprintf( value, sizeof( value ), "%s", text );
+          }
+          else
+          {
+               opt_len = sizeof( num );
+               if ( getsockopt( sock_fd, show_options[ index ].level,
+                                show_options[ index ].name, &num,
+                                &opt_len ) != 0 )
+               {
+                    continue;
+               }
+               snprintf( value, sizeof( value ), "%d", num );
+          }
+
+          /* Two to a line. */
+
+          if ( column == 0 )
+          {
+               printf( "  %-17s %-18s", show_options[ index ].label, value );
+               column = 1;
+          }
+          else
+          {
+               printf( "  %-17s %s\n", show_options[ index ].label, value );
+               column = 0;
+          }
+     }
+     printf( "%s\n", ( ( column == 0 ) ? "" : "\n" ) );
+
+     errno = 0;
      return;
 }
 
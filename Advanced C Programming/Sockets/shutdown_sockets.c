@@ -5,6 +5,16 @@
      This function is called when the socket
      connections need to be shut down.
 
+     For AF_UNIX the socket file is removed as well, unless
+     USE_ABSTRACT_AF_UNIX is defined, in which case there isn't one:
+     an abstract name goes away by itself when its socket is closed.
+
+     The sockets are closed by walking conn_table_main() with
+     conn_next(), so anything else that was put in it, such as the
+     connections a multi-connection server accepted in this process,
+     is closed too.  A socket passed in that isn't in the table is
+     added first.
+
      Written by Matthew Campbell.
 
 */
@@ -14,13 +24,33 @@
 
 #include "sockets.h"
 
+/* What is closed, in order, and what to call it if that fails. */
+
+static const int close_roles[ 4 ] =
+{
+     CONN_ROLE_SERVER, CONN_ROLE_LISTENER, CONN_ROLE_CLIENT, CONN_ROLE_PEER
+};
+
+static const char * const close_names[ 4 ] =
+{
+     "the server socket", "the server's listening socket",
+     "the client socket", "a peer connection"
+};
+
 int shutdown_sockets( int *csock_fd, int *lsock_fd, int *ssock_fd,
                       int domain, int type )
 {
-     int ret, save_errno;
+     int cursor, fd, index, ret, save_errno, *sock_fds[ 3 ], which;
+     struct conn_rec *rec;
+     struct conn_table *table;
+
+#ifndef USE_ABSTRACT_AF_UNIX
+
      struct stat sock_file;
 
-     if ( domain < 1 || domain > ( MAX_DOMAINS + 1 ) )  /* Exit is 5. */
+#endif
+
+     if ( domain < 1 || domain > ( MAX_DOMAINS + 1 ) )  /* Exit is 6. */
      {
           errno = EINVAL;
           return ( -1 );
@@ -119,6 +149,8 @@ fsync( *ssock_fd ) rejected as an invalid argument.\n" );
 
 #endif
 
+#ifndef USE_ABSTRACT_AF_UNIX
+
      /* Remove the socket file if it exists. */
 
      if ( domain == 4 )  /* AF_UNIX */
@@ -188,68 +220,78 @@ Successfully removed the socket file \"%s\".\n", SOCK_NAME );
 
      }    /* if ( domain == 4 ) */
 
-     /* Close the server socket if it is open. */
+#endif  /* USE_ABSTRACT_AF_UNIX */
+
+     /*
+
+          Make sure the table has every socket we were given, then
+          close what it holds: the server socket, the listening
+          socket, the client socket, and last any peer connections,
+          the same order as before the table kept track of them.
 
-     if ( *ssock_fd >= 0 )
+     */
+
+     table = conn_table_main();
+     if ( table == NULL )
      {
-          ret = close( *ssock_fd );
-          if ( ret != 0 )
+          save_errno = errno;
+          printf( "\n\
+Something went wrong when trying to find the connection table.\n" );
+          if ( save_errno != 0 )
           {
-               save_errno = errno;
-               printf( "\n\
-Something went wrong when trying to close the server socket.\n" );
-               if ( save_errno != 0 )
-               {
-                    printf( "Error: %s.\n", strerror( save_errno ) );
-               }
-               printf( "\n" );
-               errno = 0;
-               return ( -1 );
+               printf( "Error: %s.\n", strerror( save_errno ) );
           }
-          *ssock_fd = -1;
+          printf( "\n" );
+          errno = 0;
+          return ( -1 );
      }
-
-     /* Close the server's listening socket if it is open. */
-
-     if ( *lsock_fd >= 0 )
+     sock_fds[ 0 ] = ssock_fd;
+     sock_fds[ 1 ] = lsock_fd;
+     sock_fds[ 2 ] = csock_fd;
+     for( index = 0; index < 3; index++ )
      {
-          ret = close( *lsock_fd );
-          if ( ret != 0 )
+          if ( *( sock_fds[ index ] ) >= 0 &&
+               conn_by_fd( table, *( sock_fds[ index ] ) ) == NULL )
           {
-               save_errno = errno;
-               printf( "\n\
-Something went wrong when trying to close the server's listening socket.\
-\n" );
-               if ( save_errno != 0 )
-               {
-                    printf( "Error: %s.\n", strerror( save_errno ) );
-               }
-               printf( "\n" );
-               errno = 0;
-               return ( -1 );
+               conn_insert( table, *( sock_fds[ index ] ),
+                            close_roles[ index ],
+                            sock_family( *( sock_fds[ index ] ) ), type, NULL );
           }
-          *lsock_fd = -1;
      }
 
-     /* Close the client socket if it is open. */
-
-     if ( *csock_fd >= 0 )
+     for( index = 0; index < 4; index++ )
      {
-          ret = close( *csock_fd );
-          if ( ret != 0 )
+          cursor = 0;
+          while( ( rec = conn_next( table, &cursor ) ) != NULL )
           {
-               save_errno = errno;
-               printf( "\n\
-Something went wrong when trying to close the client socket.\n" );
-               if ( save_errno != 0 )
+               if ( rec->role != close_roles[ index ] )
+               {
+                    continue;
+               }
+               fd = rec->fd;
+               conn_remove( table, rec->handle );
+               ret = close( fd );
+               if ( ret != 0 )
+               {
+                    save_errno = errno;
+                    printf( "\n\
+Something went wrong when trying to close %s.\n", close_names[ index ] );
+                    if ( save_errno != 0 )
+                    {
+                         printf( "Error: %s.\n", strerror( save_errno ) );
+                    }
+                    printf( "\n" );
+                    errno = 0;
+                    return ( -1 );
+               }
+               for( which = 0; which < 3; which++ )
                {
-                    printf( "Error: %s.\n", strerror( save_errno ) );
+                    if ( *( sock_fds[ which ] ) == fd )
+                    {
+                         *( sock_fds[ which ] ) = -1;
+                    }
                }
-               printf( "\n" );
-               errno = 0;
-               return ( -1 );
           }
-          *csock_fd = -1;
      }
 
      return 0;
@@ -0,0 +1,339 @@
+/*
+
+     sig_events.c
+
+     These functions deliver SIGIO, SIGURG, SIGALRM, SIGCHLD and
+     SIGTERM through a signalfd(2) instead of signal handlers.
+
+     sig_events_open() blocks the five signals and makes a signalfd
+     for them.  It has to be called before any threads are started,
+     so every thread inherits the mask.  A blocked signal never
+     interrupts a system call, so nothing on a hot path sees EINTR
+     because of one of them.  The signals stay pending until an event
+     loop finds the signalfd readable and calls sig_events_read(),
+     which counts each one.  Nothing is done from a signal handler,
+     so the counts are exact.  Only the kernel can merge signals: two
+     of the same standard signal pending at once are delivered as
+     one, and count as one.
+
+     SIGTERM is different, since a pending one would keep the
+     program from being stopped while nothing is reading the
+     signalfd, such as during a pair benchmark or a reconnect.  The
+     main thread only blocks it between sig_events_hold() and
+     sig_events_release(), which the event loops and
+     sig_events_wait_input() call around the time they watch the
+     signalfd.  The rest of the time SIGTERM ends the program the
+     usual way.  A thread we start calls sig_events_thread() first,
+     so it never takes a SIGTERM meant for the main thread.
+
+     SIGCHLD is counted but not reaped.  Whoever forked a child still
+     waits for it with waitpid(2).
+
+     A child process made with fork(2) gets the old signal mask back
+     and doesn't inherit the signalfd, so the SIGTERM its parent sends
+     it still ends it.
+
+     sig_events_read() returns 1 once SIGTERM has been seen, and keeps
+     returning 1, which tells an event loop to stop.  An event loop
+     that isn't running on the main thread mustn't read the signalfd
+     at all, since the counts and the stop belong to the main thread.
+
+     sig_events_wait_input() waits for input on fd, reading the
+     signalfd whenever it becomes readable in the meantime, and fails
+     with ECANCELED if SIGTERM arrives.  sig_events_print() shows the
+     counts.
+
+     Written by Matthew Campbell.
+
+*/
+
+#ifndef _SIG_EVENTS_C
+#define _SIG_EVENTS_C
+
+#include "sockets.h"
+
+/* The signals we take through the signalfd, and their counts. */
+
+static const int sig_nums[ SIG_EVENTS ] =
+{
+     SIGIO, SIGURG, SIGALRM, SIGCHLD, SIGTERM
+};
+
+static _Atomic uint64_t sig_counts[ SIG_EVENTS ];
+
+static int sig_fd = ( -1 );
+static int sig_registered = 0;
+static int sig_stop = 0;
+static sigset_t sig_old_mask;
+
+/* Puts things back the way they were in a child process. */
+
+static void sig_events_child( void )
+{
+     if ( sig_fd >= 0 )
+     {
+          close( sig_fd );
+          sig_fd = ( -1 );
+          pthread_sigmask( SIG_SETMASK, &sig_old_mask, NULL );
+     }
+}
+
+int sig_events_open( void )
+{
+     int index, ret, save_errno;
+     sigset_t mask;
+
+     if ( sig_fd >= 0 )
+     {
+          errno = EBUSY;
+          return ( -1 );
+     }
+
+     sigemptyset( &mask );
+     for( index = 0; index < SIG_EVENTS; index++ )
+     {
+          sigaddset( &mask, sig_nums[ index ] );
+          atomic_store( &( sig_counts[ index ] ), 0 );
+     }
+     sig_stop = 0;
+
+     ret = pthread_sigmask( SIG_BLOCK, &mask, &sig_old_mask );
+     if ( ret != 0 )
+     {
+          errno = ret;
+          return ( -1 );
+     }
+
+     sig_fd = signalfd( -1, &mask, SFD_NONBLOCK | SFD_CLOEXEC );
+     if ( sig_fd < 0 )
+     {
+          save_errno = errno;
+          pthread_sigmask( SIG_SETMASK, &sig_old_mask, NULL );
+          errno = save_errno;
+          return ( -1 );
+     }
+     sig_events_release();
+
+     /* Only register this once, however many times we're opened. */
+
+     if ( sig_registered == 0 )
+     {
+          ret = pthread_atfork( NULL, NULL, sig_events_child );
+          if ( ret != 0 )
+          {
+               close( sig_fd );
+               sig_fd = ( -1 );
+               pthread_sigmask( SIG_SETMASK, &sig_old_mask, NULL );
+               errno = ret;
+               return ( -1 );
+          }
+          sig_registered = 1;
+     }
+
+     errno = 0;
+     return 0;
+}
+
+int sig_events_fd( void )
+{
+     return sig_fd;
+}
+
+/* Blocks SIGTERM so it waits for the signalfd.  errno is left alone. */
+
+void sig_events_hold( void )
+{
+     int save_errno;
+     sigset_t mask;
+
+     if ( sig_fd < 0 )
+     {
+          return;
+     }
+     save_errno = errno;
+     sigemptyset( &mask );
+     sigaddset( &mask, SIGTERM );
+     pthread_sigmask( SIG_BLOCK, &mask, NULL );
+     errno = save_errno;
+     return;
+}
+
+/* Lets SIGTERM end the program again.  errno is left alone. */
+
+void sig_events_release( void )
+{
+     int save_errno;
+     sigset_t mask;
+
+     if ( sig_fd < 0 )
+     {
+          return;
+     }
+     save_errno = errno;
+     sigemptyset( &mask );
+     sigaddset( &mask, SIGTERM );
+     pthread_sigmask( SIG_UNBLOCK, &mask, NULL );
+     errno = save_errno;
+     return;
+}
+
+/* Leaves all five signals to the main thread. */
+
+void sig_events_thread( void )
+{
+     int index, save_errno;
+     sigset_t mask;
+
+     save_errno = errno;
+     sigemptyset( &mask );
+     for( index = 0; index < SIG_EVENTS; index++ )
+     {
+          sigaddset( &mask, sig_nums[ index ] );
+     }
+     pthread_sigmask( SIG_BLOCK, &mask, NULL );
+     errno = save_errno;
+     return;
+}
+
+int sig_events_read( void )
+{
+     int index;
+     ssize_t len;
+     struct signalfd_siginfo info[ SIG_EVENTS * 4 ];
+     size_t count, num;
+
+     if ( sig_fd < 0 )
+     {
+          errno = EBADF;
+          return ( -1 );
+     }
+
+     for( ; ; )
+     {
+          len = read( sig_fd, info, sizeof( info ) );
+          if ( len < 0 )
+          {
+               if ( errno == EAGAIN )
+               {
+                    break;
+               }
+               if ( errno == EINTR )
+               {
+                    continue;
+               }
+               return ( -1 );
+          }
+
+          count = ( size_t )len / sizeof( struct signalfd_siginfo );
+          for( num = 0; num < count; num++ )
+          {
+               for( index = 0; index < SIG_EVENTS; index++ )
+               {
+                    if ( ( int )info[ num ].ssi_signo == sig_nums[ index ] )
+                    {
+                         atomic_fetch_add( &( sig_counts[ index ] ), 1 );
+                         break;
+                    }
+               }
+               if ( ( int )info[ num ].ssi_signo == SIGTERM )
+               {
+                    sig_stop = 1;
+               }
+          }
+          if ( count < sizeof( info ) / sizeof( info[ 0 ] ) )
+          {
+               break;  /* That was all of them. */
+          }
+     }
+
+     errno = 0;
+     return sig_stop;
+}
+
+uint64_t sig_events_count( const int sig_num )
+{
+     int index;
+
+     for( index = 0; index < SIG_EVENTS; index++ )
+     {
+          if ( sig_nums[ index ] == sig_num )
+          {
+               return atomic_load( &( sig_counts[ index ] ) );
+          }
+     }
+     return 0;
+}
+
+int sig_events_wait_input( const int fd )
+{
+     int nfds, result, ret;
+     struct pollfd fds[ 2 ];
+
+     if ( fd < 0 )
+     {
+          errno = EINVAL;
+          return ( -1 );
+     }
+
+     fds[ 0 ].fd = fd;
+     fds[ 0 ].events = POLLIN;
+     fds[ 1 ].fd = sig_fd;
+     fds[ 1 ].events = POLLIN;
+     nfds = ( ( sig_fd >= 0 ) ? 2 : 1 );
+
+     sig_events_hold();
+     for( ; ; )
+     {
+          if ( sig_stop == 1 )
+          {
+               errno = ECANCELED;
+               result = ( -1 );
+               break;
+          }
+
+          fds[ 0 ].revents = 0;
+          fds[ 1 ].revents = 0;
+          ret = poll( fds, ( nfds_t )nfds, -1 );
+          if ( ret < 0 )
+          {
+               if ( errno == EINTR )
+               {
+                    continue;
+               }
+               result = ( -1 );
+               break;
+          }
+
+          if ( nfds == 2 && fds[ 1 ].revents != 0 &&
+               sig_events_read() < 0 )
+          {
+               result = ( -1 );
+               break;
+          }
+          if ( fds[ 0 ].revents != 0 && sig_stop == 0 )
+          {
+               errno = 0;
+               result = 0;
+               break;
+          }
+     }
+     sig_events_release();
+     return result;
+}
+
+void sig_events_print( void )
+{
+     if ( sig_fd >= 0 )
+     {
+          sig_events_read();  /* Pick up any that are still pending. */
+     }
+     printf( "Signals received: SIGIO %" PRIu64 ", SIGURG %" PRIu64
+             ", SIGALRM %" PRIu64 ",\n", sig_events_count( SIGIO ),
+             sig_events_count( SIGURG ), sig_events_count( SIGALRM ) );
+     printf( "SIGCHLD %" PRIu64 ", SIGTERM %" PRIu64 ".\n\n",
+             sig_events_count( SIGCHLD ), sig_events_count( SIGTERM ) );
+}
+
+#endif  /* _SIG_EVENTS_C */
+
+/* EOF sig_events.c */
@@ -12,19 +12,23 @@
 
 #include "sockets.h"
 
-/* Global variables: */
+/* The names a configuration can use for the domain menu, in order. */
 
-/*
-_Atomic sig_io_received;
-_Atomic sig_urg_received;
-*/
+static const char * const domain_names[] =
+{
+     "bluetooth", "inet", "inet6", "unix", "shm", "exit"
+};
 
-int sig_io_received;
-int sig_urg_received;
+/* The address family of each domain, in the same order. */
+
+static const int domain_families[] =
+{
+     AF_BLUETOOTH, AF_INET, AF_INET6, AF_UNIX, AF_SHM_RING
+};
 
 /* Function definitions: */
 
-int main( void )
+int main( int argc, char **argv )
 {
      uint8_t address[ ADDR_SIZE ];
      static char buffer[ 80 ];
@@ -34,62 +38,56 @@ int main( void )
      int csock_fd = -1, lsock_fd = -1, ssock_fd = -1;
 
      int domain = 0, exit_loop, len = 80, ret, save_errno, type = 0;
-     struct sigaction alrm_new, io_new, urg_new;
-
-     /* Initialize these global variables: */
-
-     sig_io_received = 0;
-     sig_urg_received = 0;
-
-     /* Set up the signal handling functions: */
-
-     /* Set up SIGALRM: */
+     int swapped, use_spares = 0;
 
-     /* Clear the data space. */
+#ifdef TEST_SIGNALS
 
-     memset( &alrm_new, 0, sizeof( alrm_new ) );
+     int count;
 
-     /* Set the new signal handling function. */
+#endif
 
-     alrm_new.sa_handler = catch_sigalrm;
+     struct spare_pool spares;
+     uint64_t reconnect_ns;
 
-#ifdef DEBUG
+     /*
 
-     printf( "Calling sigaction(2) to set the catch for SIGALRM.\n" );
+          Any arguments make up a configuration, and the program runs
+          without asking any questions.  See config.c.
 
-#endif
+     */
 
-     ret = sigaction( SIGALRM, &alrm_new, NULL );
-     if ( ret != 0 )
+     if ( argc > 1 && ( strcmp( argv[ 1 ], "-h" ) == 0 ||
+                        strcmp( argv[ 1 ], "--help" ) == 0 ) )
      {
-          save_errno = errno;
-          printf( "\
-Something went wrong when trying to setup catch_sigalrm().\n" );
-          if ( save_errno != 0 )
-          {
-               printf( "Error: %s.\n", strerror( save_errno ) );
-          }
-          printf( "\n" );
+          config_usage( argv[ 0 ] );
+          exit( EXIT_SUCCESS );
+     }
+     if ( config_load_args( argc, argv ) != 0 )
+     {
+          config_usage( argv[ 0 ] );
           exit( EXIT_FAILURE );
      }
 
-     /* Set up SIGIO: */
+     /*
+
+          Take SIGIO, SIGURG, SIGALRM, SIGCHLD and SIGTERM through a
+          signalfd instead of signal handlers, before anything else
+          can start a thread.  See sig_events.c.
 
-     memset( &io_new, 0, sizeof( io_new ) );  /* Clear the data space. */
-     io_new.sa_handler = catch_sigio;
+     */
 
 #ifdef DEBUG
 
-     printf( "Calling sigaction(2) to set the catch for SIGIO.\n" );
+     printf( "Calling sig_events_open() to block the signals we watch.\n" );
 
 #endif
 
-     ret = sigaction( SIGIO, &io_new, NULL );
+     ret = sig_events_open();
      if ( ret != 0 )
      {
           save_errno = errno;
           printf( "\
-Something went wrong when trying to setup catch_sigio().\n" );
+Something went wrong when trying to set up the signalfd.\n" );
           if ( save_errno != 0 )
           {
                printf( "Error: %s.\n", strerror( save_errno ) );
@@ -98,30 +96,15 @@ Something went wrong when trying to setup catch_sigio().\n" );
           exit( EXIT_FAILURE );
      }
 
-     /* Set up SIGURG: */
+     /*
 
-     memset( &urg_new, 0, sizeof( urg_new ) );  /* Clear the data space. */
-     urg_new.sa_handler = catch_sigurg;
+          Questions wait for stdin with poll(2) so a signal can end
+          the wait, which only works if stdio isn't holding input
+          back in its own buffer.
 
-#ifdef DEBUG
+     */
 
-     printf( "Calling sigaction(2) to set the catch for SIGURG.\n" );
-
-#endif
-
-     ret = sigaction( SIGURG, &urg_new, NULL );
-     if ( ret != 0 )
-     {
-          save_errno = errno;
-          printf( "\
-Something went wrong when trying to setup catch_sigurg().\n" );
-          if ( save_errno != 0 )
-          {
-               printf( "Error: %s.\n", strerror( save_errno ) );
-          }
-          printf( "\n" );
-          exit( EXIT_FAILURE );
-     }
+     setvbuf( stdin, NULL, _IONBF, 0 );
 
 #ifdef DEBUG
 
@@ -131,85 +114,33 @@ Something went wrong when trying to setup catch_sigurg().\n" );
 
 #ifdef TEST_SIGNALS
 
-     /* Test the new signal handlers. */
-
-     printf( "Calling raise( SIGIO ) (1)\n" );
-     ret = raise( SIGIO );
-     save_errno = errno;
-     printf( "Returned from raise( SIGIO ) (1)\n" );
-
-     if ( ret != 0 )
-     {
-          printf( "Something went wrong when calling raise( SIGIO ).\n" );
-          if ( save_errno != 0 )
-          {
-               printf( "Error: %s.\n", strerror( save_errno ) );
-          }
-          printf( "\n" );
-     }
-
-     printf( "\nret: %d, sig_io_received: %d, sig_urg_received: %d.\n\n",
-             ret, sig_io_received, sig_urg_received );
-
-     printf( "Calling raise( SIGIO ) (2)\n" );
-     ret = raise( SIGIO );
-     save_errno = errno;
-     printf( "Returned from raise( SIGIO ) (2)\n" );
+     /* Test the signalfd.  Each signal should be counted once. */
 
-     if ( ret != 0 )
+     for( count = 0; count < 4; count++ )
      {
-          printf( "Something went wrong when calling raise( SIGIO ).\n" );
-          if ( save_errno != 0 )
-          {
-               printf( "Error: %s.\n", strerror( save_errno ) );
-          }
-          printf( "\n" );
-     }
-
-     printf( "\nret: %d, sig_io_received: %d, sig_urg_received: %d.\n\n",
-             ret, sig_io_received, sig_urg_received );
-
-     printf( "Calling raise( SIGURG ) (1)\n" );
-     ret = raise( SIGURG );
-     save_errno = errno;
-     printf( "Returned from raise( SIGURG ) (1)\n" );
+          printf( "Calling raise( %s ) (%d)\n",
+                  ( ( count < 2 ) ? "SIGIO" : "SIGURG" ), ( count % 2 ) + 1 );
+          ret = raise( ( count < 2 ) ? SIGIO : SIGURG );
+          save_errno = errno;
+          printf( "Returned from raise( %s ) (%d)\n",
+                  ( ( count < 2 ) ? "SIGIO" : "SIGURG" ), ( count % 2 ) + 1 );
 
-     if ( ret != 0 )
-     {
-          printf( "Something went wrong when calling raise( SIGURG ).\n" );
-          if ( save_errno != 0 )
+          if ( ret != 0 )
           {
-               printf( "Error: %s.\n", strerror( save_errno ) );
+               printf( "Something went wrong when calling raise().\n" );
+               if ( save_errno != 0 )
+               {
+                    printf( "Error: %s.\n", strerror( save_errno ) );
+               }
+               printf( "\n" );
           }
-          printf( "\n" );
-     }
-
-     printf( "\nret: %d, sig_io_received: %d, sig_urg_received: %d.\n\n",
-             ret, sig_io_received, sig_urg_received );
 
-     printf( "Calling raise( SIGURG ) (2)\n" );
-     ret = raise( SIGURG );
-     save_errno = errno;
-     printf( "Returned from raise( SIGURG ) (2)\n" );
-
-     if ( ret != 0 )
-     {
-          printf( "Something went wrong when calling raise( SIGURG ).\n" );
-          if ( save_errno != 0 )
-          {
-               printf( "Error: %s.\n", strerror( save_errno ) );
-          }
-          printf( "\n" );
+          ret = sig_events_read();
+          printf( "\nret: %d, SIGIO received: %" PRIu64
+                  ", SIGURG received: %" PRIu64 ".\n\n", ret,
+                  sig_events_count( SIGIO ), sig_events_count( SIGURG ) );
      }
 
-     printf( "\nret: %d, sig_io_received: %d, sig_urg_received: %d.\n\n",
-             ret, sig_io_received, sig_urg_received );
-
-     /* Reset sig_io_received and sig_urg_received. */
-
-     sig_io_received = 0;
-     sig_urg_received = 0;
-
 #endif  /* TEST_SIGNALS */
 
      exit_loop = 0;
@@ -218,8 +149,17 @@ Something went wrong when trying to setup catch_sigurg().\n" );
           /* Print the domain menu and seek input from the user. */
 
           print_domain_menu();
-          ret = read_stdin( buffer, len, ">> ", 1 );
-          if ( ret != 0 )
+          ret = read_answer( "domain", domain_names, MAX_DOMAINS + 1,
+                             buffer, len );
+          if ( ret != 0 && errno == ECANCELED )
+          {
+               /* SIGTERM arrived while we were waiting. */
+
+               printf( "\nSIGTERM received.\n" );
+               domain = MAX_DOMAINS + 1;
+               exit_loop = 1;
+          }
+          else if ( ret != 0 )
           {
                save_errno = errno;
                printf( "\n\
@@ -231,7 +171,7 @@ Something went wrong while reading your choice.\n" );
                printf( "\nProgram failed.  Exiting.\n\n" );
                exit( EXIT_FAILURE );
           }
-          if ( sscanf( buffer, "%d", &domain ) != 1 )
+          else if ( sscanf( buffer, "%d", &domain ) != 1 )
           {
                printf( "\n\
 That is not valid input.  Please try again.\n\n" );
@@ -253,6 +193,7 @@ That is not a valid choice.  Please try again.\n\n" );
 #ifdef DEBUG
 
           list_sockets( &csock_fd, &lsock_fd, &ssock_fd );
+          sig_events_print();
 
 #else
 
@@ -264,6 +205,23 @@ That is not a valid choice.  Please try again.\n\n" );
           exit( EXIT_SUCCESS );
      }
 
+#ifdef SERVE_METRICS
+
+     /* Serve the counters while we run.  We can manage without them. */
+
+     errno = 0;
+     if ( metrics_init() != 0 || metrics_serve( METRICS_SOCK_NAME ) != 0 )
+     {
+          save_errno = errno;
+          printf( "\nWarning: The metrics endpoint couldn't be started.\n" );
+          if ( save_errno != 0 )
+          {
+               printf( "Error: %s.\n", strerror( save_errno ) );
+          }
+     }
+
+#endif
+
      /* Open the sockets and get them connected, if applicable. */
 
      printf( "\n" );
@@ -291,6 +249,124 @@ Something went wrong while trying to open the sockets.\n" );
           exit( EXIT_FAILURE );
      }
 
+#ifdef SHOW_SOCKET_OPTIONS
+
+     /* Show how the sockets ended up tuned. */
+
+     if ( type != SOCK_SHM_RING )
+     {
+          printf( "Tuning profile: %s.\n\n",
+                  tuning_name( tuning_current() ) );
+          show_socket_options( lsock_fd, domain_families[ domain - 1 ], type,
+                               "listening socket" );
+          show_socket_options( ssock_fd, domain_families[ domain - 1 ], type,
+                               "server socket" );
+          show_socket_options( csock_fd, domain_families[ domain - 1 ], type,
+                               "client socket" );
+     }
+
+#endif
+
+     /* Make sure the connection actually works. */
+
+     if ( csock_fd != ( -1 ) && ssock_fd != ( -1 ) && type != SOCK_DGRAM )
+     {
+          errno = 0;
+          if ( type == SOCK_SHM_RING )
+          {
+               ret = shm_test_connection( csock_fd, ssock_fd );
+          }
+          else
+          {
+               ret = test_connection( csock_fd, ssock_fd );
+          }
+          if ( ret != 0 )
+          {
+               save_errno = errno;
+               printf( "\n\
+The connection failed the echo test.\n" );
+               if ( save_errno != 0 )
+               {
+                    printf( "Error: %s.\n", strerror( save_errno ) );
+               }
+
+#ifdef DEBUG
+
+               list_sockets( &csock_fd, &lsock_fd, &ssock_fd );
+
+#endif
+
+               printf( "Program failed.  Exiting.\n\n" );
+               exit( EXIT_FAILURE );
+          }
+     }
+
+     /* Offer to measure the connection. */
+
+     if ( csock_fd != ( -1 ) && ssock_fd != ( -1 ) )
+     {
+          errno = 0;
+          ret = run_pair_benchmark( csock_fd, ssock_fd, type );
+          if ( ret != 0 )
+          {
+               save_errno = errno;
+               printf( "\n\
+Something went wrong while running the benchmark.\n" );
+               if ( save_errno != 0 )
+               {
+                    printf( "Error: %s.\n", strerror( save_errno ) );
+               }
+
+#ifdef DEBUG
+
+               list_sockets( &csock_fd, &lsock_fd, &ssock_fd );
+
+#endif
+
+               printf( "Program failed.  Exiting.\n\n" );
+               exit( EXIT_FAILURE );
+          }
+     }
+
+     /*
+
+          Get a few spare connections ready so a broken
+          one can be replaced without starting over.  A shared
+          memory ring has no connection to keep spares of.
+
+     */
+
+     if ( csock_fd != ( -1 ) && ssock_fd != ( -1 ) && type != SOCK_DGRAM &&
+          type != SOCK_SHM_RING )
+     {
+          errno = 0;
+          ret = spare_init( &spares, SPARE_COUNT, csock_fd, lsock_fd,
+                            ssock_fd );
+          if ( ret == 0 )
+          {
+               use_spares = 1;
+
+#ifdef DEBUG
+
+               printf( "%d spare connections are ready.\n", spares.ready );
+
+#endif
+
+          }
+          else
+          {
+               save_errno = errno;
+               printf( "\n\
+Could not get any spare connections ready.  Reconnecting will start\n\
+from scratch.\n" );
+               if ( save_errno != 0 )
+               {
+                    printf( "Error: %s.\n", strerror( save_errno ) );
+               }
+               printf( "\n" );
+          }
+     }
+
      if ( csock_fd != ( -1 ) || type != SOCK_DGRAM )
      {
           /* Test the reconnection process. */
@@ -305,6 +381,7 @@ Something went wrong while trying to open the sockets.\n" );
 
           if ( csock_fd != ( -1 ) )
           {
+               conn_remove_fd( conn_table_main(), csock_fd );
                ret = close( csock_fd );
                if ( ret != 0 )
                {
@@ -340,6 +417,7 @@ Something went wrong while trying to open the sockets.\n" );
 
           if ( ssock_fd != ( -1 ) && type != SOCK_DGRAM )
           {
+               conn_remove_fd( conn_table_main(), ssock_fd );
                ret = close( ssock_fd );
                if ( ret != 0 )
                {
@@ -381,9 +459,56 @@ Something went wrong while trying to open the sockets.\n" );
 
 #endif
 
-          errno = 0;
-          ret = setup_sockets( &csock_fd, &lsock_fd, &ssock_fd, domain,
-                               &type, &address, 0 );
+          /* Swap in a spare if there is one, otherwise start over. */
+
+          reconnect_ns = get_time_ns();
+          ret = ( -1 );
+          swapped = 0;
+          if ( use_spares == 1 )
+          {
+               errno = 0;
+               ret = spare_failover( &spares, &csock_fd, &ssock_fd );
+               if ( ret == 0 )
+               {
+                    swapped = 1;
+                    conn_insert( conn_table_main(), csock_fd,
+                                 CONN_ROLE_CLIENT,
+                                 domain_families[ domain - 1 ], type, NULL );
+                    conn_insert( conn_table_main(), ssock_fd,
+                                 CONN_ROLE_SERVER,
+                                 domain_families[ domain - 1 ], type, NULL );
+               }
+
+#ifdef DEBUG
+
+               if ( ret == 0 )
+               {
+                    printf( "A spare connection has been swapped in.\n" );
+               }
+
+#endif
+
+          }
+          if ( ret != 0 )
+          {
+               errno = 0;
+               ret = setup_sockets( &csock_fd, &lsock_fd, &ssock_fd, domain,
+                                    &type, &address, 0 );
+          }
+          reconnect_ns = get_time_ns() - reconnect_ns;
+          if ( ret == 0 )
+          {
+               metrics_track_family( csock_fd, "client",
+                                     domain_families[ domain - 1 ] );
+               metrics_track_family( ssock_fd, "server",
+                                     domain_families[ domain - 1 ] );
+               metrics_count( csock_fd, METRIC_RECONNECTS, 1 );
+               metrics_count( csock_fd, METRIC_SETUPS, 1 );
+               metrics_count( csock_fd, METRIC_SETUP_NS, reconnect_ns );
+               metrics_count( ssock_fd, METRIC_RECONNECTS, 1 );
+               metrics_count( ssock_fd, METRIC_SETUPS, 1 );
+               metrics_count( ssock_fd, METRIC_SETUP_NS, reconnect_ns );
+          }
 
           if ( ret == ( -1 ) )
           {
@@ -406,8 +531,86 @@ Something went wrong while trying to open the sockets.\n" );
 
           }    /* if ( ret == ( -1 ) ) */
 
+          /* There is nothing to time if nothing was reconnected. */
+
+          if ( swapped == 1 )
+          {
+               printf( "Swapping in a spare took %.1f microseconds.\n",
+                       ( double )reconnect_ns / 1000.0 );
+          }
+          else if ( csock_fd != ( -1 ) )
+          {
+               printf( "Reconnecting from scratch took %.1f microseconds.\n",
+                       ( double )reconnect_ns / 1000.0 );
+          }
+
+#ifdef DEBUG
+
+          list_sockets( &csock_fd, &lsock_fd, &ssock_fd );
+
+#endif
+
+          /* Make sure the connection actually works. */
+
+          if ( csock_fd != ( -1 ) && ssock_fd != ( -1 ) && type != SOCK_DGRAM )
+          {
+               errno = 0;
+               if ( type == SOCK_SHM_RING )
+               {
+                    ret = shm_test_connection( csock_fd, ssock_fd );
+               }
+               else
+               {
+                    ret = test_connection( csock_fd, ssock_fd );
+               }
+               if ( ret != 0 )
+               {
+                    save_errno = errno;
+                    printf( "\n\
+The connection failed the echo test.\n" );
+                    if ( save_errno != 0 )
+                    {
+                         printf( "Error: %s.\n", strerror( save_errno ) );
+                    }
+
+#ifdef DEBUG
+
+                    list_sockets( &csock_fd, &lsock_fd, &ssock_fd );
+
+#endif
+
+                    printf( "Program failed.  Exiting.\n\n" );
+                    exit( EXIT_FAILURE );
+               }
+          }
+
+          /* The new connection works, so replace the spare it used. */
+
+          if ( swapped == 1 )
+          {
+               ret = spare_refill( &spares );
+
+#ifdef DEBUG
+
+               if ( ret >= 0 )
+               {
+                    printf( "%d spare connection%s ready.\n", ret,
+                            ( ( ret == 1 ) ? " is" : "s are" ) );
+               }
+
+#endif
+
+          }
+
      }    /* if ( csock_fd != ( -1 ) || type != SOCK_DGRAM ) */
 
+     /* Close the spares that weren't needed. */
+
+     if ( use_spares == 1 )
+     {
+          spare_free( &spares );
+     }
+
 
 
 
@@ -446,11 +649,18 @@ Something went wrong while trying to close the sockets.\n" );
           exit( EXIT_FAILURE );
      }
 
+#ifdef SERVE_METRICS
+
+     metrics_stop();
+
+#endif
+
      /* And we're done. */
 
 #ifdef DEBUG
 
      list_sockets( &csock_fd, &lsock_fd, &ssock_fd );
+     sig_events_print();
 
 #else
 
@@ -462,27 +672,4 @@ Something went wrong while trying to close the sockets.\n" );
      exit( EXIT_SUCCESS );
 }
 
-/* This is our signal hangling function for SIGALRM. */
-
-void catch_sigalrm( int sig_num )
-{
-     return;
-}
-
-/* This is our signal hangling function for SIGIO. */
-
-void catch_sigio( int sig_num )
-{
-     sig_io_received++;
-     return;
-}
-
-/* This is our signal handling function for SIGURG. */
-
-void catch_sigurg( int sig_num )
-{
-     sig_urg_received++;
-     return;
-}
-
 /* EOF sockets.c */
@@ -20,22 +20,46 @@
 
 #define _POSIX_C_SOURCE 200112L
 
+/* accept4(2), epoll(7) and the other Linux extensions need this. */
+
+#define _GNU_SOURCE
+
 /* Gather the necessary header files. */
 
+#include <time.h>
+#include <sched.h>
 #include <errno.h>
 #include <fcntl.h>
 #include <netdb.h>
+#include <poll.h>
 #include <stdio.h>
 #include <signal.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stddef.h>
 #include <stdint.h>
+#include <stdatomic.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <inttypes.h>
 #include <sys/stat.h>
 #include <sys/wait.h>
 #include <arpa/inet.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
 #include <sys/types.h>
+#include <sys/un.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
 #include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/resource.h>
+#include <sys/sendfile.h>
+#include <sys/signalfd.h>
+#include <linux/errqueue.h>
+#include <linux/futex.h>
+#include <linux/sockios.h>
 
 /* Make sure these are defined: */
 
@@ -67,7 +91,7 @@
 
 #define DEBUG
 
-/* Define TEST_SIGNALS to test the new signal handlers. */
+/* Define TEST_SIGNALS to test the signalfd.  See sig_events.c. */
 
 #undef TEST_SIGNALS
 
@@ -104,6 +128,27 @@
 #undef USE_DONTROUTE_AF_INET
 #undef USE_DONTROUTE_AF_INET6
 
+/*
+
+     Define USE_DUAL_STACK_AF_INET6 to turn IPV6_V6ONLY off on AF_INET6
+     servers.  A server bound to :: then accepts IPv4 peers as well,
+     as IPv4-mapped addresses, so one listener serves both families.
+
+*/
+
+#define USE_DUAL_STACK_AF_INET6
+
+/*
+
+     Define USE_ABSTRACT_AF_UNIX to give AF_UNIX servers a name in
+     Linux's abstract namespace instead of a socket file in USE_DIR.
+     Nothing is created on disk, so there is no file to stat(2) and
+     unlink(2) at shutdown and no stale one to block the next run.
+
+*/
+
+#define USE_ABSTRACT_AF_UNIX
+
 /* Define SHOW_CONNECTIONS to show connected socket address information. */
 
 #define SHOW_CONNECTIONS
@@ -118,21 +163,50 @@
 
 #define SHOW_SOCKET_OPTIONS
 
-/* Define WAIT_FOR_CHILD if you want to wait for the child process. */
+/*
+
+     Define SAMPLE_TCP_INFO to watch a TCP connection's TCP_INFO with
+     the sampler in tcp_sampler.c while a pair benchmark runs, and
+     show what it saw afterwards.  The multi-connection servers watch
+     their TCP peers the same way and count the ones that degraded.
+
+*/
 
-#define WAIT_FOR_CHILD
+#define SAMPLE_TCP_INFO
+
+/*
+
+     Define SERVE_METRICS to count what each connection does and serve
+     the counts in Prometheus's text format on an AF_UNIX socket named
+     METRICS_SOCK_NAME.  See metrics.c.
+
+*/
 
-/* Define SHOW_WAIT_ERRORS if you want to see errors from waitpid(2). */
+#define SERVE_METRICS
 
-#ifdef WAIT_FOR_CHILD
-#define SHOW_WAIT_ERRORS
-#else
-#undef SHOW_WAIT_ERRORS
+/*
+
+     Define USE_IO_URING to include the io_uring(7) engine for the
+     multi-connection server.  It needs Linux 6.0 or later for
+     multishot recv(2), and it falls back to epoll(7) at run time
+     if the kernel doesn't support it.
+
+*/
+
+#define USE_IO_URING
+
+#ifdef USE_IO_URING
+#include <linux/io_uring.h>
 #endif
 
-/* Defines the number of socket domains. */
+/*
+
+     Defines the number of socket domains.  The last one is the shared
+     memory ring, which isn't a socket domain at all.
 
-#define MAX_DOMAINS 4
+*/
+
+#define MAX_DOMAINS 5
 
 /* Defines the socket file name to use for AF_UNIX sockets. */
 
@@ -151,6 +225,113 @@
 
 #define LISTEN_BACKLOG 10
 
+/*
+
+     Defines how long connect_pair() will wait, in milliseconds,
+     for a client and server on the same device to get connected.
+
+*/
+
+#define CONNECT_TIMEOUT_MS 5000
+
+/*
+
+     These control the multi-connection server mode.  EPOLL_PEERS is
+     the number of concurrent peers the load generator will open,
+     EPOLL_BACKLOG replaces LISTEN_BACKLOG for the listening socket
+     so a connection storm doesn't overflow the accept queue, and
+     EPOLL_MESSAGE_SIZE is the size of the request each peer sends
+     and expects to have echoed back.
+
+*/
+
+#define EPOLL_PEERS 10000
+#define EPOLL_BACKLOG 4096
+#define EPOLL_MAX_EVENTS 256
+#define EPOLL_MESSAGE_SIZE 64
+#define EPOLL_CONN_BUFFER 512
+
+/*
+
+     The load generator gives up if no connection makes
+     any progress for this many seconds.
+
+*/
+
+#define EPOLL_STALL_TIMEOUT 10
+
+/*
+
+     The multi-connection server can spread its connections across
+     up to SHARD_MAX SO_REUSEPORT listeners, each with its own worker
+     process.  See shards.c.
+
+*/
+
+#define SHARD_MAX 256
+
+struct shard_set
+{
+     int count;           /* Workers running.                       */
+     int *lsock_fds;      /* Each worker's listener.  The first one
+                             belongs to the caller.                 */
+     int *result_fds;     /* Where each worker reports its stats.   */
+     pid_t *pids;
+};
+
+/*
+
+     The multi-connection server can also run as one acceptor process
+     handing each connection to the least busy of up to PREFORK_MAX
+     long-lived worker processes over AF_UNIX with SCM_RIGHTS.  A
+     worker that dies is replaced.  See prefork.c.
+
+*/
+
+#define PREFORK_MAX 64
+
+struct prefork_pool
+{
+     int count;                          /* Workers in the pool.      */
+     int lsock_fd;                       /* The acceptor's listener.  */
+     int ctl_fd;                         /* Stops the workers.        */
+     int chan_fds[ PREFORK_MAX ];        /* Acceptor end of each      */
+                                         /* worker's channel.         */
+     int result_fds[ PREFORK_MAX ];      /* Where each one reports.   */
+     pid_t pids[ PREFORK_MAX ];
+     uint64_t load[ PREFORK_MAX ];       /* Handed over, not closed.  */
+     uint64_t handed[ PREFORK_MAX ];     /* Handed over in all.       */
+     uint64_t respawned;                 /* Workers replaced.         */
+     int next;                           /* Where the search starts.  */
+};
+
+/* The event engines the multi-connection server can use. */
+
+#define ENGINE_EPOLL 1
+#define ENGINE_IO_URING 2
+#define ENGINE_PREFORK 3
+#define ENGINE_THREADS 4
+
+/*
+
+     These size the io_uring engine.  URING_ENTRIES is the number of
+     submission queue entries, and the server hands the kernel a ring
+     of URING_BUF_COUNT buffers, each URING_BUF_SIZE bytes, to receive
+     into.  URING_BUF_COUNT must be a power of 2.  The buffers come
+     from the I/O buffer pool, so there must be at least that many
+     in it and URING_BUF_SIZE can't be more than IO_POOL_BUF_SIZE.
+     Once a connection holds URING_CONN_HOLD of them waiting to be
+     echoed, whatever else it receives is copied into its arena and
+     the buffer goes straight back to the kernel, so one slow peer
+     can't take them all.
+
+*/
+
+#define URING_ENTRIES 4096
+#define URING_BUF_COUNT 4096
+#define URING_BUF_SIZE 2048
+#define URING_CONN_HOLD 8
+
 /*
 
      At the time this program was written, the sockaddr_in6 was
@@ -163,15 +344,994 @@
 
 #define ADDR_SIZE sizeof( struct sockaddr_in6 )
 
+/* Enough room for format_address() to show any of those addresses. */
+
+#define ADDR_STR_SIZE ( INET6_ADDRSTRLEN + 24 )
+
+/*
+
+     These limit how nonblocking connections use memory.  NB_READ_CHUNK
+     is how much run_io_loop() reads at a time, NB_READ_BUDGET is how
+     much it will read from one connection before moving on to the
+     next one, and NB_MAX_QUEUE is how much unsent data a connection
+     may have queued before nb_queue_send() refuses to take more.
+
+*/
+
+#define NB_READ_CHUNK 65536
+#define NB_READ_BUDGET 262144
+#define NB_MAX_QUEUE ( 16 * 1024 * 1024 )
+
+/*
+
+     Bump arenas for memory that lives exactly as long as a
+     connection.  Arenas take chunks that each hold ARENA_CHUNK_SIZE
+     bytes from a free list shared by the whole process, which keeps
+     up to ARENA_FREE_MAX of them for reuse.  Anything bigger gets a
+     block of its own.  Every allocation is aligned to
+     ARENA_ALIGN bytes.  See arena.c.
+
+*/
+
+#define ARENA_CHUNK_SIZE ( 128 * 1024 )
+#define ARENA_FREE_MAX 256
+#define ARENA_ALIGN 16
+
+struct arena_chunk;
+
+struct arena
+{
+     struct arena_chunk *chunks; /* Chunks held, newest first.         */
+     struct arena_chunk *blocks; /* Oversized blocks held.             */
+     char *next;                 /* Where the next allocation goes.    */
+     char *end;                  /* The end of the newest chunk.       */
+     void *last;                 /* The last allocation, which can
+                                    grow in place.                     */
+     size_t bytes;               /* Bytes handed out.                  */
+};
+
+/* Counts for the whole process, from arena_get_stats(). */
+
+struct arena_stats
+{
+     uint64_t bytes_in_use;      /* Held in chunks and blocks.         */
+     uint64_t bytes_high;        /* The most ever held at once.        */
+     uint64_t chunks_in_use;     /* Held by arenas.                    */
+     uint64_t chunks_high;
+     uint64_t chunks_free;       /* On the free list.                  */
+     uint64_t chunks_allocated;  /* Taken from malloc(3).              */
+     uint64_t chunks_reused;     /* Taken from the free list.          */
+     uint64_t blocks;            /* Oversized blocks allocated.        */
+     uint64_t resets;            /* Arenas reset.                      */
+};
+
+/*
+
+     The pool of fixed-size I/O buffers.  IO_POOL_BUFS buffers of
+     IO_POOL_BUF_SIZE bytes are carved out of one region backed by
+     huge pages of IO_POOL_HUGE_PAGE bytes when the system has them.
+     Each thread keeps up to IO_POOL_CACHE free buffers of its own and
+     trades IO_POOL_BATCH at a time with the shared free list.
+     io_pool_get_stats() says how the region ended up being backed.
+     See io_pool.c.
+
+*/
+
+#define IO_POOL_BUFS 8192
+#define IO_POOL_BUF_SIZE 4096
+#define IO_POOL_CACHE 64
+#define IO_POOL_BATCH 32
+#define IO_POOL_HUGE_PAGE ( 2 * 1024 * 1024 )
+
+#define IO_POOL_PAGES   0  /* Ordinary pages.                         */
+#define IO_POOL_THP     1  /* Transparent huge pages, if the kernel
+                              gives them to us.                       */
+#define IO_POOL_HUGETLB 2  /* Reserved huge pages.                    */
+
+/*
+
+     One buffer in the pool.  refs counts everyone who holds it, and
+     the buffer goes back to the pool when the last of them lets go.
+     len and user are for whoever holds it.
+
+*/
+
+struct io_buf
+{
+     _Alignas( 64 ) _Atomic int refs;
+     int index;                  /* Its place in the pool.             */
+     _Atomic int next;           /* The next free buffer, while free.  */
+     uint32_t len;               /* Bytes of data in use.              */
+     char *data;
+     void *user;
+};
+
+struct io_pool_stats
+{
+     int count;                  /* Buffers in the pool.               */
+     int backing;                /* IO_POOL_PAGES, _THP or _HUGETLB.   */
+     size_t size;                /* Bytes in each buffer.              */
+     size_t bytes;               /* Bytes mapped for the region.       */
+     uint64_t shared_free;       /* On the shared free list.           */
+     uint64_t cached;            /* In this thread's cache.            */
+     uint64_t refills;           /* Batches taken by thread caches.    */
+     uint64_t spills;            /* Batches given back by them.        */
+     uint64_t exhausted;         /* Times io_buf_get() found none.     */
+};
+
+/*
+
+     A nonblocking connection and its queue of unsent data.  on_read
+     is called with the data that arrives, or with a length of 0 when
+     the connection is closed.  If it returns nonzero the connection
+     is treated as closed.  The queue comes out of arena, and so can
+     anything else that should go away with the connection, such as
+     whatever user points to.  nb_conn_free() resets it.
+
+*/
+
+struct nb_conn;
+
+typedef int ( *nb_read_func )( struct nb_conn *conn, const char *data,
+                               size_t len );
+
+struct nb_conn
+{
+     int fd;
+     int closed;
+     char *out;             /* Data waiting to be sent.          */
+     size_t out_len;        /* Bytes in out.                     */
+     size_t out_pos;        /* Bytes of out sent so far.         */
+     size_t out_size;       /* Space allocated for out.          */
+     uint64_t bytes_in;     /* Bytes received.                   */
+     uint64_t bytes_out;    /* Bytes sent.                       */
+     nb_read_func on_read;  /* Called when data arrives.         */
+     void *user;            /* Whatever on_read needs to keep.   */
+     struct arena arena;    /* Freed all at once on close.       */
+};
+
+/*
+
+     These limit the benchmarks that run over a connected pair.
+     BENCH_MAX_DGRAM is the largest payload a UDP datagram can carry.
+     A run gives up if nothing happens for BENCH_STALL_MS
+     milliseconds, and a datagram run that has stopped receiving for
+     BENCH_IDLE_MS milliseconds after the sender is done counts
+     whatever is missing as lost.
+
+*/
+
+#define BENCH_MAX_MESSAGE ( 1024 * 1024 )
+#define BENCH_MAX_DGRAM 65507
+#define BENCH_STALL_MS 5000
+#define BENCH_IDLE_MS 200
+
+/*
+
+     These control the latency benchmark.  The first LATENCY_WARMUP
+     round trips aren't counted.  Samples are recorded in a histogram
+     that is accurate to 1 part in 2^( LATENCY_SUB_BITS - 1 ) and goes
+     up to 2^LATENCY_MAX_BITS nanoseconds.  calibrate_clock() uses
+     CLOCK_CALIBRATION_SAMPLES pairs of clock reads.
+
+*/
+
+#define LATENCY_WARMUP 1000
+#define LATENCY_SUB_BITS 8
+#define LATENCY_MAX_BITS 40
+#define CLOCK_CALIBRATION_SAMPLES 1001
+
+/*
+
+     These control the bulk send methods run_bulk_send() compares.
+     Each call hands the kernel up to BULK_CHUNK bytes.  sendfile(2)
+     and splice(2) read from a file of BULK_FILE_SIZE bytes, and
+     splice(2) goes through a pipe of BULK_PIPE_SIZE bytes.  A
+     zero-copy sender owns ZC_BUFFERS buffers and can have up to
+     ZC_SEQ_RING sends waiting for their completions, which must be a
+     power of 2.
+
+*/
+
+#define BULK_WRITE 1
+#define BULK_ZEROCOPY 2
+#define BULK_SENDFILE 3
+#define BULK_SPLICE 4
+#define BULK_CHUNK 262144
+#define BULK_FILE_SIZE ( 64 * 1024 * 1024 )
+#define BULK_PIPE_SIZE 1048576
+#define ZC_BUFFERS 16
+#define ZC_SEQ_RING 1024
+
+/*
+
+     A batch of datagrams for sendmmsg(2) and recvmmsg(2), allocated
+     once by dgram_batch_init().  No batch may hold more than
+     DGRAM_BATCH_MAX datagrams.  See dgram_batch.c.
+
+*/
+
+#define DGRAM_BATCH_MAX 256
+
+struct dgram_batch
+{
+     int count;                       /* Datagrams it can hold.   */
+     size_t size;                     /* Largest datagram.        */
+     char *data;                      /* count * size bytes.      */
+     struct iovec *iovs;
+     struct mmsghdr *msgs;
+     struct sockaddr_storage *addrs;  /* Who sent each datagram.  */
+};
+
+/*
+
+     The urgent control codes oob_send() and oob_recv() carry, and
+     the cancel benchmark run_cancel() runs.  oob_send() tries again
+     every OOB_RETRY_US microseconds while there is no room for the
+     code.  The benchmark's sender keeps CANCEL_QUEUE bytes queued for
+     CANCEL_FILL_MS before each cancel, and its receiver reads
+     CANCEL_CHUNK bytes at a time at no more than CANCEL_DRAIN_RATE
+     bytes per second, so there is always a queue for the cancel to
+     get past.  See oob_control.c and run_cancel.c.
+
+*/
+
+#define OOB_CANCEL 'C'
+#define OOB_FLUSH 'F'
+#define OOB_ABORT 'A'
+#define OOB_RETRY_US 20
+#define CANCEL_FILL_MS 20
+#define CANCEL_QUEUE ( 4 * 1024 * 1024 )
+#define CANCEL_CHUNK 65536
+#define CANCEL_DRAIN_RATE ( 256 * 1024 * 1024 )
+
+/* Results from run_cancel().  All times are in nanoseconds. */
+
+struct cancel_stats
+{
+     uint64_t rounds;      /* Cancels measured.                       */
+     uint64_t queued;      /* Mean bytes queued ahead of a cancel.    */
+     uint64_t p50_ns;      /* From sending a cancel to acting on it.  */
+     uint64_t p99_ns;
+     uint64_t max_ns;
+     uint64_t signal_ns;   /* p50 from sending to SIGURG, if urgent.  */
+     uint64_t discarded;   /* Mean bytes thrown away unread.          */
+};
+
+/* Results from run_throughput(). */
+
+struct throughput_stats
+{
+     int error;              /* errno from the sender, or 0.      */
+     uint64_t msgs_sent;     /* Whole messages sent.              */
+     uint64_t msgs_received; /* Messages that arrived.            */
+     uint64_t bytes_sent;
+     uint64_t bytes_received;
+     uint64_t elapsed_ns;    /* First send to last byte received. */
+     uint64_t send_cpu_ns;   /* CPU time used by the sender.      */
+     uint64_t recv_cpu_ns;   /* CPU time used by the receiver.    */
+     uint64_t parks;         /* Shared memory ring sleeps.        */
+     uint64_t wakeups;       /* futex(2) calls made to end them.  */
+};
+
+/* Results from run_bulk_send(). */
+
+struct bulk_stats
+{
+     int error;               /* errno from the receiver, or 0.    */
+     uint64_t bytes_sent;
+     uint64_t bytes_received;
+     uint64_t elapsed_ns;     /* First send to last byte received. */
+     uint64_t send_cpu_ns;    /* CPU time used by the sender.      */
+     uint64_t recv_cpu_ns;    /* CPU time used by the receiver.    */
+     uint64_t send_calls;     /* System calls made to send.        */
+     uint64_t zc_completions; /* Zero-copy sends completed.        */
+     uint64_t zc_copied;      /* Of those, how many were copied.   */
+};
+
+/*
+
+     A buffer belonging to a zero-copy sender.  Its data is in pieces
+     from the I/O buffer pool, which iov lists in order.  owned is set
+     while the caller holds it, and pending counts the sends made from
+     it that the kernel hasn't finished with.  See zerocopy.c.
+
+*/
+
+struct zc_buf
+{
+     struct iovec *iov;
+     int pieces;
+     size_t size;
+     int index;
+     int owned;
+     int pending;
+};
+
+struct zc_sender
+{
+     int fd;
+     int count;              /* Buffers in the pool.               */
+     size_t size;            /* Bytes in each buffer.              */
+     int pieces;             /* Pool buffers in each of them.      */
+     struct io_buf **held;   /* Every pool buffer they are made of. */
+     struct iovec *iov;      /* Every piece, in order.             */
+     struct iovec *window;   /* The pieces one sendmsg(2) sends.   */
+     struct zc_buf *bufs;
+     int *ring;              /* Which buffer each sequence number
+                                was sent from.                     */
+     uint32_t next_seq;      /* The kernel's next sequence number. */
+     uint32_t in_flight;     /* Sends not completed yet.           */
+     uint64_t calls;         /* send(2) calls made.                */
+     uint64_t completions;
+     uint64_t copied;        /* Completions the kernel copied.     */
+};
+
+/* A log-linear latency histogram.  See hdr_histogram.c. */
+
+struct hdr_hist
+{
+     int sub_bits;
+     int max_bits;
+     int full;          /* 2^sub_bits                    */
+     int half;          /* 2^( sub_bits - 1 )            */
+     int buckets;       /* How many counts there are.    */
+     uint64_t *counts;
+     uint64_t total;    /* Samples recorded.             */
+     uint64_t sum;      /* For the mean.                 */
+     uint64_t min;
+     uint64_t max;
+};
+
+/* Results from run_latency().  All times are in nanoseconds. */
+
+struct latency_stats
+{
+     uint64_t samples;      /* Round trips measured.               */
+     uint64_t overhead_ns;  /* Clock overhead taken off each one.  */
+     uint64_t min_ns;
+     uint64_t mean_ns;
+     uint64_t p50_ns;
+     uint64_t p99_ns;
+     uint64_t p999_ns;
+     uint64_t max_ns;
+     uint64_t parks;        /* Shared memory ring sleeps.          */
+     uint64_t wakeups;      /* futex(2) calls made to end them.    */
+};
+
+/*
+
+     The shared memory ring domain.  A channel is a memfd(2) holding
+     two rings of SHM_RING_SLOTS slots each, one carrying messages
+     from the client to the server and one carrying them back.  A
+     message takes as many slots as it needs, SHM_SLOT_DATA bytes of
+     it in each, so none can be longer than SHM_MAX_MESSAGE.  Any
+     number of processes may send on a ring, but only one may receive
+     from it.  Someone waiting on a ring checks it SHM_SPIN times
+     before going to sleep on a futex, unless there is only one CPU
+     for the other side to run on, and futex(2) is only called to
+     wake them up if they did.
+
+     The channel's descriptors stand in for the client and server
+     sockets, and SOCK_SHM_RING, which is no real socket type, says
+     so.  AF_SHM_RING, which is no real address family either, marks
+     them in the connection table and the metrics.  SHM_CLIENT and
+     SHM_SERVER pick which end shm_attach() maps.  SHM_RING_SLOTS
+     must be a power of 2.  See shm_ring.c.
+
+*/
+
+#define SOCK_SHM_RING 0x100
+#define AF_SHM_RING ( AF_MAX + 1 )
+#define SHM_RING_SLOTS 1024
+#define SHM_SLOT_SIZE 2048
+#define SHM_SLOT_DATA ( SHM_SLOT_SIZE - 16 )
+#define SHM_MAX_MESSAGE ( SHM_RING_SLOTS * SHM_SLOT_DATA )
+#define SHM_SPIN 10000
+#define SHM_CLIENT 0
+#define SHM_SERVER 1
+
+struct shm_slot
+{
+     _Alignas( 64 ) _Atomic uint64_t seq;  /* Where this lap started,  */
+                                           /* plus 1 once it's full.   */
+     uint32_t len;                         /* Message length and slots */
+     uint32_t count;                       /* used, in the first slot. */
+     char data[ SHM_SLOT_DATA ];
+};
+
+struct shm_ring
+{
+     _Alignas( 64 ) _Atomic uint64_t tail;  /* Next slot to claim.      */
+     _Alignas( 64 ) _Atomic uint64_t head;  /* Next slot to read.       */
+     _Alignas( 64 ) _Atomic uint32_t data_futex;   /* Wakes the reader. */
+     _Atomic uint32_t reader_parked;
+     _Alignas( 64 ) _Atomic uint32_t room_futex;   /* Wakes senders.    */
+     _Atomic uint32_t senders_parked;
+     _Atomic uint64_t parks;                /* Times anyone slept.      */
+     _Atomic uint64_t wakeups;              /* futex(2) wakes made.     */
+     struct shm_slot slots[ SHM_RING_SLOTS ];
+};
+
+struct shm_channel
+{
+     uint32_t magic;
+     struct shm_ring rings[ 2 ];  /* Client to server, then back. */
+};
+
+/* One end of a channel, mapped into this process. */
+
+struct shm_end
+{
+     struct shm_channel *chan;
+     struct shm_ring *tx;         /* The ring this end sends on.    */
+     struct shm_ring *rx;         /* The ring this end reads from.  */
+     int spin;                    /* SHM_SPIN, or 0 on one CPU.     */
+};
+
+/* Statistics gathered by the multi-connection server. */
+
+struct server_stats
+{
+     uint64_t accepted;    /* Connections accepted.                */
+     uint64_t closed;      /* Connections closed by the peer.      */
+     uint64_t max_open;    /* Most connections open at one time.   */
+     uint64_t bytes_in;    /* Bytes read from all connections.     */
+     uint64_t bytes_out;   /* Bytes echoed back to all connections. */
+     uint64_t errors;      /* Connections dropped due to an error. */
+     uint64_t syscalls;    /* System calls made by the event loop. */
+     uint64_t elapsed_ns;  /* Time spent in the event loop.        */
+     uint64_t tcp_watched; /* Peers given to the TCP_INFO sampler. */
+     uint64_t tcp_flagged; /* Those that raised a TCPINFO_ flag.   */
+};
+
+/* Statistics gathered by the load generator. */
+
+struct client_stats
+{
+     uint64_t attempted;   /* Connections attempted.                   */
+     uint64_t completed;   /* Connections that received their echo.    */
+     uint64_t failed;      /* Connections that failed along the way.   */
+     uint64_t max_open;    /* Most connections open at one time.       */
+     uint64_t elapsed_ns;  /* Time from the first connect to the last. */
+     uint64_t p50_ns;      /* Median connect plus round trip latency.  */
+     uint64_t p99_ns;      /* 99th percentile latency.                 */
+     uint64_t max_ns;      /* Worst latency seen.                      */
+     uint64_t ipv4;        /* Peers that connected over IPv4.          */
+};
+
+/*
+
+     Connecting to a host name over whichever of IPv4 and IPv6 answers
+     first.  HE_ATTEMPT_DELAY_MS is how long one connect gets before
+     the next address is tried alongside it, the 250 milliseconds RFC
+     8305 recommends.  See happy_eyeballs.c.
+
+*/
+
+#define HE_MAX_ADDRS 16
+#define HE_ATTEMPT_DELAY_MS 250
+
+struct he_result
+{
+     int family;                    /* The family of the winner.       */
+     int winner;                    /* Its place in the address list.  */
+     int attempts;                  /* Connects that were started.     */
+     int failures;                  /* Attempts that failed.           */
+     uint64_t elapsed_ns;           /* From the first connect to the   */
+                                    /* winner finishing.               */
+     struct sockaddr_storage addr;  /* The winner's address.           */
+     socklen_t addr_len;
+};
+
+/*
+
+     Limits for the configuration that lets the program run without
+     asking any questions.  See config.c.
+
+*/
+
+#define CONFIG_MAX 64
+#define CONFIG_KEY_SIZE 32
+#define CONFIG_VALUE_SIZE 256
+
+/*
+
+     How many signals are delivered through the signalfd instead of
+     signal handlers.  See sig_events.c.
+
+*/
+
+#define SIG_EVENTS 5
+
+/*
+
+     A pool of spare connections kept ready to replace a broken one.
+     SPARE_COUNT is how many the program keeps.  See spare_pool.c.
+
+*/
+
+#define SPARE_MAX 16
+#define SPARE_COUNT 4
+#define SPARE_OPTIONS 3
+
+struct spare_pool
+{
+     int domain;
+     int sock_type;
+     int count;                  /* Spares to keep ready.              */
+     int ready;                  /* Spares ready now.                  */
+     int lsock_fd;               /* Our listener, or -1.               */
+     int csock_fds[ SPARE_MAX ];
+     int ssock_fds[ SPARE_MAX ]; /* Accepted ends, or -1 when the
+                                    spare isn't connected yet.         */
+     int client_flags;           /* File status flags to copy.         */
+     int server_flags;
+     int client_options[ SPARE_OPTIONS ];
+     int server_options[ SPARE_OPTIONS ];
+     struct sockaddr_storage target;
+     socklen_t target_len;
+     uint64_t refills;           /* Spares opened.                     */
+     uint64_t stale;             /* Spares hung up on or unconnected.  */
+     uint64_t failovers;         /* Spares swapped in.                 */
+     uint64_t last_ns;           /* How long the last swap took.       */
+     uint64_t total_ns;
+     uint64_t max_ns;
+};
+
+/*
+
+     Tuning profiles, which set a group of socket options for one
+     kind of traffic.  The TUNE_ values are what they set.  See
+     tuning_profile.c.
+
+*/
+
+#define PROFILE_NONE 1
+#define PROFILE_LOW_LATENCY 2
+#define PROFILE_BULK_THROUGHPUT 3
+#define PROFILE_MANY_IDLE 4
+#define MAX_PROFILES 4
+
+#define TUNE_BUSY_POLL_US 50
+#define TUNE_NOTSENT_LOWAT ( 16 * 1024 )
+#define TUNE_IDLE_BUFFER ( 16 * 1024 )
+#define TUNE_KEEPIDLE 60
+#define TUNE_KEEPINTVL 10
+#define TUNE_KEEPCNT 5
+#define TUNE_USER_TIMEOUT_MS \
+        ( ( TUNE_KEEPIDLE + TUNE_KEEPINTVL * TUNE_KEEPCNT ) * 1000 )
+
+/*
+
+     The TCP_INFO sampler.  A thread reads TCP_INFO from each of up
+     to TCPINFO_MAX connections it is given, however many it was
+     started with room for, every TCPINFO_INTERVAL_MS milliseconds and
+     keeps the last TCPINFO_HISTORY samples of each, which must be a
+     power of 2.  A connection is flagged while its smoothed RTT over
+     the last TCPINFO_WINDOW samples is TCPINFO_RTT_FACTOR times its
+     minimum and at least TCPINFO_RTT_FLOOR_US more, or while more
+     than TCPINFO_RETRANS_PCT percent of the segments it sent in that
+     time were retransmissions.  See tcp_sampler.c.
+
+*/
+
+#define TCPINFO_MAX 65536
+#define TCPINFO_HISTORY 128
+#define TCPINFO_INTERVAL_MS 10
+#define TCPINFO_WINDOW 8
+#define TCPINFO_RTT_FACTOR 4
+#define TCPINFO_RTT_FLOOR_US 1000
+#define TCPINFO_RETRANS_PCT 1
+
+#define TCPINFO_RTT_RISING 1
+#define TCPINFO_RETRANS_RISING 2
+
+/*
+
+     The metrics registry.  Up to METRICS_BLOCKS threads each count
+     into their own block, METRICS_CONNS connections can be tracked,
+     and only descriptors below METRICS_FDS, the same limit
+     raise_fd_limit() and CONN_FD_MAX use, are counted.  The
+     endpoint waits METRICS_WAIT_MS milliseconds for a request and
+     serves at most METRICS_TEXT_MAX bytes.  See metrics.c.
+
+*/
+
+#define METRICS_BLOCKS 64
+#define METRICS_CONNS 16
+#define METRICS_FDS 1048576
+#define METRICS_WAIT_MS 100
+#define METRICS_TEXT_MAX ( 64 * 1024 )
+#define METRICS_SOCK_NAME "sockets_metrics"
+
+/* What metrics_add() and the others count. */
+
+#define METRIC_BYTES_IN 0
+#define METRIC_BYTES_OUT 1
+#define METRIC_MSGS_IN 2
+#define METRIC_MSGS_OUT 3
+#define METRIC_SYSCALLS 4
+#define METRIC_ERRORS 5
+#define METRIC_RECONNECTS 6
+#define METRIC_SETUPS 7
+#define METRIC_SETUP_NS 8
+#define METRICS_COUNTERS 9
+
+/*
+
+     The connection table.  Records are kept in slabs of
+     CONN_SLAB_RECORDS, allocated as they are needed, and a table
+     holds at most CONN_TABLE_MAX of them.  Its index by descriptor
+     covers every descriptor below the hard RLIMIT_NOFILE limit, up
+     to CONN_FD_MAX.  The table that setup_sockets(),
+     shutdown_sockets(), list_sockets() and the multi-connection
+     servers share holds as many records as that.  See conn_table.c.
+
+*/
+
+#define CONN_SLAB_RECORDS 1024
+#define CONN_TABLE_MAX ( 1 << 22 )
+#define CONN_FD_MAX 1048576
+
+/* What a connection is for. */
+
+#define CONN_ROLE_CLIENT 1
+#define CONN_ROLE_LISTENER 2
+#define CONN_ROLE_SERVER 3
+#define CONN_ROLE_PEER 4
+
+/* A handle is the record's index in the low half and its generation
+   in the high half, so it is never 0. */
+
+#define CONN_HANDLE( index, gen ) \
+        ( ( ( uint64_t )( gen ) << 32 ) | ( uint32_t )( index ) )
+#define CONN_HANDLE_INDEX( handle ) ( ( int )( ( handle ) & 0xffffffffu ) )
+#define CONN_HANDLE_GEN( handle ) ( ( uint32_t )( ( handle ) >> 32 ) )
+
+struct conn_rec
+{
+     _Alignas( 64 ) int fd;      /* -1 while the record is free.       */
+     int role;                   /* CONN_ROLE_ value.                  */
+     int domain;                 /* Address family, or AF_SHM_RING.    */
+     int sock_type;
+     uint32_t gen;               /* Changes each time it is freed.     */
+     int next_free;              /* The next free record, or -1.       */
+     uint64_t handle;
+     uint64_t open_ns;           /* When it was inserted.              */
+     void *user;                 /* The caller's own pointer.          */
+};
+
+struct conn_table
+{
+     int capacity;               /* Records.                           */
+     int fd_limit;               /* Descriptors by_fd covers.          */
+     int live;                   /* Records in use.                    */
+     int slabs;                  /* Slabs allocated so far.            */
+     int free_head;              /* First free record, or -1.          */
+     struct conn_rec **slab;     /* capacity / CONN_SLAB_RECORDS.      */
+     int *by_fd;                 /* Record index + 1, or 0.            */
+     uint64_t inserts;
+     uint64_t removes;
+     uint64_t stale;             /* Lookups with an outdated handle.   */
+};
+
+/*
+
+     glibc's struct tcp_info ends at tcpi_total_retrans.  These are
+     the fields Linux added after it, in the kernel's order.  An older
+     kernel fills in less, and says how much through the length.
+
+*/
+
+struct tcp_info_ext
+{
+     struct tcp_info base;
+     uint64_t pacing_rate;       /* Bytes per second.                  */
+     uint64_t max_pacing_rate;
+     uint64_t bytes_acked;
+     uint64_t bytes_received;
+     uint32_t segs_out;
+     uint32_t segs_in;
+     uint32_t notsent_bytes;
+     uint32_t min_rtt;           /* Microseconds.                      */
+};
+
+struct tcp_sample
+{
+     uint64_t time_ns;
+     uint64_t pacing_rate;       /* Bytes per second, or 0.            */
+     uint32_t rtt_us;            /* Smoothed.                          */
+     uint32_t rttvar_us;
+     uint32_t cwnd;              /* In segments.                       */
+     uint32_t unacked;           /* Segments sent but not acked.       */
+     uint32_t retrans;           /* Segments retransmitted in all.     */
+     uint32_t segs_out;          /* Segments sent in all, or 0.        */
+};
+
+struct tcp_series
+{
+     _Atomic int fd;             /* The descriptor + 1, or 0 if free.  */
+     _Atomic uint32_t gen;       /* Changes when the slot is reused.   */
+     _Atomic uint32_t seq;       /* Odd while a sample is written.     */
+     _Atomic int flags;          /* TCPINFO_ flags raised now.         */
+     char label[ 16 ];
+     uint32_t sampled_gen;       /* The sampler's own copy of gen.     */
+     uint32_t min_rtt_us;
+     int seen;                   /* Every flag ever raised.            */
+     uint64_t count;             /* Samples taken.                     */
+     uint64_t raised;            /* Times a flag went up.              */
+     struct tcp_sample samples[ TCPINFO_HISTORY ];
+};
+
+struct tcp_sampler
+{
+     int interval_ms;
+     int max;                    /* How many slots there are.          */
+     int running;
+     _Atomic int stopping;
+     _Atomic int top;            /* One past the highest slot used.    */
+     _Atomic int hint;           /* Where to look for a free slot.     */
+     pthread_t thread;
+     _Atomic uint64_t rounds;    /* Times every connection was read.   */
+     _Atomic uint64_t busy_ns;   /* Time the sampler spent reading.    */
+     struct tcp_series *series;  /* max of them.                       */
+};
+
+/*
+
+     A pool of worker threads, each with its own deque of tasks.  A
+     worker runs the newest task from the bottom of its own deque and
+     when that is empty steals the oldest one from the top of another
+     worker's.  WP_DEQUE_SIZE must be a power of 2.  The threads
+     engine of the multi-connection server and bench_steal.c use it.
+     See work_pool.c.
+
+*/
+
+#define WP_MAX_WORKERS 64
+#define WP_DEQUE_SIZE 4096
+
+typedef void ( *wp_task_func )( void *arg );
+
+struct wp_task
+{
+     wp_task_func run;
+     void *arg;
+};
+
+struct work_pool;
+
+struct wp_worker
+{
+     struct work_pool *pool;
+     int index;
+     pthread_t thread;
+     pthread_mutex_t lock;      /* Guards the deque.                  */
+     struct wp_task *tasks;     /* WP_DEQUE_SIZE slots.               */
+     uint64_t top;              /* Thieves take from here.            */
+     uint64_t bottom;           /* The owner pushes and pops here.    */
+     uint64_t seed;             /* Picks the first worker to rob.     */
+     uint64_t submitted;        /* Tasks pushed onto this deque.      */
+     uint64_t max_depth;        /* Most tasks ever waiting in it.     */
+     atomic_uint_fast64_t executed;      /* Tasks this worker ran.    */
+     atomic_uint_fast64_t stolen;        /* Of those, taken from
+                                            another worker's deque.   */
+     atomic_uint_fast64_t steal_misses;  /* Steals that found nothing. */
+     atomic_uint_fast64_t busy_ns;       /* Time spent running tasks. */
+     char pad[ 64 ];            /* Keeps workers off each other's
+                                   cache lines.                       */
+};
+
+struct work_pool
+{
+     int count;                      /* Workers running.             */
+     int steal;                      /* 0 keeps tasks where they are. */
+     int stopping;
+     int started;                    /* Threads created so far.      */
+     unsigned int next;              /* Round robin submissions.     */
+     struct wp_worker *workers;
+     pthread_mutex_t lock;
+     pthread_cond_t work;            /* A task was submitted.        */
+     pthread_cond_t idle;            /* Every task has finished.     */
+     atomic_uint_fast64_t queued;    /* Tasks waiting in any deque.  */
+     atomic_uint_fast64_t outstanding;  /* Submitted, not finished.  */
+     atomic_int sleepers;            /* Workers waiting for work.    */
+     uint64_t start_ns;
+};
+
+/* One worker's counters from wp_get_stats(). */
+
+struct wp_stats
+{
+     uint64_t submitted;     /* Tasks pushed onto its deque.          */
+     uint64_t executed;      /* Tasks it ran.                         */
+     uint64_t stolen;        /* Of those, taken from another worker.  */
+     uint64_t steal_misses;  /* Steal attempts that found nothing.    */
+     uint64_t depth;         /* Tasks waiting in its deque now.       */
+     uint64_t max_depth;     /* Most tasks ever waiting in it.        */
+     uint64_t busy_ns;       /* Time spent running tasks.             */
+     uint64_t elapsed_ns;    /* Time since the pool started.          */
+};
+
 /* Function prototypes: */
 
+int choose_engine( void );
+
+int config_active( void );
+
+int config_load_args( const int argc, char **argv );
+
+int config_load_file( const char *path );
+
+int config_set( const char *key, const char *value );
+
+int conn_insert( struct conn_table *table, const int fd, const int role,
+                 const int domain, const int sock_type, uint64_t *handle );
+
+int conn_remove( struct conn_table *table, const uint64_t handle );
+
+int conn_remove_fd( struct conn_table *table, const int fd );
+
+int conn_table_init( struct conn_table *table, const int capacity );
+
+int connect_by_name( int *csock_fd, const int initial );
+
+int connect_pair( const int csock_fd, const int lsock_fd,
+                  const struct sockaddr *target,
+                  const socklen_t target_len, struct sockaddr *peer,
+                  socklen_t *peer_len );
+
 int detect_endian( void );
 
+int dgram_batch_init( struct dgram_batch *batch, const int count,
+                      const size_t size );
+
+int dgram_recv_batch( const int sock_fd, struct dgram_batch *batch,
+                      const int count );
+
+int dgram_send_batch( const int sock_fd, struct dgram_batch *batch,
+                      const int first, const int count,
+                      const struct sockaddr *to, const socklen_t to_len );
+
+int format_address( const struct sockaddr *addr, char *buffer,
+                    const size_t length );
+
+int get_somaxconn( void );
+
+int happy_eyeballs( const char *host, const char *service,
+                    const int delay_ms, struct he_result *result );
+
+int hdr_init( struct hdr_hist *hist, const int sub_bits,
+              const int max_bits );
+
+int he_race( const struct sockaddr_storage *addrs, const int count,
+             const int delay_ms, struct he_result *result );
+
+int he_resolve( const char *host, const char *service,
+                struct sockaddr_storage *addrs, const int max );
+
 int invert_endian( void *buffer, int size );
 
+int io_pool_init( const int count, const size_t size );
+
+int io_pool_iovec( struct iovec *iov );
+
+int metrics_format( char *buffer, const size_t size );
+
+int metrics_init( void );
+
+int metrics_serve( const char *name );
+
+int metrics_stop( void );
+
+int metrics_track( const int sock_fd, const char *label );
+
+int metrics_track_family( const int sock_fd, const char *label,
+                          const int family );
+
+int nb_conn_init( struct nb_conn *conn, const int sock_fd,
+                  nb_read_func on_read, void *user );
+
+int nb_flush( struct nb_conn *conn );
+
+int nb_queue_send( struct nb_conn *conn, const void *data,
+                   const size_t len );
+
+int oob_recv( const int sock_fd, uint64_t *discarded, const int timeout_ms );
+
+int oob_send( const int sock_fd, const int code, const int timeout_ms );
+
+int oob_set_owner( const int sock_fd );
+
+int open_local_listener( const int domain, const int sock_type,
+                         const char *path, struct sockaddr_storage *addr,
+                         socklen_t *addr_len );
+
+int open_local_pair( const int domain, const int sock_type,
+                     const char *path, int *csock_fd, int *ssock_fd );
+
+int open_reuseport_listener( struct sockaddr_storage *addr,
+                             socklen_t *addr_len, const int backlog );
+
+int prefork_dispatch( struct prefork_pool *pool, const int fd );
+
+int prefork_finish( struct prefork_pool *pool, struct server_stats *total,
+                    uint64_t *handed );
+
+int prefork_start( struct prefork_pool *pool, const int lsock_fd,
+                   const int count, const int ctl_fd );
+
+int prefork_update( struct prefork_pool *pool, const int index );
+
+int raise_fd_limit( void );
+
+int recv_fd( const int sock_fd, const int flags );
+
+int read_answer( const char *key, const char * const *names,
+                 const int count, char *buffer, const int length );
+
+int read_number( const char *key, const char * const *names,
+                 const int count, const char *question,
+                 const long long min, const long long max,
+                 long long *value );
+
 int read_stdin( char *buffer, const int length,
                 const char *prompt, const int reprompt );
 
+int run_bulk_send( const int csock_fd, const int ssock_fd,
+                   const int method, const uint64_t total_bytes,
+                   struct bulk_stats *stats );
+
+int run_cancel( const int csock_fd, const int ssock_fd, const int urgent,
+                const uint64_t rounds, struct cancel_stats *stats );
+
+int run_epoll_server( const int lsock_fd, const int ctl_fd,
+                      struct server_stats *stats );
+
+int run_handoff_server( const int chan_fd, const int ctl_fd,
+                        struct server_stats *stats );
+
+int run_io_loop( struct nb_conn **conns, const int count,
+                 const int timeout_ms, volatile int *done );
+
+int run_latency( const int csock_fd, const int ssock_fd,
+                 const int sock_type, const size_t msg_size,
+                 const uint64_t iterations, struct latency_stats *stats );
+
+int run_load_generator( const int domain, const void *target,
+                        const socklen_t target_len, const int peers,
+                        struct client_stats *stats );
+
+int run_pair_benchmark( const int csock_fd, const int ssock_fd,
+                        const int sock_type );
+
+int run_server_benchmark( const int lsock_fd, const int domain,
+                          const void *target, const socklen_t target_len,
+                          const int peers );
+
+int run_prefork_server( const int lsock_fd, const int ctl_fd,
+                        struct prefork_pool *pool,
+                        struct server_stats *stats );
+
+int run_threaded_server( const int lsock_fd, const int ctl_fd,
+                         const int workers, struct server_stats *stats );
+
+int run_throughput( const int csock_fd, const int ssock_fd,
+                    const int sock_type, const size_t msg_size,
+                    const int batch, const uint64_t total_bytes,
+                    struct throughput_stats *stats );
+
+int run_uring_server( const int lsock_fd, const int ctl_fd,
+                      struct server_stats *stats );
+
+int send_file( const int sock_fd, const int file_fd, off_t offset,
+               const size_t count, const int method, uint64_t *calls );
+
+int send_fd( const int sock_fd, const int fd, const int flags );
+
+int set_nonblocking( const int sock_fd );
+
 int setup_af_bluetooth( int *csock_fd, int *lsock_fd, int *ssock_fd,
                         int domain, int *type, void *address,
                         int initial );
@@ -188,23 +1348,222 @@ int setup_af_unix( int *csock_fd, int *lsock_fd, int *ssock_fd,
                    int domain, int *type, void *address,
                    int initial );
 
+int setup_shm_ring( int *csock_fd, int *lsock_fd, int *ssock_fd,
+                    int domain, int *type, void *address,
+                    int initial );
+
 int setup_sockets( int *csock_fd, int *lsock_fd, int *ssock_fd,
                    int domain, int *type, void *address,
                    int initial );
 
+int shards_finish( struct shard_set *set, struct server_stats *total,
+                   uint64_t *accepted );
+
+int shards_start( struct shard_set *set, const int lsock_fd,
+                  const int count, const int backlog, const int engine,
+                  const int ctl_fd );
+
+int shm_attach( const int fd, const int side, struct shm_end *end );
+
+int shm_ring_open( int *csock_fd, int *ssock_fd );
+
+int shm_send( struct shm_end *end, const void *data, const size_t len,
+              const int timeout_ms );
+
+int shm_test_connection( const int csock_fd, const int ssock_fd );
+
 int shutdown_sockets( int *csock_fd, int *lsock_fd,
                       int *ssock_fd, int domain, int type );
 
-void catch_sigalrm( int sig_num );
+int sig_events_fd( void );
+
+int sig_events_open( void );
+
+int sig_events_read( void );
+
+int sig_events_wait_input( const int fd );
+
+int sock_family( const int sock_fd );
+
+int spare_failover( struct spare_pool *pool, int *csock_fd,
+                    int *ssock_fd );
+
+int spare_init( struct spare_pool *pool, const int count,
+                const int csock_fd, const int lsock_fd,
+                const int ssock_fd );
+
+int spare_refill( struct spare_pool *pool );
+
+int tcp_sampler_add( struct tcp_sampler *sampler, const int sock_fd,
+                     const char *label );
+
+int tcp_sampler_drop( struct tcp_sampler *sampler, const int slot );
+
+int tcp_sampler_read( struct tcp_sampler *sampler, const int slot,
+                      struct tcp_sample *samples, const int max,
+                      int *flags );
+
+int tcp_sampler_remove( struct tcp_sampler *sampler, const int slot );
+
+int tcp_sampler_start( struct tcp_sampler *sampler, const int interval_ms,
+                       const int max );
+
+int tcp_sampler_stop( struct tcp_sampler *sampler );
+
+int tcp_sampler_watch( struct tcp_sampler *sampler, const int sock_fd,
+                       const int family, const int max );
+
+int test_connection( const int csock_fd, const int ssock_fd );
+
+int tuning_apply( const int sock_fd, const int profile );
+
+int tuning_choose( void );
+
+int tuning_current( void );
+
+int unix_address( const char *name, const int abstract,
+                  struct sockaddr_un *addr, socklen_t *addr_len );
+
+int uring_available( void );
+
+int uring_connect_all( const int *sock_fds, const int count,
+                       const struct sockaddr *target,
+                       const socklen_t target_len );
+
+int wp_get_stats( struct work_pool *pool, const int index,
+                  struct wp_stats *stats );
+
+int wp_start( struct work_pool *pool, const int count, const int steal );
+
+int wp_stop( struct work_pool *pool );
+
+int wp_submit( struct work_pool *pool, const int hint, wp_task_func run,
+               void *arg );
+
+int wp_wait( struct work_pool *pool );
+
+int zc_drain( struct zc_sender *zc, const int timeout_ms );
+
+int zc_init( struct zc_sender *zc, const int sock_fd, const int count,
+             const size_t size );
+
+int zc_reap( struct zc_sender *zc );
+
+int zc_send( struct zc_sender *zc, struct zc_buf *buf, const size_t len );
+
+const char *config_get( const char *key );
+
+const char *family_name( const int family );
+
+const char *tuning_name( const int profile );
+
+ssize_t recv_nb( const int sock_fd, void *buffer, const size_t len );
+
+ssize_t send_nb( const int sock_fd, const void *data, const size_t len );
+
+ssize_t shm_recv( struct shm_end *end, void *buffer, const size_t size,
+                  const int timeout_ms );
 
-void catch_sigio( int sig_num );
+struct conn_rec *conn_by_fd( struct conn_table *table, const int fd );
 
-void catch_sigurg( int sig_num );
+struct conn_rec *conn_get( struct conn_table *table, const uint64_t handle );
+
+struct conn_rec *conn_next( struct conn_table *table, int *cursor );
+
+struct conn_table *conn_table_main( void );
+
+struct io_buf *io_buf_get( void );
+
+struct zc_buf *zc_acquire( struct zc_sender *zc, const int timeout_ms );
+
+uint64_t calibrate_clock( void );
+
+uint64_t get_cpu_ns( const int who );
+
+uint64_t get_time_ns( void );
+
+uint64_t hdr_value_at( const struct hdr_hist *hist, const double pct );
+
+uint64_t percentile( const uint64_t *sorted, const uint64_t count,
+                     const uint64_t pct );
+
+uint64_t sig_events_count( const int sig_num );
+
+void *arena_alloc( struct arena *arena, const size_t size );
+
+void *arena_realloc( struct arena *arena, void *ptr, const size_t old_size,
+                     const size_t new_size );
+
+void arena_get_stats( struct arena_stats *stats );
+
+void arena_init( struct arena *arena );
+
+void arena_release( void );
+
+void arena_reset( struct arena *arena );
+
+void config_usage( const char *name );
+
+void conn_table_free( struct conn_table *table );
+
+void dgram_batch_free( struct dgram_batch *batch );
+
+void hdr_free( struct hdr_hist *hist );
+
+void hdr_record( struct hdr_hist *hist, const uint64_t value );
+
+void io_buf_put( struct io_buf *buf );
+
+void io_buf_ref( struct io_buf *buf );
+
+void io_pool_flush( void );
+
+void io_pool_free( void );
+
+void io_pool_get_stats( struct io_pool_stats *stats );
 
 void list_sockets( int *csock_fd, int *lsock_fd, int *ssock_fd );
 
+void metrics_add( const int conn, const int counter, const uint64_t value );
+
+void metrics_count( const int sock_fd, const int counter,
+                    const uint64_t value );
+
+void metrics_forget( const int sock_fd );
+
+void metrics_inherit( const int sock_fd, const int from_fd );
+
+void metrics_io( const int sock_fd, const int counter, const ssize_t result );
+
+void nb_conn_free( struct nb_conn *conn );
+
 void print_domain_menu( void );
 
+void shm_detach( struct shm_end *end );
+
+void shm_stats( const struct shm_end *end, uint64_t *parks,
+                uint64_t *wakeups );
+
+void sig_events_hold( void );
+
+void sig_events_print( void );
+
+void sig_events_release( void );
+
+void sig_events_thread( void );
+
+void sort_samples( uint64_t *samples, const uint64_t count );
+
+void spare_free( struct spare_pool *pool );
+
+void tcp_sampler_free( struct tcp_sampler *sampler );
+
+void tcp_sampler_print( struct tcp_sampler *sampler );
+
+void zc_free( struct zc_sender *zc );
+
+void zc_release( struct zc_sender *zc, struct zc_buf *buf );
+
 #ifdef SHOW_SOCKET_OPTIONS
 
 void show_socket_options( const int sock_fd, const int domain,
@@ -0,0 +1,406 @@
+/*
+
+     spare_pool.c
+
+     Functions for keeping a few spare connections ready so a broken
+     one can be replaced at once instead of being rebuilt from
+     scratch the way setup_sockets() does when initial is 0.
+
+     spare_init() looks at a working pair to learn its domain, type,
+     peer address, file status flags and socket options, then fills
+     the pool.  When the listening socket belongs to this process, as
+     it does when the client and server are on this device, each
+     spare is connected ahead of time with connect_pair() and its
+     server side accepted, so swapping one in costs a single poll(2)
+     that makes sure neither end was hung up on while it waited.
+     Otherwise the spare is opened and configured ahead of time and
+     only the connect(2) is left for the failover.
+
+     spare_failover() hands out a spare in place of a pair the caller
+     has already closed, skipping any that have been hung up on, and
+     records how long that took.  spare_refill() opens new spares to
+     replace the ones used, with the current tuning profile applied.
+     It does the slow part, so call it after the new connection is
+     back in service.
+
+     All of these return 0 on success or -1 if an error occurs,
+     except spare_refill(), which returns how many spares are ready.
+
+     Written by Matthew Campbell.
+
+*/
+
+#ifndef _SPARE_POOL_C
+#define _SPARE_POOL_C
+
+#include "sockets.h"
+
+/* The socket options copied from the original pair onto each spare. */
+
+static const int spare_options[ SPARE_OPTIONS ] =
+{
+     SO_KEEPALIVE, SO_DONTROUTE, SO_OOBINLINE
+};
+
+/* Reads the options worth copying from sock_fd into values. */
+
+static void save_options( const int sock_fd, int *values )
+{
+     int index;
+     socklen_t size;
+
+     for( index = 0; index < SPARE_OPTIONS; index++ )
+     {
+          size = sizeof( int );
+          if ( getsockopt( sock_fd, SOL_SOCKET, spare_options[ index ],
+                           &( values[ index ] ), &size ) != 0 )
+          {
+               values[ index ] = 0;
+          }
+     }
+     return;
+}
+
+/* Sets the saved options and file status flags on sock_fd. */
+
+static int load_options( const int sock_fd, const int *values,
+                         const int flags )
+{
+     int index;
+
+     for( index = 0; index < SPARE_OPTIONS; index++ )
+     {
+          if ( values[ index ] != 0 &&
+               setsockopt( sock_fd, SOL_SOCKET, spare_options[ index ],
+                           &( values[ index ] ), sizeof( int ) ) != 0 )
+          {
+               return ( -1 );
+          }
+     }
+     if ( flags != ( -1 ) && fcntl( sock_fd, F_SETFL, flags ) != 0 )
+     {
+          return ( -1 );
+     }
+     return 0;
+}
+
+/* Waits for a nonblocking connect(2) to finish.  Returns 0 or -1. */
+
+static int finish_connect( const int sock_fd )
+{
+     int error, ret;
+     socklen_t size;
+     struct pollfd pfd;
+
+     pfd.fd = sock_fd;
+     pfd.events = POLLOUT;
+     pfd.revents = 0;
+     do
+     {
+          ret = poll( &pfd, 1, CONNECT_TIMEOUT_MS );
+     }    while( ret < 0 && errno == EINTR );
+     if ( ret < 0 )
+     {
+          return ( -1 );
+     }
+     if ( ret == 0 )
+     {
+          errno = ETIMEDOUT;
+          return ( -1 );
+     }
+
+     error = 0;
+     size = sizeof( error );
+     if ( getsockopt( sock_fd, SOL_SOCKET, SO_ERROR, &error, &size ) != 0 )
+     {
+          return ( -1 );
+     }
+     if ( error != 0 )
+     {
+          errno = error;
+          return ( -1 );
+     }
+     return 0;
+}
+
+/*
+
+     Prepares a pool of up to count spares for the connected pair
+     csock_fd and ssock_fd.  lsock_fd is the listening socket that
+     accepted the pair, or -1 if it doesn't belong to this process,
+     and ssock_fd may be -1 for the same reason.  Only stream and
+     sequenced packet sockets can be replaced this way.
+
+*/
+
+int spare_init( struct spare_pool *pool, const int count,
+                const int csock_fd, const int lsock_fd,
+                const int ssock_fd )
+{
+     int index;
+     socklen_t size;
+
+     if ( pool == NULL )
+     {
+          errno = EFAULT;
+          return ( -1 );
+     }
+     if ( count < 1 || count > SPARE_MAX || csock_fd < 0 )
+     {
+          errno = EINVAL;
+          return ( -1 );
+     }
+
+     memset( pool, 0, sizeof( struct spare_pool ) );
+     for( index = 0; index < SPARE_MAX; index++ )
+     {
+          pool->csock_fds[ index ] = ( -1 );
+          pool->ssock_fds[ index ] = ( -1 );
+     }
+     pool->count = count;
+     pool->lsock_fd = ( -1 );
+     pool->server_flags = ( -1 );
+
+     size = sizeof( pool->domain );
+     if ( getsockopt( csock_fd, SOL_SOCKET, SO_DOMAIN, &( pool->domain ),
+                      &size ) != 0 )
+     {
+          return ( -1 );
+     }
+     size = sizeof( pool->sock_type );
+     if ( getsockopt( csock_fd, SOL_SOCKET, SO_TYPE, &( pool->sock_type ),
+                      &size ) != 0 )
+     {
+          return ( -1 );
+     }
+     if ( pool->sock_type != SOCK_STREAM &&
+          pool->sock_type != SOCK_SEQPACKET )
+     {
+          errno = EPROTOTYPE;
+          return ( -1 );
+     }
+
+     /* This is where the spares connect to. */
+
+     pool->target_len = sizeof( pool->target );
+     if ( getpeername( csock_fd, ( struct sockaddr * )( &( pool->target ) ),
+                       &( pool->target_len ) ) != 0 )
+     {
+          return ( -1 );
+     }
+
+     pool->client_flags = fcntl( csock_fd, F_GETFL );
+     save_options( csock_fd, pool->client_options );
+     if ( lsock_fd >= 0 && ssock_fd >= 0 )
+     {
+          pool->lsock_fd = lsock_fd;
+          pool->server_flags = fcntl( ssock_fd, F_GETFL );
+          save_options( ssock_fd, pool->server_options );
+     }
+
+     if ( spare_refill( pool ) < 1 )
+     {
+          spare_free( pool );
+          return ( -1 );
+     }
+
+     errno = 0;
+     return 0;
+}
+
+/*
+
+     Opens spares until count are ready.  Returns how many are ready,
+     which is less than count if an error got in the way, or -1 if
+     pool is NULL.
+
+*/
+
+int spare_refill( struct spare_pool *pool )
+{
+     int csock_fd, save_errno, ssock_fd;
+
+     if ( pool == NULL )
+     {
+          errno = EFAULT;
+          return ( -1 );
+     }
+
+     save_errno = 0;
+     while( pool->ready < pool->count )
+     {
+          csock_fd = socket( pool->domain, pool->sock_type, 0 );
+          if ( csock_fd < 0 )
+          {
+               save_errno = errno;
+               break;
+          }
+
+          ssock_fd = ( -1 );
+          if ( pool->lsock_fd >= 0 )
+          {
+               /* Our own listener, so connect it now. */
+
+               ssock_fd = connect_pair( csock_fd, pool->lsock_fd,
+                                        ( struct sockaddr * )
+                                        ( &( pool->target ) ),
+                                        pool->target_len, NULL, NULL );
+               if ( ssock_fd < 0 ||
+                    load_options( ssock_fd, pool->server_options,
+                                  pool->server_flags ) != 0 ||
+                    load_options( csock_fd, pool->client_options,
+                                  pool->client_flags ) != 0 ||
+                    tuning_apply( ssock_fd, tuning_current() ) < 0 ||
+                    tuning_apply( csock_fd, tuning_current() ) < 0 )
+               {
+                    save_errno = errno;
+                    if ( ssock_fd >= 0 )
+                    {
+                         close( ssock_fd );
+                    }
+                    close( csock_fd );
+                    break;
+               }
+          }
+          else if ( load_options( csock_fd, pool->client_options,
+                                  ( -1 ) ) != 0 ||
+                    tuning_apply( csock_fd, tuning_current() ) < 0 )
+          {
+               save_errno = errno;
+               close( csock_fd );
+               break;
+          }
+
+          pool->csock_fds[ pool->ready ] = csock_fd;
+          pool->ssock_fds[ pool->ready ] = ssock_fd;
+          pool->ready++;
+          pool->refills++;
+     }
+
+     errno = save_errno;
+     return pool->ready;
+}
+
+/*
+
+     Replaces a broken pair with a spare.  The caller must already
+     have closed the broken sockets.  The spare's client socket is
+     stored in *csock_fd and its server socket, or -1 if the listener
+     isn't ours, in *ssock_fd.  A spare that was hung up on or can't
+     connect is closed and the next one is tried.  Fails with EAGAIN
+     if no spare is ready, or with the last connect(2) error if none
+     of those left could connect.  The time this took is added to the
+     pool's statistics.
+
+*/
+
+int spare_failover( struct spare_pool *pool, int *csock_fd,
+                    int *ssock_fd )
+{
+     int ret, save_errno, spare_cfd, spare_sfd;
+     struct pollfd pfds[ 2 ];
+     uint64_t elapsed_ns, start_ns;
+
+     if ( pool == NULL || csock_fd == NULL || ssock_fd == NULL )
+     {
+          errno = EFAULT;
+          return ( -1 );
+     }
+
+     save_errno = EAGAIN;
+     start_ns = get_time_ns();
+     while( pool->ready > 0 )
+     {
+          pool->ready--;
+          spare_cfd = pool->csock_fds[ pool->ready ];
+          spare_sfd = pool->ssock_fds[ pool->ready ];
+          pool->csock_fds[ pool->ready ] = ( -1 );
+          pool->ssock_fds[ pool->ready ] = ( -1 );
+
+          if ( spare_sfd >= 0 )
+          {
+               /* Make sure neither end was hung up on while it waited. */
+
+               pfds[ 0 ].fd = spare_cfd;
+               pfds[ 0 ].events = 0;
+               pfds[ 0 ].revents = 0;
+               pfds[ 1 ].fd = spare_sfd;
+               pfds[ 1 ].events = 0;
+               pfds[ 1 ].revents = 0;
+               if ( poll( pfds, 2, 0 ) != 0 )
+               {
+                    close( spare_cfd );
+                    close( spare_sfd );
+                    pool->stale++;
+                    continue;
+               }
+          }
+          else
+          {
+               /* Only the connect(2) was left to do. */
+
+               ret = connect( spare_cfd,
+                              ( struct sockaddr * )( &( pool->target ) ),
+                              pool->target_len );
+               if ( ret != 0 && errno == EINPROGRESS )
+               {
+                    ret = finish_connect( spare_cfd );
+               }
+               if ( ret != 0 || ( pool->client_flags != ( -1 ) &&
+                                  fcntl( spare_cfd, F_SETFL,
+                                         pool->client_flags ) != 0 ) )
+               {
+                    save_errno = errno;
+                    close( spare_cfd );
+                    pool->stale++;
+                    continue;
+               }
+          }
+
+          *csock_fd = spare_cfd;
+          *ssock_fd = spare_sfd;
+
+          elapsed_ns = get_time_ns() - start_ns;
+          pool->failovers++;
+          pool->last_ns = elapsed_ns;
+          pool->total_ns += elapsed_ns;
+          if ( elapsed_ns > pool->max_ns )
+          {
+               pool->max_ns = elapsed_ns;
+          }
+          errno = 0;
+          return 0;
+     }
+
+     errno = save_errno;
+     return ( -1 );
+}
+
+/* Closes every spare that wasn't used. */
+
+void spare_free( struct spare_pool *pool )
+{
+     if ( pool == NULL )
+     {
+          return;
+     }
+     while( pool->ready > 0 )
+     {
+          pool->ready--;
+          if ( pool->csock_fds[ pool->ready ] >= 0 )
+          {
+               close( pool->csock_fds[ pool->ready ] );
+          }
+          if ( pool->ssock_fds[ pool->ready ] >= 0 )
+          {
+               close( pool->ssock_fds[ pool->ready ] );
+          }
+          pool->csock_fds[ pool->ready ] = ( -1 );
+          pool->ssock_fds[ pool->ready ] = ( -1 );
+     }
+     return;
+}
+
+#endif  /* _SPARE_POOL_C */
+
+/* EOF spare_pool.c */
@@ -0,0 +1,622 @@
+/*
+
+     tcp_sampler.c
+
+     Functions for watching TCP connections with TCP_INFO while they
+     are in use.  tcp_sampler_start() starts a thread that reads
+     TCP_INFO from every connection it has been given each
+     interval_ms milliseconds: the smoothed RTT and its variation,
+     the congestion window, the segments still unacknowledged, the
+     retransmissions and segments sent so far, and the pacing rate.
+     The last TCPINFO_HISTORY samples of each connection are kept in
+     a ring.
+
+     After each sample the sampler looks at the last TCPINFO_WINDOW
+     of them and raises TCPINFO_RTT_RISING if the mean RTT has grown
+     well past the lowest the connection has seen, and
+     TCPINFO_RETRANS_RISING if too many of the segments sent in that
+     time were retransmissions.  The thresholds are in sockets.h.  A
+     flag comes down again once the window looks healthy.
+
+     The data path is never stopped for any of this.  getsockopt(2)
+     only holds the socket lock for as long as it takes to copy the
+     counters, and the sampler and its readers share nothing but
+     atomics.  Each ring is guarded by a sequence number that is odd
+     while a sample is being written, so tcp_sampler_read() just
+     tries again if it catches one half written.  The sampler also
+     adds up how long it spends reading, to show what it costs.
+
+     tcp_sampler_start() is told how many connections to make room
+     for, up to TCPINFO_MAX, so a server can size it to its
+     connection limit.  The slots are calloc(3)ed and a free one is
+     all zeros, so the pages of slots that are never used are never
+     touched.  The thread only walks as far as the highest slot that
+     has been used.
+
+     tcp_sampler_add() hands a connection to the sampler and returns
+     its slot, failing with ENOSPC if all of them are in use or
+     EPROTONOSUPPORT if it isn't TCP.  It looks for a free slot from
+     just past the last one it gave out, so a server that keeps
+     adding and removing peers doesn't scan the whole table each
+     time.  Call tcp_sampler_remove() before closing the socket.  A
+     slot keeps its samples until it is used again.  Since the
+     sampler may be reading the descriptor right then, each slot
+     carries a generation number, and a sample taken across a change
+     of hands is thrown away.
+
+     tcp_sampler_watch() is for the multi-connection servers.  It
+     starts the sampler the first time it is given an AF_INET or
+     AF_INET6 connection and adds it as a "peer".  tcp_sampler_drop()
+     removes a connection and returns every flag it raised while it
+     was watched, so the server can count the peers that degraded.
+
+     tcp_sampler_read() copies up to max of a slot's newest samples,
+     oldest first, and returns how many, while the sampler runs.
+     tcp_sampler_stop() stops the thread.  tcp_sampler_print() then
+     shows a summary of every slot, and tcp_sampler_free() frees the
+     rings.
+
+     These return 0 on success, except as noted, or -1 if an error
+     occurs.
+
+     Written by Matthew Campbell.
+
+*/
+
+#ifndef _TCP_SAMPLER_C
+#define _TCP_SAMPLER_C
+
+#include "sockets.h"
+
+/* Works out which flags a series should have up after a new sample. */
+
+static int judge_series( const struct tcp_series *series )
+{
+     const struct tcp_sample *newest, *oldest;
+     int flags, index;
+     uint32_t retrans, segs;
+     uint64_t mean;
+
+     if ( series->count <= TCPINFO_WINDOW )
+     {
+          return 0;
+     }
+
+     newest = &( series->samples[ ( series->count - 1 ) &
+                                  ( TCPINFO_HISTORY - 1 ) ] );
+     oldest = &( series->samples[ ( series->count - 1 - TCPINFO_WINDOW ) &
+                                  ( TCPINFO_HISTORY - 1 ) ] );
+     flags = 0;
+
+     mean = 0;
+     for( index = 0; index < TCPINFO_WINDOW; index++ )
+     {
+          mean += series->samples[ ( series->count - 1 - index ) &
+                                   ( TCPINFO_HISTORY - 1 ) ].rtt_us;
+     }
+     mean /= TCPINFO_WINDOW;
+     if ( series->min_rtt_us > 0 &&
+          mean >= ( uint64_t )series->min_rtt_us * TCPINFO_RTT_FACTOR &&
+          mean - series->min_rtt_us >= TCPINFO_RTT_FLOOR_US )
+     {
+          flags |= TCPINFO_RTT_RISING;
+     }
+
+     /* The counters only go up, so unsigned subtraction is safe. */
+
+     retrans = newest->retrans - oldest->retrans;
+     segs = newest->segs_out - oldest->segs_out;
+     if ( retrans > 0 &&
+          ( uint64_t )retrans * 100 > ( uint64_t )segs * TCPINFO_RETRANS_PCT )
+     {
+          flags |= TCPINFO_RETRANS_RISING;
+     }
+
+     return flags;
+}
+
+/* Reads one connection's TCP_INFO and adds it to its series. */
+
+static void sample_series( struct tcp_series *series )
+{
+     int fd, flags;
+     socklen_t len;
+     struct tcp_info_ext info;
+     struct tcp_sample *sample;
+     uint32_t gen, seq;
+
+     gen = atomic_load( &( series->gen ) );
+     fd = atomic_load( &( series->fd ) ) - 1;
+     if ( fd < 0 )
+     {
+          return;
+     }
+
+     memset( &info, 0, sizeof( info ) );
+     len = sizeof( info );
+     if ( getsockopt( fd, IPPROTO_TCP, TCP_INFO, &info, &len ) != 0 ||
+          atomic_load( &( series->gen ) ) != gen )
+     {
+          return;  /* It was closed or handed on while we looked. */
+     }
+
+     seq = atomic_load_explicit( &( series->seq ), memory_order_relaxed );
+     atomic_store_explicit( &( series->seq ), seq + 1,
+                            memory_order_relaxed );
+     atomic_thread_fence( memory_order_release );
+
+     if ( series->sampled_gen != gen )
+     {
+          /* A new connection in this slot starts from scratch. */
+
+          series->sampled_gen = gen;
+          series->count = 0;
+          series->min_rtt_us = 0;
+          series->seen = 0;
+          series->raised = 0;
+          atomic_store( &( series->flags ), 0 );
+     }
+
+     sample = &( series->samples[ series->count &
+                                  ( TCPINFO_HISTORY - 1 ) ] );
+     sample->time_ns = get_time_ns();
+     sample->rtt_us = info.base.tcpi_rtt;
+     sample->rttvar_us = info.base.tcpi_rttvar;
+     sample->cwnd = info.base.tcpi_snd_cwnd;
+     sample->unacked = info.base.tcpi_unacked;
+     sample->retrans = info.base.tcpi_total_retrans;
+     sample->pacing_rate = 0;
+     sample->segs_out = 0;
+     if ( len >= offsetof( struct tcp_info_ext, segs_in ) )
+     {
+          sample->pacing_rate = info.pacing_rate;
+          sample->segs_out = info.segs_out;
+     }
+     series->count++;
+
+     /* Prefer the kernel's own windowed minimum when it has one. */
+
+     if ( len >= offsetof( struct tcp_info_ext, min_rtt ) +
+                 sizeof( info.min_rtt ) && info.min_rtt > 0 )
+     {
+          series->min_rtt_us = info.min_rtt;
+     }
+     else if ( sample->rtt_us > 0 &&
+               ( series->min_rtt_us == 0 ||
+                 sample->rtt_us < series->min_rtt_us ) )
+     {
+          series->min_rtt_us = sample->rtt_us;
+     }
+
+     flags = judge_series( series );
+     if ( ( flags & ~atomic_load( &( series->flags ) ) ) != 0 )
+     {
+          series->raised++;
+     }
+     series->seen |= flags;
+     atomic_store( &( series->flags ), flags );
+
+     atomic_store_explicit( &( series->seq ), seq + 2,
+                            memory_order_release );
+}
+
+/* The sampler thread. */
+
+static void *sampler_main( void *arg )
+{
+     int slot, top;
+     struct tcp_sampler *sampler;
+     struct timespec next, now;
+     uint64_t start_ns;
+
+     sampler = ( struct tcp_sampler * )arg;
+     sig_events_thread();
+     clock_gettime( CLOCK_MONOTONIC, &next );
+     while( atomic_load( &( sampler->stopping ) ) == 0 )
+     {
+          start_ns = get_time_ns();
+          top = atomic_load( &( sampler->top ) );
+          for( slot = 0; slot < top; slot++ )
+          {
+               sample_series( &( sampler->series[ slot ] ) );
+          }
+          atomic_fetch_add( &( sampler->busy_ns ),
+                            get_time_ns() - start_ns );
+          atomic_fetch_add( &( sampler->rounds ), 1 );
+
+          /* Keep to the schedule, but don't try to catch up. */
+
+          next.tv_nsec += ( long )sampler->interval_ms * 1000000L;
+          while( next.tv_nsec >= 1000000000L )
+          {
+               next.tv_nsec -= 1000000000L;
+               next.tv_sec++;
+          }
+          clock_gettime( CLOCK_MONOTONIC, &now );
+          if ( now.tv_sec > next.tv_sec ||
+               ( now.tv_sec == next.tv_sec && now.tv_nsec > next.tv_nsec ) )
+          {
+               next = now;
+               continue;
+          }
+          while( clock_nanosleep( CLOCK_MONOTONIC, TIMER_ABSTIME, &next,
+                                  NULL ) == EINTR )
+          {
+               ;
+          }
+     }
+     return NULL;
+}
+
+int tcp_sampler_start( struct tcp_sampler *sampler, const int interval_ms,
+                       const int max )
+{
+     int ret;
+
+     if ( sampler == NULL )
+     {
+          errno = EFAULT;
+          return ( -1 );
+     }
+     if ( interval_ms < 1 || max < 1 )
+     {
+          errno = EINVAL;
+          return ( -1 );
+     }
+
+     memset( sampler, 0, sizeof( struct tcp_sampler ) );
+     sampler->interval_ms = interval_ms;
+     sampler->max = ( ( max < TCPINFO_MAX ) ? max : TCPINFO_MAX );
+     sampler->series = calloc( ( size_t )sampler->max,
+                               sizeof( struct tcp_series ) );
+     if ( sampler->series == NULL )
+     {
+          errno = ENOMEM;
+          return ( -1 );
+     }
+
+     ret = pthread_create( &( sampler->thread ), NULL, sampler_main,
+                           sampler );
+     if ( ret != 0 )
+     {
+          free( sampler->series );
+          sampler->series = NULL;
+          errno = ret;
+          return ( -1 );
+     }
+     sampler->running = 1;
+
+     errno = 0;
+     return 0;
+}
+
+/* Returns the slot the connection was given. */
+
+int tcp_sampler_add( struct tcp_sampler *sampler, const int sock_fd,
+                     const char *label )
+{
+     int free_fd, protocol, slot, start, top, tries;
+     socklen_t opt_len;
+     struct tcp_series *series;
+
+     if ( sampler == NULL || label == NULL )
+     {
+          errno = EFAULT;
+          return ( -1 );
+     }
+     if ( sock_fd < 0 || sampler->series == NULL )
+     {
+          errno = EINVAL;
+          return ( -1 );
+     }
+
+     protocol = 0;
+     opt_len = sizeof( protocol );
+     if ( getsockopt( sock_fd, SOL_SOCKET, SO_PROTOCOL, &protocol,
+                      &opt_len ) != 0 )
+     {
+          return ( -1 );
+     }
+     if ( protocol != IPPROTO_TCP )
+     {
+          errno = EPROTONOSUPPORT;
+          return ( -1 );
+     }
+
+     /* Claim a free slot with -1 so no one else takes it. */
+
+     start = atomic_load( &( sampler->hint ) );
+     for( tries = 0; tries < sampler->max; tries++ )
+     {
+          slot = ( start + tries ) % sampler->max;
+          series = &( sampler->series[ slot ] );
+          free_fd = 0;
+          if ( atomic_compare_exchange_strong( &( series->fd ), &free_fd,
+                                               ( -1 ) ) )
+          {
+               snprintf( series->label, sizeof( series->label ), "%s",
+                         label );
+               atomic_fetch_add( &( series->gen ), 1 );
+               atomic_store( &( series->fd ), sock_fd + 1 );
+               atomic_store( &( sampler->hint ),
+                             ( slot + 1 ) % sampler->max );
+
+               /* Let the thread walk as far as this slot. */
+
+               top = atomic_load( &( sampler->top ) );
+               while( top <= slot &&
+                      atomic_compare_exchange_weak( &( sampler->top ),
+                                                    &top, slot + 1 ) == 0 )
+               {
+                    ;
+               }
+
+               errno = 0;
+               return slot;
+          }
+     }
+
+     errno = ENOSPC;
+     return ( -1 );
+}
+
+int tcp_sampler_remove( struct tcp_sampler *sampler, const int slot )
+{
+     if ( sampler == NULL )
+     {
+          errno = EFAULT;
+          return ( -1 );
+     }
+     if ( sampler->series == NULL || slot < 0 || slot >= sampler->max ||
+          atomic_load( &( sampler->series[ slot ].fd ) ) < 1 )
+     {
+          errno = EINVAL;
+          return ( -1 );
+     }
+
+     /* Bump the generation first so a read in progress is dropped. */
+
+     atomic_fetch_add( &( sampler->series[ slot ].gen ), 1 );
+     atomic_store( &( sampler->series[ slot ].fd ), 0 );
+
+     errno = 0;
+     return 0;
+}
+
+/* Returns the flags the connection raised while it was watched. */
+
+int tcp_sampler_drop( struct tcp_sampler *sampler, const int slot )
+{
+     int flags;
+     struct tcp_sample sample;
+
+     if ( tcp_sampler_remove( sampler, slot ) != 0 )
+     {
+          return ( -1 );
+     }
+
+     /* The slot is ours until the next add, so seen is settled. */
+
+     if ( tcp_sampler_read( sampler, slot, &sample, 0, &flags ) < 0 )
+     {
+          return ( -1 );
+     }
+
+     errno = 0;
+     return flags;
+}
+
+/* Returns the slot the connection was given. */
+
+int tcp_sampler_watch( struct tcp_sampler *sampler, const int sock_fd,
+                       const int family, const int max )
+{
+     if ( sampler == NULL )
+     {
+          errno = EFAULT;
+          return ( -1 );
+     }
+     if ( family != AF_INET && family != AF_INET6 )
+     {
+          errno = EPROTONOSUPPORT;
+          return ( -1 );
+     }
+     if ( sampler->series == NULL &&
+          tcp_sampler_start( sampler, TCPINFO_INTERVAL_MS, max ) != 0 )
+     {
+          return ( -1 );
+     }
+
+     return tcp_sampler_add( sampler, sock_fd, "peer" );
+}
+
+/* Returns how many samples were copied. */
+
+int tcp_sampler_read( struct tcp_sampler *sampler, const int slot,
+                      struct tcp_sample *samples, const int max,
+                      int *flags )
+{
+     int count, index;
+     struct tcp_series *series;
+     uint32_t after, before;
+     uint64_t first, total;
+
+     if ( sampler == NULL || samples == NULL || flags == NULL )
+     {
+          errno = EFAULT;
+          return ( -1 );
+     }
+     if ( sampler->series == NULL || slot < 0 || slot >= sampler->max ||
+          max < 0 )
+     {
+          errno = EINVAL;
+          return ( -1 );
+     }
+
+     series = &( sampler->series[ slot ] );
+     for( ; ; )
+     {
+          before = atomic_load_explicit( &( series->seq ),
+                                         memory_order_acquire );
+          if ( ( before & 1 ) != 0 )
+          {
+               sched_yield();
+               continue;
+          }
+
+          total = series->count;
+          count = ( ( total < TCPINFO_HISTORY ) ? ( int )total :
+                                                  TCPINFO_HISTORY );
+          if ( count > max )
+          {
+               count = max;
+          }
+          first = total - ( uint64_t )count;
+          for( index = 0; index < count; index++ )
+          {
+               samples[ index ] = series->samples[ ( first + index ) &
+                                                   ( TCPINFO_HISTORY - 1 ) ];
+          }
+          *flags = series->seen;
+
+          atomic_thread_fence( memory_order_acquire );
+          after = atomic_load_explicit( &( series->seq ),
+                                        memory_order_relaxed );
+          if ( after == before )
+          {
+               break;
+          }
+     }
+
+     errno = 0;
+     return count;
+}
+
+void tcp_sampler_print( struct tcp_sampler *sampler )
+{
+     char flag_text[ 16 ];
+     int count, flags, index, slot, top;
+     static struct tcp_sample samples[ TCPINFO_HISTORY ];
+     uint32_t max_rtt, max_unacked;
+     uint64_t raised, rounds, total;
+
+     if ( sampler == NULL || sampler->series == NULL )
+     {
+          return;
+     }
+
+     printf( "TCP_INFO every %d ms, last %d samples:\n\n",
+             sampler->interval_ms, TCPINFO_HISTORY );
+     printf( "%-10s %7s %7s %7s %7s %6s %7s %7s %7s %s\n", "Connection",
+             "Samples", "RTT us", "Min us", "Max us", "Cwnd", "Unacked",
+             "Retrans", "Pace MB", "Flags" );
+
+     top = atomic_load( &( sampler->top ) );
+     for( slot = 0; slot < top; slot++ )
+     {
+          count = tcp_sampler_read( sampler, slot, samples, TCPINFO_HISTORY,
+                                    &flags );
+          if ( count < 1 )
+          {
+               continue;
+          }
+
+          max_rtt = 0;
+          max_unacked = 0;
+          for( index = 0; index < count; index++ )
+          {
+               if ( samples[ index ].rtt_us > max_rtt )
+               {
+                    max_rtt = samples[ index ].rtt_us;
+               }
+               if ( samples[ index ].unacked > max_unacked )
+               {
+                    max_unacked = samples[ index ].unacked;
+               }
+          }
+
+          /* The sampler has stopped, so these are settled. */
+
+          total = sampler->series[ slot ].count;
+          raised = sampler->series[ slot ].raised;
+          snprintf( flag_text, sizeof( flag_text ), "%s%s%s",
+                    ( ( ( flags & TCPINFO_RTT_RISING ) != 0 ) ? "rtt" : "" ),
+                    ( ( flags == ( TCPINFO_RTT_RISING |
+                                   TCPINFO_RETRANS_RISING ) ) ? "," : "" ),
+                    ( ( ( flags & TCPINFO_RETRANS_RISING ) != 0 ) ?
+                      "retrans" : "" ) );
+
+          printf( "%-10s %7" PRIu64 " %7" PRIu32 " %7" PRIu32 " %7" PRIu32
+                  " %6" PRIu32 " %7" PRIu32 " %7" PRIu32 " %7.1f %s",
+                  sampler->series[ slot ].label, total,
+                  samples[ count - 1 ].rtt_us,
+                  sampler->series[ slot ].min_rtt_us, max_rtt,
+                  samples[ count - 1 ].cwnd, max_unacked,
+                  samples[ count - 1 ].retrans,
+                  ( double )samples[ count - 1 ].pacing_rate / 1e6,
+                  ( ( flags == 0 ) ? "-" : flag_text ) );
+          if ( raised > 0 )
+          {
+               printf( " (%" PRIu64 "x)", raised );
+          }
+          printf( "\n" );
+     }
+
+     rounds = atomic_load( &( sampler->rounds ) );
+     printf( "\n\
+RTT is the last smoothed RTT, and Max the highest in the samples kept.\n\
+Unacked is the most segments in flight.  Pace MB is the pacing rate in\n\
+megabytes per second.  Flags shows what degraded, and how often.\n" );
+     if ( rounds > 0 )
+     {
+          printf( "Each round of sampling took %.1f us.\n",
+                  ( double )atomic_load( &( sampler->busy_ns ) ) /
+                  ( double )rounds / 1000.0 );
+     }
+     printf( "\n" );
+}
+
+int tcp_sampler_stop( struct tcp_sampler *sampler )
+{
+     int ret;
+
+     if ( sampler == NULL )
+     {
+          errno = EFAULT;
+          return ( -1 );
+     }
+
+     ret = 0;
+     if ( sampler->running == 1 )
+     {
+          atomic_store( &( sampler->stopping ), 1 );
+          ret = pthread_join( sampler->thread, NULL );
+          sampler->running = 0;
+     }
+     if ( ret != 0 )
+     {
+          errno = ret;
+          return ( -1 );
+     }
+
+     errno = 0;
+     return 0;
+}
+
+void tcp_sampler_free( struct tcp_sampler *sampler )
+{
+     if ( sampler == NULL )
+     {
+          return;
+     }
+     if ( sampler->running == 1 )
+     {
+          tcp_sampler_stop( sampler );
+     }
+     free( sampler->series );
+     sampler->series = NULL;
+}
+
+#endif  /* _TCP_SAMPLER_C */
+
+/* EOF tcp_sampler.c */
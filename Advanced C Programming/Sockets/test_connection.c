@@ -0,0 +1,146 @@
+/*
+
+     test_connection.c
+
+     This function makes sure a connected pair of sockets can really
+     talk to each other.  The client sends a short message, the server
+     echoes it back, and the client checks what it got.  Both sockets
+     are nonblocking so everything goes through run_io_loop() and
+     nothing here can get stuck waiting on the other end.
+
+     Returns 0 on success or -1 if an error occurs.
+
+     Written by Matthew Campbell.
+
+*/
+
+#ifndef _TEST_CONNECTION_C
+#define _TEST_CONNECTION_C
+
+#include "sockets.h"
+
+/* How long to wait for the echo, in milliseconds. */
+
+#define TEST_CONNECTION_TIMEOUT 3000
+
+#define TEST_MESSAGE "Can you hear me?"
+
+/* Everything the two on_read functions need to share. */
+
+struct test_state
+{
+     volatile int done;
+     int failed;
+     size_t received;
+     char reply[ sizeof( TEST_MESSAGE ) ];
+};
+
+/* The server echoes whatever arrives. */
+
+static int server_read( struct nb_conn *conn, const char *data,
+                        const size_t len )
+{
+     struct test_state *state;
+
+     state = ( struct test_state * )conn->user;
+     if ( len == 0 )  /* The client went away. */
+     {
+          state->failed = 1;
+          state->done = 1;
+          return 1;
+     }
+     if ( nb_queue_send( conn, data, len ) != 0 )
+     {
+          state->failed = 1;
+          state->done = 1;
+          return 1;
+     }
+     return 0;
+}
+
+/* The client collects the echo until the whole message is back. */
+
+static int client_read( struct nb_conn *conn, const char *data,
+                        const size_t len )
+{
+     struct test_state *state;
+
+     state = ( struct test_state * )conn->user;
+     if ( len == 0 || ( state->received + len ) > sizeof( TEST_MESSAGE ) )
+     {
+          state->failed = 1;
+          state->done = 1;
+          return 1;
+     }
+
+     memcpy( &( state->reply[ state->received ] ), data, len );
+     state->received += len;
+     if ( state->received == sizeof( TEST_MESSAGE ) )
+     {
+          if ( memcmp( state->reply, TEST_MESSAGE,
+                       sizeof( TEST_MESSAGE ) ) != 0 )
+          {
+               state->failed = 1;
+          }
+          state->done = 1;
+     }
+     return 0;
+}
+
+int test_connection( const int csock_fd, const int ssock_fd )
+{
+     int ret, save_errno;
+     struct nb_conn client, server, *conns[ 2 ];
+     struct test_state state;
+
+     if ( csock_fd < 0 || ssock_fd < 0 )
+     {
+          errno = EINVAL;
+          return ( -1 );
+     }
+
+     memset( &state, 0, sizeof( state ) );
+
+     if ( nb_conn_init( &client, csock_fd, client_read, &state ) != 0 ||
+          nb_conn_init( &server, ssock_fd, server_read, &state ) != 0 )
+     {
+          return ( -1 );
+     }
+
+     ret = nb_queue_send( &client, TEST_MESSAGE, sizeof( TEST_MESSAGE ) );
+     if ( ret == 0 )
+     {
+          conns[ 0 ] = &client;
+          conns[ 1 ] = &server;
+          ret = run_io_loop( conns, 2, TEST_CONNECTION_TIMEOUT,
+                             &( state.done ) );
+     }
+     save_errno = errno;
+
+     nb_conn_free( &client );
+     nb_conn_free( &server );
+
+     if ( ret != 0 )
+     {
+          errno = save_errno;
+          return ( -1 );
+     }
+     if ( state.failed != 0 || state.done == 0 )
+     {
+          errno = EIO;
+          return ( -1 );
+     }
+
+#ifdef DEBUG
+
+     printf( "The connection passed the echo test.\n" );
+
+#endif
+
+     errno = 0;
+     return 0;
+}
+
+#endif  /* _TEST_CONNECTION_C */
+
+/* EOF test_connection.c */
@@ -0,0 +1,189 @@
+/*
+
+     tuning_profile.c
+
+     These functions set a group of socket options at once, chosen
+     for one kind of traffic:
+
+     low-latency      TCP_NODELAY and TCP_QUICKACK so small messages
+                      go out and get acknowledged at once, a
+                      TCP_NOTSENT_LOWAT of TUNE_NOTSENT_LOWAT bytes so
+                      the send queue stays short, and SO_BUSY_POLL so
+                      a blocking read spins on the device for
+                      TUNE_BUSY_POLL_US microseconds before it sleeps.
+     bulk-throughput  Nagle's algorithm back on, so data goes out in
+                      full segments.  The buffer sizes are left to
+                      the kernel's autotuning.
+     many-idle        Keepalive probes after TUNE_KEEPIDLE seconds,
+                      a TCP_USER_TIMEOUT that gives up on a dead peer
+                      when the probes do, and buffers of only
+                      TUNE_IDLE_BUFFER bytes, so a lot of quiet
+                      connections take little memory.
+
+     tuning_choose() asks which profile to use and remembers it for
+     tuning_current().  A configuration that doesn't name one gets
+     none, which leaves the options alone.
+
+     tuning_apply() sets a profile's options on sock_fd.  The TCP
+     options are left out unless sock_fd is a TCP socket.  Options
+     set on a listening socket are inherited by the sockets it
+     accepts.  TCP_QUICKACK is the exception: the kernel turns it
+     back off by itself, so it only covers the first few segments.
+
+     Setting SO_SNDBUF or SO_RCVBUF at all, or their FORCE versions,
+     locks that buffer at the size given and turns off the kernel's
+     autotuning for it, and plain SO_SNDBUF and SO_RCVBUF are capped
+     at net.core.wmem_max and net.core.rmem_max besides.  Autotuning
+     grows a busy TCP connection's buffers up to the last value of
+     net.ipv4.tcp_wmem and net.ipv4.tcp_rmem, which is usually more
+     than those caps, so bulk-throughput doesn't set them.
+     many-idle does, since locking the buffers small is the point.
+
+     Some options need privileges: SO_BUSY_POLL needs CAP_NET_ADMIN.
+     An option the kernel won't set is skipped, and tuning_apply()
+     returns how many were skipped, or -1 if an error occurs.
+
+     Written by Matthew Campbell.
+
+*/
+
+#ifndef _TUNING_PROFILE_C
+#define _TUNING_PROFILE_C
+
+#include "sockets.h"
+
+/* The names a configuration can use for each profile, in order. */
+
+static const char * const profile_names[ MAX_PROFILES ] =
+{
+     "none", "low-latency", "bulk-throughput", "many-idle"
+};
+
+static int profile_current = PROFILE_NONE;
+
+/* The options each profile sets. */
+
+static const struct
+{
+     int profile;
+     int level;
+     int name;
+     int value;
+}    tuning_options[] =
+{
+     { PROFILE_LOW_LATENCY, IPPROTO_TCP, TCP_NODELAY, 1 },
+     { PROFILE_LOW_LATENCY, IPPROTO_TCP, TCP_QUICKACK, 1 },
+     { PROFILE_LOW_LATENCY, IPPROTO_TCP, TCP_NOTSENT_LOWAT,
+       TUNE_NOTSENT_LOWAT },
+     { PROFILE_LOW_LATENCY, SOL_SOCKET, SO_BUSY_POLL, TUNE_BUSY_POLL_US },
+     { PROFILE_BULK_THROUGHPUT, IPPROTO_TCP, TCP_NODELAY, 0 },
+     { PROFILE_MANY_IDLE, SOL_SOCKET, SO_KEEPALIVE, 1 },
+     { PROFILE_MANY_IDLE, IPPROTO_TCP, TCP_KEEPIDLE, TUNE_KEEPIDLE },
+     { PROFILE_MANY_IDLE, IPPROTO_TCP, TCP_KEEPINTVL, TUNE_KEEPINTVL },
+     { PROFILE_MANY_IDLE, IPPROTO_TCP, TCP_KEEPCNT, TUNE_KEEPCNT },
+     { PROFILE_MANY_IDLE, IPPROTO_TCP, TCP_USER_TIMEOUT,
+       TUNE_USER_TIMEOUT_MS },
+     { PROFILE_MANY_IDLE, SOL_SOCKET, SO_SNDBUF, TUNE_IDLE_BUFFER },
+     { PROFILE_MANY_IDLE, SOL_SOCKET, SO_RCVBUF, TUNE_IDLE_BUFFER }
+};
+
+int tuning_choose( void )
+{
+     long long choice;
+
+     /* A configuration doesn't have to ask for a profile. */
+
+     if ( config_active() == 1 && config_get( "profile" ) == NULL )
+     {
+          profile_current = PROFILE_NONE;
+          errno = 0;
+          return profile_current;
+     }
+
+     if ( read_number( "profile", profile_names, MAX_PROFILES, "\
+Which tuning profile should the sockets use?\n\n\
+1) None.\n\
+2) Low latency.\n\
+3) Bulk throughput.\n\
+4) Many idle connections.", 1, MAX_PROFILES, &choice ) != 0 )
+     {
+          return ( -1 );
+     }
+
+     profile_current = ( int )choice;
+     errno = 0;
+     return profile_current;
+}
+
+int tuning_current( void )
+{
+     return profile_current;
+}
+
+const char *tuning_name( const int profile )
+{
+     if ( profile < 1 || profile > MAX_PROFILES )
+     {
+          return "unknown";
+     }
+     return profile_names[ profile - 1 ];
+}
+
+int tuning_apply( const int sock_fd, const int profile )
+{
+     int index, is_tcp, protocol, skipped;
+     socklen_t opt_len;
+
+     if ( sock_fd < 0 || profile < 1 || profile > MAX_PROFILES )
+     {
+          errno = EINVAL;
+          return ( -1 );
+     }
+     if ( profile == PROFILE_NONE )
+     {
+          errno = 0;
+          return 0;
+     }
+
+     protocol = 0;
+     opt_len = sizeof( protocol );
+     if ( getsockopt( sock_fd, SOL_SOCKET, SO_PROTOCOL, &protocol,
+                      &opt_len ) != 0 )
+     {
+          return ( -1 );
+     }
+     is_tcp = ( ( protocol == IPPROTO_TCP ) ? 1 : 0 );
+
+     skipped = 0;
+     for( index = 0; index < ( int )( sizeof( tuning_options ) /
+                                      sizeof( tuning_options[ 0 ] ) );
+          index++ )
+     {
+          if ( tuning_options[ index ].profile != profile ||
+               ( tuning_options[ index ].level == IPPROTO_TCP &&
+                 is_tcp == 0 ) )
+          {
+               continue;
+          }
+          if ( setsockopt( sock_fd, tuning_options[ index ].level,
+                           tuning_options[ index ].name,
+                           &( tuning_options[ index ].value ),
+                           sizeof( int ) ) == 0 )
+          {
+               continue;
+          }
+          if ( errno != EPERM && errno != ENOPROTOOPT &&
+               errno != EOPNOTSUPP )
+          {
+               return ( -1 );
+          }
+          skipped++;
+     }
+
+     errno = 0;
+     return skipped;
+}
+
+#endif  /* _TUNING_PROFILE_C */
+
+/* EOF tuning_profile.c */
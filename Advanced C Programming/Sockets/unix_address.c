@@ -0,0 +1,76 @@
+/*
+
+     unix_address.c
+
+     This function fills in an AF_UNIX socket address for name and
+     works out its exact length.
+
+     If abstract is 0 the name is a path, and bind(2) creates a
+     socket file there that has to be removed again with unlink(2)
+     when the socket is done with, or the next bind(2) fails with
+     EADDRINUSE.  If abstract is 1 the name goes in Linux's abstract
+     namespace instead: sun_path starts with a NUL byte and the name
+     follows it.  An abstract name never touches the filesystem and
+     goes away when the last socket bound to it is closed.
+
+     An abstract name is not NUL terminated.  Every byte counted in
+     the address length is part of it, so the length has to stop at
+     the end of the name.  Passing sizeof( struct sockaddr_un ) would
+     bind a different name, padded with NULs, that a client using the
+     exact length can't reach.
+
+     Returns 0 on success or -1 if an error occurs, with errno set to
+     ENAMETOOLONG if name doesn't fit.
+
+     Written by Matthew Campbell.
+
+*/
+
+#ifndef _UNIX_ADDRESS_C
+#define _UNIX_ADDRESS_C
+
+#include "sockets.h"
+
+int unix_address( const char *name, const int abstract,
+                  struct sockaddr_un *addr, socklen_t *addr_len )
+{
+     size_t length;
+
+     if ( name == NULL || addr == NULL || addr_len == NULL )
+     {
+          errno = EFAULT;
+          return ( -1 );
+     }
+     if ( abstract != 0 && abstract != 1 )
+     {
+          errno = EINVAL;
+          return ( -1 );
+     }
+
+     /* Leave room for the leading NUL or the trailing one. */
+
+     length = strlen( name );
+     if ( length == 0 || length + 1 > sizeof( addr->sun_path ) )
+     {
+          errno = ( ( length == 0 ) ? EINVAL : ENAMETOOLONG );
+          return ( -1 );
+     }
+
+     memset( addr, 0, sizeof( struct sockaddr_un ) );
+     addr->sun_family = AF_UNIX;
+     if ( abstract == 1 )
+     {
+          memcpy( &( addr->sun_path[ 1 ] ), name, length );
+     }
+     else
+     {
+          memcpy( addr->sun_path, name, length );
+     }
+     *addr_len = ( socklen_t )( offsetof( struct sockaddr_un, sun_path ) +
+                                length + 1 );
+     return 0;
+}
+
+#endif  /* _UNIX_ADDRESS_C */
+
+/* EOF unix_address.c */
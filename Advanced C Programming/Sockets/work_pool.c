@@ -0,0 +1,452 @@
+/*
+
+     work_pool.c
+
+     A pool of worker threads for handling requests on connections
+     that have already been accepted, so one busy connection doesn't
+     keep everything on the thread that accepted it.
+
+     Each worker has its own deque of tasks.  wp_submit() pushes a
+     task onto the bottom of one worker's deque, normally the worker
+     that owns the connection, so a connection's requests keep going
+     to the same worker while it keeps up.  A worker runs the newest
+     task from the bottom of its own deque.  When its deque is empty
+     it steals the oldest task from the top of another worker's,
+     starting with a randomly chosen one, so no worker sits idle while
+     another is backed up.  A worker with nothing to run or steal
+     sleeps until something is submitted.  Each deque has its own
+     lock, so workers only contend when one is robbing another.
+
+     Since a task can be stolen, two tasks for the same connection
+     may run at the same time on different workers.  Tasks must not
+     depend on running in the order they were submitted.
+
+     Every worker counts the tasks pushed onto its deque, the most
+     that were ever waiting in it, the tasks it ran and stole, the
+     steals that found nothing, and the time it spent running tasks.
+     wp_get_stats() reads them at any time.  They are exact once
+     wp_wait() has returned.
+
+     The multi-connection server's threads engine submits a task for
+     each connection that has something to do, with the connection's
+     descriptor as the hint, and arms the connection again only when
+     the task is done, so there is never more than one task for a
+     connection.  See run_epoll_server.c.  bench_steal.c measures the
+     pool under a skewed load.
+
+     All of these return 0 on success or -1 if an error occurs.
+
+     Written by Matthew Campbell.
+
+*/
+
+#ifndef _WORK_POOL_C
+#define _WORK_POOL_C
+
+#include "sockets.h"
+
+/* Adds to a counter only its own worker changes. */
+
+static void bump( atomic_uint_fast64_t *counter, const uint64_t amount )
+{
+     atomic_store_explicit( counter,
+                            atomic_load_explicit( counter,
+                                                  memory_order_relaxed ) +
+                            amount, memory_order_relaxed );
+     return;
+}
+
+/* Takes the newest task from the worker's own deque.  Returns 1 or 0. */
+
+static int pop_task( struct wp_worker *worker, struct wp_task *task )
+{
+     int found;
+
+     found = 0;
+     pthread_mutex_lock( &( worker->lock ) );
+     if ( worker->bottom > worker->top )
+     {
+          worker->bottom--;
+          *task = worker->tasks[ worker->bottom & ( WP_DEQUE_SIZE - 1 ) ];
+          found = 1;
+     }
+     pthread_mutex_unlock( &( worker->lock ) );
+     return found;
+}
+
+/* Takes the oldest task from another worker's deque.  Returns 1 or 0. */
+
+static int steal_task( struct wp_worker *thief, struct wp_task *task )
+{
+     int count, index, tries;
+     struct wp_worker *victim;
+
+     count = thief->pool->count;
+
+     /* A cheap xorshift is plenty for picking where to start. */
+
+     thief->seed ^= thief->seed << 13;
+     thief->seed ^= thief->seed >> 7;
+     thief->seed ^= thief->seed << 17;
+     index = ( int )( thief->seed % ( uint64_t )count );
+
+     for( tries = 0; tries < count; tries++, index = ( index + 1 ) % count )
+     {
+          victim = &( thief->pool->workers[ index ] );
+          if ( victim == thief )
+          {
+               continue;
+          }
+          pthread_mutex_lock( &( victim->lock ) );
+          if ( victim->bottom > victim->top )
+          {
+               *task = victim->tasks[ victim->top & ( WP_DEQUE_SIZE - 1 ) ];
+               victim->top++;
+               pthread_mutex_unlock( &( victim->lock ) );
+               bump( &( thief->stolen ), 1 );
+               return 1;
+          }
+          pthread_mutex_unlock( &( victim->lock ) );
+     }
+     bump( &( thief->steal_misses ), 1 );
+     return 0;
+}
+
+/* Returns how many tasks are waiting in the worker's deque. */
+
+static uint64_t deque_depth( struct wp_worker *worker )
+{
+     uint64_t depth;
+
+     pthread_mutex_lock( &( worker->lock ) );
+     depth = worker->bottom - worker->top;
+     pthread_mutex_unlock( &( worker->lock ) );
+     return depth;
+}
+
+/* Each worker thread runs this until the pool stops. */
+
+static void *worker_main( void *arg )
+{
+     int have;
+     struct wp_task task;
+     struct wp_worker *worker;
+     struct work_pool *pool;
+     uint64_t start_ns;
+
+     worker = ( struct wp_worker * )arg;
+     pool = worker->pool;
+
+     for( ;; )
+     {
+          have = pop_task( worker, &task );
+          if ( have == 0 && pool->steal != 0 && pool->count > 1 &&
+               atomic_load( &( pool->queued ) ) > 0 )
+          {
+               have = steal_task( worker, &task );
+          }
+
+          if ( have != 0 )
+          {
+               atomic_fetch_sub( &( pool->queued ), 1 );
+               start_ns = get_time_ns();
+               task.run( task.arg );
+               bump( &( worker->busy_ns ), get_time_ns() - start_ns );
+               bump( &( worker->executed ), 1 );
+               if ( atomic_fetch_sub( &( pool->outstanding ), 1 ) == 1 )
+               {
+                    pthread_mutex_lock( &( pool->lock ) );
+                    pthread_cond_broadcast( &( pool->idle ) );
+                    pthread_mutex_unlock( &( pool->lock ) );
+               }
+               continue;
+          }
+
+          /*
+
+               Nothing to do.  sleepers goes up before queued is
+               checked, and wp_submit() raises queued before it looks
+               at sleepers, so a submission can't slip past us.
+
+          */
+
+          pthread_mutex_lock( &( pool->lock ) );
+          atomic_fetch_add( &( pool->sleepers ), 1 );
+          while( pool->stopping == 0 &&
+                 ( ( pool->steal != 0 &&
+                     atomic_load( &( pool->queued ) ) == 0 ) ||
+                   ( pool->steal == 0 && deque_depth( worker ) == 0 ) ) )
+          {
+               pthread_cond_wait( &( pool->work ), &( pool->lock ) );
+          }
+          atomic_fetch_sub( &( pool->sleepers ), 1 );
+          if ( pool->stopping != 0 )
+          {
+               pthread_mutex_unlock( &( pool->lock ) );
+               break;
+          }
+          pthread_mutex_unlock( &( pool->lock ) );
+     }
+     return NULL;
+}
+
+/*
+
+     Starts count worker threads.  If steal is 0 workers only run
+     the tasks submitted to them, which is useful for comparison.
+
+*/
+
+int wp_start( struct work_pool *pool, const int count, const int steal )
+{
+     int index, ret;
+
+     if ( pool == NULL )
+     {
+          errno = EFAULT;
+          return ( -1 );
+     }
+     if ( count < 1 || count > WP_MAX_WORKERS )
+     {
+          errno = EINVAL;
+          return ( -1 );
+     }
+
+     memset( pool, 0, sizeof( struct work_pool ) );
+     pool->workers = calloc( ( size_t )count, sizeof( struct wp_worker ) );
+     if ( pool->workers == NULL )
+     {
+          errno = ENOMEM;
+          return ( -1 );
+     }
+     pool->count = count;
+     pool->steal = steal;
+     atomic_init( &( pool->queued ), 0 );
+     atomic_init( &( pool->outstanding ), 0 );
+     atomic_init( &( pool->sleepers ), 0 );
+     pthread_mutex_init( &( pool->lock ), NULL );
+     pthread_cond_init( &( pool->work ), NULL );
+     pthread_cond_init( &( pool->idle ), NULL );
+
+     for( index = 0; index < count; index++ )
+     {
+          pool->workers[ index ].pool = pool;
+          pool->workers[ index ].index = index;
+          pool->workers[ index ].seed = 0x9E3779B97F4A7C15ULL *
+                                        ( uint64_t )( index + 1 );
+          atomic_init( &( pool->workers[ index ].executed ), 0 );
+          atomic_init( &( pool->workers[ index ].stolen ), 0 );
+          atomic_init( &( pool->workers[ index ].steal_misses ), 0 );
+          atomic_init( &( pool->workers[ index ].busy_ns ), 0 );
+          pthread_mutex_init( &( pool->workers[ index ].lock ), NULL );
+     }
+     for( index = 0; index < count; index++ )
+     {
+          pool->workers[ index ].tasks = calloc( WP_DEQUE_SIZE,
+                                                 sizeof( struct wp_task ) );
+          if ( pool->workers[ index ].tasks == NULL )
+          {
+               wp_stop( pool );
+               errno = ENOMEM;
+               return ( -1 );
+          }
+     }
+
+     pool->start_ns = get_time_ns();
+     for( index = 0; index < count; index++ )
+     {
+          ret = pthread_create( &( pool->workers[ index ].thread ), NULL,
+                                worker_main, &( pool->workers[ index ] ) );
+          if ( ret != 0 )
+          {
+               wp_stop( pool );
+               errno = ret;
+               return ( -1 );
+          }
+          pool->started++;
+     }
+
+     errno = 0;
+     return 0;
+}
+
+/*
+
+     Queues run( arg ) on worker hint % count, or on the next worker
+     in turn if hint is negative.  Fails with EAGAIN if that worker's
+     deque is full, in which case the caller should try again later.
+     Only one thread, the one accepting connections, may submit.
+
+*/
+
+int wp_submit( struct work_pool *pool, const int hint, wp_task_func run,
+               void *arg )
+{
+     uint64_t depth;
+     struct wp_worker *worker;
+
+     if ( pool == NULL || pool->workers == NULL || run == NULL )
+     {
+          errno = EFAULT;
+          return ( -1 );
+     }
+
+     if ( hint >= 0 )
+     {
+          worker = &( pool->workers[ hint % pool->count ] );
+     }
+     else
+     {
+          worker = &( pool->workers[ pool->next %
+                                     ( unsigned int )pool->count ] );
+          pool->next++;
+     }
+
+     pthread_mutex_lock( &( worker->lock ) );
+     depth = worker->bottom - worker->top;
+     if ( depth >= WP_DEQUE_SIZE )
+     {
+          pthread_mutex_unlock( &( worker->lock ) );
+          errno = EAGAIN;
+          return ( -1 );
+     }
+     worker->tasks[ worker->bottom & ( WP_DEQUE_SIZE - 1 ) ].run = run;
+     worker->tasks[ worker->bottom & ( WP_DEQUE_SIZE - 1 ) ].arg = arg;
+     worker->bottom++;
+     worker->submitted++;
+     if ( ( depth + 1 ) > worker->max_depth )
+     {
+          worker->max_depth = depth + 1;
+     }
+     atomic_fetch_add( &( pool->outstanding ), 1 );
+     atomic_fetch_add( &( pool->queued ), 1 );
+     pthread_mutex_unlock( &( worker->lock ) );
+
+     /* Without stealing only the owner can run it, so wake everyone. */
+
+     if ( atomic_load( &( pool->sleepers ) ) > 0 )
+     {
+          pthread_mutex_lock( &( pool->lock ) );
+          if ( pool->steal != 0 )
+          {
+               pthread_cond_signal( &( pool->work ) );
+          }
+          else
+          {
+               pthread_cond_broadcast( &( pool->work ) );
+          }
+          pthread_mutex_unlock( &( pool->lock ) );
+     }
+     return 0;
+}
+
+/* Waits until every task that was submitted has finished. */
+
+int wp_wait( struct work_pool *pool )
+{
+     if ( pool == NULL || pool->workers == NULL )
+     {
+          errno = EFAULT;
+          return ( -1 );
+     }
+
+     pthread_mutex_lock( &( pool->lock ) );
+     while( atomic_load( &( pool->outstanding ) ) > 0 )
+     {
+          pthread_cond_wait( &( pool->idle ), &( pool->lock ) );
+     }
+     pthread_mutex_unlock( &( pool->lock ) );
+     return 0;
+}
+
+/*
+
+     Copies worker index's counters into stats.  elapsed_ns is the
+     time since the pool started, so busy_ns / elapsed_ns is how
+     much of that time the worker was busy.
+
+*/
+
+int wp_get_stats( struct work_pool *pool, const int index,
+                  struct wp_stats *stats )
+{
+     struct wp_worker *worker;
+
+     if ( pool == NULL || pool->workers == NULL || stats == NULL )
+     {
+          errno = EFAULT;
+          return ( -1 );
+     }
+     if ( index < 0 || index >= pool->count )
+     {
+          errno = EINVAL;
+          return ( -1 );
+     }
+
+     worker = &( pool->workers[ index ] );
+     pthread_mutex_lock( &( worker->lock ) );
+     stats->submitted = worker->submitted;
+     stats->depth = worker->bottom - worker->top;
+     stats->max_depth = worker->max_depth;
+     pthread_mutex_unlock( &( worker->lock ) );
+     stats->executed = atomic_load_explicit( &( worker->executed ),
+                                             memory_order_relaxed );
+     stats->stolen = atomic_load_explicit( &( worker->stolen ),
+                                           memory_order_relaxed );
+     stats->steal_misses = atomic_load_explicit( &( worker->steal_misses ),
+                                                 memory_order_relaxed );
+     stats->busy_ns = atomic_load_explicit( &( worker->busy_ns ),
+                                            memory_order_relaxed );
+     stats->elapsed_ns = get_time_ns() - pool->start_ns;
+     return 0;
+}
+
+/*
+
+     Waits for the tasks already submitted, stops the workers and
+     frees the pool.  Any counters needed should be read first.
+
+*/
+
+int wp_stop( struct work_pool *pool )
+{
+     int index;
+
+     if ( pool == NULL || pool->workers == NULL )
+     {
+          errno = EFAULT;
+          return ( -1 );
+     }
+
+     if ( pool->started == pool->count )
+     {
+          wp_wait( pool );
+     }
+
+     pthread_mutex_lock( &( pool->lock ) );
+     pool->stopping = 1;
+     pthread_cond_broadcast( &( pool->work ) );
+     pthread_mutex_unlock( &( pool->lock ) );
+
+     for( index = 0; index < pool->started; index++ )
+     {
+          pthread_join( pool->workers[ index ].thread, NULL );
+     }
+     for( index = 0; index < pool->count; index++ )
+     {
+          pthread_mutex_destroy( &( pool->workers[ index ].lock ) );
+          free( pool->workers[ index ].tasks );
+     }
+     pthread_mutex_destroy( &( pool->lock ) );
+     pthread_cond_destroy( &( pool->work ) );
+     pthread_cond_destroy( &( pool->idle ) );
+     free( pool->workers );
+     memset( pool, 0, sizeof( struct work_pool ) );
+
+     errno = 0;
+     return 0;
+}
+
+#endif  /* _WORK_POOL_C */
+
+/* EOF work_pool.c */
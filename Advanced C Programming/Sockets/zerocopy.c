@@ -0,0 +1,587 @@
+/*
+
+     zerocopy.c
+
+     Functions for sending from buffers the kernel reads in place.
+
+     With MSG_ZEROCOPY send(2) pins the pages of the caller's buffer
+     instead of copying them into the socket, so the buffer still
+     belongs to the kernel when send(2) returns.  Each send that
+     takes any data is given the next number in a 32 bit sequence,
+     and once the kernel is done with the pages it queues a
+     notification on the socket's error queue that covers a range of
+     those numbers.  A buffer must not be written to or reused until
+     every send made from it has been covered.
+
+     A zc_sender owns a set of buffers and keeps track of that.  The
+     buffers are made of pieces taken from the I/O buffer pool in
+     io_pool.c, so they sit on huge pages when the system has them and
+     the kernel has far fewer pages to pin for each send.  A buffer
+     bigger than the pool's own is made of several of them, and
+     zc_send() hands the pieces to sendmsg(2) together, so the kernel
+     sees one send just as it would for one piece of memory.
+     zc_acquire() hands out a buffer nothing is using, waiting for
+     completions if it has to, zc_send() gives the buffer to the
+     kernel, and zc_reap() reads the notifications and gives buffers
+     back to the pool.  zc_send() refuses a buffer that wasn't
+     acquired, so a buffer can't be sent again while it is in flight.
+     zc_release() returns an acquired buffer that wasn't sent.
+
+     When the kernel has to copy the data after all, which it always
+     does when the receiver is on this device, the notification says
+     so and zc_reap() counts it in copied.
+
+     Only stream sockets in AF_INET and AF_INET6 support this, and
+     zc_init() fails with EOPNOTSUPP on anything else.
+
+     Written by Matthew Campbell.
+
+*/
+
+#ifndef _ZEROCOPY_C
+#define _ZEROCOPY_C
+
+#include "sockets.h"
+
+/* Waits for the socket, reading any notifications that are waiting. */
+
+static int zc_wait( struct zc_sender *zc, const short events,
+                    const int timeout_ms )
+{
+     int ret;
+     struct pollfd pfd;
+
+     pfd.fd = zc->fd;
+     pfd.events = events;
+     pfd.revents = 0;
+     ret = poll( &pfd, 1, timeout_ms );
+     if ( ret < 0 )
+     {
+          return ( ( errno == EINTR ) ? 0 : ( -1 ) );
+     }
+     if ( ret == 0 )
+     {
+          errno = ETIMEDOUT;
+          return ( -1 );
+     }
+     if ( pfd.revents & POLLERR )
+     {
+          if ( zc_reap( zc ) < 0 )
+          {
+               return ( -1 );
+          }
+     }
+     return 0;
+}
+
+/* Marks one send as completed. */
+
+static void zc_complete( struct zc_sender *zc, const uint32_t seq )
+{
+     struct zc_buf *buf;
+
+     buf = &( zc->bufs[ zc->ring[ seq & ( ZC_SEQ_RING - 1 ) ] ] );
+     if ( buf->pending > 0 )
+     {
+          buf->pending--;
+     }
+     zc->in_flight--;
+     zc->completions++;
+     return;
+}
+
+/*
+
+     Turns on SO_ZEROCOPY for sock_fd and makes count buffers of size
+     bytes each out of the I/O buffer pool, setting the pool up first
+     if nothing has yet.  Returns 0 on success, or -1 with errno set
+     to ENOBUFS if the pool doesn't have enough buffers free, or -1 if
+     another error occurs.
+
+*/
+
+int zc_init( struct zc_sender *zc, const int sock_fd, const int count,
+             const size_t size )
+{
+     int index, one, piece;
+     long iov_max;
+     size_t left;
+     struct iovec *iov;
+     struct io_pool_stats pool;
+
+     if ( zc == NULL )
+     {
+          errno = EFAULT;
+          return ( -1 );
+     }
+     if ( sock_fd < 0 || count < 1 || size < 1 )
+     {
+          errno = EINVAL;
+          return ( -1 );
+     }
+
+     memset( zc, 0, sizeof( struct zc_sender ) );
+     zc->fd = sock_fd;
+
+     one = 1;
+     if ( setsockopt( sock_fd, SOL_SOCKET, SO_ZEROCOPY, &one,
+                      sizeof( one ) ) != 0 )
+     {
+          return ( -1 );
+     }
+
+     if ( io_pool_init( IO_POOL_BUFS, IO_POOL_BUF_SIZE ) != 0 &&
+          errno != EALREADY )
+     {
+          return ( -1 );
+     }
+     io_pool_get_stats( &pool );
+
+     /* One sendmsg(2) has to be able to take a whole buffer. */
+
+     zc->pieces = ( int )( ( size + pool.size - 1 ) / pool.size );
+     iov_max = sysconf( _SC_IOV_MAX );
+     if ( iov_max > 0 && zc->pieces > iov_max )
+     {
+          errno = EINVAL;
+          return ( -1 );
+     }
+     if ( ( long )zc->pieces * count > pool.count )
+     {
+          errno = ENOBUFS;
+          return ( -1 );
+     }
+
+     zc->bufs = calloc( ( size_t )count, sizeof( struct zc_buf ) );
+     zc->ring = calloc( ZC_SEQ_RING, sizeof( int ) );
+     zc->held = calloc( ( size_t )count * ( size_t )zc->pieces,
+                        sizeof( struct io_buf * ) );
+     zc->iov = calloc( ( size_t )( count + 1 ) * ( size_t )zc->pieces,
+                       sizeof( struct iovec ) );
+     zc->count = count;
+     zc->size = size;
+     if ( zc->bufs == NULL || zc->ring == NULL || zc->held == NULL ||
+          zc->iov == NULL )
+     {
+          zc_free( zc );
+          errno = ENOMEM;
+          return ( -1 );
+     }
+     zc->window = &( zc->iov[ count * zc->pieces ] );
+
+     for( index = 0; index < count; index++ )
+     {
+          iov = &( zc->iov[ index * zc->pieces ] );
+          zc->bufs[ index ].iov = iov;
+          zc->bufs[ index ].pieces = zc->pieces;
+          zc->bufs[ index ].size = size;
+          zc->bufs[ index ].index = index;
+
+          left = size;
+          for( piece = 0; piece < zc->pieces; piece++ )
+          {
+               zc->held[ index * zc->pieces + piece ] = io_buf_get();
+               if ( zc->held[ index * zc->pieces + piece ] == NULL )
+               {
+                    zc_free( zc );
+                    errno = ENOBUFS;
+                    return ( -1 );
+               }
+               iov[ piece ].iov_base =
+                    zc->held[ index * zc->pieces + piece ]->data;
+               iov[ piece ].iov_len = ( ( left < pool.size ) ? left :
+                                                              pool.size );
+               left -= iov[ piece ].iov_len;
+          }
+     }
+     return 0;
+}
+
+/*
+
+     Points zc->window at len bytes of buf, starting offset bytes in.
+     Returns how many pieces that took.
+
+*/
+
+static int zc_window( struct zc_sender *zc, const struct zc_buf *buf,
+                      size_t offset, size_t len )
+{
+     int count, piece;
+     size_t take;
+
+     piece = 0;
+     while( piece < buf->pieces && offset >= buf->iov[ piece ].iov_len )
+     {
+          offset -= buf->iov[ piece ].iov_len;
+          piece++;
+     }
+
+     count = 0;
+     while( len > 0 && piece < buf->pieces )
+     {
+          take = buf->iov[ piece ].iov_len - offset;
+          if ( take > len )
+          {
+               take = len;
+          }
+          zc->window[ count ].iov_base =
+               ( char * )buf->iov[ piece ].iov_base + offset;
+          zc->window[ count ].iov_len = take;
+          count++;
+          len -= take;
+          offset = 0;
+          piece++;
+     }
+     return count;
+}
+
+/*
+
+     Hands out a buffer nothing else is using.  If every buffer is
+     still in flight this waits up to timeout_ms milliseconds for the
+     kernel to finish with one.  Returns the buffer, or NULL with
+     errno set to ETIMEDOUT if none came free in time, or NULL if an
+     error occurs.
+
+*/
+
+struct zc_buf *zc_acquire( struct zc_sender *zc, const int timeout_ms )
+{
+     int index, reaped;
+     uint64_t deadline_ns, now_ns;
+
+     if ( zc == NULL || zc->bufs == NULL )
+     {
+          errno = EFAULT;
+          return NULL;
+     }
+
+     deadline_ns = get_time_ns() + ( ( uint64_t )timeout_ms * 1000000ULL );
+     for( ; ; )
+     {
+          for( index = 0; index < zc->count; index++ )
+          {
+               if ( zc->bufs[ index ].owned == 0 &&
+                    zc->bufs[ index ].pending == 0 )
+               {
+                    zc->bufs[ index ].owned = 1;
+                    return &( zc->bufs[ index ] );
+               }
+          }
+
+          if ( zc->in_flight == 0 )
+          {
+               errno = EBUSY;  /* The caller is holding all of them. */
+               return NULL;
+          }
+
+          /* Something may have just come back.  If so look again. */
+
+          reaped = zc_reap( zc );
+          if ( reaped < 0 )
+          {
+               return NULL;
+          }
+          if ( reaped > 0 )
+          {
+               continue;
+          }
+
+          now_ns = get_time_ns();
+          if ( now_ns >= deadline_ns )
+          {
+               errno = ETIMEDOUT;
+               return NULL;
+          }
+          if ( zc_wait( zc, 0, ( int )( ( deadline_ns - now_ns ) /
+                                       1000000ULL ) + 1 ) != 0 )
+          {
+               return NULL;
+          }
+     }
+}
+
+/* Gives back a buffer that was acquired but not sent. */
+
+void zc_release( struct zc_sender *zc, struct zc_buf *buf )
+{
+     if ( zc == NULL || buf == NULL || buf->index < 0 ||
+          buf->index >= zc->count || buf != &( zc->bufs[ buf->index ] ) )
+     {
+          return;
+     }
+     buf->owned = 0;
+     return;
+}
+
+/*
+
+     Sends the first len bytes of buf with MSG_ZEROCOPY, waiting up
+     to BENCH_STALL_MS milliseconds at a time whenever the socket is
+     full.  The buffer belongs to the kernel afterwards and comes back
+     to the pool once zc_reap() has seen every completion for it.
+     Returns 0 on success, or -1 with errno set to EBUSY if buf isn't
+     currently acquired, or -1 if another error occurs.
+
+*/
+
+int zc_send( struct zc_sender *zc, struct zc_buf *buf, const size_t len )
+{
+     size_t sent;
+     ssize_t num;
+     struct msghdr msg;
+
+     if ( zc == NULL || buf == NULL )
+     {
+          errno = EFAULT;
+          return ( -1 );
+     }
+     if ( buf->index < 0 || buf->index >= zc->count ||
+          buf != &( zc->bufs[ buf->index ] ) || len > buf->size )
+     {
+          errno = EINVAL;
+          return ( -1 );
+     }
+     if ( buf->owned == 0 || buf->pending != 0 )
+     {
+          errno = EBUSY;
+          return ( -1 );
+     }
+
+     buf->owned = 0;
+     sent = 0;
+     while( sent < len )
+     {
+          /* Don't let the sequence numbers lap the ring. */
+
+          if ( zc->in_flight >= ZC_SEQ_RING )
+          {
+               if ( zc_wait( zc, 0, BENCH_STALL_MS ) != 0 )
+               {
+                    return ( -1 );
+               }
+               continue;
+          }
+
+          memset( &msg, 0, sizeof( msg ) );
+          msg.msg_iov = zc->window;
+          msg.msg_iovlen = ( size_t )zc_window( zc, buf, sent, len - sent );
+          num = sendmsg( zc->fd, &msg,
+                         ( MSG_ZEROCOPY | MSG_NOSIGNAL | MSG_DONTWAIT ) );
+          zc->calls++;
+          if ( num < 0 )
+          {
+               if ( errno == EINTR )
+               {
+                    continue;
+               }
+               if ( errno == EAGAIN || errno == EWOULDBLOCK )
+               {
+                    if ( zc_wait( zc, POLLOUT, BENCH_STALL_MS ) != 0 )
+                    {
+                         return ( -1 );
+                    }
+                    continue;
+               }
+               if ( errno == ENOBUFS && zc->in_flight > 0 )
+               {
+                    /* Too many pages are pinned.  Wait for some. */
+
+                    if ( zc_wait( zc, 0, BENCH_STALL_MS ) != 0 )
+                    {
+                         return ( -1 );
+                    }
+                    continue;
+               }
+               return ( -1 );
+          }
+
+          zc->ring[ zc->next_seq & ( ZC_SEQ_RING - 1 ) ] = buf->index;
+          zc->next_seq++;
+          zc->in_flight++;
+          buf->pending++;
+          sent += ( size_t )num;
+     }
+     return 0;
+}
+
+/*
+
+     Reads every completion notification that is waiting on the
+     socket's error queue without blocking.  Returns the number of
+     sends they covered, or -1 if an error occurs.
+
+*/
+
+int zc_reap( struct zc_sender *zc )
+{
+     char control[ 128 ];
+     int reaped;
+     ssize_t num;
+     struct cmsghdr *cmsg;
+     struct msghdr msg;
+     struct sock_extended_err *serr;
+     uint32_t seq;
+
+     if ( zc == NULL || zc->bufs == NULL )
+     {
+          errno = EFAULT;
+          return ( -1 );
+     }
+
+     reaped = 0;
+     while( zc->in_flight > 0 )
+     {
+          memset( &msg, 0, sizeof( msg ) );
+          msg.msg_control = control;
+          msg.msg_controllen = sizeof( control );
+
+          num = recvmsg( zc->fd, &msg, ( MSG_ERRQUEUE | MSG_DONTWAIT ) );
+          if ( num < 0 )
+          {
+               if ( errno == EINTR )
+               {
+                    continue;
+               }
+               if ( errno == EAGAIN || errno == EWOULDBLOCK )
+               {
+                    break;
+               }
+               return ( -1 );
+          }
+
+          for( cmsg = CMSG_FIRSTHDR( &msg ); cmsg != NULL;
+               cmsg = CMSG_NXTHDR( &msg, cmsg ) )
+          {
+               if ( !( ( cmsg->cmsg_level == SOL_IP &&
+                         cmsg->cmsg_type == IP_RECVERR ) ||
+                       ( cmsg->cmsg_level == SOL_IPV6 &&
+                         cmsg->cmsg_type == IPV6_RECVERR ) ) )
+               {
+                    continue;
+               }
+               serr = ( struct sock_extended_err * )CMSG_DATA( cmsg );
+               if ( serr->ee_origin != SO_EE_ORIGIN_ZEROCOPY ||
+                    serr->ee_errno != 0 )
+               {
+                    continue;
+               }
+
+               /* ee_info through ee_data, which may wrap around. */
+
+               seq = serr->ee_info;
+               for( ; ; )
+               {
+                    zc_complete( zc, seq );
+                    reaped++;
+                    if ( serr->ee_code & SO_EE_CODE_ZEROCOPY_COPIED )
+                    {
+                         zc->copied++;
+                    }
+                    if ( seq == serr->ee_data )
+                    {
+                         break;
+                    }
+                    seq++;
+               }
+          }
+     }
+     return reaped;
+}
+
+/*
+
+     Waits up to timeout_ms milliseconds for every send to complete.
+     Returns 0 on success, or -1 with errno set to ETIMEDOUT if some
+     are still in flight, or -1 if an error occurs.
+
+*/
+
+int zc_drain( struct zc_sender *zc, const int timeout_ms )
+{
+     uint64_t deadline_ns, now_ns;
+
+     if ( zc == NULL || zc->bufs == NULL )
+     {
+          errno = EFAULT;
+          return ( -1 );
+     }
+
+     deadline_ns = get_time_ns() + ( ( uint64_t )timeout_ms * 1000000ULL );
+     while( zc->in_flight > 0 )
+     {
+          if ( zc_reap( zc ) < 0 )
+          {
+               return ( -1 );
+          }
+          if ( zc->in_flight == 0 )
+          {
+               break;
+          }
+          now_ns = get_time_ns();
+          if ( now_ns >= deadline_ns )
+          {
+               errno = ETIMEDOUT;
+               return ( -1 );
+          }
+          if ( zc_wait( zc, 0, ( int )( ( deadline_ns - now_ns ) /
+                                       1000000ULL ) + 1 ) != 0 )
+          {
+               return ( -1 );
+          }
+     }
+     return 0;
+}
+
+/*
+
+     Waits for anything still in flight and releases the buffers.
+     A buffer the kernel still hasn't finished with after a timeout
+     is kept out of the pool, so no one else writes to it while it is
+     being sent.  The socket itself is left open.
+
+*/
+
+void zc_free( struct zc_sender *zc )
+{
+     int index, piece;
+
+     if ( zc == NULL )
+     {
+          return;
+     }
+     if ( zc->bufs != NULL && zc->ring != NULL )
+     {
+          zc_drain( zc, BENCH_STALL_MS );
+     }
+     if ( zc->bufs != NULL && zc->held != NULL )
+     {
+          for( index = 0; index < zc->count; index++ )
+          {
+               if ( zc->bufs[ index ].pending > 0 )
+               {
+                    continue;
+               }
+               for( piece = 0; piece < zc->pieces; piece++ )
+               {
+                    io_buf_put( zc->held[ index * zc->pieces + piece ] );
+               }
+          }
+          io_pool_flush();
+     }
+     free( zc->bufs );
+     free( zc->ring );
+     free( zc->held );
+     free( zc->iov );
+     zc->bufs = NULL;
+     zc->ring = NULL;
+     zc->held = NULL;
+     zc->iov = NULL;
+     zc->window = NULL;
+     return;
+}
+
+#endif  /* _ZEROCOPY_C */
+
+/* EOF zerocopy.c */